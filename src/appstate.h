@@ -1,10 +1,9 @@
 #ifndef APPSTATE_H
 #define APPSTATE_H
 
-#include "cache.h"
-
 #include <gio/gio.h>
 #include <glib.h>
+#include <stdbool.h>
 
 #include <sys/param.h>
 
@@ -58,8 +57,14 @@ typedef struct
         bool allowNotifications;                        // Send desktop notifications or not
         int visualizerHeight;                           // Height in characters of the spectrum visualizer
         int visualizerColorType;                        // How colors are laid out in the spectrum visualizer
+        bool visualizerMeasureFft;                      // Let FFTW measure the fastest FFT for the visualizer, with the result saved in the config dir
         int titleDelay;                                 // Delay when drawing title in track view
         int cacheLibrary;                               // Cache the library or not
+        int libraryScanThreads;                         // Number of threads reading the library directories, 0 for automatic
+        bool watchLibrary;                              // Update the library when the music folder changes or not
+        int outputSampleRate;                           // Keep the audio device open at this rate and convert every track to it, 0 to follow each track
+        int prefetchTracks;                             // Number of upcoming songs loaded ahead of time, 0 to not load ahead
+        int prefetchMemoryLimit;                        // In MB, for the songs loaded ahead of time
         bool quitAfterStopping;                         // Exit kew when the music stops or not
         bool hideGlimmeringText;                        // Glimmering text on the bottom row
         time_t lastTimeAppRan;                          // When did this app run last, used for updating the cached library if it has been modified since that time
@@ -83,7 +88,6 @@ typedef struct
 
 typedef struct
 {
-        Cache *tempCache;                               // Cache for temporary files
         ViewState currentView;                          // The current view (playlist, library, track) that kew is on
         UIState uiState;
         UISettings uiSettings;
@@ -113,6 +117,10 @@ typedef struct
         char visualizerEnabled[2];
         char visualizerHeight[6];
         char visualizerColorType[2];
+        char visualizerMeasureFft[2];
+        char outputSampleRate[8];
+        char prefetchTracks[6];
+        char prefetchMemoryLimit[8];
         char titleDelay[6];
         char togglePlaylist[6];
         char toggleBindings[6];
@@ -192,6 +200,8 @@ typedef struct
         char hideLogo[2];
         char hideHelp[2];
         char cacheLibrary[6];
+        char libraryScanThreads[6];
+        char watchLibrary[2];
         char quitAfterStopping[2];
         char hideGlimmeringText[2];
         char nextView[6];
@@ -0,0 +1,141 @@
+#include "audiotap.h"
+
+/*
+
+audiotap.c
+
+ Keeps the most recently played audio, mixed down to mono, for the visualizer. The audio callback
+ writes it without locking or allocating, the visualizer reads it from the main thread.
+
+*/
+
+#define AUDIO_TAP_SIZE 16384 // Power of two, twice the most samples the visualizer reads
+#define AUDIO_TAP_MASK (AUDIO_TAP_SIZE - 1)
+#define AUDIO_TAP_READ_ATTEMPTS 4
+
+// Single writer, the audio callback. Positions count samples since the start and never wrap.
+static _Atomic float tapSamples[AUDIO_TAP_SIZE];
+static _Atomic ma_uint64 tapWritten = 0; // Samples that can be read
+static _Atomic ma_uint64 tapWriting = 0; // Ahead of tapWritten while samples are written
+static _Atomic ma_uint64 tapClearedAt = 0;
+
+static float downmixFrame(const void *pFrames, ma_uint64 frame, ma_format format, ma_uint32 channels)
+{
+        float sum = 0.0f;
+
+        switch (format)
+        {
+        case ma_format_f32:
+        {
+                const float *samples = (const float *)pFrames + frame * channels;
+                for (ma_uint32 ch = 0; ch < channels; ch++)
+                        sum += samples[ch];
+                break;
+        }
+        case ma_format_s16:
+        {
+                const ma_int16 *samples = (const ma_int16 *)pFrames + frame * channels;
+                for (ma_uint32 ch = 0; ch < channels; ch++)
+                        sum += samples[ch] / 32768.0f;
+                break;
+        }
+        case ma_format_s24:
+        {
+                const unsigned char *samples = (const unsigned char *)pFrames + frame * channels * 3;
+                for (ma_uint32 ch = 0; ch < channels; ch++)
+                {
+                        const unsigned char *bytes = samples + ch * 3;
+                        ma_int32 sample = (ma_int32)((ma_uint32)bytes[0] << 8 | (ma_uint32)bytes[1] << 16 | (ma_uint32)bytes[2] << 24) >> 8;
+                        sum += sample / 8388608.0f;
+                }
+                break;
+        }
+        case ma_format_s32:
+        {
+                const ma_int32 *samples = (const ma_int32 *)pFrames + frame * channels;
+                for (ma_uint32 ch = 0; ch < channels; ch++)
+                        sum += samples[ch] / 2147483648.0f;
+                break;
+        }
+        case ma_format_u8:
+        {
+                const ma_uint8 *samples = (const ma_uint8 *)pFrames + frame * channels;
+                for (ma_uint32 ch = 0; ch < channels; ch++)
+                        sum += (samples[ch] - 128) / 128.0f;
+                break;
+        }
+        default:
+                break;
+        }
+
+        return sum / channels;
+}
+
+// Audio callback only
+void publishAudioTap(const void *pFrames, ma_uint64 frameCount, ma_format format, ma_uint32 channels)
+{
+        if (pFrames == NULL || frameCount == 0 || channels == 0)
+                return;
+
+        ma_uint64 first = 0;
+
+        // Only the last of them fit
+        if (frameCount > AUDIO_TAP_SIZE)
+                first = frameCount - AUDIO_TAP_SIZE;
+
+        ma_uint64 start = atomic_load_explicit(&tapWritten, memory_order_relaxed);
+        ma_uint64 end = start + (frameCount - first);
+
+        // A reader that sees any of the new samples also sees that they were being written
+        atomic_store_explicit(&tapWriting, end, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+
+        for (ma_uint64 i = first; i < frameCount; i++)
+                atomic_store_explicit(&tapSamples[(start + i - first) & AUDIO_TAP_MASK], downmixFrame(pFrames, i, format, channels), memory_order_relaxed);
+
+        atomic_store_explicit(&tapWritten, end, memory_order_release);
+}
+
+// The latest count samples, oldest first, silence before the tap was cleared. False if the audio
+// callback kept overwriting them while they were copied.
+bool readAudioTap(float *samples, int count)
+{
+        if (samples == NULL || count <= 0)
+                return false;
+
+        if (count > AUDIO_TAP_SIZE / 2)
+                count = AUDIO_TAP_SIZE / 2;
+
+        for (int attempt = 0; attempt < AUDIO_TAP_READ_ATTEMPTS; attempt++)
+        {
+                ma_uint64 end = atomic_load_explicit(&tapWritten, memory_order_acquire);
+                ma_uint64 clearedAt = atomic_load_explicit(&tapClearedAt, memory_order_relaxed);
+                ma_uint64 first = (end > (ma_uint64)count) ? end - count : 0;
+                int silent = count - (int)(end - first);
+
+                for (int i = 0; i < count; i++)
+                {
+                        ma_uint64 pos = first + i - silent;
+
+                        if (i < silent || pos < clearedAt)
+                                samples[i] = 0.0f;
+                        else
+                                samples[i] = atomic_load_explicit(&tapSamples[pos & AUDIO_TAP_MASK], memory_order_relaxed);
+                }
+
+                atomic_thread_fence(memory_order_acquire);
+
+                ma_uint64 writing = atomic_load_explicit(&tapWriting, memory_order_relaxed);
+
+                if (writing - first <= AUDIO_TAP_SIZE)
+                        return true;
+        }
+
+        return false;
+}
+
+// What was played so far reads as silence, like when the track changes
+void clearAudioTap(void)
+{
+        atomic_store_explicit(&tapClearedAt, atomic_load_explicit(&tapWritten, memory_order_acquire), memory_order_relaxed);
+}
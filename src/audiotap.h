@@ -0,0 +1,16 @@
+#ifndef AUDIOTAP_H
+#define AUDIOTAP_H
+
+#include <miniaudio.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void publishAudioTap(const void *pFrames, ma_uint64 frameCount, ma_format format, ma_uint32 channels);
+
+bool readAudioTap(float *samples, int count);
+
+void clearAudioTap(void);
+
+#endif
@@ -16,6 +16,7 @@ void setErrorMessage(const char *message)
         currentErrorMessage[ERROR_MESSAGE_LENGTH - 1] = '\0';
         hasPrintedError = false;
         refresh = true;
+        wakeMainLoop();
 }
 
 bool hasErrorMessage()
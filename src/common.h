@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
+#include "wakeup.h"
 
 #ifndef MAXPATHLEN
 #define MAXPATHLEN 4096
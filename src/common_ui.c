@@ -26,20 +26,20 @@ void setColorAndWeight(int bold, UISettings *ui)
 {
         if (ui->useConfigColors)
         {
-                printf("\033[%dm", bold);
+                screenPrintf("\033[%dm", bold);
                 return;
         }
         if (ui->color.r == defaultColor && ui->color.g == defaultColor && ui->color.b == defaultColor)
-                printf("\033[%dm", bold);
+                screenPrintf("\033[%dm", bold);
         else if (ui->color.r >= 210 && ui->color.g >= 210 && ui->color.b >= 210)
         {
                 ui->color.r = defaultColor;
                 ui->color.g = defaultColor;
                 ui->color.b = defaultColor;
-                printf("\033[%d;38;2;%03u;%03u;%03um", bold, ui->color.r, ui->color.g, ui->color.b);
+                screenPrintf("\033[%d;38;2;%03u;%03u;%03um", bold, ui->color.r, ui->color.g, ui->color.b);
         }
         else
         {
-                printf("\033[%d;38;2;%03u;%03u;%03um", bold, ui->color.r, ui->color.g, ui->color.b);
+                screenPrintf("\033[%d;38;2;%03u;%03u;%03um", bold, ui->color.r, ui->color.g, ui->color.b);
         }
 }
@@ -0,0 +1,511 @@
+#include "decodeahead.h"
+#include "audiotap.h"
+#include "replaygain.h"
+#include "sound.h"
+#include "soundbuiltin.h"
+#include "soundradio.h"
+
+/*
+
+decodeahead.c
+
+ Decodes audio on its own thread into a ring buffer that the audio callback plays from.
+
+*/
+
+#define DECODE_AHEAD_MS 200      // How much decoded audio is kept ready
+#define DECODE_CHUNK_FRAMES 1024 // Decoded at a time, with dataSourceMutex held
+#define DECODE_WAIT_MS 5         // How long to wait for room in the buffer while playing
+#define DECODE_IDLE_WAIT_MS 100  // While paused or stopped, unless woken
+#define NO_POSITION UINT64_MAX
+
+// Single producer, single consumer: only the decoder thread writes frames and moves writePos,
+// only the audio callback moves readPos. Positions count frames since the last reset and never wrap.
+typedef struct
+{
+        unsigned char *data;
+        size_t dataSize;
+        ma_uint64 capacity; // In frames
+        ma_uint32 bytesPerFrame;
+        ma_format format;
+        ma_uint32 channels;
+        ma_uint32 sampleRate;
+        enum AudioImplementation implementation;
+        _Atomic ma_uint64 writePos;
+        _Atomic ma_uint64 readPos;
+        _Atomic ma_uint64 discardPos;    // Frames before this are skipped, not played
+        _Atomic ma_uint64 endOfTrackPos; // When playback gets here the track has ended
+        _Atomic ma_uint64 underruns;
+        _Atomic ma_uint64 underrunFrames;
+        bool playedToEnd; // Only used by the audio callback, until the next track starts
+} PcmRingBuffer;
+
+static PcmRingBuffer ringBuffer = {NULL, 0, 0, 0, ma_format_unknown, 0, 0, NONE, 0, 0, 0, NO_POSITION, 0, 0, false};
+
+// Converts what the decoders output to the format of the ring buffer, when the two differ.
+// Only used with dataSourceMutex held.
+typedef struct
+{
+        ma_data_converter converter;
+        bool active;
+        ma_uint32 bytesPerFrame;
+        unsigned char *frames; // Decoded, waiting to be converted
+        size_t framesSize;
+        ma_uint64 offset;
+        ma_uint64 count;
+} InputConverter;
+
+static InputConverter inputConverter = {0};
+static unsigned int discards = 0;
+
+static pthread_t decoderThread;
+static _Atomic bool decoderRunning = false;
+static pthread_mutex_t decoderWaitMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t decoderWake = PTHREAD_COND_INITIALIZER;
+static bool trackEnded = false;
+static bool continuedPastEnd = false; // Decoding went on into the next track before playback got to the end
+
+static void stopConverting(void)
+{
+        if (inputConverter.active)
+                ma_data_converter_uninit(&inputConverter.converter, NULL);
+
+        inputConverter.active = false;
+        inputConverter.offset = 0;
+        inputConverter.count = 0;
+}
+
+// Called with dataSourceMutex held and the playback device not running
+int resetDecodeAhead(enum AudioImplementation implementation, ma_format format, ma_uint32 channels, ma_uint32 sampleRate)
+{
+        ma_uint32 bytesPerFrame = ma_get_bytes_per_frame(format, channels);
+        ma_uint64 capacity = (ma_uint64)sampleRate * DECODE_AHEAD_MS / 1000;
+
+        if (capacity < DECODE_CHUNK_FRAMES * 2)
+                capacity = DECODE_CHUNK_FRAMES * 2;
+
+        size_t dataSize = capacity * bytesPerFrame;
+
+        ringBuffer.implementation = NONE;
+
+        stopConverting();
+
+        if (bytesPerFrame == 0)
+                return -1;
+
+        if (dataSize > ringBuffer.dataSize)
+        {
+                unsigned char *data = realloc(ringBuffer.data, dataSize);
+                if (data == NULL)
+                        return -1;
+
+                ringBuffer.data = data;
+                ringBuffer.dataSize = dataSize;
+        }
+
+        ringBuffer.capacity = capacity;
+        ringBuffer.bytesPerFrame = bytesPerFrame;
+        ringBuffer.format = format;
+        ringBuffer.channels = channels;
+        ringBuffer.sampleRate = sampleRate;
+        ringBuffer.implementation = implementation;
+
+        atomic_store(&ringBuffer.writePos, 0);
+        atomic_store(&ringBuffer.readPos, 0);
+        atomic_store(&ringBuffer.discardPos, 0);
+        atomic_store(&ringBuffer.endOfTrackPos, NO_POSITION);
+        ringBuffer.playedToEnd = false;
+        continuedPastEnd = false;
+
+        resetReplayGain(sampleRate);
+
+        wakeDecodeAhead();
+
+        return 0;
+}
+
+// Called with dataSourceMutex held while the device keeps playing from the ring buffer. What is decoded
+// from now on is converted to the ring buffer's format, so the device doesn't need to be opened again.
+// What is already buffered is still played.
+int setDecodeAheadInput(enum AudioImplementation implementation, ma_format format, ma_uint32 channels, ma_uint32 sampleRate)
+{
+        ringBuffer.implementation = NONE;
+
+        stopConverting();
+
+        if (format != ringBuffer.format || channels != ringBuffer.channels || sampleRate != ringBuffer.sampleRate)
+        {
+                ma_uint32 bytesPerFrame = ma_get_bytes_per_frame(format, channels);
+                size_t framesSize = DECODE_CHUNK_FRAMES * bytesPerFrame;
+
+                if (bytesPerFrame == 0)
+                        return -1;
+
+                if (framesSize > inputConverter.framesSize)
+                {
+                        unsigned char *frames = realloc(inputConverter.frames, framesSize);
+                        if (frames == NULL)
+                                return -1;
+
+                        inputConverter.frames = frames;
+                        inputConverter.framesSize = framesSize;
+                }
+
+                ma_data_converter_config config = ma_data_converter_config_init(format, ringBuffer.format, channels, ringBuffer.channels,
+                                                                                sampleRate, ringBuffer.sampleRate);
+                config.resampling.algorithm = ma_resample_algorithm_linear;
+                config.resampling.linear.lpfOrder = MA_MAX_FILTER_ORDER;
+                config.ditherMode = ma_dither_mode_triangle;
+
+                if (ma_data_converter_init(&config, NULL, &inputConverter.converter) != MA_SUCCESS)
+                        return -1;
+
+                inputConverter.active = true;
+                inputConverter.bytesPerFrame = bytesPerFrame;
+        }
+
+        ringBuffer.implementation = implementation;
+
+        wakeDecodeAhead();
+
+        return 0;
+}
+
+// True when audio in this format goes into the ring buffer as it is
+bool isDecodeAheadFormat(ma_format format, ma_uint32 channels, ma_uint32 sampleRate)
+{
+        return format == ringBuffer.format && channels == ringBuffer.channels && sampleRate == ringBuffer.sampleRate;
+}
+
+// Called with dataSourceMutex held: everything decoded so far is dropped, like when seeking
+void discardDecodedAudio(void)
+{
+        atomic_store_explicit(&ringBuffer.discardPos, atomic_load_explicit(&ringBuffer.writePos, memory_order_relaxed), memory_order_release);
+
+        inputConverter.offset = 0;
+        inputConverter.count = 0;
+        if (inputConverter.active)
+                ma_data_converter_reset(&inputConverter.converter);
+
+        discards++;
+}
+
+// Decoder thread only: the frames decoded so far are the last ones of the track
+void markEndOfTrack(void)
+{
+        trackEnded = true;
+}
+
+// Until playback gets to the end of a track and the main thread has moved on, the end of the next one has to wait
+bool isEndOfTrackPending(void)
+{
+        return isEOFReached() || atomic_load(&ringBuffer.endOfTrackPos) != NO_POSITION;
+}
+
+void wakeDecodeAhead(void)
+{
+        pthread_mutex_lock(&decoderWaitMutex);
+        pthread_cond_signal(&decoderWake);
+        pthread_mutex_unlock(&decoderWaitMutex);
+}
+
+static void waitForDecodeAhead(int ms)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += ms / 1000;
+        ts.tv_nsec += (long)(ms % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000)
+        {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+        }
+
+        pthread_mutex_lock(&decoderWaitMutex);
+        if (atomic_load(&decoderRunning))
+                pthread_cond_timedwait(&decoderWake, &decoderWaitMutex, &ts);
+        pthread_mutex_unlock(&decoderWaitMutex);
+}
+
+static ma_uint64 decodeFrames(void *pFramesOut, ma_uint64 frameCount)
+{
+        ma_uint64 framesRead = 0;
+
+        switch (ringBuffer.implementation)
+        {
+        case BUILTIN:
+                builtin_read_pcm_frames(&audioData, pFramesOut, frameCount, &framesRead);
+                break;
+        case OPUS:
+                opus_read_pcm_frames(&audioData, pFramesOut, frameCount, &framesRead);
+                break;
+        case VORBIS:
+                vorbis_read_pcm_frames(&audioData, pFramesOut, frameCount, &framesRead);
+                break;
+#ifdef USE_FAAD
+        case M4A:
+                m4a_read_pcm_frames(&audioData, pFramesOut, frameCount, &framesRead);
+                break;
+#endif
+        default:
+                break;
+        }
+
+        return framesRead;
+}
+
+// Decodes straight into the ring buffer, or through the converter when the decoders output another format
+static ma_uint64 readFrames(void *pFramesOut, ma_uint64 frameCount)
+{
+        if (!inputConverter.active)
+                return decodeFrames(pFramesOut, frameCount);
+
+        ma_uint64 framesOut = 0;
+
+        while (framesOut < frameCount)
+        {
+                if (inputConverter.count == 0)
+                {
+                        if (trackEnded)
+                                break;
+
+                        ma_uint64 needed = 0;
+                        ma_data_converter_get_required_input_frame_count(&inputConverter.converter, frameCount - framesOut, &needed);
+
+                        if (needed == 0)
+                                needed = 1;
+                        else if (needed > DECODE_CHUNK_FRAMES)
+                                needed = DECODE_CHUNK_FRAMES;
+
+                        unsigned int discardsBefore = discards;
+
+                        inputConverter.offset = 0;
+                        inputConverter.count = decodeFrames(inputConverter.frames, needed);
+
+                        // A seek while decoding makes what was converted before it stale
+                        if (discards != discardsBefore)
+                                framesOut = 0;
+
+                        if (inputConverter.count == 0)
+                                break;
+                }
+
+                ma_uint64 framesIn = inputConverter.count;
+                ma_uint64 framesConverted = frameCount - framesOut;
+
+                ma_data_converter_process_pcm_frames(&inputConverter.converter,
+                                                     inputConverter.frames + inputConverter.offset * inputConverter.bytesPerFrame, &framesIn,
+                                                     (unsigned char *)pFramesOut + framesOut * ringBuffer.bytesPerFrame, &framesConverted);
+
+                inputConverter.offset += framesIn;
+                inputConverter.count -= framesIn;
+                framesOut += framesConverted;
+
+                if (framesIn == 0 && framesConverted == 0)
+                        break;
+        }
+
+        return framesOut;
+}
+
+// Returns false when there was nothing to do
+static bool decodeNextChunk(void)
+{
+        bool endPending = isEndOfTrackPending();
+
+        if (!endPending)
+                continuedPastEnd = false;
+
+        // Unless decoding has gone on into the next track, wait for the main thread to move on to it
+        if (isImplSwitchReached() || isRadioPlaying() || (endPending && !continuedPastEnd))
+                return false;
+
+        pthread_mutex_lock(&dataSourceMutex);
+
+        if (ringBuffer.data == NULL || ringBuffer.implementation == NONE)
+        {
+                pthread_mutex_unlock(&dataSourceMutex);
+                return false;
+        }
+
+        // Let playback skip what is buffered so there is room to decode from the new position. A switch asked
+        // for by the player and not by the decoder reaching the end, like skipping while paused, drops it too.
+        if (isSeekRequested() || audioData.switchFiles)
+                discardDecodedAudio();
+
+        ma_uint64 writePos = atomic_load_explicit(&ringBuffer.writePos, memory_order_relaxed);
+        ma_uint64 readPos = atomic_load_explicit(&ringBuffer.readPos, memory_order_acquire);
+        ma_uint64 space = ringBuffer.capacity - (writePos - readPos);
+
+        if (space < DECODE_CHUNK_FRAMES)
+        {
+                pthread_mutex_unlock(&dataSourceMutex);
+                return false;
+        }
+
+        ma_uint64 index = writePos % ringBuffer.capacity;
+        ma_uint64 frameCount = ringBuffer.capacity - index;
+
+        if (frameCount > DECODE_CHUNK_FRAMES)
+                frameCount = DECODE_CHUNK_FRAMES;
+
+        // The last decoded frames of a track can still be waiting for the converter
+        if (inputConverter.count == 0)
+                trackEnded = false;
+
+        // A chunk is all from one track
+        setReplayGain(getReplayGainDb(getLoadedSongData(&userData)));
+
+        unsigned char *pFrames = ringBuffer.data + index * ringBuffer.bytesPerFrame;
+        ma_uint64 framesRead = readFrames(pFrames, frameCount);
+
+        applyReplayGain(pFrames, framesRead, ringBuffer.format, ringBuffer.channels);
+        bool lastFrames = trackEnded && inputConverter.count == 0;
+
+        // The end goes first, so that running out of frames at the end of a track isn't taken for an underrun
+        if (lastFrames)
+                atomic_store(&ringBuffer.endOfTrackPos, writePos + framesRead);
+
+        atomic_store_explicit(&ringBuffer.writePos, writePos + framesRead, memory_order_release);
+
+        // The next track starts right after the last frame of this one
+        if (lastFrames)
+                continuedPastEnd = startNextTrack();
+
+        pthread_mutex_unlock(&dataSourceMutex);
+
+        return framesRead > 0 || trackEnded;
+}
+
+static void *decodeAheadThread(void *arg)
+{
+        (void)arg;
+
+        bool eofSeen = false;
+
+        while (atomic_load(&decoderRunning))
+        {
+                // The audio callback only sets the flag, a system call there could make it miss its deadline.
+                // The main loop is woken from here instead.
+                bool eof = isEOFReached();
+                if (eof && !eofSeen)
+                        wakeMainLoop();
+                eofSeen = eof;
+
+                if (!decodeNextChunk())
+                        waitForDecodeAhead((isPaused() || isStopped()) ? DECODE_IDLE_WAIT_MS : DECODE_WAIT_MS);
+        }
+
+        return NULL;
+}
+
+void startDecodeAhead(void)
+{
+        if (atomic_load(&decoderRunning))
+                return;
+
+        atomic_store(&decoderRunning, true);
+
+        if (pthread_create(&decoderThread, NULL, decodeAheadThread, NULL) != 0)
+        {
+                perror("Failed to create decoder thread");
+                atomic_store(&decoderRunning, false);
+        }
+}
+
+void stopDecodeAhead(void)
+{
+        if (!atomic_load(&decoderRunning))
+                return;
+
+        pthread_mutex_lock(&decoderWaitMutex);
+        atomic_store(&decoderRunning, false);
+        pthread_cond_signal(&decoderWake);
+        pthread_mutex_unlock(&decoderWaitMutex);
+
+        pthread_join(decoderThread, NULL);
+
+        stopConverting();
+        free(inputConverter.frames);
+        inputConverter.frames = NULL;
+        inputConverter.framesSize = 0;
+
+        free(ringBuffer.data);
+        ringBuffer.data = NULL;
+        ringBuffer.dataSize = 0;
+        ringBuffer.implementation = NONE;
+}
+
+void getDecodeAheadStats(DecodeAheadStats *stats)
+{
+        ma_uint64 writePos = atomic_load(&ringBuffer.writePos);
+        ma_uint64 readPos = atomic_load(&ringBuffer.readPos);
+
+        stats->underruns = atomic_load(&ringBuffer.underruns);
+        stats->underrunFrames = atomic_load(&ringBuffer.underrunFrames);
+        stats->bufferedFrames = writePos > readPos ? writePos - readPos : 0;
+        stats->capacityFrames = ringBuffer.capacity;
+}
+
+// The audio callback, only copies from the ring buffer: no locks, allocations or file access
+void decodeahead_on_audio_frames(ma_device *pDevice, void *pFramesOut, const void *pFramesIn, ma_uint32 frameCount)
+{
+        (void)pDevice;
+        (void)pFramesIn;
+
+        // discardPos first, it is never past writePos
+        ma_uint64 discardPos = atomic_load_explicit(&ringBuffer.discardPos, memory_order_acquire);
+        ma_uint64 writePos = atomic_load_explicit(&ringBuffer.writePos, memory_order_acquire);
+        ma_uint64 readPos = atomic_load_explicit(&ringBuffer.readPos, memory_order_relaxed);
+        ma_uint64 framesRead = 0;
+
+        if (readPos < discardPos)
+                readPos = discardPos;
+
+        if (ringBuffer.data != NULL && writePos > readPos)
+        {
+                ma_uint64 available = writePos - readPos;
+                framesRead = available < frameCount ? available : frameCount;
+
+                ma_uint64 index = readPos % ringBuffer.capacity;
+                ma_uint64 firstPart = ringBuffer.capacity - index;
+                if (firstPart > framesRead)
+                        firstPart = framesRead;
+
+                memcpy(pFramesOut, ringBuffer.data + index * ringBuffer.bytesPerFrame, firstPart * ringBuffer.bytesPerFrame);
+                memcpy((unsigned char *)pFramesOut + firstPart * ringBuffer.bytesPerFrame, ringBuffer.data,
+                       (framesRead - firstPart) * ringBuffer.bytesPerFrame);
+        }
+
+        atomic_store_explicit(&ringBuffer.readPos, readPos + framesRead, memory_order_release);
+
+        ma_uint64 endOfTrackPos = atomic_load(&ringBuffer.endOfTrackPos);
+
+        if (framesRead < frameCount)
+        {
+                ma_silence_pcm_frames((unsigned char *)pFramesOut + framesRead * ringBuffer.bytesPerFrame, frameCount - framesRead,
+                                      ringBuffer.format, ringBuffer.channels);
+
+                // Running dry at the start, after a seek or between tracks is expected
+                if (writePos > discardPos && endOfTrackPos == NO_POSITION && !ringBuffer.playedToEnd && !isImplSwitchReached())
+                {
+                        atomic_fetch_add(&ringBuffer.underruns, 1);
+                        atomic_fetch_add(&ringBuffer.underrunFrames, frameCount - framesRead);
+                }
+        }
+
+        if (framesRead > 0)
+                ringBuffer.playedToEnd = false;
+
+        if (endOfTrackPos != NO_POSITION && readPos + framesRead >= endOfTrackPos)
+        {
+                // EOF first, so that the end stays pending until the main thread has moved on
+                ringBuffer.playedToEnd = true;
+                setEOFReached();
+                atomic_store(&ringBuffer.endOfTrackPos, NO_POSITION);
+        }
+
+        publishAudioTap(pFramesOut, framesRead, ringBuffer.format, ringBuffer.channels);
+        // The device period, which doesn't change when a callback comes up short, so the visualizer keeps its size
+        setBufferSize(frameCount < MAX_BUFFER_SIZE ? (int)frameCount : MAX_BUFFER_SIZE);
+}
@@ -0,0 +1,47 @@
+#ifndef DECODEAHEAD_H
+#define DECODEAHEAD_H
+
+#include <miniaudio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "soundcommon.h"
+
+#ifndef DECODEAHEADSTATS_STRUCT
+#define DECODEAHEADSTATS_STRUCT
+typedef struct
+{
+        ma_uint64 underruns;      // Audio callbacks that got fewer frames than they asked for
+        ma_uint64 underrunFrames; // Frames of silence played because of that
+        ma_uint64 bufferedFrames;
+        ma_uint64 capacityFrames;
+} DecodeAheadStats;
+#endif
+
+void startDecodeAhead(void);
+
+void stopDecodeAhead(void);
+
+int resetDecodeAhead(enum AudioImplementation implementation, ma_format format, ma_uint32 channels, ma_uint32 sampleRate);
+
+int setDecodeAheadInput(enum AudioImplementation implementation, ma_format format, ma_uint32 channels, ma_uint32 sampleRate);
+
+void wakeDecodeAhead(void);
+
+bool isDecodeAheadFormat(ma_format format, ma_uint32 channels, ma_uint32 sampleRate);
+
+void discardDecodedAudio(void);
+
+void markEndOfTrack(void);
+
+bool isEndOfTrackPending(void);
+
+void getDecodeAheadStats(DecodeAheadStats *stats);
+
+void decodeahead_on_audio_frames(ma_device *pDevice, void *pFramesOut, const void *pFramesIn, ma_uint32 frameCount);
+
+#endif
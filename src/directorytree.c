@@ -10,29 +10,292 @@ directorytree.c
 
 static int lastUsedId = 0;
 
+// The library file: a header, followed by a table of nodes in preorder, a table of empty directories
+// and a pool of null-terminated strings
+#define LIBRARY_FILE_MAGIC "KEWLIB\0\0"
+#define LIBRARY_FILE_VERSION 4 // 4: mtimes in nanoseconds
+
+typedef struct
+{
+        char magic[8];
+        uint32_t version;
+        uint32_t nodeCount;
+        uint64_t poolSize;
+        uint64_t checksum;       // Of the tables and the string pool
+        uint32_t rootPathOffset; // The music path the library was scanned from
+        uint32_t prunedCount;
+} LibraryFileHeader;
+
+typedef struct
+{
+        int32_t id;
+        int32_t parentIndex; // Index into the node table, -1 for the root
+        uint32_t nameOffset; // Offset into the string pool
+        uint32_t isDirectory;
+        int64_t mtime;
+} LibraryFileNode;
+
+typedef struct
+{
+        uint32_t pathOffset;
+        uint32_t reserved;
+        int64_t mtime;
+} LibraryFilePrunedDirectory;
+
+#define MTIME_GRANULARITY_NS 2000000000LL // The coarsest directory timestamps, like on FAT
+
+#define ARENA_BLOCK_SIZE (256 * 1024)
+#define ARENA_ALIGNMENT 16
+
+typedef struct ArenaBlock
+{
+        struct ArenaBlock *next;
+        size_t size;
+        size_t used;
+} ArenaBlock;
+
+// A directory left out of the tree because it has no audio files. It is remembered so that files
+// added to it later are noticed by an update, since that doesn't change the mtime of its parent.
+typedef struct
+{
+        const char *path;
+        int64_t mtime;
+} PrunedDirectory;
+
+// Owns every node and string of a tree, so that the whole tree is freed at once
+struct EntryArena
+{
+        ArenaBlock *blocks;
+        const char *rootPath;
+        void *mappedData; // The library file, when the tree was reconstructed from it
+        size_t mappedSize;
+        int lastId;           // The highest id in the tree, new entries get the ids after it
+        unsigned int version; // Changes whenever the tree changes
+        PrunedDirectory *pruned;
+        int numPruned;
+        int prunedCapacity;
+        int64_t scanStart; // When it was created, for the directories read into it
+};
+
+// A directory whose contents changed on disk, with what it contains now
+typedef struct
+{
+        FileSystemEntry *directory;
+        FileSystemEntry *contents; // Read into the update's arena, its children replace those of the directory
+} DirectoryChange;
+
+struct LibraryUpdate
+{
+        EntryArena *arena; // The entries read from disk, moved into the tree's arena when the update is applied
+        DirectoryChange *changes;
+        int numChanges;
+        int changesCapacity;
+        FileSystemEntry **forced; // Directories to read again because an empty directory below them changed
+        int numForced;
+        FileSystemEntry **prunedParents; // The directory in the tree that each empty directory of the tree belongs to
+        int numPruned;
+        bool onlyForced; // Only the forced directories are read, not the ones below them that are in the tree already
+};
+
+#define MAX_SCAN_THREADS 64
+#define DEFAULT_MAX_SCAN_THREADS 8
+
+typedef struct
+{
+        FileSystemEntry *entry;
+        char *path;
+} ScanTask;
+
+typedef struct
+{
+        ScanTask *tasks;
+        int head;
+        int count;
+        int capacity;
+        pthread_mutex_t mutex;
+} ScanQueue;
+
+// Reads a directory tree with a pool of workers, each with its own queue of directories to read
+typedef struct
+{
+        ScanQueue *queues;
+        int numWorkers;
+        atomic_int pendingTasks; // Directories queued or being read
+        atomic_int queuedTasks;  // Directories queued
+        pthread_mutex_t idleMutex;
+        pthread_cond_t idleCond;
+} DirectoryScanner;
+
+typedef struct
+{
+        DirectoryScanner *scanner;
+        int index;
+        EntryArena *arena; // Per worker, merged into the tree's arena when the scan is done
+        int numEntries;
+} ScanWorker;
+
+static int scanThreads = 0;
+static atomic_uint lastTreeVersion = 0;
+
 typedef void (*TimeoutCallback)(void);
 
-FileSystemEntry *createEntry(const char *name, int isDirectory, FileSystemEntry *parent)
+void setLibraryScanThreads(int numThreads)
+{
+        scanThreads = numThreads;
+}
+
+static size_t alignSize(size_t size)
+{
+        return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+static EntryArena *createArena(void)
+{
+        EntryArena *arena = calloc(1, sizeof(EntryArena));
+        if (arena == NULL)
+        {
+                perror("Failed to allocate arena");
+                return NULL;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        arena->scanStart = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+        return arena;
+}
+
+static void *arenaAlloc(EntryArena *arena, size_t size)
+{
+        size = alignSize(size);
+
+        ArenaBlock *block = arena->blocks;
+        if (block == NULL || block->size - block->used < size)
+        {
+                // Allocations bigger than a block get a block of their own
+                size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+
+                block = malloc(alignSize(sizeof(ArenaBlock)) + blockSize);
+                if (block == NULL)
+                {
+                        perror("Failed to allocate arena block");
+                        return NULL;
+                }
+                block->size = blockSize;
+                block->used = 0;
+
+                // Keep the partly used block in front if the new block is a dedicated one
+                if (arena->blocks != NULL && blockSize > ARENA_BLOCK_SIZE)
+                {
+                        block->next = arena->blocks->next;
+                        arena->blocks->next = block;
+                }
+                else
+                {
+                        block->next = arena->blocks;
+                        arena->blocks = block;
+                }
+        }
+
+        void *ptr = (char *)block + alignSize(sizeof(ArenaBlock)) + block->used;
+        block->used += size;
+
+        return ptr;
+}
+
+static char *arenaStrdup(EntryArena *arena, const char *str)
+{
+        size_t length = strlen(str) + 1;
+        char *copy = arenaAlloc(arena, length);
+        if (copy != NULL)
+        {
+                memcpy(copy, str, length);
+        }
+        return copy;
+}
+
+static void destroyArena(EntryArena *arena)
+{
+        if (arena == NULL)
+                return;
+
+        ArenaBlock *block = arena->blocks;
+        while (block != NULL)
+        {
+                ArenaBlock *next = block->next;
+                free(block);
+                block = next;
+        }
+
+        if (arena->mappedData != NULL)
+                munmap(arena->mappedData, arena->mappedSize);
+
+        free(arena->pruned);
+        free(arena);
+}
+
+// Moves all the memory of one arena into another
+static void mergeArena(EntryArena *dest, EntryArena *src)
+{
+        if (src->blocks != NULL)
+        {
+                ArenaBlock *last = src->blocks;
+                while (last->next != NULL)
+                {
+                        last = last->next;
+                }
+
+                // Keep the destination's current block in front so that it can be filled up
+                if (dest->blocks != NULL)
+                {
+                        last->next = dest->blocks->next;
+                        dest->blocks->next = src->blocks;
+                }
+                else
+                {
+                        dest->blocks = src->blocks;
+                }
+        }
+
+        free(src->pruned);
+        free(src);
+}
+
+// Creates an entry without an id, for the scanner threads. Ids are given out afterwards by assignIds.
+static FileSystemEntry *allocEntry(EntryArena *arena, const char *name, int isDirectory, FileSystemEntry *parent)
 {
-        FileSystemEntry *newEntry = (FileSystemEntry *)malloc(sizeof(FileSystemEntry));
+        FileSystemEntry *newEntry = arenaAlloc(arena, sizeof(FileSystemEntry));
         if (newEntry != NULL)
         {
-                newEntry->name = strdup(name);
+                newEntry->name = arenaStrdup(arena, name);
+                if (newEntry->name == NULL)
+                {
+                        return NULL;
+                }
 
                 newEntry->isDirectory = isDirectory;
                 newEntry->isEnqueued = 0;
                 newEntry->parent = parent;
                 newEntry->children = NULL;
                 newEntry->next = NULL;
+                newEntry->arena = NULL;
+                newEntry->id = 0;
+                newEntry->parentId = -1;
+                newEntry->mtime = 0;
+        }
+        return newEntry;
+}
+
+static FileSystemEntry *createEntry(EntryArena *arena, const char *name, int isDirectory, FileSystemEntry *parent)
+{
+        FileSystemEntry *newEntry = allocEntry(arena, name, isDirectory, parent);
+        if (newEntry != NULL)
+        {
                 newEntry->id = ++lastUsedId;
                 if (parent != NULL)
                 {
                         newEntry->parentId = parent->id;
                 }
-                else
-                {
-                        newEntry->parentId = -1;
-                }
         }
         return newEntry;
 }
@@ -46,22 +309,90 @@ void addChild(FileSystemEntry *parent, FileSystemEntry *child)
         }
 }
 
-void setFullPath(FileSystemEntry *entry, const char *parentPath, const char *entryName)
+static const FileSystemEntry *getRoot(const FileSystemEntry *entry)
 {
-        if (entry == NULL || parentPath == NULL || entryName == NULL)
+        while (entry->parent != NULL)
         {
+                entry = entry->parent;
+        }
+        return entry;
+}
 
-                return;
+static const char *getRootPath(const FileSystemEntry *root)
+{
+        return (root->arena != NULL && root->arena->rootPath != NULL) ? root->arena->rootPath : "";
+}
+
+int getFullPath(const FileSystemEntry *entry, char *path, size_t size)
+{
+        if (entry == NULL || path == NULL || size == 0)
+                return -1;
+
+        const FileSystemEntry *root = getRoot(entry);
+        const char *rootPath = getRootPath(root);
+        size_t rootLength = strlen(rootPath);
+        size_t length = rootLength;
+
+        for (const FileSystemEntry *node = entry; node != root; node = node->parent)
+        {
+                length += strlen(node->name) + 1;
+        }
+
+        if (length >= size)
+        {
+                path[0] = '\0';
+                return -1;
         }
 
-        size_t fullPathLength = strnlen(parentPath, MAXPATHLEN) + strnlen(entryName, MAXPATHLEN) + 2; // +2 for '/' and '\0'
+        // Fill in the names from the end of the path, walking up towards the root
+        size_t pos = length;
+        path[pos] = '\0';
 
-        entry->fullPath = (char *)malloc(fullPathLength);
-        if (entry->fullPath == NULL)
+        for (const FileSystemEntry *node = entry; node != root; node = node->parent)
         {
-                return;
+                size_t nameLength = strlen(node->name);
+                pos -= nameLength;
+                memcpy(path + pos, node->name, nameLength);
+                path[--pos] = '/';
+        }
+
+        memcpy(path, rootPath, rootLength);
+
+        return 0;
+}
+
+bool entryHasPath(const FileSystemEntry *entry, const char *path)
+{
+        if (entry == NULL || path == NULL)
+                return false;
+
+        size_t remaining = strlen(path);
+        const FileSystemEntry *node = entry;
+
+        // Match the path from its end, name by name, without building the full path of the entry
+        while (node->parent != NULL)
+        {
+                size_t nameLength = strlen(node->name);
+
+                if (remaining < nameLength + 1 ||
+                    path[remaining - nameLength - 1] != '/' ||
+                    memcmp(path + remaining - nameLength, node->name, nameLength) != 0)
+                {
+                        return false;
+                }
+
+                remaining -= nameLength + 1;
+                node = node->parent;
         }
-        snprintf(entry->fullPath, fullPathLength, "%s/%s", parentPath, entryName);
+
+        const char *rootPath = getRootPath(node);
+
+        return remaining == strlen(rootPath) && memcmp(path, rootPath, remaining) == 0;
+}
+
+unsigned int getTreeVersion(const FileSystemEntry *root)
+{
+        return (root != NULL && root->arena != NULL) ? root->arena->version : 0;
 }
 
 void freeTree(FileSystemEntry *root)
@@ -71,21 +402,45 @@ void freeTree(FileSystemEntry *root)
                 return;
         }
 
-        FileSystemEntry *child = root->children;
-        while (child != NULL)
+        // Only the root knows the arena, every other node is freed along with it
+        destroyArena(root->arena);
+}
+
+static void addPrunedDirectory(EntryArena *arena, const char *path, int64_t mtime)
+{
+        if (arena->numPruned == arena->prunedCapacity)
         {
-                FileSystemEntry *next = child->next;
-                freeTree(child);
-                child = next;
+                int capacity = arena->prunedCapacity == 0 ? 16 : arena->prunedCapacity * 2;
+                PrunedDirectory *pruned = realloc(arena->pruned, capacity * sizeof(PrunedDirectory));
+                if (pruned == NULL)
+                {
+                        perror("Failed to grow the list of empty directories");
+                        return;
+                }
+                arena->pruned = pruned;
+                arena->prunedCapacity = capacity;
         }
 
-        free(root->name);
-        free(root->fullPath);
+        const char *copy = arenaStrdup(arena, path);
+        if (copy == NULL)
+                return;
+
+        arena->pruned[arena->numPruned].path = copy;
+        arena->pruned[arena->numPruned].mtime = mtime;
+        arena->numPruned++;
+}
 
-        free(root);
+// Appends a name to a path held in a buffer of PATH_MAX, returns the previous length to restore it with
+static size_t appendToPath(char *path, const char *name)
+{
+        size_t length = strlen(path);
+        snprintf(path + length, PATH_MAX - length, "/%s", name);
+        return length;
 }
 
-int removeEmptyDirectories(FileSystemEntry *node)
+// Unlinks the directories below node that have no audio files, and remembers them in the arena.
+// path holds the path of node.
+int removeEmptyDirectories(EntryArena *arena, FileSystemEntry *node, char *path)
 {
         if (node == NULL)
         {
@@ -100,7 +455,14 @@ int removeEmptyDirectories(FileSystemEntry *node)
         {
                 if (currentChild->isDirectory)
                 {
-                        numEntries += removeEmptyDirectories(currentChild);
+                        size_t length = appendToPath(path, currentChild->name);
+
+                        numEntries += removeEmptyDirectories(arena, currentChild, path);
+
+                        if (currentChild->children == NULL)
+                                addPrunedDirectory(arena, path, currentChild->mtime);
+
+                        path[length] = '\0';
 
                         if (currentChild->children == NULL)
                         {
@@ -113,12 +475,8 @@ int removeEmptyDirectories(FileSystemEntry *node)
                                         prevChild->next = currentChild->next;
                                 }
 
-                                FileSystemEntry *toFree = currentChild;
+                                // Its memory stays in the arena until the tree is freed
                                 currentChild = currentChild->next;
-
-                                free(toFree->name);
-                                free(toFree->fullPath);
-                                free(toFree);
                                 numEntries++;
                                 continue;
                         }
@@ -130,74 +488,192 @@ int removeEmptyDirectories(FileSystemEntry *node)
         return numEntries;
 }
 
-int readDirectory(const char *path, FileSystemEntry *parent)
+static void pushScanTask(DirectoryScanner *scanner, int queueIndex, FileSystemEntry *entry, char *path)
+{
+        ScanQueue *queue = &scanner->queues[queueIndex];
+
+        pthread_mutex_lock(&queue->mutex);
+
+        if (queue->count == queue->capacity)
+        {
+                int capacity = queue->capacity == 0 ? 64 : queue->capacity * 2;
+                ScanTask *tasks = realloc(queue->tasks, capacity * sizeof(ScanTask));
+                if (tasks == NULL)
+                {
+                        pthread_mutex_unlock(&queue->mutex);
+                        perror("Failed to grow scan queue");
+                        free(path);
+                        return;
+                }
+                queue->tasks = tasks;
+                queue->capacity = capacity;
+        }
+
+        queue->tasks[queue->count].entry = entry;
+        queue->tasks[queue->count].path = path;
+        queue->count++;
+
+        pthread_mutex_unlock(&queue->mutex);
+
+        atomic_fetch_add(&scanner->pendingTasks, 1);
+        atomic_fetch_add(&scanner->queuedTasks, 1);
+
+        pthread_mutex_lock(&scanner->idleMutex);
+        pthread_cond_signal(&scanner->idleCond);
+        pthread_mutex_unlock(&scanner->idleMutex);
+}
+
+// Workers take their own tasks from the back (depth first) and steal other workers' tasks from the front
+static bool takeScanTask(DirectoryScanner *scanner, int queueIndex, bool steal, ScanTask *task)
+{
+        ScanQueue *queue = &scanner->queues[queueIndex];
+        bool found = false;
+
+        pthread_mutex_lock(&queue->mutex);
+
+        if (queue->head < queue->count)
+        {
+                if (steal)
+                {
+                        *task = queue->tasks[queue->head++];
+                }
+                else
+                {
+                        *task = queue->tasks[--queue->count];
+                }
+
+                if (queue->head == queue->count)
+                {
+                        queue->head = queue->count = 0;
+                }
+
+                found = true;
+        }
+
+        pthread_mutex_unlock(&queue->mutex);
+
+        if (found)
+                atomic_fetch_sub(&scanner->queuedTasks, 1);
+
+        return found;
+}
+
+static bool findScanTask(DirectoryScanner *scanner, int index, ScanTask *task)
+{
+        if (takeScanTask(scanner, index, false, task))
+                return true;
+
+        for (int i = 1; i < scanner->numWorkers; i++)
+        {
+                if (takeScanTask(scanner, (index + i) % scanner->numWorkers, true, task))
+                        return true;
+        }
+
+        return false;
+}
+
+static int64_t getMtime(const struct stat *stats)
 {
+#ifdef __APPLE__
+        return (int64_t)stats->st_mtimespec.tv_sec * 1000000000 + stats->st_mtimespec.tv_nsec;
+#else
+        return (int64_t)stats->st_mtim.tv_sec * 1000000000 + stats->st_mtim.tv_nsec;
+#endif
+}
 
-        DIR *directory = opendir(path);
+// Reads the audio files and subdirectories of one directory into the children of parent, and records its mtime.
+// Returns the number of subdirectories, or -1 if the directory couldn't be read.
+static int listDirectory(EntryArena *arena, regex_t *regex, const char *path, FileSystemEntry *parent)
+{
+        int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR *directory = fd >= 0 ? fdopendir(fd) : NULL;
         if (directory == NULL)
         {
                 perror("Error opening directory");
-                return 0;
+                if (fd >= 0)
+                        close(fd);
+                return -1;
         }
 
-        struct dirent **entries;
-        int dirEntries = scandir(path, &entries, NULL, compareLibEntriesReversed);
+        struct stat directoryStats;
+        if (fstat(fd, &directoryStats) == 0)
+                parent->mtime = getMtime(&directoryStats);
 
-        if (dirEntries < 0)
+        // Files added right after it was read can leave the mtime as it is, within the timestamp granularity of
+        // the filesystem. Such a directory is read again by the next update.
+        if (parent->mtime > arena->scanStart - MTIME_GRANULARITY_NS)
+                parent->mtime = 0;
+
+        int numDirectories = 0;
+
+        int count = 0, capacity = 0;
+        struct dirent **entries = NULL;
+        struct dirent *dirEntry;
+
+        while ((dirEntry = readdir(directory)) != NULL)
         {
-                perror("Error scanning directory entries");
-                closedir(directory);
-                return 0;
-        }
+                if (dirEntry->d_name[0] == '.')
+                        continue;
 
-        regex_t regex;
-        regcomp(&regex, AUDIO_EXTENSIONS, REG_EXTENDED);
+                if (count == capacity)
+                {
+                        capacity = capacity == 0 ? 32 : capacity * 2;
+                        struct dirent **tmp = realloc(entries, capacity * sizeof(struct dirent *));
+                        if (tmp == NULL)
+                                break;
+                        entries = tmp;
+                }
 
-        int numEntries = 0;
+                size_t entrySize = offsetof(struct dirent, d_name) + strlen(dirEntry->d_name) + 1;
+                struct dirent *copy = malloc(entrySize);
+                if (copy == NULL)
+                        break;
+
+                memcpy(copy, dirEntry, entrySize);
+                entries[count++] = copy;
+        }
 
-        for (int i = 0; i < dirEntries; ++i)
+        // The same order as scandir with compareLibEntriesReversed, since children are prepended to their parent
+        if (count > 1)
+                qsort(entries, count, sizeof(struct dirent *), (int (*)(const void *, const void *))compareLibEntriesReversed);
+
+        for (int i = 0; i < count; ++i)
         {
                 struct dirent *entry = entries[i];
+                int isDirectory = true;
 
-                if (entry->d_name[0] != '.' && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+                // Only stat when the directory entry doesn't tell the type, or it's a link that needs following
+                if (entry->d_type == DT_REG)
+                {
+                        isDirectory = false;
+                }
+                else if (entry->d_type != DT_DIR)
                 {
-                        char childPath[MAXPATHLEN];
-                        snprintf(childPath, sizeof(childPath), "%s/%s", path, entry->d_name);
-
                         struct stat fileStats;
-                        if (stat(childPath, &fileStats) == -1)
+                        if (fstatat(dirfd(directory), entry->d_name, &fileStats, 0) == -1)
                         {
+                                free(entry);
                                 continue;
                         }
 
-                        int isDirectory = true;
+                        isDirectory = !S_ISREG(fileStats.st_mode);
+                }
 
-                        if (S_ISREG(fileStats.st_mode))
-                        {
-                                isDirectory = false;
-                        }
+                char exto[100];
+                extractExtension(entry->d_name, sizeof(exto) - 1, exto);
 
-                        char exto[100];
-                        extractExtension(entry->d_name, sizeof(exto) - 1, exto);
+                int isAudio = match_regex(regex, exto);
 
-                        int isAudio = match_regex(&regex, exto);
+                if (isAudio == 0 || isDirectory)
+                {
+                        FileSystemEntry *child = allocEntry(arena, entry->d_name, isDirectory, parent);
 
-                        if (isAudio == 0 || isDirectory)
+                        if (child != NULL)
                         {
-                                FileSystemEntry *child = createEntry(entry->d_name, isDirectory, parent);
-
-                                if (entry != NULL)
-                                {
-                                        setFullPath(child, path, entry->d_name);
-                                }
-
                                 addChild(parent, child);
 
                                 if (isDirectory)
-                                {
-                                        numEntries++;
-                                        numEntries += readDirectory(childPath, child);
-                                }
+                                        numDirectories++;
                         }
                 }
 
@@ -205,282 +681,1185 @@ int readDirectory(const char *path, FileSystemEntry *parent)
         }
 
         free(entries);
-        regfree(&regex);
-
         closedir(directory);
 
-        return numEntries;
+        return numDirectories;
 }
 
-void writeTreeToFile(FileSystemEntry *node, FILE *file, int parentId)
+// Reads one directory and adds its entries to the tree, subdirectories are queued to be read by any worker
+static void scanDirectory(ScanWorker *worker, regex_t *regex, ScanTask *task)
 {
-        if (node == NULL)
-        {
+        int numDirectories = listDirectory(worker->arena, regex, task->path, task->entry);
+        if (numDirectories <= 0)
                 return;
-        }
 
-        fprintf(file, "%d\t%s\t%d\t%d\n", node->id, node->name, node->isDirectory, parentId);
+        worker->numEntries += numDirectories;
 
-        FileSystemEntry *child = node->children;
-        FileSystemEntry *tmp = NULL;
-        while (child)
+        for (FileSystemEntry *child = task->entry->children; child != NULL; child = child->next)
         {
-                tmp = child->next;
-                writeTreeToFile(child, file, node->id);
-                child = tmp;
-        }
+                if (!child->isDirectory)
+                        continue;
 
-        free(node->name);
-        free(node->fullPath);
-        free(node);
+                size_t pathLength = strlen(task->path) + strlen(child->name) + 2;
+                char *childPath = malloc(pathLength);
+                if (childPath != NULL)
+                {
+                        snprintf(childPath, pathLength, "%s/%s", task->path, child->name);
+                        pushScanTask(worker->scanner, worker->index, child, childPath);
+                }
+        }
 }
 
-void freeAndWriteTree(FileSystemEntry *root, const char *filename)
+static void *scanWorkerThread(void *arg)
 {
-        FILE *file = fopen(filename, "w");
-        if (!file)
+        ScanWorker *worker = (ScanWorker *)arg;
+        DirectoryScanner *scanner = worker->scanner;
+
+        regex_t regex;
+        regcomp(&regex, AUDIO_EXTENSIONS, REG_EXTENDED);
+
+        while (true)
         {
-                perror("Failed to open file");
-                return;
-        }
+                ScanTask task;
 
-        writeTreeToFile(root, file, -1);
-        fclose(file);
-}
+                if (findScanTask(scanner, worker->index, &task))
+                {
+                        scanDirectory(worker, &regex, &task);
+                        free(task.path);
 
-FileSystemEntry *createDirectoryTree(const char *startPath, int *numEntries)
-{
-        FileSystemEntry *root = createEntry("root", 1, NULL);
+                        if (atomic_fetch_sub(&scanner->pendingTasks, 1) == 1)
+                        {
+                                // That was the last directory, wake up everyone so they can exit
+                                pthread_mutex_lock(&scanner->idleMutex);
+                                pthread_cond_broadcast(&scanner->idleCond);
+                                pthread_mutex_unlock(&scanner->idleMutex);
+                        }
+                        continue;
+                }
 
-        setFullPath(root, "", "");
+                pthread_mutex_lock(&scanner->idleMutex);
+                while (atomic_load(&scanner->queuedTasks) == 0 && atomic_load(&scanner->pendingTasks) > 0)
+                {
+                        pthread_cond_wait(&scanner->idleCond, &scanner->idleMutex);
+                }
+                bool done = atomic_load(&scanner->pendingTasks) == 0;
+                pthread_mutex_unlock(&scanner->idleMutex);
 
-        *numEntries = readDirectory(startPath, root);
-        *numEntries -= removeEmptyDirectories(root);
+                if (done)
+                        break;
+        }
 
-        lastUsedId = 0;
+        regfree(&regex);
 
-        return root;
+        return NULL;
 }
 
-FileSystemEntry **resizeNodesArray(FileSystemEntry **nodes, int oldSize, int newSize)
+static int getScanThreadCount(void)
 {
-        FileSystemEntry **newNodes = realloc(nodes, newSize * sizeof(FileSystemEntry *));
-        if (newNodes)
-        {
-                for (int i = oldSize; i < newSize; i++)
-                {
-                        newNodes[i] = NULL;
-                }
-        }
-        return newNodes;
+        if (scanThreads > 0)
+                return scanThreads > MAX_SCAN_THREADS ? MAX_SCAN_THREADS : scanThreads;
+
+        long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (numCpus < 1)
+                return 1;
+
+        return numCpus > DEFAULT_MAX_SCAN_THREADS ? DEFAULT_MAX_SCAN_THREADS : (int)numCpus;
 }
 
-FileSystemEntry *reconstructTreeFromFile(const char *filename, const char *startMusicPath, int *numDirectoryEntries)
+// Reads the whole directory tree below parent, using several threads
+static int readDirectory(EntryArena *arena, const char *path, FileSystemEntry *parent)
 {
-        FILE *file = fopen(filename, "r");
-        if (!file)
+        DirectoryScanner scanner;
+        ScanWorker workers[MAX_SCAN_THREADS];
+        pthread_t threads[MAX_SCAN_THREADS];
+
+        scanner.numWorkers = getScanThreadCount();
+        scanner.queues = calloc(scanner.numWorkers, sizeof(ScanQueue));
+        if (scanner.queues == NULL)
         {
-                return NULL;
+                perror("Failed to allocate scan queues");
+                return 0;
         }
 
-        char line[1024];
-        int nodesCount = 0, nodesCapacity = 1000, oldCapacity = 0;
-        FileSystemEntry **nodes = calloc(nodesCapacity, sizeof(FileSystemEntry *));
-        if (!nodes)
+        atomic_init(&scanner.pendingTasks, 0);
+        atomic_init(&scanner.queuedTasks, 0);
+        pthread_mutex_init(&scanner.idleMutex, NULL);
+        pthread_cond_init(&scanner.idleCond, NULL);
+
+        for (int i = 0; i < scanner.numWorkers; i++)
         {
-                fclose(file);
-                return NULL;
+                pthread_mutex_init(&scanner.queues[i].mutex, NULL);
+                workers[i].scanner = &scanner;
+                workers[i].index = i;
+                workers[i].numEntries = 0;
+                workers[i].arena = createArena();
         }
 
-        FileSystemEntry *root = NULL;
+        pushScanTask(&scanner, 0, parent, strdup(path));
 
-        while (fgets(line, sizeof(line), file))
+        // The calling thread is the first worker
+        int numThreads = 0;
+        for (int i = 1; i < scanner.numWorkers; i++)
         {
-                int id, parentId, isDirectory;
-                char name[256];
+                if (workers[i].arena == NULL || pthread_create(&threads[numThreads], NULL, scanWorkerThread, &workers[i]) != 0)
+                        break;
+                numThreads++;
+        }
 
-                if (sscanf(line, "%d\t%255[^\t]\t%d\t%d", &id, name, &isDirectory, &parentId) == 4)
+        if (workers[0].arena != NULL)
+                scanWorkerThread(&workers[0]);
+
+        for (int i = 0; i < numThreads; i++)
+        {
+                pthread_join(threads[i], NULL);
+        }
+
+        int numEntries = 0;
+
+        for (int i = 0; i < scanner.numWorkers; i++)
+        {
+                numEntries += workers[i].numEntries;
+
+                if (workers[i].arena != NULL)
+                        mergeArena(arena, workers[i].arena);
+
+                free(scanner.queues[i].tasks);
+                pthread_mutex_destroy(&scanner.queues[i].mutex);
+        }
+
+        free(scanner.queues);
+        pthread_mutex_destroy(&scanner.idleMutex);
+        pthread_cond_destroy(&scanner.idleCond);
+
+        return numEntries;
+}
+
+static FileSystemEntry *reverseSiblings(FileSystemEntry *first)
+{
+        FileSystemEntry *prev = NULL;
+
+        while (first != NULL)
+        {
+                FileSystemEntry *next = first->next;
+                first->next = prev;
+                prev = first;
+                first = next;
+        }
+
+        return prev;
+}
+
+// Gives out ids in the order a sequential scan creates the entries: in reverse order of the children list, depth first
+static void assignIds(FileSystemEntry *parent, int *lastId)
+{
+        parent->children = reverseSiblings(parent->children);
+
+        for (FileSystemEntry *child = parent->children; child != NULL; child = child->next)
+        {
+                child->id = ++(*lastId);
+                child->parentId = parent->id;
+
+                if (child->isDirectory)
+                        assignIds(child, lastId);
+        }
+
+        parent->children = reverseSiblings(parent->children);
+}
+
+// Fowler-Noll-Vo (FNV-1a) hash, used to detect a corrupt or truncated library file
+static uint64_t libraryChecksum(const unsigned char *data, size_t size)
+{
+        uint64_t hash = 14695981039346656037ULL;
+
+        for (size_t i = 0; i < size; i++)
+        {
+                hash ^= data[i];
+                hash *= 1099511628211ULL;
+        }
+
+        return hash;
+}
+
+static void countTreeForFile(FileSystemEntry *node, uint32_t *nodeCount, size_t *poolSize)
+{
+        while (node != NULL)
+        {
+                (*nodeCount)++;
+                *poolSize += strlen(node->name) + 1;
+
+                countTreeForFile(node->children, nodeCount, poolSize);
+
+                node = node->next;
+        }
+}
+
+// Lays out the tree in preorder: every parent is stored before its children, which lets the loader link nodes in a single pass
+static void writeTreeToImage(FileSystemEntry *node, int32_t parentIndex, LibraryFileNode *table, char *pool, uint32_t *index, size_t *poolOffset)
+{
+        while (node != NULL)
+        {
+                uint32_t nodeIndex = (*index)++;
+                size_t nameLength = strlen(node->name);
+
+                LibraryFileNode *record = &table[nodeIndex];
+                record->id = node->id;
+                record->parentIndex = parentIndex;
+                record->isDirectory = node->isDirectory;
+                record->mtime = node->mtime;
+                record->nameOffset = (uint32_t)*poolOffset;
+
+                memcpy(pool + *poolOffset, node->name, nameLength + 1);
+                *poolOffset += nameLength + 1;
+
+                writeTreeToImage(node->children, (int32_t)nodeIndex, table, pool, index, poolOffset);
+
+                node = node->next;
+        }
+}
+
+int writeTreeToFile(FileSystemEntry *root, const char *filename)
+{
+        uint32_t nodeCount = 0;
+        const char *rootPath = getRootPath(root);
+        size_t poolSize = strlen(rootPath) + 1;
+        EntryArena *arena = root->arena;
+        uint32_t prunedCount = arena != NULL ? (uint32_t)arena->numPruned : 0;
+
+        // Only the root itself is written here, not its siblings
+        FileSystemEntry *next = root->next;
+        root->next = NULL;
+        countTreeForFile(root, &nodeCount, &poolSize);
+
+        for (uint32_t i = 0; i < prunedCount; i++)
+        {
+                poolSize += strlen(arena->pruned[i].path) + 1;
+        }
+
+        if (poolSize > UINT32_MAX)
+        {
+                root->next = next;
+                fprintf(stderr, "Library is too large to be cached.\n");
+                return -1;
+        }
+
+        size_t tableSize = (size_t)nodeCount * sizeof(LibraryFileNode);
+        size_t prunedTableSize = (size_t)prunedCount * sizeof(LibraryFilePrunedDirectory);
+        size_t imageSize = sizeof(LibraryFileHeader) + tableSize + prunedTableSize + poolSize;
+        unsigned char *image = calloc(1, imageSize);
+        if (image == NULL)
+        {
+                root->next = next;
+                perror("Failed to allocate library image");
+                return -1;
+        }
+
+        LibraryFileHeader *header = (LibraryFileHeader *)image;
+        LibraryFileNode *table = (LibraryFileNode *)(image + sizeof(LibraryFileHeader));
+        LibraryFilePrunedDirectory *prunedTable = (LibraryFilePrunedDirectory *)(image + sizeof(LibraryFileHeader) + tableSize);
+        char *pool = (char *)(image + sizeof(LibraryFileHeader) + tableSize + prunedTableSize);
+
+        size_t poolOffset = strlen(rootPath) + 1;
+        memcpy(pool, rootPath, poolOffset);
+
+        uint32_t index = 0;
+        writeTreeToImage(root, -1, table, pool, &index, &poolOffset);
+        root->next = next;
+
+        for (uint32_t i = 0; i < prunedCount; i++)
+        {
+                size_t pathLength = strlen(arena->pruned[i].path) + 1;
+
+                prunedTable[i].pathOffset = (uint32_t)poolOffset;
+                prunedTable[i].mtime = arena->pruned[i].mtime;
+                memcpy(pool + poolOffset, arena->pruned[i].path, pathLength);
+                poolOffset += pathLength;
+        }
+
+        memcpy(header->magic, LIBRARY_FILE_MAGIC, sizeof(header->magic));
+        header->version = LIBRARY_FILE_VERSION;
+        header->nodeCount = nodeCount;
+        header->prunedCount = prunedCount;
+        header->poolSize = poolSize;
+        header->rootPathOffset = 0;
+        header->checksum = libraryChecksum(image + sizeof(LibraryFileHeader), tableSize + prunedTableSize + poolSize);
+
+        // Write to a temporary file and rename it, so that a crash never leaves a half written library behind
+        // and a tree that is currently mapped from the old file stays valid
+        char tmpFilename[MAXPATHLEN];
+        snprintf(tmpFilename, sizeof(tmpFilename), "%s.tmp", filename);
+
+        FILE *file = fopen(tmpFilename, "wb");
+        if (!file)
+        {
+                perror("Failed to open file");
+                free(image);
+                return -1;
+        }
+
+        size_t written = fwrite(image, 1, imageSize, file);
+        int closed = fclose(file);
+        free(image);
+
+        if (written != imageSize || closed != 0 || rename(tmpFilename, filename) != 0)
+        {
+                perror("Failed to write library file");
+                unlink(tmpFilename);
+                return -1;
+        }
+
+        return 0;
+}
+
+void freeAndWriteTree(FileSystemEntry *root, const char *filename)
+{
+        writeTreeToFile(root, filename);
+        freeTree(root);
+}
+
+FileSystemEntry *createDirectoryTree(const char *startPath, int *numEntries)
+{
+        EntryArena *arena = createArena();
+        if (arena == NULL)
+        {
+                return NULL;
+        }
+
+        FileSystemEntry *root = createEntry(arena, "root", 1, NULL);
+        arena->rootPath = arenaStrdup(arena, startPath);
+
+        if (root == NULL || arena->rootPath == NULL)
+        {
+                destroyArena(arena);
+                return NULL;
+        }
+
+        root->arena = arena;
+
+        *numEntries = readDirectory(arena, startPath, root);
+
+        arena->lastId = root->id;
+        assignIds(root, &arena->lastId);
+        arena->version = atomic_fetch_add(&lastTreeVersion, 1) + 1;
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s", startPath);
+        *numEntries -= removeEmptyDirectories(arena, root, path);
+
+        lastUsedId = 0;
+
+        return root;
+}
+
+static void *mapLibraryFile(const char *filename, size_t *size)
+{
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0)
+        {
+                return NULL;
+        }
+
+        struct stat fileStats;
+        if (fstat(fd, &fileStats) == -1 || fileStats.st_size < (off_t)sizeof(LibraryFileHeader))
+        {
+                close(fd);
+                return NULL;
+        }
+
+        void *data = mmap(NULL, fileStats.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if (data == MAP_FAILED)
+        {
+                return NULL;
+        }
+
+        *size = fileStats.st_size;
+
+        return data;
+}
+
+// Checks that the mapped file is a complete library file of this version that hasn't been corrupted
+static bool isValidLibraryImage(const unsigned char *data, size_t size)
+{
+        const LibraryFileHeader *header = (const LibraryFileHeader *)data;
+
+        if (memcmp(header->magic, LIBRARY_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != LIBRARY_FILE_VERSION ||
+            header->nodeCount == 0 ||
+            header->poolSize == 0 || header->poolSize > UINT32_MAX ||
+            header->rootPathOffset >= header->poolSize)
+        {
+                return false;
+        }
+
+        size_t tableSize = (size_t)header->nodeCount * sizeof(LibraryFileNode);
+        size_t prunedTableSize = (size_t)header->prunedCount * sizeof(LibraryFilePrunedDirectory);
+        if (tableSize / sizeof(LibraryFileNode) != header->nodeCount ||
+            size != sizeof(LibraryFileHeader) + tableSize + prunedTableSize + header->poolSize)
+        {
+                return false;
+        }
+
+        if (libraryChecksum(data + sizeof(LibraryFileHeader), tableSize + prunedTableSize + header->poolSize) != header->checksum)
+        {
+                return false;
+        }
+
+        // Every string in the pool must be terminated
+        return data[size - 1] == '\0';
+}
+
+FileSystemEntry *reconstructTreeFromFile(const char *filename, const char *startMusicPath, int *numDirectoryEntries)
+{
+        size_t size = 0;
+        unsigned char *data = mapLibraryFile(filename, &size);
+        if (data == NULL)
+        {
+                return NULL;
+        }
+
+        if (!isValidLibraryImage(data, size))
+        {
+                munmap(data, size);
+                return NULL;
+        }
+
+        const LibraryFileHeader *header = (const LibraryFileHeader *)data;
+        const LibraryFileNode *table = (const LibraryFileNode *)(data + sizeof(LibraryFileHeader));
+        const LibraryFilePrunedDirectory *prunedTable = (const LibraryFilePrunedDirectory *)(table + header->nodeCount);
+        char *pool = (char *)(prunedTable + header->prunedCount);
+        uint32_t nodeCount = header->nodeCount;
+
+        // A library cached for another music path can't be used
+        if (table[0].parentIndex != -1 || strcmp(pool + header->rootPathOffset, startMusicPath) != 0)
+        {
+                munmap(data, size);
+                return NULL;
+        }
+
+        EntryArena *arena = createArena();
+        if (arena == NULL)
+        {
+                munmap(data, size);
+                return NULL;
+        }
+
+        arena->mappedData = data;
+        arena->mappedSize = size;
+        arena->rootPath = pool + header->rootPathOffset;
+        arena->version = atomic_fetch_add(&lastTreeVersion, 1) + 1;
+
+        if (header->prunedCount > 0)
+        {
+                arena->pruned = malloc((size_t)header->prunedCount * sizeof(PrunedDirectory));
+                if (arena->pruned == NULL)
                 {
-                        if (id >= nodesCapacity)
+                        destroyArena(arena);
+                        return NULL;
+                }
+                arena->prunedCapacity = header->prunedCount;
+
+                for (uint32_t i = 0; i < header->prunedCount; i++)
+                {
+                        if (prunedTable[i].pathOffset >= header->poolSize)
                         {
-                                oldCapacity = nodesCapacity;
-                                nodesCapacity = id + 100;
-                                FileSystemEntry **tempNodes = resizeNodesArray(nodes, oldCapacity, nodesCapacity);
-                                if (!tempNodes)
-                                {
-                                        perror("Failed to resize nodes array");
-
-                                        for (int i = 0; i < nodesCount; i++)
-                                        {
-                                                if (nodes[i])
-                                                {
-                                                        free(nodes[i]->name);
-                                                        free(nodes[i]->fullPath);
-                                                        free(nodes[i]);
-                                                }
-                                        }
-                                        free(nodes);
-                                        fclose(file);
-                                        exit(1);
-                                }
-                                nodes = tempNodes;
+                                destroyArena(arena);
+                                return NULL;
                         }
 
-                        FileSystemEntry *node = malloc(sizeof(FileSystemEntry));
-                        if (!node)
-                        {
-                                perror("Failed to allocate node");
+                        arena->pruned[i].path = pool + prunedTable[i].pathOffset;
+                        arena->pruned[i].mtime = prunedTable[i].mtime;
+                }
+                arena->numPruned = header->prunedCount;
+        }
 
-                                fclose(file);
-                                exit(1);
-                        }
-                        node->id = id;
-                        node->name = strdup(name);
-                        node->isDirectory = isDirectory;
-                        node->isEnqueued = 0;
-                        node->children = node->next = node->parent = NULL;
-                        nodes[id] = node;
-                        nodesCount++;
-
-                        if (parentId >= 0 && nodes[parentId])
-                        {
-                                node->parent = nodes[parentId];
-                                if (nodes[parentId]->children)
-                                {
-                                        FileSystemEntry *child = nodes[parentId]->children;
-                                        while (child->next)
-                                        {
-                                                child = child->next;
-                                        }
-                                        child->next = node;
-                                }
-                                else
-                                {
-                                        nodes[parentId]->children = node;
-                                }
+        // One allocation for all the nodes, names point straight into the mapped string pool
+        FileSystemEntry *nodes = arenaAlloc(arena, (size_t)nodeCount * sizeof(FileSystemEntry));
+        if (nodes == NULL)
+        {
+                destroyArena(arena);
+                return NULL;
+        }
+        memset(nodes, 0, (size_t)nodeCount * sizeof(FileSystemEntry));
 
-                                setFullPath(node, nodes[parentId]->fullPath, node->name);
+        int directoryEntries = 0;
 
-                                if (isDirectory)
-                                        *numDirectoryEntries = *numDirectoryEntries + 1;
+        for (uint32_t i = 0; i < nodeCount; i++)
+        {
+                const LibraryFileNode *record = &table[i];
+                FileSystemEntry *node = &nodes[i];
+
+                if (record->nameOffset >= header->poolSize ||
+                    (i > 0 && (record->parentIndex < 0 || (uint32_t)record->parentIndex >= i)))
+                {
+                        destroyArena(arena);
+                        return NULL;
+                }
+
+                node->id = record->id;
+                node->name = pool + record->nameOffset;
+                node->isDirectory = record->isDirectory;
+                node->mtime = record->mtime;
+                node->isEnqueued = 0;
+                node->parentId = -1;
+
+                if (node->id > arena->lastId)
+                        arena->lastId = node->id;
+
+                if (i == 0)
+                {
+                        continue;
+                }
+
+                node->parent = &nodes[record->parentIndex];
+                node->parentId = table[record->parentIndex].id;
+
+                if (node->isDirectory)
+                        directoryEntries++;
+        }
+
+        // Link siblings by walking the table backwards and prepending each node to its parent's children.
+        // Since the table is in preorder this restores the original order, in O(1) per node however wide a directory is.
+        for (uint32_t i = nodeCount - 1; i > 0; i--)
+        {
+                FileSystemEntry *node = &nodes[i];
+
+                node->next = node->parent->children;
+                node->parent->children = node;
+        }
+
+        nodes[0].arena = arena;
+
+        *numDirectoryEntries += directoryEntries;
+
+        return &nodes[0];
+}
+
+static int compareEntryNames(const void *a, const void *b)
+{
+        const FileSystemEntry *entryA = *(const FileSystemEntry **)a;
+        const FileSystemEntry *entryB = *(const FileSystemEntry **)b;
+
+        return strcmp(entryA->name, entryB->name);
+}
+
+// Returns the children of a directory sorted by name, for looking them up with findChildByName
+static FileSystemEntry **getSortedChildren(FileSystemEntry *directory, int *count)
+{
+        *count = 0;
+
+        for (FileSystemEntry *child = directory->children; child != NULL; child = child->next)
+        {
+                (*count)++;
+        }
+
+        if (*count == 0)
+                return NULL;
+
+        FileSystemEntry **children = malloc(*count * sizeof(FileSystemEntry *));
+        if (children == NULL)
+        {
+                *count = 0;
+                return NULL;
+        }
+
+        int i = 0;
+        for (FileSystemEntry *child = directory->children; child != NULL; child = child->next)
+        {
+                children[i++] = child;
+        }
+
+        qsort(children, *count, sizeof(FileSystemEntry *), compareEntryNames);
+
+        return children;
+}
+
+static int findChildByName(FileSystemEntry **children, int count, const char *name)
+{
+        int low = 0, high = count - 1;
+
+        while (low <= high)
+        {
+                int mid = low + (high - low) / 2;
+                int cmp = strcmp(children[mid]->name, name);
+
+                if (cmp == 0)
+                        return mid;
+                else if (cmp < 0)
+                        low = mid + 1;
+                else
+                        high = mid - 1;
+        }
+
+        return -1;
+}
+
+static int countDirectories(FileSystemEntry *node)
+{
+        int count = 0;
+
+        for (; node != NULL; node = node->next)
+        {
+                if (node->isDirectory)
+                        count += 1 + countDirectories(node->children);
+        }
+
+        return count;
+}
+
+// Finds the directory in the tree that is the closest ancestor of a path
+static FileSystemEntry *findNearestDirectory(FileSystemEntry *root, const char *path)
+{
+        const char *rootPath = getRootPath(root);
+        size_t rootLength = strlen(rootPath);
+
+        if (strncmp(path, rootPath, rootLength) != 0 || path[rootLength] != '/')
+                return NULL;
+
+        FileSystemEntry *directory = root;
+        const char *name = path + rootLength + 1;
+        const char *end;
+
+        while ((end = strchr(name, '/')) != NULL)
+        {
+                size_t nameLength = end - name;
+                FileSystemEntry *child = directory->children;
+
+                while (child != NULL &&
+                       !(child->isDirectory && strncmp(child->name, name, nameLength) == 0 && child->name[nameLength] == '\0'))
+                {
+                        child = child->next;
+                }
+
+                if (child == NULL)
+                        break;
+
+                directory = child;
+                name = end + 1;
+        }
+
+        return directory;
+}
+
+static bool isForcedDirectory(LibraryUpdate *update, FileSystemEntry *directory)
+{
+        for (int i = 0; i < update->numForced; i++)
+        {
+                if (update->forced[i] == directory)
+                        return true;
+        }
+
+        return false;
+}
+
+static void addDirectoryChange(LibraryUpdate *update, FileSystemEntry *directory, FileSystemEntry *contents)
+{
+        if (update->numChanges == update->changesCapacity)
+        {
+                int capacity = update->changesCapacity == 0 ? 16 : update->changesCapacity * 2;
+                DirectoryChange *changes = realloc(update->changes, capacity * sizeof(DirectoryChange));
+                if (changes == NULL)
+                {
+                        perror("Failed to grow the list of library changes");
+                        return;
+                }
+                update->changes = changes;
+                update->changesCapacity = capacity;
+        }
+
+        update->changes[update->numChanges].directory = directory;
+        update->changes[update->numChanges].contents = contents;
+        update->numChanges++;
+}
+
+// Reads again the directory at path if it changed since it was read, and reads the directories that are new in it.
+// Then goes on with the subdirectories that are already in the tree. path is a buffer of PATH_MAX.
+static void findChangedDirectories(LibraryUpdate *update, regex_t *regex, FileSystemEntry *directory, char *path)
+{
+        struct stat directoryStats;
+
+        // A directory that is gone is dropped by the update of its parent
+        if (stat(path, &directoryStats) == -1 || !S_ISDIR(directoryStats.st_mode))
+                return;
+
+        if (getMtime(&directoryStats) == directory->mtime && !isForcedDirectory(update, directory))
+        {
+                for (FileSystemEntry *child = directory->children; child != NULL; child = child->next)
+                {
+                        if (!child->isDirectory)
+                                continue;
+
+                        size_t length = appendToPath(path, child->name);
+                        findChangedDirectories(update, regex, child, path);
+                        path[length] = '\0';
+                }
+                return;
+        }
+
+        FileSystemEntry *contents = allocEntry(update->arena, directory->name, 1, directory->parent);
+        if (contents == NULL || listDirectory(update->arena, regex, path, contents) < 0)
+                return;
+
+        int numExisting = 0;
+        FileSystemEntry **existing = getSortedChildren(directory, &numExisting);
+
+        FileSystemEntry *child = contents->children;
+        FileSystemEntry *prevChild = NULL;
+
+        while (child != NULL)
+        {
+                FileSystemEntry *next = child->next;
+
+                if (child->isDirectory)
+                {
+                        int index = findChildByName(existing, numExisting, child->name);
+                        size_t length = appendToPath(path, child->name);
+
+                        if (index >= 0 && existing[index]->isDirectory)
+                        {
+                                if (!update->onlyForced)
+                                        findChangedDirectories(update, regex, existing[index], path);
                         }
                         else
                         {
-                                root = node;
-                                setFullPath(node, startMusicPath, "");
+                                readDirectory(update->arena, path, child);
+                                removeEmptyDirectories(update->arena, child, path);
+
+                                if (child->children == NULL)
+                                {
+                                        addPrunedDirectory(update->arena, path, child->mtime);
+
+                                        if (prevChild == NULL)
+                                                contents->children = next;
+                                        else
+                                                prevChild->next = next;
+
+                                        path[length] = '\0';
+                                        child = next;
+                                        continue;
+                                }
                         }
+
+                        path[length] = '\0';
                 }
+
+                prevChild = child;
+                child = next;
         }
-        fclose(file);
-        free(nodes);
 
-        return root;
+        free(existing);
+
+        addDirectoryChange(update, directory, contents);
 }
 
-#ifdef __GNUC__
-#ifndef __APPLE__
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
-#endif
-#endif
-// Calculates the Levenshtein distance.
-// The Levenshtein distance between two strings is the minimum number of single-character edits
-// (insertions, deletions, or substitutions) required to change one string into the other.
-int utf8_levenshteinDistance(const char *s1, const char *s2)
+static void freeLibraryUpdate(LibraryUpdate *update)
+{
+        destroyArena(update->arena);
+        free(update->changes);
+        free(update->forced);
+        free(update->prunedParents);
+        free(update);
+}
+
+static LibraryUpdate *createLibraryUpdate(FileSystemEntry *root, int maxForced)
 {
-        // Get the length of s1 and s2 in terms of characters, not bytes
-        int len1 = g_utf8_strlen(s1, -1);
-        int len2 = g_utf8_strlen(s2, -1);
+        EntryArena *treeArena = root->arena;
 
-        // Allocate a 2D matrix (only two rows at a time are needed)
-        int *prevRow = (int *)malloc((len2 + 1) * sizeof(int));
-        int *currRow = (int *)malloc((len2 + 1) * sizeof(int));
+        LibraryUpdate *update = calloc(1, sizeof(LibraryUpdate));
+        if (update == NULL)
+                return NULL;
 
-        // Initialize the first row (for empty s1)
-        for (int j = 0; j <= len2; j++)
+        update->arena = createArena();
+        if (update->arena == NULL)
         {
-                prevRow[j] = j;
+                free(update);
+                return NULL;
         }
 
-        // Iterate over the characters of both strings
-        const char *p1 = s1;
-        for (int i = 1; i <= len1; i++, p1 = g_utf8_next_char(p1))
+        update->numPruned = treeArena->numPruned;
+
+        if (update->numPruned > 0)
         {
-                currRow[0] = i;
-                const char *p2 = s2;
-                for (int j = 1; j <= len2; j++, p2 = g_utf8_next_char(p2))
+                update->prunedParents = calloc(update->numPruned, sizeof(FileSystemEntry *));
+                if (update->prunedParents == NULL)
                 {
-                        // Compare Unicode characters using g_utf8_get_char
-                        gunichar c1 = g_utf8_get_char(p1);
-                        gunichar c2 = g_utf8_get_char(p2);
+                        freeLibraryUpdate(update);
+                        return NULL;
+                }
+        }
+
+        if (maxForced > 0)
+        {
+                update->forced = malloc(maxForced * sizeof(FileSystemEntry *));
+                if (update->forced == NULL)
+                {
+                        freeLibraryUpdate(update);
+                        return NULL;
+                }
+        }
+
+        for (int i = 0; i < update->numPruned; i++)
+        {
+                update->prunedParents[i] = findNearestDirectory(root, treeArena->pruned[i].path);
+        }
+
+        return update;
+}
+
+// Compares the tree with the disk and reads the directories that changed, without changing the tree.
+// Returns NULL if nothing changed.
+LibraryUpdate *prepareLibraryUpdate(FileSystemEntry *root)
+{
+        if (root == NULL || root->arena == NULL)
+                return NULL;
+
+        EntryArena *treeArena = root->arena;
+
+        LibraryUpdate *update = createLibraryUpdate(root, treeArena->numPruned);
+        if (update == NULL)
+                return NULL;
+
+        // An empty directory that changed, or is gone, has its closest directory in the tree read again
+        for (int i = 0; i < update->numPruned; i++)
+        {
+                PrunedDirectory *pruned = &treeArena->pruned[i];
+                FileSystemEntry *parent = update->prunedParents[i];
+                struct stat directoryStats;
+
+                if (parent == NULL || isForcedDirectory(update, parent))
+                        continue;
+
+                if (stat(pruned->path, &directoryStats) == -1 ||
+                    (S_ISDIR(directoryStats.st_mode) && getMtime(&directoryStats) != pruned->mtime))
+                        update->forced[update->numForced++] = parent;
+        }
 
-                        int cost = (c1 == c2) ? 0 : 1;
+        regex_t regex;
+        regcomp(&regex, AUDIO_EXTENSIONS, REG_EXTENDED);
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s", getRootPath(root));
+
+        findChangedDirectories(update, &regex, root, path);
+
+        regfree(&regex);
+
+        if (update->numChanges == 0)
+        {
+                freeLibraryUpdate(update);
+                return NULL;
+        }
+
+        return update;
+}
+
+// The directory of the tree at path, or else the closest one above it
+static FileSystemEntry *findDirectory(FileSystemEntry *root, const char *path)
+{
+        if (strcmp(path, getRootPath(root)) == 0)
+                return root;
+
+        FileSystemEntry *parent = findNearestDirectory(root, path);
+        if (parent == NULL)
+                return NULL;
+
+        const char *name = strrchr(path, '/') + 1;
+
+        for (FileSystemEntry *child = parent->children; child != NULL; child = child->next)
+        {
+                if (child->isDirectory && strcmp(child->name, name) == 0 && entryHasPath(child, path))
+                        return child;
+        }
+
+        return parent;
+}
+
+// Like prepareLibraryUpdate, but only the directories at paths are read, along with the directories that are new
+// in them, when it is already known what changed. A path that isn't in the tree, like an empty directory, has its
+// closest directory in the tree read instead.
+LibraryUpdate *prepareLibraryUpdateOf(FileSystemEntry *root, const char **paths, int numPaths)
+{
+        if (root == NULL || root->arena == NULL || numPaths <= 0)
+                return NULL;
+
+        LibraryUpdate *update = createLibraryUpdate(root, numPaths);
+        if (update == NULL)
+                return NULL;
+
+        update->onlyForced = true;
+
+        for (int i = 0; i < numPaths; i++)
+        {
+                FileSystemEntry *directory = findDirectory(root, paths[i]);
 
-                        // Fill the current row with the minimum of deletion, insertion, or substitution
-                        currRow[j] = MIN(prevRow[j] + 1,              // Deletion
-                                         MIN(currRow[j - 1] + 1,      // Insertion
-                                             prevRow[j - 1] + cost)); // Substitution
+                if (directory != NULL && !isForcedDirectory(update, directory))
+                        update->forced[update->numForced++] = directory;
+        }
+
+        regex_t regex;
+        regcomp(&regex, AUDIO_EXTENSIONS, REG_EXTENDED);
+
+        char path[PATH_MAX];
+
+        for (int i = 0; i < update->numForced; i++)
+        {
+                if (getFullPath(update->forced[i], path, sizeof(path)) == 0)
+                        findChangedDirectories(update, &regex, update->forced[i], path);
+        }
+
+        regfree(&regex);
+
+        if (update->numChanges == 0)
+        {
+                freeLibraryUpdate(update);
+                return NULL;
+        }
+
+        return update;
+}
+
+// Replaces the children of a directory with what is on disk now. Entries that are still there are kept as they are,
+// with their ids, enqueued state and subdirectories. Returns the change in the number of directories.
+static int spliceDirectory(EntryArena *arena, FileSystemEntry *directory, FileSystemEntry *contents)
+{
+        int numExisting = 0;
+        FileSystemEntry **existing = getSortedChildren(directory, &numExisting);
+        bool *kept = numExisting > 0 ? calloc(numExisting, sizeof(bool)) : NULL;
+
+        if (numExisting > 0 && (existing == NULL || kept == NULL))
+        {
+                free(existing);
+                free(kept);
+                return 0;
+        }
+
+        FileSystemEntry *first = NULL;
+        FileSystemEntry *last = NULL;
+        int numEntries = 0;
+
+        FileSystemEntry *child = contents->children;
+
+        while (child != NULL)
+        {
+                FileSystemEntry *next = child->next;
+                FileSystemEntry *entry = child;
+                int index = findChildByName(existing, numExisting, child->name);
+
+                if (index >= 0 && existing[index]->isDirectory == child->isDirectory)
+                {
+                        entry = existing[index];
+                        kept[index] = true;
+                }
+                else
+                {
+                        entry->parent = directory;
+                        entry->parentId = directory->id;
+                        entry->id = ++arena->lastId;
+
+                        if (entry->isDirectory)
+                        {
+                                assignIds(entry, &arena->lastId);
+                                numEntries += 1 + countDirectories(entry->children);
+                        }
                 }
 
-                // Swap rows (current becomes previous for the next iteration)
-                int *temp = prevRow;
-                prevRow = currRow;
-                currRow = temp;
+                entry->next = NULL;
+
+                if (last == NULL)
+                        first = entry;
+                else
+                        last->next = entry;
+
+                last = entry;
+                child = next;
         }
 
-        // The last value in prevRow contains the Levenshtein distance
-        int distance = prevRow[len2];
+        // Entries that are gone stay in the arena until the tree is freed
+        for (int i = 0; i < numExisting; i++)
+        {
+                if (!kept[i] && existing[i]->isDirectory)
+                        numEntries -= 1 + countDirectories(existing[i]->children);
+        }
+
+        directory->children = first;
+        directory->mtime = contents->mtime;
 
-        // Free the allocated memory
-        free(prevRow);
-        free(currRow);
+        free(existing);
+        free(kept);
 
-        return distance;
+        return numEntries;
 }
 
-#ifdef __GNUC__
-#ifndef __APPLE__
-#pragma GCC diagnostic pop
-#endif
-#endif
+static bool unlinkEntry(FileSystemEntry *entry)
+{
+        FileSystemEntry *parent = entry->parent;
+        if (parent == NULL)
+                return false;
+
+        FileSystemEntry **link = &parent->children;
+
+        while (*link != NULL && *link != entry)
+        {
+                link = &(*link)->next;
+        }
+
+        if (*link == NULL)
+                return false;
 
-// Traverses the tree and applies fuzzy search on each node
-void fuzzySearchRecursive(FileSystemEntry *node, const char *searchTerm, int threshold, void (*callback)(FileSystemEntry *, int))
+        *link = entry->next;
+
+        return true;
+}
+
+static int compareEntryPointers(const void *a, const void *b)
 {
-        if (node == NULL)
+        uintptr_t entryA = (uintptr_t) * (FileSystemEntry *const *)a;
+        uintptr_t entryB = (uintptr_t) * (FileSystemEntry *const *)b;
+
+        return (entryA > entryB) - (entryA < entryB);
+}
+
+// Applies the changes found by prepareLibraryUpdate to the tree and frees the update.
+// The tree must not have changed in between. Returns the change in the number of directories.
+int applyLibraryUpdate(FileSystemEntry *root, LibraryUpdate *update)
+{
+        if (root == NULL || update == NULL)
+                return 0;
+
+        EntryArena *arena = root->arena;
+        int numEntries = 0;
+
+        FileSystemEntry **changed = malloc(update->numChanges * sizeof(FileSystemEntry *));
+        if (changed == NULL)
         {
-                return;
+                freeLibraryUpdate(update);
+                return 0;
         }
 
-        // Convert search term, name, and fullPath to lowercase
-        char *lowerSearchTerm = g_utf8_casefold((char *)searchTerm, -1);
-        char *lowerName = g_utf8_casefold(node->name, -1);
+        for (int i = 0; i < update->numChanges; i++)
+        {
+                DirectoryChange *change = &update->changes[i];
+
+                numEntries += spliceDirectory(arena, change->directory, change->contents);
+                changed[i] = change->directory;
+        }
+
+        qsort(changed, update->numChanges, sizeof(FileSystemEntry *), compareEntryPointers);
+
+        // Empty directories below a directory that was read again have been found again by reading it
+        int numPruned = 0;
+        for (int i = 0; i < update->numPruned && i < arena->numPruned; i++)
+        {
+                FileSystemEntry *parent = update->prunedParents[i];
+
+                if (parent == NULL || bsearch(&parent, changed, update->numChanges, sizeof(FileSystemEntry *), compareEntryPointers) != NULL)
+                        continue;
+
+                arena->pruned[numPruned++] = arena->pruned[i];
+        }
+        arena->numPruned = numPruned;
 
-        int nameDistance = utf8_levenshteinDistance(lowerName, lowerSearchTerm);
+        EntryArena *updateArena = update->arena;
 
-        // Partial matching with lowercase strings
-        if (strstr(lowerName, lowerSearchTerm) != NULL)
+        for (int i = 0; i < updateArena->numPruned; i++)
         {
-                callback(node, 0);
+                addPrunedDirectory(arena, updateArena->pruned[i].path, updateArena->pruned[i].mtime);
         }
-        else if (nameDistance <= threshold)
+
+        mergeArena(arena, updateArena);
+        update->arena = NULL;
+
+        arena->version = atomic_fetch_add(&lastTreeVersion, 1) + 1;
+
+        // Directories that no longer have any audio files leave the tree, and so may their parents
+        for (int i = 0; i < update->numChanges; i++)
         {
-                callback(node, nameDistance);
+                FileSystemEntry *directory = update->changes[i].directory;
+
+                while (directory->children == NULL && unlinkEntry(directory))
+                {
+                        char path[PATH_MAX];
+
+                        if (getFullPath(directory, path, sizeof(path)) == 0)
+                                addPrunedDirectory(arena, path, directory->mtime);
+
+                        numEntries--;
+                        directory = directory->parent;
+                }
         }
 
-        // Free the allocated memory for lowercase strings
-        free(lowerSearchTerm);
-        free(lowerName);
+        free(changed);
+        freeLibraryUpdate(update);
 
-        fuzzySearchRecursive(node->children, searchTerm, threshold, callback);
-        fuzzySearchRecursive(node->next, searchTerm, threshold, callback);
+        return numEntries;
+}
+
+static void visitDirectories(FileSystemEntry *directory, char *path, void (*callback)(const char *path, void *data), void *data)
+{
+        callback(path, data);
+
+        for (FileSystemEntry *child = directory->children; child != NULL; child = child->next)
+        {
+                if (!child->isDirectory)
+                        continue;
+
+                size_t length = appendToPath(path, child->name);
+                visitDirectories(child, path, callback, data);
+                path[length] = '\0';
+        }
+}
+
+// Calls callback with the path of every directory of the library, including the empty ones left out of the tree
+void forEachDirectory(FileSystemEntry *root, void (*callback)(const char *path, void *data), void *data)
+{
+        if (root == NULL)
+                return;
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s", getRootPath(root));
+
+        visitDirectories(root, path, callback, data);
+
+        if (root->arena == NULL)
+                return;
+
+        for (int i = 0; i < root->arena->numPruned; i++)
+        {
+                callback(root->arena->pruned[i].path, data);
+        }
+}
+
+// The same, for the directory at path and the ones below it
+void forEachDirectoryBelow(FileSystemEntry *root, const char *path, void (*callback)(const char *path, void *data), void *data)
+{
+        if (root == NULL)
+                return;
+
+        char directoryPath[PATH_MAX];
+        FileSystemEntry *directory = findDirectory(root, path);
+
+        if (directory != NULL && getFullPath(directory, directoryPath, sizeof(directoryPath)) == 0 && strcmp(directoryPath, path) == 0)
+                visitDirectories(directory, directoryPath, callback, data);
+
+        if (root->arena == NULL)
+                return;
+
+        size_t length = strlen(path);
+
+        for (int i = 0; i < root->arena->numPruned; i++)
+        {
+                const char *prunedPath = root->arena->pruned[i].path;
+
+                if (strncmp(prunedPath, path, length) == 0 && (prunedPath[length] == '/' || prunedPath[length] == '\0'))
+                        callback(prunedPath, data);
+        }
 }
 
 FileSystemEntry *findCorrespondingEntry(FileSystemEntry *temp, const char *fullPath)
 {
         if (temp == NULL)
                 return NULL;
-        if (strcmp(temp->fullPath, fullPath) == 0)
+        if (entryHasPath(temp, fullPath))
                 return temp;
 
         FileSystemEntry *found = findCorrespondingEntry(temp->children, fullPath);
@@ -497,7 +1876,10 @@ void copyIsEnqueued(FileSystemEntry *library, FileSystemEntry *temp)
 
         if (library->isEnqueued)
         {
-                FileSystemEntry *tempEntry = findCorrespondingEntry(temp, library->fullPath);
+                char fullPath[MAXPATHLEN];
+                getFullPath(library, fullPath, sizeof(fullPath));
+
+                FileSystemEntry *tempEntry = findCorrespondingEntry(temp, fullPath);
                 if (tempEntry != NULL)
                 {
                         tempEntry->isEnqueued = library->isEnqueued;
@@ -3,11 +3,17 @@
 
 #include <ctype.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <regex.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include "file.h"
 #include "utils.h"
@@ -17,17 +23,20 @@
 #endif
 #ifndef FILE_SYSTEM_ENTRY
 #define FILE_SYSTEM_ENTRY
+typedef struct EntryArena EntryArena;
+
 typedef struct FileSystemEntry
 {
         int id;
         char *name;
-        char *fullPath;
         int isDirectory; // 1 for directory, 0 for file
         int isEnqueued;
         int parentId;
+        int64_t mtime; // Directories only, when their contents last changed on disk, in nanoseconds
         struct FileSystemEntry *parent;
         struct FileSystemEntry *children;
         struct FileSystemEntry *next; // For siblings (next node in the same directory)
+        EntryArena *arena;            // Only set on the root, owns the memory of the whole tree
 } FileSystemEntry;
 #endif
 
@@ -36,15 +45,35 @@ typedef struct FileSystemEntry
 typedef void (*SlowloadingCallback)(void);
 #endif
 
+typedef struct LibraryUpdate LibraryUpdate;
+
+void setLibraryScanThreads(int numThreads);
+
 FileSystemEntry *createDirectoryTree(const char *startPath, int *numEntries);
 
 void freeTree(FileSystemEntry *root);
 
+unsigned int getTreeVersion(const FileSystemEntry *root);
+
+int getFullPath(const FileSystemEntry *entry, char *path, size_t size);
+
+bool entryHasPath(const FileSystemEntry *entry, const char *path);
+
+int writeTreeToFile(FileSystemEntry *root, const char *filename);
+
 void freeAndWriteTree(FileSystemEntry *root, const char *filename);
 
 FileSystemEntry *reconstructTreeFromFile(const char *filename, const char *startMusicPath, int *numDirectoryEntries);
 
-void fuzzySearchRecursive(FileSystemEntry *node, const char *searchTerm, int threshold, void (*callback)(FileSystemEntry *, int));
+LibraryUpdate *prepareLibraryUpdate(FileSystemEntry *root);
+
+LibraryUpdate *prepareLibraryUpdateOf(FileSystemEntry *root, const char **paths, int numPaths);
+
+int applyLibraryUpdate(FileSystemEntry *root, LibraryUpdate *update);
+
+void forEachDirectory(FileSystemEntry *root, void (*callback)(const char *path, void *data), void *data);
+
+void forEachDirectoryBelow(FileSystemEntry *root, const char *path, void (*callback)(const char *path, void *data), void *data);
 
 void copyIsEnqueued(FileSystemEntry *library, FileSystemEntry *temp);
 
@@ -264,6 +264,24 @@ unsigned char *getBitmap(const char *image_path, int *width, int *height)
         return image;
 }
 
+// The same, for a picture that is already in memory, like one embedded in the tags
+unsigned char *getBitmapFromMemory(const unsigned char *data, size_t size, int *width, int *height)
+{
+        if (data == NULL || size == 0 || size > INT_MAX)
+                return NULL;
+
+        int channels;
+
+        unsigned char *image = stbi_load_from_memory(data, (int)size, width, height, &channels, 4); // Force 4 channels (RGBA)
+        if (!image)
+        {
+                fprintf(stderr, "Failed to load embedded image\n");
+                return NULL;
+        }
+
+        return image;
+}
+
 float calcAspectRatio(void)
 {
         TermSize term_size;
@@ -288,12 +306,27 @@ float calcAspectRatio(void)
         return (float)cell_height / (float)cell_width;
 }
 
-void printSquareBitmapCentered(unsigned char *pixels, int width, int height, int baseHeight)
+static void getCellSize(const TermSize *term_size, gint *cell_width, gint *cell_height)
+{
+        *cell_width = -1;
+        *cell_height = -1;
+
+        if (term_size->width_cells > 0 && term_size->height_cells > 0 &&
+            term_size->width_pixels > 0 && term_size->height_pixels > 0)
+        {
+                *cell_width = term_size->width_pixels / term_size->width_cells;
+                *cell_height = term_size->height_pixels / term_size->height_cells;
+        }
+}
+
+static GString *renderSquareBitmapCentered(unsigned char *pixels, int width, int height, int baseHeight, const TermSize *term_size)
 {
+        GString *output = g_string_new(NULL);
+
         if (pixels == NULL)
         {
-                printf("Error: Invalid pixel data.\n");
-                return;
+                g_string_append(output, "Error: Invalid pixel data.\n");
+                return output;
         }
 
         // Use the provided width and height
@@ -304,23 +337,14 @@ void printSquareBitmapCentered(unsigned char *pixels, int width, int height, int
         // Validate the image dimensions
         if (pix_width == 0 || pix_height == 0)
         {
-                printf("Error: Invalid image dimensions.\n");
-                return;
+                g_string_append(output, "Error: Invalid image dimensions.\n");
+                return output;
         }
 
-        TermSize term_size;
         GString *printable;
-        gint cell_width = -1, cell_height = -1;
-
-        tty_init();
-        get_tty_size(&term_size);
+        gint cell_width, cell_height;
 
-        if (term_size.width_cells > 0 && term_size.height_cells > 0 &&
-            term_size.width_pixels > 0 && term_size.height_pixels > 0)
-        {
-                cell_width = term_size.width_pixels / term_size.width_cells;
-                cell_height = term_size.height_pixels / term_size.height_cells;
-        }
+        getCellSize(term_size, &cell_width, &cell_height);
 
         // Set default cell size for some terminals
         if (cell_width == -1 || cell_height == -1)
@@ -345,25 +369,24 @@ void printSquareBitmapCentered(unsigned char *pixels, int width, int height, int
             cell_width,
             cell_height);
 
-        // Ensure the string is null-terminated
-        g_string_append_c(printable, '\0');
-
         // Split the printable string into lines
         const gchar *delimiters = "\n";
         gchar **lines = g_strsplit(printable->str, delimiters, -1);
 
         // Calculate indentation to center the image
-        int indentation = ((term_size.width_cells - correctedWidth) / 2);
+        int indentation = ((term_size->width_cells - correctedWidth) / 2);
 
-        // Print each line with indentation
+        // Each line with indentation
         for (int i = 0; lines[i] != NULL; i++)
         {
-                printf("\n\033[%dC%s", indentation, lines[i]);
+                g_string_append_printf(output, "\n\033[%dC%s", indentation, lines[i]);
         }
 
         // Free allocated memory
         g_strfreev(lines);
         g_string_free(printable, TRUE);
+
+        return output;
 }
 
 unsigned char luminanceFromRGB(unsigned char r, unsigned char g, unsigned char b)
@@ -423,7 +446,7 @@ unsigned char calcAsciiChar(PixelData *p)
         return scale[brightness_levels - rescaled];
 }
 
-int convertToAscii(const char *filepath, unsigned int height)
+static int convertToAscii(GString *output, unsigned char *pixels, int width, int height, unsigned int rows, const TermSize *term_size)
 {
         /*
         Modified, originally by Danny Burrows:
@@ -452,79 +475,116 @@ int convertToAscii(const char *filepath, unsigned int height)
         SOFTWARE.
         */
 
-        TermSize term_size;
-        gint cell_width = -1, cell_height = -1;
+        gint cell_width, cell_height;
 
-        tty_init();
-        get_tty_size(&term_size);
-
-        if (term_size.width_cells > 0 && term_size.height_cells > 0 &&
-            term_size.width_pixels > 0 && term_size.height_pixels > 0)
-        {
-                cell_width = term_size.width_pixels / term_size.width_cells;
-                cell_height = term_size.height_pixels / term_size.height_cells;
-        }
+        getCellSize(term_size, &cell_width, &cell_height);
 
         float aspect_ratio_correction = (float)cell_height / (float)cell_width;
-        unsigned int correctedWidth = (int)(height * aspect_ratio_correction) - 1;
-
+        unsigned int correctedWidth = (int)(rows * aspect_ratio_correction) - 1;
 
         // Calculate indentation to center the image
-        int indent = ((term_size.width_cells - correctedWidth) / 2);
+        int indent = ((term_size->width_cells - correctedWidth) / 2);
 
-        int rwidth, rheight, rchannels;
-        unsigned char *read_data = stbi_load(filepath, &rwidth, &rheight, &rchannels, 3);
-
-        if (read_data == NULL)
+        if (pixels == NULL || width <= 0 || height <= 0)
         {
                 return -1;
         }
 
-        PixelData *data;
-        if (correctedWidth != (unsigned)rwidth || height != (unsigned)rheight)
+        // The cover that is already decoded, as RGBA
+        unsigned char *data = pixels;
+        if (correctedWidth != (unsigned)width || rows != (unsigned)height)
         {
-                // 3 * uint8 for RGB!
-                unsigned char *new_data = malloc(3 * sizeof(unsigned char) * correctedWidth * height);
-                stbir_resize_uint8_srgb(
-                    read_data, rwidth, rheight, 0,
-                    new_data, correctedWidth, height, 0, 3);
+                data = malloc(4 * sizeof(unsigned char) * correctedWidth * rows);
+                if (data == NULL)
+                        return -1;
 
-                stbi_image_free(read_data);
-                data = (PixelData *)new_data;
-        }
-        else
-        {
-                data = (PixelData *)read_data;
+                stbir_resize_uint8_srgb(
+                    pixels, width, height, 0,
+                    data, correctedWidth, rows, 0, STBIR_RGBA);
         }
 
-        printf("\n");
-        printf("%*s", indent, "");
+        g_string_append(output, "\n");
+        g_string_append_printf(output, "%*s", indent, "");
 
-        for (unsigned int d = 0; d < correctedWidth * height; d++)
+        for (unsigned int d = 0; d < correctedWidth * rows; d++)
         {
                 if (d % correctedWidth == 0 && d != 0)
                 {
-                        printf("\n");
-                        printf("%*s", indent, "");
+                        g_string_append(output, "\n");
+                        g_string_append_printf(output, "%*s", indent, "");
                 }
 
-                PixelData *c = data + d;
+                PixelData c = {data[d * 4], data[d * 4 + 1], data[d * 4 + 2]};
 
-                printf("\033[1;38;2;%03u;%03u;%03um%c", c->r, c->g, c->b, calcAsciiChar(c));
+                g_string_append_printf(output, "\033[1;38;2;%03u;%03u;%03um%c", c.r, c.g, c.b, calcAsciiChar(&c));
         }
 
-        printf("\n");
+        g_string_append(output, "\n");
+
+        if (data != pixels)
+                free(data);
 
-        stbi_image_free(data);
         return 0;
 }
 
-int printInAscii(const char *pathToImgFile, int height)
+static GString *renderAscii(unsigned char *pixels, int width, int height, int rows, const TermSize *term_size)
 {
-        printf("\r");
+        GString *output = g_string_new("\r");
 
-        int ret = convertToAscii(pathToImgFile,(unsigned)height);
+        int ret = convertToAscii(output, pixels, width, height, (unsigned)rows, term_size);
         if (ret == -1)
-                printf("\033[0m");
-        return 0;
+                g_string_append(output, "\033[0m");
+
+        return output;
+}
+
+static atomic_int lastCoverHeight = 0;
+
+// The cover as it is printed in a terminal of the size it is now, from what was rendered before if that still fits.
+// The cover can be rendered on another thread, before it is shown, as long as it isn't rendered on two at once.
+GString *getCoverRender(CoverRender *render, unsigned char *pixels, int width, int height, int baseHeight, bool ascii)
+{
+        TermSize term_size;
+
+        tty_init();
+        get_tty_size(&term_size);
+
+        atomic_store(&lastCoverHeight, baseHeight);
+
+        if (render->output != NULL && render->termWidth == term_size.width_cells && render->termHeight == term_size.height_cells &&
+            render->termWidthPixels == term_size.width_pixels && render->termHeightPixels == term_size.height_pixels &&
+            render->baseHeight == baseHeight && render->ascii == ascii)
+        {
+                return render->output;
+        }
+
+        freeCoverRender(render);
+
+        if (ascii)
+                render->output = renderAscii(pixels, width, height, baseHeight, &term_size);
+        else
+                render->output = renderSquareBitmapCentered(pixels, width, height, baseHeight, &term_size);
+
+        render->termWidth = term_size.width_cells;
+        render->termHeight = term_size.height_cells;
+        render->termWidthPixels = term_size.width_pixels;
+        render->termHeightPixels = term_size.height_pixels;
+        render->baseHeight = baseHeight;
+        render->ascii = ascii;
+
+        return render->output;
+}
+
+// The height the last cover was shown with, to render the next one for
+int getLastCoverHeight(void)
+{
+        return atomic_load(&lastCoverHeight);
+}
+
+void freeCoverRender(CoverRender *render)
+{
+        if (render->output != NULL)
+                g_string_free(render->output, TRUE);
+
+        render->output = NULL;
 }
@@ -1,5 +1,7 @@
 #include <chafa.h>
 #include <chafa-canvas-config.h>
+#include <limits.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,12 +18,30 @@
     } PixelData;
 #endif
 
-int printInAscii(const char *pathToImgFile, int height);
+#ifndef COVERRENDER_STRUCT
+#define COVERRENDER_STRUCT
+    typedef struct
+    {
+        GString *output;      // What is printed for the cover
+        int termWidth;        // The terminal it was rendered for, in cells
+        int termHeight;
+        int termWidthPixels;
+        int termHeightPixels;
+        int baseHeight;
+        bool ascii;
+    } CoverRender;
+#endif
 
 float calcAspectRatio(void);
 
 unsigned char *getBitmap(const char *image_path, int *width, int *height);
 
-void printSquareBitmapCentered(unsigned char *pixels, int width, int height, int baseHeight);
+unsigned char *getBitmapFromMemory(const unsigned char *data, size_t size, int *width, int *height);
+
+GString *getCoverRender(CoverRender *render, unsigned char *pixels, int width, int height, int baseHeight, bool ascii);
+
+int getLastCoverHeight(void);
+
+void freeCoverRender(CoverRender *render);
 
 int getCoverColor(unsigned char *pixels, int width, int height, unsigned char *r, unsigned char *g, unsigned char *b);
@@ -50,14 +50,15 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE. */
 #include <time.h>
 #include <unistd.h>
 #include "appstate.h"
-#include "cache.h"
 #include "events.h"
 #include "file.h"
+#include "librarywatcher.h"
 #include "mpris.h"
 #include "notifications.h"
 #include "player.h"
 #include "playerops.h"
 #include "playlist.h"
+#include "prefetch.h"
 #include "search_ui.h"
 #include "settings.h"
 #include "sound.h"
@@ -69,6 +70,8 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE. */
 #define MAX_TMP_SEQ_LEN 256 // Maximum length of temporary sequence buffer
 #define COOLDOWN_MS 500
 #define COOLDOWN2_MS 100
+#define RESIZE_SETTLE_MS 100
+#define RESIZE_MAX_WAIT_MS 1000
 
 #define TMPPIDFILE "/tmp/kew_"
 
@@ -77,6 +80,12 @@ struct winsize windowSize;
 char digitsPressed[MAX_SEQ_LEN];
 int digitsPressedCount = 0;
 static unsigned int updateCounter = 0;
+static guint frameTimerId = 0;
+static volatile sig_atomic_t resizeSignals = 0;
+static struct timespec updateStart = {0, 0}; // When the main loop last started working
+static struct timespec updateEnd = {0, 0};
+static double maxInputLatencyMs = 0.0;
+static unsigned long long numInputs = 0;
 bool startFromTop = false;
 int lastNotifiedId = -1;
 bool songWasRemoved = false;
@@ -97,12 +106,7 @@ void updateLastInputTime(void)
 
 bool isCooldownElapsed(int milliSeconds)
 {
-        struct timespec currentTime;
-        clock_gettime(CLOCK_MONOTONIC, &currentTime);
-        double elapsedMilliseconds = (currentTime.tv_sec - lastInputTime.tv_sec) * 1000.0 +
-                                     (currentTime.tv_nsec - lastInputTime.tv_nsec) / 1000000.0;
-
-        return elapsedMilliseconds >= milliSeconds;
+        return getMsSince(&lastInputTime) >= milliSeconds;
 }
 
 struct Event processInput()
@@ -377,12 +381,18 @@ void notifyMPRISSwitch(SongData *currentSongData)
 
         gint64 length = getLengthInMicroSec(currentSongData->duration);
 
+#ifndef __APPLE__
+        const char *coverArtPath = getCoverArtPath(currentSongData);
+#else
+        const char *coverArtPath = ""; // There is no MPRIS to show it
+#endif
+
         // Update mpris
         emitMetadataChanged(
             currentSongData->metadata->title,
             currentSongData->metadata->artist,
             currentSongData->metadata->album,
-            currentSongData->coverArtPath,
+            coverArtPath,
             currentSongData->trackId != NULL ? currentSongData->trackId : "", currentSong,
             length);
 }
@@ -392,7 +402,8 @@ void notifySongSwitch(SongData *currentSongData, UISettings *ui)
         if (currentSongData != NULL && currentSongData->hasErrors == 0 && currentSongData->metadata && strnlen(currentSongData->metadata->title, 10) > 0)
         {
 #ifdef USE_DBUS
-                displaySongNotification(currentSongData->metadata->artist, currentSongData->metadata->title, currentSongData->coverArtPath, ui);
+                const char *coverArtPath = ui->allowNotifications ? getCoverArtPath(currentSongData) : "";
+                displaySongNotification(currentSongData->metadata->artist, currentSongData->metadata->title, coverArtPath, ui);
 #else
                 (void)ui;
 #endif
@@ -717,7 +728,10 @@ void enqueueAndPlay(AppState *state)
 
         if (firstEnqueuedEntry && !wasEmpty)
         {
-                Node *song = findPathInPlaylist(firstEnqueuedEntry->fullPath, &playlist);
+                char fullPath[MAXPATHLEN];
+                getFullPath(firstEnqueuedEntry, fullPath, sizeof(fullPath));
+
+                Node *song = findPathInPlaylist(fullPath, &playlist);
 
                 loadedNextSong = true;
 
@@ -901,16 +915,31 @@ void handleInput(AppState *state)
         }
 }
 
+// Redraws once the window has stopped changing size for a moment, or after a second of dragging it
 void resize(UIState *uis)
 {
-        alarm(1); // Timer
-        while (uis->resizeFlag)
+        static bool waiting = false;
+        static sig_atomic_t lastResizeSignals = 0;
+        static struct timespec firstChange;
+        static struct timespec lastChange;
+
+        if (!waiting || resizeSignals != lastResizeSignals)
         {
-                uis->resizeFlag = 0;
-                c_sleep(100);
+                clock_gettime(CLOCK_MONOTONIC, &lastChange);
+
+                if (!waiting)
+                        firstChange = lastChange;
+
+                waiting = true;
+                lastResizeSignals = resizeSignals;
         }
-        alarm(0); // Cancel timer
-        printf("\033[1;1H");
+
+        if (getMsSince(&lastChange) < RESIZE_SETTLE_MS && getMsSince(&firstChange) < RESIZE_MAX_WAIT_MS)
+                return;
+
+        waiting = false;
+        uis->resizeFlag = 0;
+        screenPrintf("\033[1;1H");
         clearScreen();
         refresh = true;
 }
@@ -1140,25 +1169,103 @@ void processDBusEvents(void)
         }
 }
 
+// Whether something on screen moves by itself, or the player is in the middle of something it drives forward
+bool needsFrameTimer(AppState *state)
+{
+        // Without a way to be woken up, it has to keep checking
+        if (getWakeupFd() < 0)
+                return true;
+
+        bool moving = state->uiSettings.uiEnabled && (state->currentView == TRACK_VIEW || state->uiState.miniMode) &&
+                      !isPaused() && !isStopped() && !audioData.endOfListReached;
+
+        // A key can be held down, or a seek is waiting for it to be let go
+        bool inputPending = !isCooldownElapsed(COOLDOWN_MS);
+
+        bool busy = songLoading || skipping || state->uiState.resizeFlag || isAnimating();
+
+        return moving || inputPending || busy;
+}
+
+void updateMainLoop(bool updateStatus);
+
 gboolean mainloop_callback(gpointer data)
 {
         (void)data;
 
+        updateCounter++;
+
+        // Update every other time or if searching (search needs to update often to detect keypresses)
+        bool updateStatus = updateCounter % 2 == 0 || ((appState.currentView == SEARCH_VIEW || appState.currentView == RADIOSEARCH_VIEW) && !appState.uiState.miniMode);
+
+        updateMainLoop(updateStatus);
+
+        // It stops after an update, so that what the last input changed is shown
+        if (updateStatus && !needsFrameTimer(&appState))
+        {
+                frameTimerId = 0;
+                return G_SOURCE_REMOVE;
+        }
+
+        return TRUE;
+}
+
+void updateMainLoop(bool updateStatus)
+{
+        clock_gettime(CLOCK_MONOTONIC, &updateStart);
+
         calcElapsedTime();
 
         handleInput(&appState);
 
-        updateCounter++;
-
-        // Update every other time or if searching (search needs to update often to detect keypresses)
-        if (updateCounter % 2 == 0 || ((appState.currentView == SEARCH_VIEW || appState.currentView == RADIOSEARCH_VIEW) && !appState.uiState.miniMode))
+        if (updateStatus)
         {
                 processDBusEvents();
 
                 updatePlayerStatus(&appState);
         }
 
-        return TRUE;
+        if (frameTimerId == 0 && needsFrameTimer(&appState))
+                frameTimerId = g_timeout_add(56, mainloop_callback, NULL);
+
+        clock_gettime(CLOCK_MONOTONIC, &updateEnd);
+}
+
+static gboolean onInput(gint fd, GIOCondition condition, gpointer user_data)
+{
+        (void)fd;
+        (void)user_data;
+
+        if (condition & (G_IO_HUP | G_IO_ERR | G_IO_NVAL))
+                return G_SOURCE_REMOVE;
+
+        // If the main loop went straight from working to this, the key could have come in when it started
+        // working, which is the latency that counts
+        struct timespec pressed;
+        clock_gettime(CLOCK_MONOTONIC, &pressed);
+        if (getMsSince(&updateEnd) < 1.0)
+                pressed = updateStart;
+
+        updateMainLoop(true);
+
+        double latency = getMsSince(&pressed);
+        if (latency > maxInputLatencyMs)
+                maxInputLatencyMs = latency;
+        numInputs++;
+
+        return G_SOURCE_CONTINUE;
+}
+
+static gboolean onWakeup(gint fd, GIOCondition condition, gpointer user_data)
+{
+        (void)fd;
+        (void)condition;
+        (void)user_data;
+
+        clearWakeup();
+        updateMainLoop(true);
+
+        return G_SOURCE_CONTINUE;
 }
 
 static gboolean quitOnSignal(gpointer user_data)
@@ -1223,13 +1330,33 @@ void initFirstPlay(Node *song, AppState *state)
         else
                 emitPlaybackStoppedMpris();
 
-        g_timeout_add(56, mainloop_callback, NULL);
+        // Runs when there is input, or another thread or a signal wakes it up, and on a timer only while the screen moves
+        g_unix_fd_add(STDIN_FILENO, G_IO_IN | G_IO_HUP | G_IO_ERR, onInput, NULL);
+        if (getWakeupFd() >= 0)
+                g_unix_fd_add(getWakeupFd(), G_IO_IN, onWakeup, NULL);
+        frameTimerId = g_timeout_add(56, mainloop_callback, NULL);
+
         g_main_loop_run(main_loop);
         g_main_loop_unref(main_loop);
 }
 
 void cleanupOnExit()
 {
+#ifdef DEBUG
+        DecodeAheadStats stats;
+        getDecodeAheadStats(&stats);
+        fprintf(stderr, "Audio underruns: %llu (%llu frames)\n", (unsigned long long)stats.underruns, (unsigned long long)stats.underrunFrames);
+        fprintf(stderr, "Input latency: %.1f ms at most over %llu inputs\n", maxInputLatencyMs, numInputs);
+        ScreenStats screenStats;
+        getScreenStats(&screenStats);
+        fprintf(stderr, "Screen: %llu frames, %llu written whole, %llu bytes per frame\n", (unsigned long long)screenStats.frames,
+                (unsigned long long)screenStats.fullFrames,
+                (unsigned long long)(screenStats.frames > 0 ? screenStats.bytesWritten / screenStats.frames : 0));
+#endif
+        stopSongLoader();
+        stopDecodeAhead();
+        stopPrefetcher();
+
         pthread_mutex_lock(&dataSourceMutex);
 
         resetAllDecoders();
@@ -1265,6 +1392,7 @@ void cleanupOnExit()
         }
 
         freeSearchResults();
+        freeLibrarySearchIndex();
         freeRadioSearchResults();
         freeCurrentlyPlayingRadioStation();
         curl_global_cleanup();
@@ -1273,8 +1401,7 @@ void cleanupOnExit()
         enableInputBuffering();
         setConfig(&settings, &(appState.uiSettings));
         saveSpecialPlaylist(settings.path);
-        freeAudioBuffer();
-        deleteCache(appState.tempCache);
+        stopLibraryWatcher();
         freeMainDirectoryTree(&appState);
         freeAndwriteRadioFavorites();
         deletePlaylist(&playlist);
@@ -1289,6 +1416,7 @@ void cleanupOnExit()
         pthread_mutex_unlock(&dataSourceMutex);
         pthread_mutex_destroy(&(dataSourceMutex));
         freeLastCover();
+        freeVisuals();
 #ifdef USE_DBUS
         cleanupDbusConnection();
 #endif
@@ -1301,11 +1429,13 @@ void cleanupOnExit()
                 perror("freopen error");
         }
 
-        printf("\n");
+        screenPrintf("\n");
         showCursor();
         exitAlternateScreenBuffer();
         if (appState.uiSettings.mouseEnabled)
                 disableTerminalMouseButtons();
+        screenFlush();
+        freeScreen();
 
         if (noMusicFound)
         {
@@ -1340,40 +1470,31 @@ void run(AppState *state)
         currentSong = playlist.head;
         initFirstPlay(currentSong, state);
         clearScreen();
-        fflush(stdout);
+        screenFlush();
 }
 
 void handleResize(int sig)
 {
         (void)sig;
         appState.uiState.resizeFlag = 1;
-}
-
-void resetResizeFlag(int sig)
-{
-        (void)sig;
-        appState.uiState.resizeFlag = 0;
+        resizeSignals++;
+        wakeMainLoop();
 }
 
 void initResize()
 {
         signal(SIGWINCH, handleResize);
-
-        struct sigaction sa;
-        sa.sa_handler = resetResizeFlag;
-        sigemptyset(&(sa.sa_mask));
-        sa.sa_flags = 0;
-        sigaction(SIGALRM, &sa, NULL);
 }
 
 void init(AppState *state)
 {
         disableInputBuffering();
+        if (initWakeup() != 0)
+                perror("Failed to create wakeup descriptor");
         initResize();
         ioctl(STDOUT_FILENO, TIOCGWINSZ, &windowSize);
         enableScrolling();
         setNonblockingMode();
-        state->tempCache = createCache();
         c_strcpy(loadingdata.filePath, "", sizeof(loadingdata.filePath));
         loadingdata.songdataA = NULL;
         loadingdata.songdataB = NULL;
@@ -1382,14 +1503,18 @@ void init(AppState *state)
         audioData.restart = true;
         userData.songdataADeleted = true;
         userData.songdataBDeleted = true;
-        initAudioBuffer();
         unsigned int seed = (unsigned int)time(NULL);
         srand(seed);
-        pthread_mutex_init(&dataSourceMutex, NULL);
-        pthread_mutex_init(&switchMutex, NULL);
         pthread_mutex_init(&(loadingdata.mutex), NULL);
         pthread_mutex_init(&(playlist.mutex), NULL);
+        // The threads start once every mutex they use is set up
+        startDecodeAhead();
+        startPrefetcher(state, state->uiSettings.prefetchTracks, state->uiSettings.prefetchMemoryLimit);
+        startSongLoader();
+        initVisuals(state->uiSettings.visualizerMeasureFft);
         createLibrary(&settings, state);
+        if (state->uiSettings.watchLibrary)
+                startLibraryWatcher(settings.path);
         createRadioFavorites();
         curl_global_init(CURL_GLOBAL_DEFAULT);
         fflush(stdout);
@@ -1633,6 +1758,7 @@ void setMusicPath()
         char *user = NULL;
 
         clearScreen();
+        screenFlush();
 
         if (pw)
         {
@@ -1717,6 +1843,9 @@ void setMusicPath()
 
         if (result == -1)
                 exit(1);
+
+        // The questions were printed around the screen
+        screenInvalidate();
 }
 
 void enableMouse(UISettings *ui)
@@ -1742,8 +1871,14 @@ void initState(AppState *state)
         state->uiSettings.coverAnsi = false;
         state->uiSettings.visualizerHeight = 5;
         state->uiSettings.visualizerColorType = 0;
+        state->uiSettings.visualizerMeasureFft = false;
         state->uiSettings.titleDelay = 9;
         state->uiSettings.cacheLibrary = -1;
+        state->uiSettings.libraryScanThreads = 0;
+        state->uiSettings.watchLibrary = false;
+        state->uiSettings.outputSampleRate = 0;
+        state->uiSettings.prefetchTracks = 2;
+        state->uiSettings.prefetchMemoryLimit = 64;
         state->uiSettings.useConfigColors = false;
         state->uiSettings.mouseEnabled = true;
         state->uiState.numDirectoryTreeEntries = 0;
@@ -1757,7 +1892,6 @@ void initState(AppState *state)
         state->uiState.doNotifyMPRISSwitched = false;
         state->uiState.doNotifyMPRISPlaying = false;
         state->uiState.collapseView = false;
-        state->tempCache = NULL;
 
         radioContext.buf.stale = false;
 }
@@ -1784,6 +1918,7 @@ int main(int argc, char *argv[])
         else if (argc == 2 && (strcmp(argv[1], "--version") == 0 || strcmp(argv[1], "-v") == 0))
         {
                 printAbout(NULL, ui);
+                screenFlush();
                 exit(0);
         }
 
@@ -0,0 +1,335 @@
+#include "librarywatcher.h"
+
+/*
+
+librarywatcher.c
+
+ Watches the music library for changes and updates the library when they happen.
+
+*/
+
+#define MAX_LIBRARY_WATCHES 8192 // Beyond this, the library is polled instead
+#define WATCH_DEBOUNCE_MS 1000   // Update after this long without changes
+#define WATCH_MAX_DELAY_MS 10000 // But at least this often while changes keep coming, like when copying many albums
+#define POLL_INTERVAL_MS 60000   // How often the mtimes are checked when the library isn't watched
+
+#ifdef __linux__
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#endif
+
+typedef struct
+{
+        int fd;                   // The inotify instance, -1 when polling
+        char **paths;             // The directory of each watch descriptor, the strings belong to watchedPaths
+        int pathsCapacity;
+        GHashTable *watchedPaths; // The watch descriptor of each directory
+        GHashTable *changed;      // Directories with events since the last update
+        bool fullUpdate;          // Events were lost, so every mtime is checked
+        bool markNewWatches;      // A directory watched from now on could have changed before it was watched
+        bool overflow;
+} LibraryWatcher;
+
+static pthread_t watcherThread;
+static bool watcherRunning = false;
+static int stopPipe[2] = {-1, -1};
+static char watchedPath[MAXPATHLEN];
+
+static void stopWatching(LibraryWatcher *watcher)
+{
+        if (watcher->fd >= 0)
+                close(watcher->fd);
+
+        watcher->fd = -1;
+
+        free(watcher->paths);
+        watcher->paths = NULL;
+        watcher->pathsCapacity = 0;
+
+        g_hash_table_remove_all(watcher->watchedPaths);
+        g_hash_table_remove_all(watcher->changed);
+}
+
+#ifdef __linux__
+static void addWatch(const char *path, void *data)
+{
+        LibraryWatcher *watcher = (LibraryWatcher *)data;
+
+        if (watcher->overflow || g_hash_table_contains(watcher->watchedPaths, path))
+                return;
+
+        int wd = inotify_add_watch(watcher->fd, path, WATCH_MASK);
+        if (wd < 0)
+        {
+                // Out of watches for this user, other errors are directories that are gone or can't be read
+                if (errno == ENOSPC)
+                        watcher->overflow = true;
+                return;
+        }
+
+        if (wd >= watcher->pathsCapacity)
+        {
+                int capacity = watcher->pathsCapacity == 0 ? 1024 : watcher->pathsCapacity;
+                while (capacity <= wd)
+                        capacity *= 2;
+
+                char **paths = realloc(watcher->paths, capacity * sizeof(char *));
+                if (paths == NULL)
+                {
+                        watcher->overflow = true;
+                        return;
+                }
+                memset(paths + watcher->pathsCapacity, 0, (capacity - watcher->pathsCapacity) * sizeof(char *));
+
+                watcher->paths = paths;
+                watcher->pathsCapacity = capacity;
+        }
+
+        // A directory that was moved keeps its watch descriptor
+        if (watcher->paths[wd] != NULL)
+                g_hash_table_remove(watcher->watchedPaths, watcher->paths[wd]);
+
+        char *watched = g_strdup(path);
+        g_hash_table_insert(watcher->watchedPaths, watched, GINT_TO_POINTER(wd));
+        watcher->paths[wd] = watched;
+
+        if (g_hash_table_size(watcher->watchedPaths) > MAX_LIBRARY_WATCHES)
+                watcher->overflow = true;
+
+        // Files that landed in it before the watch was added are found by reading it again
+        if (watcher->markNewWatches && !g_hash_table_contains(watcher->changed, path))
+                g_hash_table_add(watcher->changed, g_strdup(path));
+}
+
+// Watches every directory of the library that isn't watched yet, or falls back to polling if there are too many
+static void updateWatches(LibraryWatcher *watcher)
+{
+        if (watcher->fd < 0)
+                return;
+
+        forEachLibraryDirectory(addWatch, watcher);
+
+        if (watcher->overflow)
+                stopWatching(watcher);
+}
+
+// The same, for the directories at paths and below them
+static void updateWatchesBelow(LibraryWatcher *watcher, const char **paths, int numPaths)
+{
+        if (watcher->fd < 0)
+                return;
+
+        for (int i = 0; i < numPaths && !watcher->overflow; i++)
+        {
+                forEachLibraryDirectoryBelow(paths[i], addWatch, watcher);
+        }
+
+        if (watcher->overflow)
+                stopWatching(watcher);
+}
+
+// Notes which directories had events, so that only those are read again
+static void readEvents(LibraryWatcher *watcher)
+{
+        char buffer[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t length;
+
+        while ((length = read(watcher->fd, buffer, sizeof(buffer))) > 0)
+        {
+                for (char *ptr = buffer; ptr < buffer + length;)
+                {
+                        struct inotify_event *event = (struct inotify_event *)ptr;
+                        ptr += sizeof(struct inotify_event) + event->len;
+
+                        if (event->mask & IN_Q_OVERFLOW)
+                        {
+                                watcher->fullUpdate = true;
+                                continue;
+                        }
+
+                        if (event->wd < 0 || event->wd >= watcher->pathsCapacity || watcher->paths[event->wd] == NULL)
+                                continue;
+
+                        const char *path = watcher->paths[event->wd];
+
+                        if (event->mask & IN_IGNORED)
+                        {
+                                watcher->paths[event->wd] = NULL;
+                                g_hash_table_remove(watcher->watchedPaths, path);
+                                continue;
+                        }
+
+                        // A directory that is deleted or moved is an event in its parent too
+                        if ((event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) == 0 && !g_hash_table_contains(watcher->changed, path))
+                                g_hash_table_add(watcher->changed, g_strdup(path));
+                }
+        }
+}
+
+// Reads again the directories that had events, and watches the directories that are new in them
+static void updateChangedDirectories(LibraryWatcher *watcher)
+{
+        GHashTable *changed = watcher->changed;
+        watcher->changed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+        guint numPaths = 0;
+        const char **paths = (const char **)g_hash_table_get_keys_as_array(changed, &numPaths);
+
+        if (numPaths > 0 && updateLibraryDirectoriesFromDisk(paths, (int)numPaths))
+                updateWatchesBelow(watcher, paths, (int)numPaths);
+
+        g_free(paths);
+        g_hash_table_destroy(changed);
+}
+#endif
+
+// Waits for changes to the library, and then until they stop coming. Returns false when the watcher is stopped.
+static bool waitForChanges(LibraryWatcher *watcher)
+{
+        struct pollfd fds[2];
+        int numFds = 1;
+
+        fds[0].fd = stopPipe[0];
+        fds[0].events = POLLIN;
+
+        if (watcher->fd >= 0)
+        {
+                fds[1].fd = watcher->fd;
+                fds[1].events = POLLIN;
+                numFds = 2;
+        }
+
+        int timeout = watcher->fd >= 0 ? -1 : POLL_INTERVAL_MS;
+        struct timespec start;
+        bool changed = false;
+
+        // Directories left to read again from the last update
+        if (watcher->fd >= 0 && g_hash_table_size(watcher->changed) > 0)
+        {
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                changed = true;
+                timeout = WATCH_DEBOUNCE_MS;
+        }
+
+        while (true)
+        {
+                int ret = poll(fds, numFds, timeout);
+
+                if (ret < 0)
+                {
+                        if (errno == EINTR)
+                                continue;
+                        return false;
+                }
+
+                if (fds[0].revents & POLLIN)
+                        return false;
+
+                // Polling, or quiet for long enough
+                if (ret == 0)
+                        return true;
+
+#ifdef __linux__
+                readEvents(watcher);
+#endif
+
+                if (!changed)
+                {
+                        clock_gettime(CLOCK_MONOTONIC, &start);
+                        changed = true;
+                }
+
+                long remaining = WATCH_MAX_DELAY_MS - (long)getMsSince(&start);
+                if (remaining <= 0)
+                        return true;
+
+                timeout = remaining < WATCH_DEBOUNCE_MS ? (int)remaining : WATCH_DEBOUNCE_MS;
+        }
+}
+
+static void *libraryWatcherThread(void *arg)
+{
+        (void)arg;
+
+        LibraryWatcher watcher = {-1, NULL, 0, NULL, NULL, false, false, false};
+
+        watcher.watchedPaths = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        watcher.changed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+#ifdef __linux__
+        watcher.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        updateWatches(&watcher);
+        watcher.markNewWatches = true;
+#endif
+
+        while (waitForChanges(&watcher))
+        {
+#ifdef __linux__
+                // Only the directories that had events are read, unless events were lost
+                if (watcher.fd >= 0 && !watcher.fullUpdate)
+                {
+                        updateChangedDirectories(&watcher);
+                        continue;
+                }
+
+                watcher.fullUpdate = false;
+                g_hash_table_remove_all(watcher.changed);
+#endif
+
+                // Polling, or after lost events, the mtime of every directory tells what changed
+                if (updateLibraryFromDisk(watchedPath))
+                {
+#ifdef __linux__
+                        updateWatches(&watcher);
+#endif
+                }
+        }
+
+        stopWatching(&watcher);
+
+        g_hash_table_destroy(watcher.watchedPaths);
+        g_hash_table_destroy(watcher.changed);
+
+        return NULL;
+}
+
+void startLibraryWatcher(const char *path)
+{
+        if (watcherRunning || path == NULL || path[0] == '\0')
+                return;
+
+        if (pipe(stopPipe) != 0)
+        {
+                perror("pipe");
+                return;
+        }
+
+        c_strcpy(watchedPath, path, sizeof(watchedPath));
+
+        if (pthread_create(&watcherThread, NULL, libraryWatcherThread, NULL) != 0)
+        {
+                perror("Failed to create library watcher thread");
+                close(stopPipe[0]);
+                close(stopPipe[1]);
+                return;
+        }
+
+        watcherRunning = true;
+}
+
+void stopLibraryWatcher(void)
+{
+        if (!watcherRunning)
+                return;
+
+        char stop = 1;
+        if (write(stopPipe[1], &stop, 1) != 1)
+                perror("write");
+
+        pthread_join(watcherThread, NULL);
+
+        close(stopPipe[0]);
+        close(stopPipe[1]);
+        stopPipe[0] = stopPipe[1] = -1;
+
+        watcherRunning = false;
+}
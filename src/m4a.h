@@ -19,10 +19,22 @@ extern "C"
 #include "../include/minimp4/minimp4.h"
 #include "../include/alac/codec/alac_wrapper.h"
 #include "../include/alac/codec/EndianPortable.h"
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __APPLE__
+#include <sys/mount.h>
+#else
+#include <sys/vfs.h>
+#endif
 
         typedef enum
         {
@@ -33,6 +45,12 @@ extern "C"
                 k_FLAC = 4
         } k_m4adec_filetype;
 
+        typedef struct
+        {
+                ma_int64 offset;
+                uint32_t firstBlock; // In blocks of 1024 frames, counted from the start of the file
+        } m4a_adts_frame;
+
         typedef struct
         {
                 ma_data_source_base ds; // The m4a decoder can be used independently as a data source.
@@ -46,8 +64,9 @@ extern "C"
                 // faad2 related fields...
                 NeAACDecHandle hDecoder;
                 NeAACDecFrameInfo frameInfo;
-                unsigned char *buffer;
+                unsigned char *buffer; // Compressed packets are read into this
                 unsigned int buffer_size;
+                unsigned int maxPacketBytes; // The largest packet in the track, what buffer is sized for
                 ma_uint32 sampleSize;
                 int bitDepth;
                 ma_uint32 sampleRate;
@@ -55,9 +74,16 @@ extern "C"
                 double duration;
                 unsigned long totalFrames;
 
+                // Raw aac: where each ADTS frame starts, so that seeking can go straight to one
+                m4a_adts_frame *adtsFrames;
+                uint32_t adtsFrameCount;
+                ma_uint64 framesToDiscard; // Decoded frames dropped after a seek, to land on the exact frame
+
                 k_m4adec_filetype fileType;
 
                 alac_decoder_t *alacDecoder;
+                int32_t *alacBuffer;
+                uint32_t alacFrameLength;
 
                 // minimp4 fields...
                 MP4D_demux_t mp4;
@@ -68,8 +94,14 @@ extern "C"
 
                 // For m4a_decoder_init_file
                 FILE *file;
+                const uint8_t *map; // The whole file, for local files
+                ma_int64 mapSize;
 
                 ma_uint64 cursor;
+
+                // Decoded frames that didn't fit in the last read, still in the decoder's output buffer
+                const uint8_t *leftoverData;
+                ma_uint64 leftoverFrames;
         } m4a_decoder;
 
 #define FOUR_CHAR_INT(a, b, c, d) (((uint32_t)(a) << 24) | ((b) << 16) | ((c) << 8) | (d))
@@ -95,14 +127,6 @@ extern "C"
 
 #if defined(MINIAUDIO_IMPLEMENTATION) || defined(MA_IMPLEMENTATION)
 
-#define MAX_CHANNELS 2
-#define MAX_SAMPLES 4800 // Maximum expected frame size
-#define MAX_SAMPLE_SIZE 4
-
-        static uint8_t leftoverBuffer[MAX_SAMPLES * MAX_CHANNELS * MAX_SAMPLE_SIZE];
-
-        static ma_uint64 leftoverSampleCount = 0;
-
         ma_result m4a_decoder_ds_read(ma_data_source *pDataSource, void *pFramesOut, ma_uint64 frameCount, ma_uint64 *pFramesRead)
         {
                 return m4a_decoder_read_pcm_frames((m4a_decoder *)pDataSource, pFramesOut, frameCount, pFramesRead);
@@ -164,10 +188,230 @@ extern "C"
                 return MA_SUCCESS;
         }
 
+        // Compressed packets are all read into the same buffer. It is sized for the largest packet in
+        // the track the first time, and only grows again if a packet is bigger than the track said.
+        static ma_result reserve_packet_buffer(m4a_decoder *pM4a, unsigned int bytes)
+        {
+                if (bytes <= pM4a->buffer_size)
+                {
+                        return MA_SUCCESS;
+                }
+
+                if (bytes < pM4a->maxPacketBytes)
+                {
+                        bytes = pM4a->maxPacketBytes;
+                }
+
+                unsigned char *buffer = (unsigned char *)realloc(pM4a->buffer, bytes);
+                if (buffer == NULL)
+                {
+                        return MA_OUT_OF_MEMORY;
+                }
+
+                pM4a->buffer = buffer;
+                pM4a->buffer_size = bytes;
+
+                return MA_SUCCESS;
+        }
+
+        static unsigned int get_max_packet_bytes(const MP4D_track_t *track)
+        {
+                unsigned int maxBytes = 0;
+
+                for (unsigned int i = 0; i < track->sample_count; i++)
+                {
+                        if (track->entry_size[i] > maxBytes)
+                                maxBytes = track->entry_size[i];
+                }
+
+                return maxBytes;
+        }
+
+        // Network filesystems, where touching the mapping can stall on the network or fault if the server goes away
+        static int is_remote_file(int fd)
+        {
+                struct statfs sfs;
+
+                if (fstatfs(fd, &sfs) != 0)
+                {
+                        return 1;
+                }
+
+#ifdef __APPLE__
+                return (sfs.f_flags & MNT_LOCAL) == 0;
+#else
+                static const uint32_t remoteTypes[] = {
+                    0x6969,     // NFS
+                    0x517B,     // SMB
+                    0xFF534D42, // CIFS
+                    0xFE534D42, // SMB2
+                    0x65735546, // FUSE, like sshfs
+                    0x01021997, // 9P
+                    0x00C36400, // Ceph
+                    0x5346414F, // AFS
+                    0x73757245  // Coda
+                };
+
+                for (size_t i = 0; i < sizeof(remoteTypes) / sizeof(remoteTypes[0]); i++)
+                {
+                        if ((uint32_t)sfs.f_type == remoteTypes[i])
+                                return 1;
+                }
+
+                return 0;
+#endif
+        }
+
+        // A mapped file that is truncated while it plays, like when a tag editor saves it in place, raises SIGBUS
+        // where the pages past its new end are touched. Copies out of the mapping are guarded, so they fail instead.
+        static _Thread_local sigjmp_buf *volatile mapReadGuard = NULL;
+        static struct sigaction previousBusAction;
+        static pthread_once_t busHandlerOnce = PTHREAD_ONCE_INIT;
+        static bool busHandlerInstalled = false;
+
+        static void on_bus_error(int sig, siginfo_t *info, void *context)
+        {
+                if (mapReadGuard != NULL)
+                {
+                        siglongjmp(*mapReadGuard, 1);
+                }
+
+                // Not from a guarded copy, so it goes to whoever handled it before
+                if (previousBusAction.sa_flags & SA_SIGINFO)
+                {
+                        previousBusAction.sa_sigaction(sig, info, context);
+                }
+                else if (previousBusAction.sa_handler != SIG_DFL && previousBusAction.sa_handler != SIG_IGN)
+                {
+                        previousBusAction.sa_handler(sig);
+                }
+                else
+                {
+                        // The fault happens again on return, and ends the process as it would have
+                        signal(SIGBUS, SIG_DFL);
+                }
+        }
+
+        static void install_bus_handler(void)
+        {
+                struct sigaction action;
+
+                memset(&action, 0, sizeof(action));
+                sigemptyset(&action.sa_mask);
+                action.sa_sigaction = on_bus_error;
+                action.sa_flags = SA_SIGINFO | SA_NODEFER; // The jump out doesn't restore the signal mask
+
+                busHandlerInstalled = (sigaction(SIGBUS, &action, &previousBusAction) == 0);
+        }
+
+        // Local files are mapped, so that the demuxer and the decoders read them without a syscall for every
+        // box and packet. Anything else, like a pipe or a file on a network filesystem, is read through stdio.
+        static void map_file(m4a_decoder *pM4a, FILE *fp, ma_int64 fileSize)
+        {
+                struct stat st;
+                int fd = fileno(fp);
+
+                pM4a->map = NULL;
+                pM4a->mapSize = 0;
+
+                if (fileSize <= 0 || (uint64_t)fileSize > SIZE_MAX)
+                {
+                        return;
+                }
+
+                pthread_once(&busHandlerOnce, install_bus_handler);
+
+                if (!busHandlerInstalled)
+                {
+                        return;
+                }
+
+                if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || is_remote_file(fd))
+                {
+                        return;
+                }
+
+                void *map = mmap(NULL, (size_t)fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (map == MAP_FAILED)
+                {
+                        return;
+                }
+
+                // Playback reads the packets front to back
+                madvise(map, (size_t)fileSize, MADV_SEQUENTIAL);
+
+                pM4a->map = (const uint8_t *)map;
+                pM4a->mapSize = fileSize;
+        }
+
+        static void unmap_file(m4a_decoder *pM4a)
+        {
+                if (pM4a->map != NULL)
+                {
+                        munmap((void *)pM4a->map, (size_t)pM4a->mapSize);
+                        pM4a->map = NULL;
+                        pM4a->mapSize = 0;
+                }
+        }
+
+        // Copies from the mapping. Fails past its end, or when the file has shrunk under it: the mapping
+        // is then dropped and the file is read through stdio from now on, which ends the track the usual way.
+        static bool copy_from_map(m4a_decoder *pM4a, void *buffer, ma_int64 offset, size_t size)
+        {
+                sigjmp_buf env;
+
+                if (offset < 0 || offset + (ma_int64)size > pM4a->mapSize)
+                {
+                        return false;
+                }
+
+                if (sigsetjmp(env, 0) != 0)
+                {
+                        mapReadGuard = NULL;
+                        unmap_file(pM4a);
+                        return false;
+                }
+
+                // The fences keep the copy between setting the guard and clearing it
+                mapReadGuard = &env;
+                atomic_signal_fence(memory_order_seq_cst);
+                memcpy(buffer, pM4a->map + offset, size);
+                atomic_signal_fence(memory_order_seq_cst);
+                mapReadGuard = NULL;
+
+                return true;
+        }
+
+        // The packet at this offset, read into the packet buffer. From a mapped file that is a copy, not a syscall.
+        static uint8_t *get_packet(m4a_decoder *pM4a, ma_int64 offset, unsigned int bytes)
+        {
+                if (reserve_packet_buffer(pM4a, bytes) != MA_SUCCESS)
+                {
+                        return NULL;
+                }
+
+                if (pM4a->map != NULL)
+                {
+                        return copy_from_map(pM4a, pM4a->buffer, offset, bytes) ? pM4a->buffer : NULL;
+                }
+
+                if (fseeko(pM4a->file, offset, SEEK_SET) != 0 || fread(pM4a->buffer, 1, bytes, pM4a->file) != bytes)
+                {
+                        return NULL;
+                }
+
+                return pM4a->buffer;
+        }
+
         static int minimp4_read_callback(int64_t offset, void *buffer, size_t size, void *token)
         {
                 m4a_decoder *pM4a = (m4a_decoder *)token;
 
+                if (pM4a->map != NULL)
+                {
+                        return copy_from_map(pM4a, buffer, offset, size) ? 0 : 1;
+                }
+
                 // Cast int64_t to ma_int64 for onSeek
                 ma_int64 ma_offset = (ma_int64)offset;
                 if (file_on_seek(pM4a->file, ma_offset, ma_seek_origin_start) != MA_SUCCESS)
@@ -301,6 +545,7 @@ extern "C"
 
                 pM4a->current_sample = 0;
                 pM4a->total_samples = pM4a->track->sample_count;
+                pM4a->maxPacketBytes = get_max_packet_bytes(pM4a->track);
 
                 // Initialize faad2 decoder
                 pM4a->hDecoder = NeAACDecOpen();
@@ -344,53 +589,124 @@ extern "C"
                 NeAACDecSetConfiguration(pM4a->hDecoder, config);
 
                 // Initialize other fields
-                leftoverSampleCount = 0;
+                pM4a->leftoverFrames = 0;
                 pM4a->cursor = 0;
 
                 return MA_SUCCESS;
         }
 
-        double calculate_aac_duration(FILE *fp, unsigned long sampleRate, unsigned long *totalFrames)
+#define ADTS_HEADER_SIZE 7
+#define ADTS_SCAN_BUFFER_SIZE (64 * 1024)
+
+        // Reads every ADTS frame header once, in large chunks, into an index of where each frame starts
+        static ma_result build_adts_index(m4a_decoder *pM4a, FILE *fp, ma_int64 fileSize)
         {
-                if (fp == NULL || sampleRate == 0 || totalFrames == NULL)
+                unsigned char *buffer = malloc(ADTS_SCAN_BUFFER_SIZE);
+                if (buffer == NULL)
                 {
-                        return -1.0;
+                        return MA_OUT_OF_MEMORY;
                 }
 
-                unsigned char buffer[7];
-                unsigned long fileSize = 0;
-                *totalFrames = 0;
+                uint32_t capacity = 0;
+                uint32_t blocks = 0;
+                ma_int64 bufferStart = 0;
+                ma_int64 bufferEnd = 0;
+                ma_int64 pos = 0;
 
-                // Get file size
-                fseek(fp, 0, SEEK_END);
-                fileSize = ftell(fp);
-                fseek(fp, 0, SEEK_SET);
+                pM4a->adtsFrames = NULL;
+                pM4a->adtsFrameCount = 0;
 
-                // Loop to count frames
-                while (ftell(fp) < (long)(fileSize - 7)) // Ensure at least an ADTS header remains
+                while (pos + ADTS_HEADER_SIZE <= fileSize)
                 {
-                        // Read header
-                        if (fread(buffer, 1, 7, fp) < 7)
+                        if (pos + ADTS_HEADER_SIZE > bufferEnd && pM4a->map != NULL)
+                        {
+                                size_t bytesToCopy = (fileSize - pos < ADTS_SCAN_BUFFER_SIZE) ? (size_t)(fileSize - pos) : ADTS_SCAN_BUFFER_SIZE;
+
+                                if (!copy_from_map(pM4a, buffer, pos, bytesToCopy))
+                                        break;
+
+                                bufferStart = pos;
+                                bufferEnd = pos + (ma_int64)bytesToCopy;
+                        }
+                        else if (pos + ADTS_HEADER_SIZE > bufferEnd)
+                        {
+                                if (fseeko(fp, pos, SEEK_SET) != 0)
+                                        break;
+
+                                size_t bytesRead = fread(buffer, 1, ADTS_SCAN_BUFFER_SIZE, fp);
+                                if (bytesRead < ADTS_HEADER_SIZE)
+                                        break;
+
+                                bufferStart = pos;
+                                bufferEnd = pos + (ma_int64)bytesRead;
+                        }
+
+                        const unsigned char *header = buffer + (pos - bufferStart);
+
+                        // Stop at anything that isn't an ADTS frame, like an ID3v1 tag at the end
+                        if (header[0] != 0xFF || (header[1] & 0xF0) != 0xF0)
                                 break;
 
-                        // Extract frame size
-                        unsigned int frameSize = ((buffer[3] & 0x03) << 11) | ((buffer[4] & 0xFF) << 3) | ((buffer[5] & 0xE0) >> 5);
+                        unsigned int frameSize = ((header[3] & 0x03) << 11) | ((header[4] & 0xFF) << 3) | ((header[5] & 0xE0) >> 5);
 
-                        if (frameSize <= 7)
+                        if (frameSize <= ADTS_HEADER_SIZE)
                                 break;
 
-                        // Skip to next frame
-                        fseek(fp, frameSize - 7, SEEK_CUR);
+                        if (pM4a->adtsFrameCount == capacity)
+                        {
+                                uint32_t newCapacity = (capacity > 0) ? capacity * 2 : 4096;
+                                m4a_adts_frame *frames = realloc(pM4a->adtsFrames, newCapacity * sizeof(m4a_adts_frame));
+
+                                if (frames == NULL)
+                                {
+                                        free(buffer);
+                                        free(pM4a->adtsFrames);
+                                        pM4a->adtsFrames = NULL;
+                                        pM4a->adtsFrameCount = 0;
+                                        return MA_OUT_OF_MEMORY;
+                                }
+
+                                pM4a->adtsFrames = frames;
+                                capacity = newCapacity;
+                        }
+
+                        pM4a->adtsFrames[pM4a->adtsFrameCount].offset = pos;
+                        pM4a->adtsFrames[pM4a->adtsFrameCount].firstBlock = blocks;
+                        pM4a->adtsFrameCount++;
 
-                        (*totalFrames)++;
+                        // A frame can hold up to four raw data blocks
+                        blocks += (header[6] & 0x03) + 1;
+                        pos += frameSize;
                 }
 
-                // Compute duration using: duration = (totalFrames * 1024) / sampleRate
-                double duration = (double)(*totalFrames * 1024) / sampleRate;
+                free(buffer);
 
-                fseek(fp, 0, SEEK_SET);
+                pM4a->totalFrames = blocks;
+                pM4a->total_samples = pM4a->adtsFrameCount;
+                pM4a->duration = (pM4a->sampleRate > 0) ? (double)blocks * 1024 / pM4a->sampleRate : 0.0;
+
+                fseeko(fp, 0, SEEK_SET);
+
+                return MA_SUCCESS;
+        }
+
+        // The index of the ADTS frame holding this block
+        static uint32_t find_adts_frame(const m4a_decoder *pM4a, ma_uint64 block)
+        {
+                uint32_t low = 0;
+                uint32_t high = pM4a->adtsFrameCount - 1;
+
+                while (low < high)
+                {
+                        uint32_t mid = low + (high - low + 1) / 2;
 
-                return duration;
+                        if (pM4a->adtsFrames[mid].firstBlock <= block)
+                                low = mid;
+                        else
+                                high = mid - 1;
+                }
+
+                return low;
         }
 
         uint32_t read_u32be(FILE *fp)
@@ -505,19 +821,8 @@ extern "C"
                 return 1;
         }
 
-        MA_API ma_result m4a_decoder_init_file(
-            const char *pFilePath,
-            const ma_decoding_backend_config *pConfig,
-            const ma_allocation_callbacks *pAllocationCallbacks,
-            m4a_decoder *pM4a)
+        static ma_result m4a_decoder_open_file(const char *pFilePath, const ma_decoding_backend_config *pConfig, m4a_decoder *pM4a)
         {
-                (void)pAllocationCallbacks;
-
-                if (pFilePath == NULL || pM4a == NULL)
-                {
-                        return MA_INVALID_ARGS;
-                }
-
                 ma_result result = m4a_decoder_init_internal(pConfig, pM4a);
                 if (result != MA_SUCCESS)
                 {
@@ -553,6 +858,8 @@ extern "C"
                 // Store the FILE pointer in the decoder struct
                 pM4a->file = fp;
 
+                map_file(pM4a, fp, fileSize);
+
                 // Try to detect the file format (ADTS, MP4, LATM, etc.)
                 unsigned char buffer[7];
                 size_t bytesRead = fread(buffer, 1, sizeof(buffer), fp);
@@ -665,11 +972,18 @@ extern "C"
                         pM4a->sampleRate = (ma_uint32)sampleRate;
                         pM4a->channels = (ma_uint32)channels;
 
-                        pM4a->duration = calculate_aac_duration(fp, pM4a->sampleRate, &pM4a->totalFrames);
-
                         // Clean up the frame data after processing
                         free(frameData);
 
+                        pM4a->maxPacketBytes = 8192; // ADTS frames are at most 8191 bytes
+
+                        if (build_adts_index(pM4a, fp, fileSize) != MA_SUCCESS)
+                        {
+                                NeAACDecClose(pM4a->hDecoder);
+                                fclose(fp);
+                                return MA_ERROR;
+                        }
+
                         // Configure output format
                         NeAACDecConfigurationPtr config_ptr = NeAACDecGetCurrentConfiguration(pM4a->hDecoder);
                         if (pM4a->format == ma_format_s16)
@@ -688,13 +1002,15 @@ extern "C"
                         {
                                 // Unsupported format
                                 NeAACDecClose(pM4a->hDecoder);
+                                free(pM4a->adtsFrames);
+                                pM4a->adtsFrames = NULL;
                                 fclose(fp);
                                 return MA_ERROR;
                         }
                         NeAACDecSetConfiguration(pM4a->hDecoder, config_ptr);
 
                         // Initialize other fields
-                        leftoverSampleCount = 0;
+                        pM4a->leftoverFrames = 0;
                         pM4a->cursor = 0;
 
                         fseek(pM4a->file, 0, SEEK_SET);
@@ -727,6 +1043,7 @@ extern "C"
 
                         pM4a->current_sample = 0;
                         pM4a->total_samples = pM4a->track->sample_count;
+                        pM4a->maxPacketBytes = get_max_packet_bytes(pM4a->track);
 
                         uint8_t alac_dsi[32];
                         size_t alac_dsi_size;
@@ -778,7 +1095,21 @@ extern "C"
                                         return MA_ERROR;
                                 }
 
-                                leftoverSampleCount = 0;
+                                pM4a->alacFrameLength = alacConfig.frameLength;
+                                pM4a->alacBuffer = (int32_t *)malloc((size_t)alacConfig.frameLength * pM4a->channels * sizeof(int32_t));
+                                if (pM4a->alacBuffer == NULL)
+                                {
+                                        alac_decoder_free(pM4a->alacDecoder);
+                                        pM4a->alacDecoder = NULL;
+                                        MP4D_close(&pM4a->mp4);
+                                        fclose(fp);
+                                        return MA_ERROR;
+                                }
+
+                                if (alacConfig.maxFrameBytes > pM4a->maxPacketBytes)
+                                        pM4a->maxPacketBytes = alacConfig.maxFrameBytes;
+
+                                pM4a->leftoverFrames = 0;
                                 pM4a->cursor = 0;
 
                                 pM4a->fileType = k_ALAC;
@@ -840,7 +1171,7 @@ extern "C"
                                 NeAACDecSetConfiguration(pM4a->hDecoder, config_ptr);
 
                                 // Initialize other fields
-                                leftoverSampleCount = 0;
+                                pM4a->leftoverFrames = 0;
                                 pM4a->cursor = 0;
 
                                 return MA_SUCCESS;
@@ -848,6 +1179,31 @@ extern "C"
                 }
         }
 
+        MA_API ma_result m4a_decoder_init_file(
+            const char *pFilePath,
+            const ma_decoding_backend_config *pConfig,
+            const ma_allocation_callbacks *pAllocationCallbacks,
+            m4a_decoder *pM4a)
+        {
+                (void)pAllocationCallbacks;
+
+                if (pFilePath == NULL || pM4a == NULL)
+                {
+                        return MA_INVALID_ARGS;
+                }
+
+                ma_result result = m4a_decoder_open_file(pFilePath, pConfig, pM4a);
+
+                // The paths that fail close the file but leave the mapping
+                if (result != MA_SUCCESS)
+                {
+                        unmap_file(pM4a);
+                        pM4a->file = NULL;
+                }
+
+                return result;
+        }
+
         MA_API void m4a_decoder_uninit(m4a_decoder *pM4a, const ma_allocation_callbacks *pAllocationCallbacks)
         {
                 (void)pAllocationCallbacks;
@@ -863,16 +1219,34 @@ extern "C"
                         pM4a->hDecoder = NULL;
                 }
 
+                if (pM4a->adtsFrames != NULL)
+                {
+                        free(pM4a->adtsFrames);
+                        pM4a->adtsFrames = NULL;
+                        pM4a->adtsFrameCount = 0;
+                }
+
                 if (pM4a->fileType != k_rawAAC)
                 {
                         MP4D_close(&pM4a->mp4);
                 }
-                else if (pM4a->fileType == k_ALAC)
+
+                if (pM4a->alacDecoder != NULL)
                 {
                         alac_decoder_free(pM4a->alacDecoder);
                         pM4a->alacDecoder = NULL;
                 }
 
+                free(pM4a->alacBuffer);
+                pM4a->alacBuffer = NULL;
+
+                free(pM4a->buffer);
+                pM4a->buffer = NULL;
+                pM4a->buffer_size = 0;
+                pM4a->leftoverFrames = 0;
+
+                unmap_file(pM4a);
+
                 if (pM4a->file)
                 {
                         fclose(pM4a->file);
@@ -880,6 +1254,21 @@ extern "C"
                 }
         }
 
+        // Copies what fits of a decoded frame to the output and points at the rest. The decoder's own
+        // output buffer stays as it is until the next frame is decoded, so the rest isn't copied aside.
+        static ma_uint64 take_decoded_frames(m4a_decoder *pM4a, const uint8_t *decodedData, ma_uint64 framesDecoded, uint8_t *pFramesOut, ma_uint64 framesWanted)
+        {
+                ma_uint64 frameBytes = (ma_uint64)pM4a->channels * pM4a->sampleSize;
+                ma_uint64 framesToCopy = (framesDecoded < framesWanted) ? framesDecoded : framesWanted;
+
+                memcpy(pFramesOut, decodedData, framesToCopy * frameBytes);
+
+                pM4a->leftoverData = decodedData + framesToCopy * frameBytes;
+                pM4a->leftoverFrames = framesDecoded - framesToCopy;
+
+                return framesToCopy;
+        }
+
         MA_API ma_result m4a_decoder_read_pcm_frames(
             m4a_decoder *pM4a,
             void *pFramesOut,
@@ -894,24 +1283,19 @@ extern "C"
                 ma_result result = MA_SUCCESS;
                 ma_uint32 channels = pM4a->channels;
                 ma_uint32 sampleSize = pM4a->sampleSize;
+                ma_uint64 frameBytes = (ma_uint64)channels * sampleSize;
                 ma_uint64 totalFramesProcessed = 0;
 
-                // Handle any leftover samples from previous call using the global/static leftover buffer
-                if (leftoverSampleCount > 0)
+                // Handle any frames left over from the previous call
+                if (pM4a->leftoverFrames > 0)
                 {
-                        ma_uint64 leftoverToProcess = (leftoverSampleCount < frameCount) ? leftoverSampleCount : frameCount;
-                        ma_uint64 leftoverBytes = leftoverToProcess * channels * sampleSize;
+                        ma_uint64 leftoverToProcess = (pM4a->leftoverFrames < frameCount) ? pM4a->leftoverFrames : frameCount;
 
-                        memcpy(pFramesOut, leftoverBuffer, leftoverBytes);
+                        memcpy(pFramesOut, pM4a->leftoverData, leftoverToProcess * frameBytes);
                         totalFramesProcessed += leftoverToProcess;
 
-                        // Shift the leftover buffer
-                        ma_uint64 samplesLeft = leftoverSampleCount - leftoverToProcess;
-                        if (samplesLeft > 0)
-                        {
-                                memmove(leftoverBuffer, leftoverBuffer + leftoverBytes, samplesLeft * channels * sampleSize);
-                        }
-                        leftoverSampleCount = samplesLeft;
+                        pM4a->leftoverData += leftoverToProcess * frameBytes;
+                        pM4a->leftoverFrames -= leftoverToProcess;
                 }
 
                 while (totalFramesProcessed < frameCount)
@@ -919,40 +1303,33 @@ extern "C"
                         if (pM4a->fileType == k_rawAAC)
                         {
                                 unsigned int headerSize = 7;
-                                uint8_t buffer[headerSize];
 
-                                if (fread(buffer, 1, headerSize, pM4a->file) != headerSize)
+                                if (pM4a->current_sample >= pM4a->adtsFrameCount)
                                 {
-                                        result = MA_ERROR;
+                                        result = MA_AT_END;
                                         break;
                                 }
 
-                                unsigned int frame_bytes = ((buffer[3] & 0x03) << 11) | ((buffer[4] & 0xFF) << 3) | ((buffer[5] & 0xE0) >> 5);
+                                ma_int64 frame_offset = pM4a->adtsFrames[pM4a->current_sample].offset;
 
-                                if (frame_bytes < headerSize || frame_bytes > 8192)
+                                uint8_t *header = get_packet(pM4a, frame_offset, headerSize);
+                                if (header == NULL)
                                 {
                                         result = MA_ERROR;
                                         break;
                                 }
 
-                                // Allocate memory for the frame
-                                unsigned char *sample_data = (unsigned char *)malloc(frame_bytes);
-                                if (!sample_data)
+                                unsigned int frame_bytes = ((header[3] & 0x03) << 11) | ((header[4] & 0xFF) << 3) | ((header[5] & 0xE0) >> 5);
+
+                                if (frame_bytes < headerSize || frame_bytes > 8192)
                                 {
-                                        result = MA_OUT_OF_MEMORY;
+                                        result = MA_ERROR;
                                         break;
                                 }
 
-                                // Copy the header to the sample_data buffer
-                                memcpy(sample_data, buffer, headerSize);
-
-                                // Read the rest of the frame (audio data)
-                                size_t remaining_bytes = frame_bytes - headerSize;
-                                size_t additionalBytesRead = fread(sample_data + headerSize, 1, remaining_bytes, pM4a->file);
-
-                                if (additionalBytesRead < remaining_bytes)
+                                uint8_t *frame = get_packet(pM4a, frame_offset, frame_bytes);
+                                if (frame == NULL)
                                 {
-                                        free(sample_data);
                                         result = MA_ERROR;
                                         break; // Failed to read full frame
                                 }
@@ -960,8 +1337,7 @@ extern "C"
                                 pM4a->current_sample++;
 
                                 // Decode the AAC frame using faad2
-                                void *decodedData = NeAACDecDecode(pM4a->hDecoder, &(pM4a->frameInfo), sample_data + 7, frame_bytes - 7);
-                                free(sample_data);
+                                uint8_t *decodedData = NeAACDecDecode(pM4a->hDecoder, &(pM4a->frameInfo), frame + 7, frame_bytes - 7);
 
                                 if (pM4a->frameInfo.error > 0)
                                 {
@@ -979,40 +1355,22 @@ extern "C"
                                 unsigned long samplesDecoded = pM4a->frameInfo.samples; // Total samples decoded (channels * frames)
                                 ma_uint64 framesDecoded = samplesDecoded / channels;
 
-                                // Calculate how many frames we can process in this call
-                                ma_uint64 framesNeeded = frameCount - totalFramesProcessed;
-                                ma_uint64 framesToCopy = (framesDecoded < framesNeeded) ? framesDecoded : framesNeeded;
-                                ma_uint64 bytesToCopy = framesToCopy * channels * sampleSize;
-
-                                memcpy((uint8_t *)pFramesOut + totalFramesProcessed * channels * sampleSize, decodedData, bytesToCopy);
-                                totalFramesProcessed += framesToCopy;
-
-                                // Handle leftover frames using the global/static leftover buffer
-                                if (framesToCopy < framesDecoded)
-                                {
-                                        // There are leftover frames
-                                        leftoverSampleCount = framesDecoded - framesToCopy;
-                                        ma_uint64 leftoverBytes = leftoverSampleCount * channels * sampleSize;
-
-                                        if (leftoverBytes > sizeof(leftoverBuffer))
-                                        {
-                                                // Safety check to avoid overflow in the buffer.
-                                                leftoverSampleCount = sizeof(leftoverBuffer) / (channels * sampleSize);
-                                                leftoverBytes = leftoverSampleCount * channels * sampleSize;
-                                        }
-
-                                        memcpy(leftoverBuffer, (uint8_t *)decodedData + bytesToCopy, leftoverBytes);
-                                }
-                                else
+                                // After a seek, the frames before the one sought to are dropped
+                                if (pM4a->framesToDiscard > 0 && framesDecoded > 0)
                                 {
-                                        leftoverSampleCount = 0;
+                                        ma_uint64 framesToDrop = (pM4a->framesToDiscard < framesDecoded) ? pM4a->framesToDiscard : framesDecoded;
+
+                                        decodedData += framesToDrop * frameBytes;
+                                        framesDecoded -= framesToDrop;
+                                        pM4a->framesToDiscard -= framesToDrop;
                                 }
+
+                                totalFramesProcessed += take_decoded_frames(pM4a, decodedData, framesDecoded,
+                                                                            (uint8_t *)pFramesOut + totalFramesProcessed * frameBytes,
+                                                                            frameCount - totalFramesProcessed);
                         }
                         else if (pM4a->fileType == k_ALAC)
                         {
-                                unsigned channels = pM4a->channels;
-                                unsigned sampleSize = pM4a->sampleSize;
-
                                 if (pM4a->current_sample >= pM4a->total_samples)
                                 {
                                         result = MA_AT_END;
@@ -1033,80 +1391,32 @@ extern "C"
                                         result = MA_ERROR;
                                         break;
                                 }
-                                uint8_t *sample_data = (uint8_t *)malloc(frame_bytes);
-                                if (!sample_data)
-                                {
-                                        result = MA_OUT_OF_MEMORY;
-                                        break;
-                                }
 
-                                // Ensure sample_data is aligned on a 2-byte boundary
-                                uintptr_t ptr = (uintptr_t)sample_data;
-                                if ((ptr % sizeof(uint8_t)) != 0)
+                                uint8_t *packet = get_packet(pM4a, sample_offset, frame_bytes);
+                                if (packet == NULL || pM4a->alacBuffer == NULL)
                                 {
-                                        free(sample_data);
                                         result = MA_ERROR;
                                         break;
                                 }
 
-                                if (fseek(pM4a->file, sample_offset, SEEK_SET) != 0 ||
-                                    fread(sample_data, 1, frame_bytes, pM4a->file) != frame_bytes)
-                                {
-                                        free(sample_data);
-                                        result = MA_ERROR;
-                                        break;
-                                }
-
-                                static int32_t decodedBuffer[8192] = {0};
                                 uint32_t samplesDecodedPerChannel;
 
                                 int alac_ret = alac_decoder_decode(
                                     pM4a->alacDecoder,
-                                    sample_data,
+                                    packet,
                                     frame_bytes,
-                                    decodedBuffer,
+                                    pM4a->alacBuffer,
                                     &samplesDecodedPerChannel);
 
-                                free(sample_data);
-
-                                if (alac_ret != 0 || samplesDecodedPerChannel == 0)
+                                if (alac_ret != 0 || samplesDecodedPerChannel == 0 || samplesDecodedPerChannel > pM4a->alacFrameLength)
                                 {
                                         result = MA_ERROR;
                                         break;
                                 }
 
-                                ma_uint64 framesDecoded = samplesDecodedPerChannel;
-                                ma_uint64 framesNeeded = frameCount - totalFramesProcessed;
-                                ma_uint64 framesToCopy = framesDecoded < framesNeeded ? framesDecoded : framesNeeded;
-                                ma_uint64 bytesToCopy = framesToCopy * channels * sampleSize;
-
-                                memcpy((uint8_t *)pFramesOut + totalFramesProcessed * channels * sampleSize,
-                                       decodedBuffer,
-                                       bytesToCopy);
-
-                                totalFramesProcessed += framesToCopy;
-
-                                leftoverSampleCount -= framesToCopy;
-
-                                if (framesToCopy < framesDecoded)
-                                {
-                                        // There are leftover frames
-                                        leftoverSampleCount = framesDecoded - framesToCopy;
-                                        ma_uint64 leftoverBytes = leftoverSampleCount * channels * sampleSize;
-
-                                        if (leftoverBytes > sizeof(leftoverBuffer))
-                                        {
-                                                // Safety check to avoid overflow in the buffer.
-                                                leftoverSampleCount = sizeof(leftoverBuffer) / (channels * sampleSize);
-                                                leftoverBytes = leftoverSampleCount * channels * sampleSize;
-                                        }
-
-                                        memcpy(leftoverBuffer, (uint8_t *)decodedBuffer + bytesToCopy, leftoverBytes);
-                                }
-                                else
-                                {
-                                        leftoverSampleCount = 0;
-                                }
+                                totalFramesProcessed += take_decoded_frames(pM4a, (const uint8_t *)pM4a->alacBuffer, samplesDecodedPerChannel,
+                                                                            (uint8_t *)pFramesOut + totalFramesProcessed * frameBytes,
+                                                                            frameCount - totalFramesProcessed);
 
                                 pM4a->current_sample++;
 
@@ -1147,19 +1457,9 @@ extern "C"
                                         break;
                                 }
 
-                                // Allocate buffer for the sample data
-                                uint8_t *sample_data = (uint8_t *)malloc(frame_bytes);
-                                if (sample_data == NULL)
+                                uint8_t *packet = get_packet(pM4a, sample_offset, frame_bytes);
+                                if (packet == NULL)
                                 {
-                                        result = MA_OUT_OF_MEMORY;
-                                        break;
-                                }
-
-                                // Read the sample data directly from the file
-                                size_t bytesRead = 0;
-                                if (file_on_read(pM4a->file, sample_data, frame_bytes, &bytesRead) != MA_SUCCESS || bytesRead != frame_bytes)
-                                {
-                                        free(sample_data);
                                         result = MA_ERROR;
                                         break;
                                 }
@@ -1167,9 +1467,7 @@ extern "C"
                                 pM4a->current_sample++;
 
                                 // Decode the AAC frame using faad2
-                                void *decodedData = NeAACDecDecode(pM4a->hDecoder, &(pM4a->frameInfo), sample_data, frame_bytes);
-
-                                free(sample_data); // Free the sample data buffer
+                                uint8_t *decodedData = NeAACDecDecode(pM4a->hDecoder, &(pM4a->frameInfo), packet, frame_bytes);
 
                                 if (pM4a->frameInfo.error > 0)
                                 {
@@ -1185,36 +1483,10 @@ extern "C"
                                 }
 
                                 unsigned long samplesDecoded = pM4a->frameInfo.samples; // Total samples decoded (channels * frames)
-                                ma_uint64 framesDecoded = samplesDecoded / channels;
-
-                                // Calculate how many frames we can process in this call
-                                ma_uint64 framesNeeded = frameCount - totalFramesProcessed;
-                                ma_uint64 framesToCopy = (framesDecoded < framesNeeded) ? framesDecoded : framesNeeded;
-                                ma_uint64 bytesToCopy = framesToCopy * channels * sampleSize;
-
-                                memcpy((uint8_t *)pFramesOut + totalFramesProcessed * channels * sampleSize, decodedData, bytesToCopy);
-                                totalFramesProcessed += framesToCopy;
 
-                                // Handle leftover frames using the global/static leftover buffer
-                                if (framesToCopy < framesDecoded)
-                                {
-                                        // There are leftover frames
-                                        leftoverSampleCount = framesDecoded - framesToCopy;
-                                        ma_uint64 leftoverBytes = leftoverSampleCount * channels * sampleSize;
-
-                                        if (leftoverBytes > sizeof(leftoverBuffer))
-                                        {
-                                                // Safety check to avoid overflow in the buffer.
-                                                leftoverSampleCount = sizeof(leftoverBuffer) / (channels * sampleSize);
-                                                leftoverBytes = leftoverSampleCount * channels * sampleSize;
-                                        }
-
-                                        memcpy(leftoverBuffer, (uint8_t *)decodedData + bytesToCopy, leftoverBytes);
-                                }
-                                else
-                                {
-                                        leftoverSampleCount = 0;
-                                }
+                                totalFramesProcessed += take_decoded_frames(pM4a, decodedData, samplesDecoded / channels,
+                                                                            (uint8_t *)pFramesOut + totalFramesProcessed * frameBytes,
+                                                                            frameCount - totalFramesProcessed);
                         }
                 }
 
@@ -1228,21 +1500,52 @@ extern "C"
                 return (totalFramesProcessed > 0) ? MA_SUCCESS : result;
         }
 
+        // Raw aac seeks by pcm frame. faad2 outputs nothing for the first frame it decodes and the
+        // output of every other frame starts a block behind it, so decoding starts at the frame holding
+        // the wanted block, and what comes before the wanted pcm frame is dropped.
+        static ma_result seek_adts(m4a_decoder *pM4a, ma_uint64 frameIndex)
+        {
+                if (pM4a->adtsFrameCount == 0 || pM4a->totalFrames == 0)
+                        return MA_ERROR;
+
+                if (frameIndex >= (ma_uint64)(pM4a->totalFrames - 1) * 1024)
+                        return MA_INVALID_ARGS;
+
+                uint32_t frame = find_adts_frame(pM4a, frameIndex / 1024);
+
+                if (file_on_seek(pM4a->file, pM4a->adtsFrames[frame].offset, ma_seek_origin_start) != MA_SUCCESS)
+                {
+                        return MA_ERROR;
+                }
+
+                NeAACDecPostSeekReset(pM4a->hDecoder, (long)frame);
+
+                ma_uint64 outputStart = (frame > 0) ? (ma_uint64)(pM4a->adtsFrames[frame].firstBlock - 1) * 1024 : 0;
+
+                pM4a->framesToDiscard = frameIndex - outputStart;
+                pM4a->current_sample = frame;
+                pM4a->leftoverFrames = 0;
+                pM4a->cursor = frameIndex;
+
+                return MA_SUCCESS;
+        }
+
         MA_API ma_result m4a_decoder_seek_to_pcm_frame(m4a_decoder *pM4a, ma_uint64 frameIndex)
         {
                 if (pM4a == NULL)
                         return MA_INVALID_ARGS;
 
+                if (pM4a->fileType == k_rawAAC)
+                {
+                        return seek_adts(pM4a, frameIndex);
+                }
+
                 if (frameIndex >= pM4a->total_samples)
                         return MA_INVALID_ARGS;
 
                 pM4a->current_sample = (uint32_t)frameIndex;
 
-                if (pM4a->fileType == k_rawAAC)
-                {
-                        return MA_ERROR;
-                }
-                else if (pM4a->fileType == k_ALAC)
+                if (pM4a->fileType == k_ALAC)
                 {
                         unsigned int frame_bytes = 0;
                         unsigned int timestamp = 0;
@@ -1266,7 +1569,7 @@ extern "C"
                                 return MA_ERROR;
                         }
 
-                        leftoverSampleCount = 0;
+                        pM4a->leftoverFrames = 0;
 
                         pM4a->cursor = frameIndex;
 
@@ -1298,7 +1601,7 @@ extern "C"
 
                         NeAACDecPostSeekReset(pM4a->hDecoder, (long)pM4a->current_sample);
 
-                        leftoverSampleCount = 0;
+                        pM4a->leftoverFrames = 0;
                         pM4a->cursor = frameIndex;
 
                         return MA_SUCCESS;
@@ -1396,7 +1699,22 @@ extern "C"
 
                 *pLength = 0; // Safety.
 
-                if (pM4a == NULL || pM4a->track == NULL)
+                if (pM4a == NULL)
+                {
+                        return MA_INVALID_ARGS;
+                }
+
+                // Raw aac is in pcm frames, without the first block that faad2 doesn't output
+                if (pM4a->fileType == k_rawAAC)
+                {
+                        if (pM4a->totalFrames <= 1)
+                                return MA_ERROR;
+
+                        *pLength = (ma_uint64)(pM4a->totalFrames - 1) * 1024;
+                        return MA_SUCCESS;
+                }
+
+                if (pM4a->track == NULL)
                 {
                         return MA_INVALID_ARGS;
                 }
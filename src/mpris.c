@@ -419,6 +419,9 @@ static void handle_method_call(GDBusConnection *connection, const gchar *sender,
                                                            "org.freedesktop.DBus.Error.UnknownMethod",
                                                            "No such method");
         }
+
+        // The main loop shows what changed
+        wakeMainLoop();
 }
 #endif
 
@@ -554,7 +557,7 @@ static gboolean get_metadata(GDBusConnection *connection, const gchar *sender,
                         artistList[1] = NULL;
                 }
 
-                gchar *coverArtUrl = g_strdup_printf("file://%s", currentSongData->coverArtPath);
+                gchar *coverArtUrl = g_strdup_printf("file://%s", getCoverArtPath(currentSongData));
 
                 g_variant_builder_add(&metadata_builder, "{sv}", "xesam:artist", g_variant_new_strv(artistList, -1));
                 g_variant_builder_add(&metadata_builder, "{sv}", "xesam:album", g_variant_new_string(currentSongData->metadata->album));
@@ -888,6 +891,9 @@ static gboolean set_property_callback(GDBusConnection *connection, const gchar *
 
         if (g_strcmp0(interface_name, "org.mpris.MediaPlayer2.Player") == 0)
         {
+                // The main loop shows what changed
+                wakeMainLoop();
+
                 if (g_strcmp0(property_name, "PlaybackStatus") == 0)
                 {
                         g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Setting PlaybackStatus property not supported");
@@ -55,6 +55,17 @@ int libCurrentDirSongCount = 0;
 
 PixelData lastRowColor = {120, 120, 120};
 
+// The title being typed out in track view. Animations move on with each frame that is drawn, instead
+// of the main loop waiting for them.
+static char titleText[METADATA_MAX_LENGTH];
+static int titleDelay = 0;
+static int titleMaxWidth = 0;
+static bool titleAnimating = false;
+static struct timespec titleStart;
+
+static bool glimmering = false;
+static int glimmerIndex = 0; // The character of the last row the bright spot is on, it moves one with each frame
+
 const char LIBRARY_FILE[] = "kewlibrary";
 
 FileSystemEntry *currentEntry = NULL;
@@ -170,20 +181,20 @@ int printLogo(SongData *songData, UISettings *ui)
         if (!ui->hideLogo)
         {
                 printBlankSpaces(indent);
-                printf(" __\n");
+                screenPrintf(" __\n");
                 printBlankSpaces(indent);
-                printf("|  |--.-----.--.--.--.\n");
+                screenPrintf("|  |--.-----.--.--.--.\n");
                 printBlankSpaces(indent);
-                printf("|    <|  -__|  |  |  |\n");
+                screenPrintf("|    <|  -__|  |  |  |\n");
                 printBlankSpaces(indent);
-                printf("|__|__|_____|________|");
+                screenPrintf("|__|__|_____|________|");
 
                 logoWidth = 22;
                 height += 3;
         }
         else
         {
-                printf("\n");
+                screenPrintf("\n");
                 height += 1;
         }
 
@@ -213,7 +224,7 @@ int printLogo(SongData *songData, UISettings *ui)
                 if (ui->useConfigColors)
                         setTextColor(ui->titleColor);
 
-                printf(" %s\n\n", title);
+                screenPrintf(" %s\n\n", title);
                 height += 2;
         }
         else if (isRadioPlaying())
@@ -235,18 +246,18 @@ int printLogo(SongData *songData, UISettings *ui)
                         if (ui->useConfigColors)
                                 setTextColor(ui->titleColor);
 
-                        printf(" %s\n\n", title);
+                        screenPrintf(" %s\n\n", title);
                         height += 2;
                 }
                 else
                 {
-                        printf("\n\n");
+                        screenPrintf("\n\n");
                         height += 2;
                 }
         }
         else
         {
-                printf("\n\n");
+                screenPrintf("\n\n");
                 height += 2;
         }
 
@@ -270,55 +281,113 @@ void printCover(SongData *songdata, UISettings *ui)
 
         if (songdata != NULL && songdata->cover != NULL && ui->coverEnabled)
         {
-                if (!ui->coverAnsi)
-                {
-                        printSquareBitmapCentered(songdata->cover, songdata->coverWidth, songdata->coverHeight, preferredHeight);
-                }
-                else
-                {
-                        printInAscii(songdata->coverArtPath, preferredHeight);
-                }
+                GString *output = getCoverRender(&(songdata->coverRender), songdata->cover, songdata->coverWidth, songdata->coverHeight,
+                                                  preferredHeight, ui->coverAnsi);
+
+                screenWrite(output->str, output->len);
         }
         else
         {
                 for (int i = 0; i <= preferredHeight; ++i)
                 {
-                        printf("\n");
+                        screenPrintf("\n");
                 }
         }
 
-        printf("\n\n");
+        screenPrintf("\n\n");
 }
 
-void printTitleWithDelay(const char *text, int delay, int maxWidth)
+static int getTitleLength(void)
 {
-        int max = strnlen(text, maxWidth);
+        int max = strnlen(titleText, titleMaxWidth);
 
-        if (max == maxWidth) // For long names
-                max -= 2;    // Accommodate for the cursor that we display after the name.
+        if (max == titleMaxWidth) // For long names
+                max -= 2;         // Accommodate for the cursor that we display after the name.
 
-        for (int i = 0; i <= max && delay; i++)
+        return max;
+}
+
+// One character per delay, then the cursor stays after the name for twenty more
+static bool isTitleAnimating(void)
+{
+        return titleAnimating && getMsSince(&titleStart) < (getTitleLength() + 21) * (double)titleDelay;
+}
+
+// Prints the title the way it is at this point of the animation
+static void printTitleFrame(void)
+{
+        int max = getTitleLength();
+
+        if (isTitleAnimating())
         {
-                printf("\r ");
-                printBlankSpaces(indent);
-                for (int j = 0; j < i; j++)
-                {
-                        printf("%c", text[j]);
-                }
-                printf("█");
-                fflush(stdout);
+                int shown = (int)(getMsSince(&titleStart) / titleDelay);
+
+                if (shown > max)
+                        shown = max;
+
+                // Not in the middle of a character
+                while (shown < max && (titleText[shown] & 0xC0) == 0x80)
+                        shown++;
 
-                c_sleep(delay);
+                screenPrintf("\r ");
+                printBlankSpaces(indent);
+                screenPrintf("%.*s█", shown, titleText);
+                return;
         }
-        if (delay)
-                c_sleep(delay * 20);
 
-        printf("\r");
-        printf("\033[K");
+        titleAnimating = false;
+
+        screenPrintf("\r");
+        screenPrintf("\033[K");
         printBlankSpaces(indent);
-        printf("\033[1K %.*s", maxWidth, text);
-        printf("\n");
-        fflush(stdout);
+        screenPrintf("\033[1K %.*s", titleMaxWidth, titleText);
+}
+
+void printTitleWithDelay(const char *text, int delay, int maxWidth)
+{
+        c_strcpy(titleText, text, sizeof(titleText));
+        titleDelay = delay;
+        titleMaxWidth = maxWidth;
+        titleAnimating = (delay > 0);
+        clock_gettime(CLOCK_MONOTONIC, &titleStart);
+
+        printTitleFrame();
+        screenPrintf("\n");
+}
+
+void setTitleColor(UISettings *ui)
+{
+        PixelData pixel = increaseLuminosity(ui->color, 20);
+
+        if (ui->useConfigColors)
+        {
+                setDefaultTextColor();
+        }
+        else if (pixel.r == 255 && pixel.g == 255 && pixel.b == 255)
+        {
+                PixelData gray;
+                gray.r = defaultColor;
+                gray.g = defaultColor;
+                gray.b = defaultColor;
+                screenPrintf("\033[1;38;2;%03u;%03u;%03um", gray.r, gray.g, gray.b);
+        }
+        else
+        {
+                screenPrintf("\033[1;38;2;%03u;%03u;%03um", pixel.r, pixel.g, pixel.b);
+        }
+}
+
+// Moves the title animation on, with the cursor at the row of the time, as it is between redraws of the track view
+void updateTitle(UISettings *ui)
+{
+        if (!titleAnimating)
+                return;
+
+        screenPrintf("\033[s");
+        cursorJump(4);
+        setTitleColor(ui);
+        printTitleFrame();
+        screenPrintf("\033[u");
 }
 
 void printBasicMetadata(TagSettings const *metadata, UISettings *ui)
@@ -326,66 +395,50 @@ void printBasicMetadata(TagSettings const *metadata, UISettings *ui)
         int term_w, term_h;
         getTermSize(&term_w, &term_h);
         int maxWidth = textWidth; // term_w - 3 - (indent * 2);
-        printf("\n");
+        titleAnimating = false;
+        screenPrintf("\n");
 
         if (strnlen(metadata->artist, METADATA_MAX_LENGTH) > 0)
         {
                 printBlankSpaces(indent);
-                printf(" %.*s\n", maxWidth, metadata->artist);
+                screenPrintf(" %.*s\n", maxWidth, metadata->artist);
         }
         else
         {
-                printf("\n");
+                screenPrintf("\n");
         }
         if (strnlen(metadata->album, METADATA_MAX_LENGTH) > 0)
         {
                 printBlankSpaces(indent);
-                printf(" %.*s\n", maxWidth, metadata->album);
+                screenPrintf(" %.*s\n", maxWidth, metadata->album);
         }
         else
         {
-                printf("\n");
+                screenPrintf("\n");
         }
         if (strnlen(metadata->date, METADATA_MAX_LENGTH) > 0)
         {
                 printBlankSpaces(indent);
                 int year = getYear(metadata->date);
                 if (year == -1)
-                        printf(" %s\n", metadata->date);
+                        screenPrintf(" %s\n", metadata->date);
                 else
-                        printf(" %d\n", year);
+                        screenPrintf(" %d\n", year);
         }
         else
         {
-                printf("\n");
+                screenPrintf("\n");
         }
         cursorJump(4);
         if (strnlen(metadata->title, METADATA_MAX_LENGTH) > 0)
         {
-                PixelData pixel = increaseLuminosity(ui->color, 20);
-
-                if (ui->useConfigColors)
-                {
-                        setDefaultTextColor();
-                }
-                else if (pixel.r == 255 && pixel.g == 255 && pixel.b == 255)
-                {
-                        PixelData gray;
-                        gray.r = defaultColor;
-                        gray.g = defaultColor;
-                        gray.b = defaultColor;
-                        printf("\033[1;38;2;%03u;%03u;%03um", gray.r, gray.g, gray.b);
-                }
-                else
-                {
-                        printf("\033[1;38;2;%03u;%03u;%03um", pixel.r, pixel.g, pixel.b);
-                }
+                setTitleColor(ui);
 
                 printTitleWithDelay(metadata->title, ui->titleDelay, maxWidth);
         }
         else
         {
-                printf("\n");
+                screenPrintf("\n");
         }
         cursorJumpDown(3);
 }
@@ -408,7 +461,7 @@ void printProgress(double elapsed_seconds, double total_seconds)
                 return;
 
         // Save the current cursor position
-        printf("\033[s");
+        screenPrintf("\033[s");
 
         int elapsed_hours = (int)(elapsed_seconds / 3600);
         int elapsed_minutes = (int)(((int)elapsed_seconds / 60) % 60);
@@ -422,17 +475,17 @@ void printProgress(double elapsed_seconds, double total_seconds)
         int vol = getCurrentVolume();
 
         // Clear the current line
-        printf("\r\033[K");
+        screenPrintf("\r\033[K");
 
         printBlankSpaces(indent);
 
-        printf(" %02d:%02d:%02d / %02d:%02d:%02d (%d%%) Vol:%d%%",
+        screenPrintf(" %02d:%02d:%02d / %02d:%02d:%02d (%d%%) Vol:%d%%",
                elapsed_hours, elapsed_minutes, elapsed_seconds_remainder,
                total_hours, total_minutes, total_seconds_remainder,
                progress_percentage, vol);
 
         // Restore the cursor position
-        printf("\033[u");
+        screenPrintf("\033[u");
 }
 
 void printMetadata(TagSettings const *metadata, UISettings *ui)
@@ -440,9 +493,6 @@ void printMetadata(TagSettings const *metadata, UISettings *ui)
         if (appState.currentView == LIBRARY_VIEW || appState.currentView == PLAYLIST_VIEW || appState.currentView == SEARCH_VIEW)
                 return;
 
-        if (ui->titleDelay)
-                c_sleep(100);
-
         if (ui->useConfigColors)
                 setDefaultTextColor();
         else
@@ -506,43 +556,41 @@ void calcIndent(SongData *songdata)
 
 void printGlimmeringText(char *text, int textLength, char *nerdFontText, PixelData color)
 {
-        int brightIndex = 0;
+        int brightIndex = glimmerIndex++;
         PixelData vbright = increaseLuminosity(color, 120);
         PixelData bright = increaseLuminosity(color, 60);
 
+        if (brightIndex >= textLength)
+                glimmering = false;
+
         printBlankSpaces(calcIndentNormal());
 
-        while (brightIndex < textLength)
+        for (int i = 0; i < textLength; i++)
         {
-                for (int i = 0; i < textLength; i++)
+                if (i == brightIndex)
                 {
-                        if (i == brightIndex)
-                        {
-                                setTextColorRGB(vbright.r, vbright.g, vbright.b);
-                                printf("%c", text[i]);
-                        }
-                        else if (i == brightIndex - 1 || i == brightIndex + 1)
-                        {
-                                setTextColorRGB(bright.r, bright.g, bright.b);
-                                printf("%c", text[i]);
-                        }
-                        else
-                        {
-                                setTextColorRGB(color.r, color.g, color.b);
-                                printf("%c", text[i]);
-                        }
-
-                        fflush(stdout);
-                        c_usleep(50);
+                        setTextColorRGB(vbright.r, vbright.g, vbright.b);
+                        screenPrintf("%c", text[i]);
+                }
+                else if (i == brightIndex - 1 || i == brightIndex + 1)
+                {
+                        setTextColorRGB(bright.r, bright.g, bright.b);
+                        screenPrintf("%c", text[i]);
+                }
+                else
+                {
+                        setTextColorRGB(color.r, color.g, color.b);
+                        screenPrintf("%c", text[i]);
                 }
-                printf("%s", nerdFontText);
-                fflush(stdout);
-                c_usleep(50);
-
-                brightIndex++;
-                printf("\r");
-                printBlankSpaces(indent);
         }
+
+        setTextColorRGB(color.r, color.g, color.b);
+        screenPrintf("%s", nerdFontText);
+}
+
+bool isAnimating(void)
+{
+        return isTitleAnimating() || glimmering;
 }
 
 void printErrorRow(void)
@@ -554,12 +602,12 @@ void printErrorRow(void)
 
 #ifndef __APPLE__
         // Move to next to lastRow
-        printf("\033[%d;1H", term_h - 1);
+        screenPrintf("\033[%d;1H", term_h - 1);
 #endif
 
         if (term_w < ABSOLUTE_MIN_WIDTH)
         {
-                printf("\n");
+                screenPrintf("\n");
                 return;
         }
 
@@ -567,13 +615,12 @@ void printErrorRow(void)
         {
                 setTextColorRGB(lastRowColor.r, lastRowColor.g, lastRowColor.b);
                 printBlankSpaces(indent);
-                printf(" %s\n", getErrorMessage());
+                screenPrintf(" %s\n", getErrorMessage());
                 hasPrintedError = true;
-                fflush(stdout);
         }
         else
         {
-                printf("\n");
+                screenPrintf("\n");
         }
 }
 
@@ -590,7 +637,7 @@ void printLastRow(UISettings *ui)
 
 #ifndef __APPLE__
         // Move to lastRow
-        printf("\033[%d;1H", term_h);
+        screenPrintf("\033[%d;1H", term_h);
 #endif
 
         setTextColorRGB(lastRowColor.r, lastRowColor.g, lastRowColor.b);
@@ -603,7 +650,7 @@ void printLastRow(UISettings *ui)
 
         char nerdFontText[100] = "";
 
-        printf("\r");
+        screenPrintf("\r");
 
         size_t maxLength = sizeof(nerdFontText);
 
@@ -662,19 +709,32 @@ void printLastRow(UISettings *ui)
                 currentLength += strnlen(rewindText, maxLength - currentLength);
         }
 
-        printf("\033[K"); // Clear the line
+        screenPrintf("\033[K"); // Clear the line
 
         int indent = calcIndentNormal();
         int textLength = strnlen(text, 100);
         int randomNumber = getRandomNumber(1, 808);
 
-        if (randomNumber == 808 && !ui->hideGlimmeringText)
+#ifdef __APPLE__
+        // Only the track view prints the last row again with every frame there
+        bool canGlimmer = appState.currentView == TRACK_VIEW;
+#else
+        bool canGlimmer = true;
+#endif
+
+        if (!glimmering && randomNumber == 808 && !ui->hideGlimmeringText && canGlimmer)
+        {
+                glimmering = true;
+                glimmerIndex = 0;
+        }
+
+        if (glimmering)
                 printGlimmeringText(text, textLength, nerdFontText, lastRowColor);
         else
         {
                 printBlankSpaces(indent);
-                printf("%s", text);
-                printf("%s", nerdFontText);
+                screenPrintf("%s", text);
+                screenPrintf("%s", nerdFontText);
         }
 }
 
@@ -684,7 +744,7 @@ int printAbout(SongData *songdata, UISettings *ui)
         int numRows = printLogo(songdata, ui);
         setDefaultTextColor();
         printBlankSpaces(indent);
-        printf(" kew version: %s\n\n", VERSION);
+        screenPrintf(" kew version: %s\n\n", VERSION);
         numRows += 2;
 
         return numRows;
@@ -702,62 +762,62 @@ int showKeyBindings(SongData *songdata, AppSettings *settings, UISettings *ui)
         setDefaultTextColor();
 
         printBlankSpaces(indent);
-        printf(" - Switch tracks with ←, → or %s, %s keys.\n", settings->previousTrackAlt, settings->nextTrackAlt);
+        screenPrintf(" - Switch tracks with ←, → or %s, %s keys.\n", settings->previousTrackAlt, settings->nextTrackAlt);
         printBlankSpaces(indent);
-        printf(" - Volume is adjusted with %s (or %s) and %s.\n", settings->volumeUp, settings->volumeUpAlt, settings->volumeDown);
+        screenPrintf(" - Volume is adjusted with %s (or %s) and %s.\n", settings->volumeUp, settings->volumeUpAlt, settings->volumeDown);
         printBlankSpaces(indent);
-        printf(" - Press F2 for Playlist View:\n");
+        screenPrintf(" - Press F2 for Playlist View:\n");
         printBlankSpaces(indent);
-        printf("     Use ↑, ↓ keys, %s, %s keys, or mouse scroll to scroll through the playlist.\n", settings->scrollUpAlt, settings->scrollDownAlt);
+        screenPrintf("     Use ↑, ↓ keys, %s, %s keys, or mouse scroll to scroll through the playlist.\n", settings->scrollUpAlt, settings->scrollDownAlt);
         printBlankSpaces(indent);
-        printf("     Press Enter or middle click to play.\n");
+        screenPrintf("     Press Enter or middle click to play.\n");
         printBlankSpaces(indent);
-        printf("     Press Backspace to clear the playlist or Delete to remove a single entry.\n");
+        screenPrintf("     Press Backspace to clear the playlist or Delete to remove a single entry.\n");
         printBlankSpaces(indent);
-        printf(" - Press F3 for Library View:\n");
+        screenPrintf(" - Press F3 for Library View:\n");
         printBlankSpaces(indent);
-        printf("     Use ↑, ↓ keys, %s, %s keys, or mouse scroll to scroll through the library.\n", settings->scrollUpAlt, settings->scrollDownAlt);
+        screenPrintf("     Use ↑, ↓ keys, %s, %s keys, or mouse scroll to scroll through the library.\n", settings->scrollUpAlt, settings->scrollDownAlt);
         printBlankSpaces(indent);
-        printf("     Press Enter or middle click to add/remove songs to/from the playlist.\n");
+        screenPrintf("     Press Enter or middle click to add/remove songs to/from the playlist.\n");
         printBlankSpaces(indent);
-        printf(" - Press F4 for Track View.\n");
+        screenPrintf(" - Press F4 for Track View.\n");
         printBlankSpaces(indent);
-        printf(" - Space, %s, or right click to play or pause.\n", settings->togglePause);
+        screenPrintf(" - Space, %s, or right click to play or pause.\n", settings->togglePause);
         printBlankSpaces(indent);
-        printf(" - Shift+s to stop.\n");
+        screenPrintf(" - Shift+s to stop.\n");
         printBlankSpaces(indent);
-        printf(" - %s toggle color derived from album or from profile.\n", settings->toggleColorsDerivedFrom);
+        screenPrintf(" - %s toggle color derived from album or from profile.\n", settings->toggleColorsDerivedFrom);
         printBlankSpaces(indent);
-        printf(" - %s to update the library.\n", settings->updateLibrary);
+        screenPrintf(" - %s to update the library.\n", settings->updateLibrary);
         printBlankSpaces(indent);
-        printf(" - %s to show/hide the spectrum visualizer.\n", settings->toggleVisualizer);
+        screenPrintf(" - %s to show/hide the spectrum visualizer.\n", settings->toggleVisualizer);
         printBlankSpaces(indent);
-        printf(" - %s to toggle album covers drawn in ascii.\n", settings->toggleAscii);
+        screenPrintf(" - %s to toggle album covers drawn in ascii.\n", settings->toggleAscii);
         printBlankSpaces(indent);
-        printf(" - %s to repeat the current song after playing.\n", settings->toggleRepeat);
+        screenPrintf(" - %s to repeat the current song after playing.\n", settings->toggleRepeat);
         printBlankSpaces(indent);
-        printf(" - %s to shuffle the playlist.\n", settings->toggleShuffle);
+        screenPrintf(" - %s to shuffle the playlist.\n", settings->toggleShuffle);
         printBlankSpaces(indent);
-        printf(" - %s to seek backward.\n", settings->seekBackward);
+        screenPrintf(" - %s to seek backward.\n", settings->seekBackward);
         printBlankSpaces(indent);
-        printf(" - %s to seek forward.\n", settings->seekForward);
+        screenPrintf(" - %s to seek forward.\n", settings->seekForward);
         printBlankSpaces(indent);
-        printf(" - %s to save the playlist to your music folder.\n", settings->savePlaylist);
+        screenPrintf(" - %s to save the playlist to your music folder.\n", settings->savePlaylist);
         printBlankSpaces(indent);
-        printf(" - %s to add current song to kew.m3u (run with \"kew .\").\n", settings->addToMainPlaylist);
+        screenPrintf(" - %s to add current song to kew.m3u (run with \"kew .\").\n", settings->addToMainPlaylist);
         printBlankSpaces(indent);
-        printf(" - Esc or %s to quit.\n\n", settings->quit);
+        screenPrintf(" - Esc or %s to quit.\n\n", settings->quit);
         printBlankSpaces(indent);
-        printf(" Copyright © 2022-2025 Ravachol.\n");
+        screenPrintf(" Copyright © 2022-2025 Ravachol.\n");
         printBlankSpaces(indent);
-        printf(" Please donate: https://github.com/sponsors/ravachol\n");
-        printf("\n");
+        screenPrintf(" Please donate: https://github.com/sponsors/ravachol\n");
+        screenPrintf("\n");
 
         numPrintedRows += 27;
 
         while (numPrintedRows < maxListSize)
         {
-                printf("\n");
+                screenPrintf("\n");
                 numPrintedRows++;
         }
 
@@ -974,15 +1034,15 @@ int printLogoAndAdjustments(SongData *songData, int termWidth, UISettings *ui, i
         {
                 setDefaultTextColor();
                 printBlankSpaces(indentation);
-                printf(" Use ↑, ↓ or k, j to choose. Enter=Accept.\n");
+                screenPrintf(" Use ↑, ↓ or k, j to choose. Enter=Accept.\n");
                 printBlankSpaces(indentation);
 #ifndef __APPLE__
-                printf(" Pg Up and Pg Dn to scroll. Del to remove entry.\n");
+                screenPrintf(" Pg Up and Pg Dn to scroll. Del to remove entry.\n");
 #else
-                printf(" Fn+Arrow Up and Fn+Arrow Down to scroll. Del to remove entry.\n");
+                screenPrintf(" Fn+Arrow Up and Fn+Arrow Down to scroll. Del to remove entry.\n");
 #endif
                 printBlankSpaces(indentation);
-                printf(" Backspace to clear. Use t, g to move the songs.\n\n");
+                screenPrintf(" Backspace to clear. Use t, g to move the songs.\n\n");
                 return aboutRows + 4;
         }
         return aboutRows;
@@ -1002,7 +1062,7 @@ void showSearch(SongData *songData, int *chosenRow, UISettings *ui)
         if (term_w > indent + 38 && !ui->hideHelp)
         {
                 printBlankSpaces(indent);
-                printf(" Use ↑, ↓ to choose. Enter=Accept. Alt+Enter=Play.\n\n");
+                screenPrintf(" Use ↑, ↓ to choose. Enter=Accept. Alt+Enter=Play.\n\n");
                 maxSearchListSize -= 2;
         }
 
@@ -1026,9 +1086,9 @@ void showRadioSearch(SongData *songData, int *chosenRow, UISettings *ui)
         if (term_w > indent + 73 && !ui->hideHelp)
         {
                 printBlankSpaces(indent);
-                printf(" Use ↑, ↓ to choose. Enter to search and then enter to accept a station.\n");
+                screenPrintf(" Use ↑, ↓ to choose. Enter to search and then enter to accept a station.\n");
                 printBlankSpaces(indent);
-                printf(" Shift+f to add, del to remove favorites. Empty search to show favorites.\n\n");
+                screenPrintf(" Shift+f to add, del to remove favorites. Empty search to show favorites.\n\n");
                 maxRadioSearchListSize -= 3;
         }
 
@@ -1053,7 +1113,7 @@ void showPlaylist(SongData *songData, PlayList *list, int *chosenSong, int *chos
                 setColor(&(state->uiSettings));
 
         printBlankSpaces(indent);
-        printf("   ─ PLAYLIST ─\n");
+        screenPrintf("   ─ PLAYLIST ─\n");
         maxListSize -= 1;
 
         displayPlaylist(list, maxListSize, indent, chosenSong, chosenNodeId, state->uiState.resetPlaylistDisplay, state);
@@ -1077,25 +1137,25 @@ void printElapsedBars(int elapsedBars, int numProgressBars, PixelData color, int
         if (!useConfigColors)
         {
                 PixelData tmp = increaseLuminosity(color, round(height * 4));
-                printf("\033[38;2;%d;%d;%dm", tmp.r, tmp.g, tmp.b);
+                screenPrintf("\033[38;2;%d;%d;%dm", tmp.r, tmp.g, tmp.b);
         }
         else
         {
                 setDefaultTextColor();
         }
         printBlankSpaces(indent);
-        printf(" ");
+        screenPrintf(" ");
         for (int i = 0; i < numProgressBars; i++)
         {
                 if (i == 0)
                 {
-                        printf("■ ");
+                        screenPrintf("■ ");
                 }
                 else if (i < elapsedBars)
-                        printf("■ ");
+                        screenPrintf("■ ");
                 else
                 {
-                        printf("= ");
+                        screenPrintf("= ");
                 }
         }
 }
@@ -1109,7 +1169,7 @@ void printVisualizer(double elapsedSeconds, AppState *state)
 
         if (ui->visualizerEnabled)
         {
-                printf("\n");
+                screenPrintf("\n");
 
                 int visualizerWidth = (ABSOLUTE_MIN_WIDTH > preferredWidth) ? ABSOLUTE_MIN_WIDTH : preferredWidth;
                 visualizerWidth = (visualizerWidth < textWidth && textWidth < term_w - 2) ? textWidth : visualizerWidth;
@@ -1138,7 +1198,7 @@ void printVisualizer(double elapsedSeconds, AppState *state)
                 if (term_w >= ABSOLUTE_MIN_WIDTH)
                 {
 #ifdef __APPLE__
-                        printf("\n");
+                        screenPrintf("\n");
                         printErrorRow();
                         saveCursorPosition();
                         printLastRow(ui);
@@ -1148,7 +1208,7 @@ void printVisualizer(double elapsedSeconds, AppState *state)
                         saveCursorPosition();
                         printErrorRow();
                         restoreCursorPosition();
-                        printf("\n");
+                        screenPrintf("\n");
                         saveCursorPosition();
                         printLastRow(ui);
                         restoreCursorPosition();
@@ -1239,7 +1299,7 @@ int displayTree(FileSystemEntry *root, int depth, int maxListSize, int maxNameWi
         UISettings *ui = &(state->uiSettings);
         UIState *uis = &(state->uiState);
 
-        if (currentSong != NULL && (strcmp(currentSong->song.filePath, root->fullPath) == 0))
+        if (currentSong != NULL && entryHasPath(root, currentSong->song.filePath))
         {
                 foundCurrent = 1;
         }
@@ -1267,7 +1327,7 @@ int displayTree(FileSystemEntry *root, int depth, int maxListSize, int maxNameWi
         if (root->isDirectory ||
             (!root->isDirectory && depth == 1) ||
             (root->isDirectory && depth == 0) ||
-            (chosenDir != NULL && uis->allowChooseSongs && root->parent != NULL && (strcmp(root->parent->fullPath, chosenDir->fullPath) == 0 || strcmp(root->fullPath, chosenDir->fullPath) == 0)))
+            (chosenDir != NULL && uis->allowChooseSongs && root->parent != NULL && (root->parent == chosenDir || root == chosenDir)))
         {
                 if (depth >= 0)
                 {
@@ -1303,7 +1363,7 @@ int displayTree(FileSystemEntry *root, int depth, int maxListSize, int maxNameWi
                                 }
 
                                 if (depth >= 2)
-                                        printf("  ");
+                                        screenPrintf("  ");
 
                                 // If more than two levels deep add an extra indentation
                                 extraIndent = (depth - 2 <= 0) ? 0 : depth - 2;
@@ -1319,18 +1379,18 @@ int displayTree(FileSystemEntry *root, int depth, int maxListSize, int maxNameWi
                                                 else
                                                         setColorAndWeight(0, ui);
 
-                                                printf("\x1b[7m * ");
+                                                screenPrintf("\x1b[7m * ");
                                         }
                                         else
                                         {
-                                                printf("  \x1b[7m ");
+                                                screenPrintf("  \x1b[7m ");
                                         }
 
                                         currentEntry = root;
 
                                         if (uis->allowChooseSongs == true && (chosenDir == NULL ||
-                                                                              (currentEntry != NULL && currentEntry->parent != NULL && chosenDir != NULL && (strcmp(currentEntry->parent->fullPath, chosenDir->fullPath) != 0) &&
-                                                                               strcmp(root->fullPath, chosenDir->fullPath) != 0)))
+                                                                              (currentEntry != NULL && currentEntry->parent != NULL && chosenDir != NULL && currentEntry->parent != chosenDir &&
+                                                                               root != chosenDir)))
                                         {
                                                 uis->collapseView = true;
                                                 refresh = true;
@@ -1350,15 +1410,15 @@ int displayTree(FileSystemEntry *root, int depth, int maxListSize, int maxNameWi
                                         if (root->isEnqueued)
                                         {
                                                 if (ui->useConfigColors)
-                                                        printf("\033[%d;3%dm", foundCurrent, ui->enqueuedColor);
+                                                        screenPrintf("\033[%d;3%dm", foundCurrent, ui->enqueuedColor);
                                                 else
                                                         setColorAndWeight(foundCurrent, ui);
 
-                                                printf(" * ");
+                                                screenPrintf(" * ");
                                         }
                                         else
                                         {
-                                                printf("   ");
+                                                screenPrintf("   ");
                                         }
                                 }
 
@@ -1377,10 +1437,10 @@ int displayTree(FileSystemEntry *root, int depth, int maxListSize, int maxNameWi
                                         char *upperDirName = stringToUpper(dirName);
 
                                         if (depth == 1)
-                                                printf("%s \n", upperDirName);
+                                                screenPrintf("%s \n", upperDirName);
                                         else
                                         {
-                                                printf("%s \n", dirName);
+                                                screenPrintf("%s \n", dirName);
                                         }
                                         free(upperDirName);
                                 }
@@ -1389,14 +1449,14 @@ int displayTree(FileSystemEntry *root, int depth, int maxListSize, int maxNameWi
                                         filename[0] = '\0';
                                         processName(root->name, filename, maxNameWidth - extraIndent);
 
-                                        printf("└─ ");
+                                        screenPrintf("└─ ");
 
                                         if (foundCurrent && chosenLibRow != libIter)
                                         {
-                                                printf("\e[4m\e[1m");
+                                                screenPrintf("\e[4m\e[1m");
                                         }
 
-                                        printf("%s\n", filename);
+                                        screenPrintf("%s\n", filename);
 
                                         libSongIter++;
                                 }
@@ -1480,12 +1540,12 @@ void showLibrary(SongData *songData, AppState *state)
         {
                 maxLibListSize -= 3;
                 printBlankSpaces(indent);
-                printf(" Use ↑, ↓ or k, j to choose. Enter=Enqueue/Dequeue. Alt+Enter=Play.\n");
+                screenPrintf(" Use ↑, ↓ or k, j to choose. Enter=Enqueue/Dequeue. Alt+Enter=Play.\n");
                 printBlankSpaces(indent);
 #ifndef __APPLE__
-                printf(" Pg Up and Pg Dn to scroll. Press u to update the library.\n\n");
+                screenPrintf(" Pg Up and Pg Dn to scroll. Press u to update the library.\n\n");
 #else
-                printf(" Fn+Arrow Up and Fn+Arrow Down to scroll. u to update the library.\n\n");
+                screenPrintf(" Fn+Arrow Up and Fn+Arrow Down to scroll. u to update the library.\n\n");
 #endif
         }
 
@@ -1511,7 +1571,7 @@ void showLibrary(SongData *songData, AppState *state)
 
         for (int i = libIter - startLibIter; i < maxLibListSize; i++)
         {
-                printf("\n");
+                screenPrintf("\n");
         }
 
         printErrorRow();
@@ -1519,7 +1579,7 @@ void showLibrary(SongData *songData, AppState *state)
 
         if (refresh)
         {
-                printf("\033[1;1H");
+                screenPrintf("\033[1;1H");
                 clearScreen();
                 showLibrary(songData, state);
         }
@@ -1550,7 +1610,7 @@ void showTrackViewMini(SongData *songdata, AppState *state, double elapsedSecond
 
         if (refresh)
         {
-                printf("\n");
+                screenPrintf("\n");
 
                 clearScreen();
 
@@ -1562,15 +1622,15 @@ void showTrackViewMini(SongData *songdata, AppState *state, double elapsedSecond
                         if (term_w > 21 && term_h > 4)
                         {
                                 printBlankSpaces(indent);
-                                printf(" __\n");
+                                screenPrintf(" __\n");
                                 printBlankSpaces(indent);
-                                printf("|  |--.-----.--.--.--.\n");
+                                screenPrintf("|  |--.-----.--.--.--.\n");
                                 printBlankSpaces(indent);
-                                printf("|    <|  -__|  |  |  |\n");
+                                screenPrintf("|    <|  -__|  |  |  |\n");
                                 printBlankSpaces(indent);
-                                printf("|__|__|_____|________|\n");
+                                screenPrintf("|__|__|_____|________|\n");
                                 printBlankSpaces(indent);
-                                printf(" kew version: %s", VERSION);
+                                screenPrintf(" kew version: %s", VERSION);
                         }
                         return;
                 }
@@ -1600,12 +1660,12 @@ void showTrackViewMini(SongData *songdata, AppState *state, double elapsedSecond
                         char combined[text_len + 1];
                         snprintf(combined, sizeof(combined), "%s - %s", metadata->artist, metadata->title);
 
-                        printf(" %.*s\n", text_len, combined);
+                        screenPrintf(" %.*s\n", text_len, combined);
                 }
                 else if (strnlen(metadata->title, METADATA_MAX_LENGTH) > 0)
                 {
                         printBlankSpaces(indent);
-                        printf(" %.*s\n", textWidth, metadata->title);
+                        screenPrintf(" %.*s\n", textWidth, metadata->title);
                 }
 
                 if (!songdata && metadata)
@@ -1644,7 +1704,7 @@ void showTrackView(SongData *songdata, AppState *state, double elapsedSeconds)
                 }
 
                 clearScreen();
-                printf("\n");
+                screenPrintf("\n");
                 printCover(songdata, &(state->uiSettings));
 
                 printMetadata(metadata, &(state->uiSettings));
@@ -1653,6 +1713,10 @@ void showTrackView(SongData *songdata, AppState *state, double elapsedSeconds)
                         free(metadata);
                 refresh = false;
         }
+        else
+        {
+                updateTitle(&(state->uiSettings));
+        }
         if (songdata)
                 printTime(elapsedSeconds, state);
         printVisualizer(elapsedSeconds, state);
@@ -1708,7 +1772,7 @@ int printPlayer(SongData *songdata, double elapsedSeconds, AppSettings *settings
         {
                 state->uiState.miniMode = true;
                 showTrackViewMini(songdata, state, elapsedSeconds);
-                fflush(stdout);
+                screenFlush();
                 return 0;
         }
         if (state->currentView != PLAYLIST_VIEW)
@@ -1720,7 +1784,7 @@ int printPlayer(SongData *songdata, double elapsedSeconds, AppSettings *settings
                 showKeyBindings(songdata, settings, ui);
                 saveCursorPosition();
                 refresh = false;
-                fflush(stdout);
+                screenFlush();
         }
         else if (state->currentView == PLAYLIST_VIEW && refresh)
         {
@@ -1728,34 +1792,42 @@ int printPlayer(SongData *songdata, double elapsedSeconds, AppSettings *settings
                 showPlaylist(songdata, originalPlaylist, &chosenRow, &(uis->chosenNodeId), state);
                 state->uiState.resetPlaylistDisplay = false;
                 refresh = false;
-                fflush(stdout);
+                screenFlush();
         }
         else if (state->currentView == SEARCH_VIEW && refresh)
         {
                 clearScreen();
                 showSearch(songdata, &chosenSearchResultRow, ui);
                 refresh = false;
-                fflush(stdout);
+                screenFlush();
         }
         else if (state->currentView == RADIOSEARCH_VIEW && refresh)
         {
                 clearScreen();
                 showRadioSearch(songdata, &chosenRadioSearchResultRow, ui);
                 refresh = false;
-                fflush(stdout);
+                screenFlush();
         }
         else if (state->currentView == LIBRARY_VIEW && refresh)
         {
                 clearScreen();
                 showLibrary(songdata, state);
                 refresh = false;
-                fflush(stdout);
+                screenFlush();
         }
         else if (state->currentView == TRACK_VIEW)
         {
                 showTrackView(songdata, state, elapsedSeconds);
-                fflush(stdout);
+                screenFlush();
         }
+#ifndef __APPLE__
+        else if (glimmering)
+        {
+                // The other views only print the last row when they are redrawn
+                printLastRow(ui);
+                screenFlush();
+        }
+#endif
 
         return 0;
 }
@@ -42,6 +42,8 @@ void setChosenDir(FileSystemEntry *entry);
 
 int printAbout(SongData *songdata, UISettings *ui);
 
+bool isAnimating(void);
+
 FileSystemEntry *getCurrentLibEntry(void);
 
 FileSystemEntry *getChosenDir(void);
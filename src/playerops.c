@@ -45,11 +45,16 @@ volatile bool songLoading = false;
 GDBusConnection *connection = NULL;
 GMainContext *global_main_context = NULL;
 
-typedef struct
-{
-        char *path;
-        UISettings *ui;
-} UpdateLibraryThreadArgs;
+static pthread_mutex_t libraryUpdateMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Songs are loaded one at a time on the song loader thread. Only the latest request is carried out,
+// and a load that a newer request came in during is thrown away.
+static pthread_t songLoaderThread;
+static bool songLoaderRunning = false;
+static pthread_mutex_t songLoaderMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t songLoaderWake = PTHREAD_COND_INITIALIZER;
+static _Atomic unsigned int loadRequests = 0;
+static unsigned int loadsStarted = 0;
 
 void reshufflePlaylist(void)
 {
@@ -528,18 +533,6 @@ void flushSeek(void)
 {
         if (seekAccumulatedSeconds != 0.0)
         {
-                if (currentSong != NULL)
-                {
-#ifdef USE_FAAD
-                        if (pathEndsWith(currentSong->song.filePath, "aac"))
-                        {
-                                m4a_decoder *decoder = getCurrentM4aDecoder();
-                                if (decoder->fileType == k_rawAAC)
-                                        return;
-                        }
-#endif
-                }
-
                 setSeekElapsed(getSeekElapsed() + seekAccumulatedSeconds);
                 seekAccumulatedSeconds = 0.0;
                 calcElapsedTime();
@@ -602,14 +595,6 @@ void seekForward(UIState *uis)
 {
         if (currentSong != NULL)
         {
-#ifdef USE_FAAD
-                if (pathEndsWith(currentSong->song.filePath, "aac"))
-                {
-                        m4a_decoder *decoder = getCurrentM4aDecoder();
-                        if (decoder != NULL && decoder->fileType == k_rawAAC)
-                                return;
-                }
-#endif
                 if (isPaused())
                         return;
 
@@ -627,15 +612,6 @@ void seekBack(UIState *uis)
 {
         if (currentSong != NULL)
         {
-#ifdef USE_FAAD
-                if (pathEndsWith(currentSong->song.filePath, "aac"))
-                {
-
-                        m4a_decoder *decoder = getCurrentM4aDecoder();
-                        if (decoder != NULL && decoder->fileType == k_rawAAC)
-                                return;
-                }
-#endif
                 if (isPaused())
                         return;
 
@@ -716,7 +692,7 @@ bool markAsDequeued(FileSystemEntry *root, char *path)
 
         if (!root->isDirectory)
         {
-                if (strcmp(root->fullPath, path) == 0)
+                if (entryHasPath(root, path))
                 {
                         root->isEnqueued = false;
                         return true;
@@ -775,12 +751,15 @@ void enqueueSong(FileSystemEntry *child)
 {
         int id = nodeIdCounter++;
 
+        char fullPath[MAXPATHLEN];
+        getFullPath(child, fullPath, sizeof(fullPath));
+
         Node *node = NULL;
-        createNode(&node, child->fullPath, id);
+        createNode(&node, fullPath, id);
         addToList(originalPlaylist, node);
 
         Node *node2 = NULL;
-        createNode(&node2, child->fullPath, id);
+        createNode(&node2, fullPath, id);
         addToList(&playlist, node2);
 
         child->isEnqueued = 1;
@@ -1003,7 +982,10 @@ void moveSongDown()
 
 void dequeueSong(FileSystemEntry *child)
 {
-        Node *node1 = findLastPathInPlaylist(child->fullPath, originalPlaylist);
+        char fullPath[MAXPATHLEN];
+        getFullPath(child, fullPath, sizeof(fullPath));
+
+        Node *node1 = findLastPathInPlaylist(fullPath, originalPlaylist);
 
         if (node1 == NULL)
                 return;
@@ -1143,7 +1125,7 @@ FileSystemEntry *enqueueSongs(FileSystemEntry *entry, UIState *uis)
         {
                 if (entry->isDirectory)
                 {
-                        if (!hasSongChildren(entry) || entry->parent == NULL || (chosenDir != NULL && strcmp(entry->fullPath, chosenDir->fullPath) == 0))
+                        if (!hasSongChildren(entry) || entry->parent == NULL || entry == chosenDir)
                         {
                                 if (hasDequeuedChildren(entry))
                                 {
@@ -1168,7 +1150,7 @@ FileSystemEntry *enqueueSongs(FileSystemEntry *entry, UIState *uis)
                                         nextSongNeedsRebuilding = true;
                                 }
                         }
-                        if ((chosenDir != NULL && entry->parent != NULL && strcmp(entry->parent->fullPath, chosenDir->fullPath) == 0) && uis->allowChooseSongs == true)
+                        if ((chosenDir != NULL && entry->parent != NULL && entry->parent == chosenDir) && uis->allowChooseSongs == true)
                         {
                                 uis->openedSubDir = true;
 
@@ -1178,7 +1160,7 @@ FileSystemEntry *enqueueSongs(FileSystemEntry *entry, UIState *uis)
 
                                 while (tmpc != NULL)
                                 {
-                                        if (strcmp(entry->fullPath, tmpc->fullPath) == 0)
+                                        if (entry == tmpc)
                                                 break;
                                         tmpc = tmpc->next;
                                         uis->numSongsAboveSubDir++;
@@ -1220,7 +1202,12 @@ FileSystemEntry *enqueueSongs(FileSystemEntry *entry, UIState *uis)
                 waitingForNext = true;
                 audioData.endOfListReached = false;
                 if (firstEnqueuedEntry != NULL)
-                        songToStartFrom = findPathInPlaylist(firstEnqueuedEntry->fullPath, &playlist);
+                {
+                        char fullPath[MAXPATHLEN];
+                        getFullPath(firstEnqueuedEntry, fullPath, sizeof(fullPath));
+
+                        songToStartFrom = findPathInPlaylist(fullPath, &playlist);
+                }
                 lastPlayedId = -1;
         }
 
@@ -1395,18 +1382,31 @@ int assignLoadedData(void)
         return result;
 }
 
-void *songDataReaderThread(void *arg)
+// Skipped past already, the newer request loads the song that is wanted now
+static bool isLoadSuperseded(void *data)
 {
-        LoadingThreadData *loadingdata = (LoadingThreadData *)arg;
+        return atomic_load(&loadRequests) != *(unsigned int *)data;
+}
 
+static void readSongData(LoadingThreadData *loadingdata, unsigned int request)
+{
         // Acquire the mutex lock
         pthread_mutex_lock(&(loadingdata->mutex));
 
+        if (isLoadSuperseded(&request))
+        {
+                pthread_mutex_unlock(&(loadingdata->mutex));
+                return;
+        }
+
         char filepath[MAXPATHLEN];
         c_strcpy(filepath, loadingdata->filePath, sizeof(filepath));
 
         SongData *songdata = NULL;
 
+        // The decoder thread reads the song data of the track it plays and opens the next one when it gets there
+        pthread_mutex_lock(&dataSourceMutex);
+
         if (loadingdata->loadA)
         {
                 if (!userData.songdataADeleted)
@@ -1424,13 +1424,23 @@ void *songDataReaderThread(void *arg)
                 }
         }
 
+        pthread_mutex_unlock(&dataSourceMutex);
+
         if (filepath[0] != '\0')
         {
-                songdata = loadSongData(filepath, &appState);
+                songdata = loadPrefetchedSongData(filepath, &appState, isLoadSuperseded, &request);
         }
         else
                 songdata = NULL;
 
+        // Loaded for nothing, but the song can still come up soon
+        if (isLoadSuperseded(&request))
+        {
+                returnPrefetchedSongData(filepath, songdata, &appState);
+                pthread_mutex_unlock(&(loadingdata->mutex));
+                return;
+        }
+
         if (loadingdata->loadA)
         {
                 loadingdata->songdataA = songdata;
@@ -1440,8 +1450,12 @@ void *songDataReaderThread(void *arg)
                 loadingdata->songdataB = songdata;
         }
 
+        pthread_mutex_lock(&dataSourceMutex);
+
         int result = assignLoadedData();
 
+        pthread_mutex_unlock(&dataSourceMutex);
+
         if (result < 0)
                 songdata->hasErrors = true;
 
@@ -1466,9 +1480,73 @@ void *songDataReaderThread(void *arg)
         skipping = false;
         songLoading = false;
 
+        wakeMainLoop();
+}
+
+static void *songLoaderThreadFunction(void *arg)
+{
+        LoadingThreadData *loadingdata = (LoadingThreadData *)arg;
+
+        pthread_mutex_lock(&songLoaderMutex);
+
+        while (songLoaderRunning)
+        {
+                unsigned int request = atomic_load(&loadRequests);
+
+                if (request == loadsStarted)
+                {
+                        pthread_cond_wait(&songLoaderWake, &songLoaderMutex);
+                        continue;
+                }
+
+                loadsStarted = request;
+
+                pthread_mutex_unlock(&songLoaderMutex);
+                readSongData(loadingdata, request);
+                pthread_mutex_lock(&songLoaderMutex);
+        }
+
+        pthread_mutex_unlock(&songLoaderMutex);
+
         return NULL;
 }
 
+void startSongLoader(void)
+{
+        if (songLoaderRunning)
+                return;
+
+        songLoaderRunning = true;
+
+        if (pthread_create(&songLoaderThread, NULL, songLoaderThreadFunction, (void *)&loadingdata) != 0)
+        {
+                perror("Failed to create song loader thread");
+                songLoaderRunning = false;
+        }
+}
+
+void stopSongLoader(void)
+{
+        if (!songLoaderRunning)
+                return;
+
+        pthread_mutex_lock(&songLoaderMutex);
+        songLoaderRunning = false;
+        pthread_cond_signal(&songLoaderWake);
+        pthread_mutex_unlock(&songLoaderMutex);
+
+        pthread_join(songLoaderThread, NULL);
+}
+
+// Loads the song in loadingdata.filePath, instead of what was asked for before if that hasn't finished
+static void requestSongLoad(void)
+{
+        pthread_mutex_lock(&songLoaderMutex);
+        atomic_fetch_add(&loadRequests, 1);
+        pthread_cond_signal(&songLoaderWake);
+        pthread_mutex_unlock(&songLoaderMutex);
+}
+
 void loadSong(Node *song, LoadingThreadData *loadingdata)
 {
         if (song == NULL)
@@ -1481,8 +1559,9 @@ void loadSong(Node *song, LoadingThreadData *loadingdata)
 
         c_strcpy(loadingdata->filePath, song->song.filePath, sizeof(loadingdata->filePath));
 
-        pthread_t loadingThread;
-        pthread_create(&loadingThread, NULL, songDataReaderThread, (void *)loadingdata);
+        prefetchFrom(song);
+
+        requestSongLoad();
 }
 
 void loadNext(LoadingThreadData *loadingdata)
@@ -1498,8 +1577,7 @@ void loadNext(LoadingThreadData *loadingdata)
                 c_strcpy(loadingdata->filePath, nextSong->song.filePath, sizeof(loadingdata->filePath));
         }
 
-        pthread_t loadingThread;
-        pthread_create(&loadingThread, NULL, songDataReaderThread, (void *)loadingdata);
+        requestSongLoad();
 }
 
 void rebuildNextSong(Node *song)
@@ -1815,9 +1893,9 @@ void loadFirstSong(Node *song, UISettings *ui)
         while (!loadedNextSong && i < 10000)
         {
                 if (i != 0 && i % 1000 == 0 && ui->uiEnabled)
-                        printf(".");
+                        screenPrintf(".");
                 c_sleep(10);
-                fflush(stdout);
+                screenFlush();
                 i++;
         }
 }
@@ -1901,9 +1979,55 @@ int loadFirst(Node *song, AppState *state)
         return 0;
 }
 
-void *updateLibraryThread(void *arg)
+static void writeLibraryCache(void)
+{
+        if (appState.uiSettings.cacheLibrary <= 0)
+                return;
+
+        char *filepath = getLibraryFilePath();
+        writeTreeToFile(library, filepath);
+        free(filepath);
+}
+
+// Called with libraryUpdateMutex held, which it lets go of. Returns true if the library changed.
+static bool applyUpdateToLibrary(LibraryUpdate *update)
+{
+        if (update == NULL)
+        {
+                pthread_mutex_unlock(&libraryUpdateMutex);
+                return false;
+        }
+
+        pthread_mutex_lock(&switchMutex);
+
+        appState.uiState.numDirectoryTreeEntries += applyLibraryUpdate(library, update);
+        resetChosenDir();
+
+        pthread_mutex_unlock(&switchMutex);
+
+        writeLibraryCache();
+
+        pthread_mutex_unlock(&libraryUpdateMutex);
+
+        refresh = true;
+        wakeMainLoop();
+
+        return true;
+}
+
+// Brings the library up to date with the disk and the cache up to date with the library.
+// Returns true if the library changed.
+bool updateLibraryFromDisk(char *path)
 {
-        char *path = (char *)arg;
+        // One update at a time, so that the tree doesn't change between reading the disk and applying the changes
+        pthread_mutex_lock(&libraryUpdateMutex);
+
+        if (library != NULL && entryHasPath(library, path))
+        {
+                // Only the directories that changed since they were read are read again, without holding the lock
+                return applyUpdateToLibrary(prepareLibraryUpdate(library));
+        }
+
         int tmpDirectoryTreeEntries = 0;
 
         FileSystemEntry *temp = createDirectoryTree(path, &tmpDirectoryTreeEntries);
@@ -1911,8 +2035,8 @@ void *updateLibraryThread(void *arg)
         if (!temp)
         {
                 perror("createDirectoryTree");
-                pthread_mutex_unlock(&switchMutex);
-                return NULL;
+                pthread_mutex_unlock(&libraryUpdateMutex);
+                return false;
         }
 
         pthread_mutex_lock(&switchMutex);
@@ -1926,7 +2050,45 @@ void *updateLibraryThread(void *arg)
 
         pthread_mutex_unlock(&switchMutex);
 
+        writeLibraryCache();
+
+        pthread_mutex_unlock(&libraryUpdateMutex);
+
         refresh = true;
+        wakeMainLoop();
+
+        return true;
+}
+
+// Only reads the directories at paths, and the directories that are new in them. Returns true if the library changed.
+bool updateLibraryDirectoriesFromDisk(const char **paths, int numPaths)
+{
+        pthread_mutex_lock(&libraryUpdateMutex);
+
+        return applyUpdateToLibrary(prepareLibraryUpdateOf(library, paths, numPaths));
+}
+
+void forEachLibraryDirectory(void (*callback)(const char *path, void *data), void *data)
+{
+        pthread_mutex_lock(&libraryUpdateMutex);
+
+        forEachDirectory(library, callback, data);
+
+        pthread_mutex_unlock(&libraryUpdateMutex);
+}
+
+void forEachLibraryDirectoryBelow(const char *path, void (*callback)(const char *path, void *data), void *data)
+{
+        pthread_mutex_lock(&libraryUpdateMutex);
+
+        forEachDirectoryBelow(library, path, callback, data);
+
+        pthread_mutex_unlock(&libraryUpdateMutex);
+}
+
+void *updateLibraryThread(void *arg)
+{
+        updateLibraryFromDisk((char *)arg);
 
         return NULL;
 }
@@ -1954,6 +2116,7 @@ void askIfCacheLibrary(UISettings *ui)
         restoreTerminalMode();
         enableInputBuffering();
         showCursor();
+        screenFlush();
 
         printf("Would you like to enable a (local) library cache for quicker startup times?\nYou can update the cache at any time by pressing 'u'. (y/n): ");
 
@@ -1979,6 +2142,9 @@ void askIfCacheLibrary(UISettings *ui)
                 ui->cacheLibrary = 0;
         }
 
+        // The question was printed around the screen
+        screenInvalidate();
+
         setNonblockingMode();
         disableInputBuffering();
         hideCursor();
@@ -1986,12 +2152,16 @@ void askIfCacheLibrary(UISettings *ui)
 
 void createLibrary(AppSettings *settings, AppState *state)
 {
+        setLibraryScanThreads(state->uiSettings.libraryScanThreads);
+
         if (state->uiSettings.cacheLibrary > 0)
         {
                 char *libFilepath = getLibraryFilePath();
                 library = reconstructTreeFromFile(libFilepath, settings->path, &(state->uiState.numDirectoryTreeEntries));
                 free(libFilepath);
-                updateLibraryIfChangedDetected();
+
+                if (library != NULL && library->children != NULL)
+                        updateLibraryIfChangedDetected();
         }
 
         if (library == NULL || library->children == NULL)
@@ -2024,109 +2194,10 @@ void createLibrary(AppSettings *settings, AppState *state)
         }
 }
 
-time_t getModificationTime(struct stat *path_stat)
-{
-
-        if (path_stat->st_mtime != 0)
-        {
-                return path_stat->st_mtime;
-        }
-        else
-        {
-#ifdef __APPLE__
-                return path_stat->st_mtimespec.tv_sec; // macOS-specific member.
-#else
-                return path_stat->st_mtim.tv_sec; // Linux-specific member.
-#endif
-        }
-}
-
-void *updateIfTopLevelFoldersMtimesChangedThread(void *arg)
-{
-        UpdateLibraryThreadArgs *args = (UpdateLibraryThreadArgs *)arg; // Cast `arg` back to the structure pointer
-        char *path = args->path;
-        UISettings *ui = args->ui;
-
-        struct stat path_stat;
-
-        if (stat(path, &path_stat) == -1)
-        {
-                perror("stat");
-                free(args);
-                pthread_exit(NULL);
-        }
-
-        if (getModificationTime(&path_stat) > ui->lastTimeAppRan && ui->lastTimeAppRan > 0)
-        {
-                updateLibrary(path);
-                free(args);
-                pthread_exit(NULL);
-        }
-
-        DIR *dir = opendir(path);
-        if (!dir)
-        {
-                perror("opendir");
-                free(args);
-                pthread_exit(NULL);
-        }
-
-        struct dirent *entry;
-        while ((entry = readdir(dir)) != NULL)
-        {
-
-                if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-                {
-                        continue;
-                }
-
-                char fullPath[1024];
-                snprintf(fullPath, sizeof(fullPath), "%s/%s", path, entry->d_name);
-
-                if (stat(fullPath, &path_stat) == -1)
-                {
-                        perror("stat");
-                        continue;
-                }
-
-                if (S_ISDIR(path_stat.st_mode))
-                {
-
-                        if (getModificationTime(&path_stat) > ui->lastTimeAppRan && ui->lastTimeAppRan > 0)
-                        {
-                                updateLibrary(path);
-                                break;
-                        }
-                }
-        }
-
-        closedir(dir);
-
-        free(args);
-
-        pthread_exit(NULL);
-}
-
-// This only checks the library mtime and toplevel subfolders mtimes
+// Every directory in the cached library has its mtime, so an update only reads the directories that changed
 void updateLibraryIfChangedDetected(void)
 {
-        pthread_t tid;
-
-        UpdateLibraryThreadArgs *args = malloc(sizeof(UpdateLibraryThreadArgs));
-        if (args == NULL)
-        {
-                perror("malloc");
-                return;
-        }
-
-        args->path = settings.path;
-        args->ui = &(appState.uiSettings);
-
-        if (pthread_create(&tid, NULL, updateIfTopLevelFoldersMtimesChangedThread, (void *)args) != 0)
-        {
-                perror("pthread_create");
-                free(args);
-        }
+        updateLibrary(settings.path);
 }
 
 // Go through the display playlist and the shuffle playlist to remove all songs except the current one.
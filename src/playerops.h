@@ -11,6 +11,7 @@
 #include <unistd.h>
 #include "appstate.h"
 #include "player.h"
+#include "prefetch.h"
 #include "songloader.h"
 #include "settings.h"
 #include "soundcommon.h"
@@ -107,6 +108,10 @@ void skipToNumberedSong(int songNumber);
 
 void skipToLastSong(void);
 
+void startSongLoader(void);
+
+void stopSongLoader(void);
+
 void loadSong(Node *song, LoadingThreadData *loadingdata);
 
 void loadNext(LoadingThreadData *loadingdata);
@@ -123,6 +128,14 @@ void rebuildNextSong(Node *song);
 
 void updateLibrary(char *path);
 
+bool updateLibraryFromDisk(char *path);
+
+bool updateLibraryDirectoriesFromDisk(const char **paths, int numPaths);
+
+void forEachLibraryDirectory(void (*callback)(const char *path, void *data), void *data);
+
+void forEachLibraryDirectoryBelow(const char *path, void (*callback)(const char *path, void *data), void *data);
+
 void askIfCacheLibrary(UISettings *ui);
 
 void unloadSongA(AppState *state);
@@ -848,7 +848,10 @@ void traverseFileSystemEntry(FileSystemEntry *entry, PlayList *list, int playlis
 
         if (entry->isDirectory == 0)
         {
-                addSongToPlayList(list, entry->fullPath, playlistMax);
+                char fullPath[MAXPATHLEN];
+                getFullPath(entry, fullPath, sizeof(fullPath));
+
+                addSongToPlayList(list, fullPath, playlistMax);
         }
 
         if (entry->isDirectory == 1 && entry->children != NULL)
@@ -911,7 +914,10 @@ void addAlbumToPlayList(PlayList *list, FileSystemEntry *album, int playlistMax)
         {
                 if (!entry->isDirectory && isMusicFile(entry->name))
                 {
-                        addSongToPlayList(list, entry->fullPath, playlistMax);
+                        char fullPath[MAXPATHLEN];
+                        getFullPath(entry, fullPath, sizeof(fullPath));
+
+                        addSongToPlayList(list, fullPath, playlistMax);
                 }
                 entry = entry->next;
         }
@@ -87,7 +87,7 @@ int displayPlaylistItems(Node *startNode, int startIter, int maxListSize, int te
 
                         printBlankSpaces(indent);
 
-                        printf("   %d. ", i + 1);
+                        screenPrintf("   %d. ", i + 1);
 
                         setDefaultTextColor();
 
@@ -95,19 +95,19 @@ int displayPlaylistItems(Node *startNode, int startIter, int maxListSize, int te
                         {
                                 *chosenNodeId = node->id;
 
-                                printf("\x1b[7m");
+                                screenPrintf("\x1b[7m");
                         }
 
                         if (i + 1 < 10)
-                                printf(" ");
+                                screenPrintf(" ");
 
 
                         if (currentSong != NULL && currentSong->id == node->id)
                         {
-                                printf("\e[4m\e[1m");
+                                screenPrintf("\e[4m\e[1m");
                         }
 
-                        printf("%s\n", buffer);
+                        screenPrintf("%s\n", buffer);
 
                         numPrintedRows++;
                 }
@@ -179,7 +179,7 @@ int displayPlaylist(PlayList *list, int maxListSize, int indent, int *chosenSong
 
         while (printedRows < maxListSize)
         {
-                printf("\n");
+                screenPrintf("\n");
                 printedRows++;
         }
 
@@ -0,0 +1,382 @@
+#include "prefetch.h"
+
+/*
+
+prefetch.c
+
+ Loads the songs coming up in the playlist ahead of time: the start of the file is read so it is
+ in memory, and the tags and cover are extracted, so that moving on to them doesn't wait for the disk.
+
+*/
+
+#define PREFETCH_MAX_TRACKS 8
+#define PREFETCH_SLOTS ((PREFETCH_MAX_TRACKS + 1) * 2) // Room for the songs that went out of the window until they are unloaded
+#define PREFETCH_HEAD_BYTES (2 * 1024 * 1024)          // The headers and the first seconds of audio
+#define PREFETCH_TAIL_BYTES (128 * 1024)               // Tags at the end of the file, like ID3v1, APE or an mp4 index
+#define PREFETCH_READ_SIZE (64 * 1024)
+
+typedef struct
+{
+        char filePath[MAXPATHLEN];
+        SongData *songData;
+        size_t bytes; // What it counts against the memory limit
+        bool loading;
+        bool used;
+} PrefetchSlot;
+
+static PrefetchSlot slots[PREFETCH_SLOTS];
+static char wanted[PREFETCH_MAX_TRACKS + 1][MAXPATHLEN]; // The songs coming up, in playing order
+static bool taken[PREFETCH_MAX_TRACKS + 1];               // Handed out already, so not loaded again
+static int numWanted = 0;
+static int maxTracks = 0;
+static size_t memoryLimit = 0;
+static size_t memoryUsed = 0;
+static AppState *prefetchState = NULL;
+
+static pthread_t prefetchThread;
+static bool prefetcherRunning = false;
+static pthread_mutex_t prefetchMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetchWake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t prefetchLoaded = PTHREAD_COND_INITIALIZER;
+
+static size_t getSongDataBytes(const SongData *songData)
+{
+        size_t bytes = sizeof(SongData) + sizeof(TagSettings);
+
+        if (songData != NULL && songData->cover != NULL)
+                bytes += (size_t)songData->coverWidth * songData->coverHeight * 4;
+
+        if (songData != NULL)
+                bytes += songData->coverDataSize;
+
+        if (songData != NULL && songData->coverRender.output != NULL)
+                bytes += songData->coverRender.output->len;
+
+        return bytes;
+}
+
+// Reads the start and the end of the file, so that the decoder and the tag reader find them in the page cache
+static size_t warmFile(const char *filePath)
+{
+        static char buffer[PREFETCH_READ_SIZE];
+        struct stat st;
+        size_t bytesRead = 0;
+
+        int fd = open(filePath, O_RDONLY);
+        if (fd < 0)
+                return 0;
+
+        if (fstat(fd, &st) != 0 || st.st_size <= 0)
+        {
+                close(fd);
+                return 0;
+        }
+
+        off_t head = (st.st_size < PREFETCH_HEAD_BYTES) ? st.st_size : PREFETCH_HEAD_BYTES;
+        off_t tail = (st.st_size - head < PREFETCH_TAIL_BYTES) ? st.st_size - head : PREFETCH_TAIL_BYTES;
+
+#ifdef POSIX_FADV_WILLNEED
+        posix_fadvise(fd, 0, head, POSIX_FADV_WILLNEED);
+        if (tail > 0)
+                posix_fadvise(fd, st.st_size - tail, tail, POSIX_FADV_WILLNEED);
+#endif
+
+        // The hint is only a hint, on network filesystems especially, so it is read for real
+        for (off_t offset = 0; offset < head;)
+        {
+                ssize_t n = pread(fd, buffer, sizeof(buffer), offset);
+                if (n <= 0)
+                        break;
+                offset += n;
+                bytesRead += n;
+        }
+
+        if (tail > 0)
+        {
+                for (off_t offset = st.st_size - tail; offset < st.st_size;)
+                {
+                        ssize_t n = pread(fd, buffer, sizeof(buffer), offset);
+                        if (n <= 0)
+                                break;
+                        offset += n;
+                        bytesRead += n;
+                }
+        }
+
+        close(fd);
+
+        return bytesRead;
+}
+
+static PrefetchSlot *findSlot(const char *filePath)
+{
+        for (int i = 0; i < PREFETCH_SLOTS; i++)
+        {
+                if (slots[i].used && strcmp(slots[i].filePath, filePath) == 0)
+                        return &slots[i];
+        }
+
+        return NULL;
+}
+
+static bool isWanted(const char *filePath)
+{
+        for (int i = 0; i < numWanted; i++)
+        {
+                if (strcmp(wanted[i], filePath) == 0)
+                        return true;
+        }
+
+        return false;
+}
+
+static void freeSlot(PrefetchSlot *slot)
+{
+        memoryUsed -= slot->bytes;
+        slot->bytes = 0;
+        slot->songData = NULL;
+        slot->filePath[0] = '\0';
+        slot->used = false;
+}
+
+// Called with prefetchMutex held, which it lets go of while songs are unloaded
+static void unloadUnwanted(void)
+{
+        for (int i = 0; i < PREFETCH_SLOTS; i++)
+        {
+                PrefetchSlot *slot = &slots[i];
+
+                if (!slot->used || slot->loading || isWanted(slot->filePath))
+                        continue;
+
+                SongData *songData = slot->songData;
+                freeSlot(slot);
+
+                pthread_mutex_unlock(&prefetchMutex);
+                unloadSongData(&songData, prefetchState);
+                pthread_mutex_lock(&prefetchMutex);
+        }
+}
+
+// Called with prefetchMutex held. The nearest song that isn't loaded yet, if there is room for it.
+static PrefetchSlot *claimNextSlot(void)
+{
+        for (int i = 0; i < numWanted; i++)
+        {
+                if (taken[i] || findSlot(wanted[i]) != NULL)
+                        continue;
+
+                if (memoryUsed + PREFETCH_HEAD_BYTES > memoryLimit)
+                        return NULL;
+
+                for (int j = 0; j < PREFETCH_SLOTS; j++)
+                {
+                        if (slots[j].used)
+                                continue;
+
+                        c_strcpy(slots[j].filePath, wanted[i], sizeof(slots[j].filePath));
+                        slots[j].songData = NULL;
+                        slots[j].bytes = 0;
+                        slots[j].loading = true;
+                        slots[j].used = true;
+
+                        return &slots[j];
+                }
+
+                return NULL;
+        }
+
+        return NULL;
+}
+
+static void *prefetchThreadFunction(void *arg)
+{
+        (void)arg;
+
+        pthread_mutex_lock(&prefetchMutex);
+
+        while (prefetcherRunning)
+        {
+                unloadUnwanted();
+
+                PrefetchSlot *slot = claimNextSlot();
+
+                if (slot == NULL)
+                {
+                        pthread_cond_wait(&prefetchWake, &prefetchMutex);
+                        continue;
+                }
+
+                char filePath[MAXPATHLEN];
+                c_strcpy(filePath, slot->filePath, sizeof(filePath));
+
+                pthread_mutex_unlock(&prefetchMutex);
+
+                size_t bytesRead = warmFile(filePath);
+                SongData *songData = loadSongData(filePath, prefetchState);
+
+                pthread_mutex_lock(&prefetchMutex);
+
+                slot->songData = songData;
+                slot->bytes = getSongDataBytes(songData) + bytesRead;
+                slot->loading = false;
+                memoryUsed += slot->bytes;
+
+                pthread_cond_broadcast(&prefetchLoaded);
+        }
+
+        pthread_mutex_unlock(&prefetchMutex);
+
+        return NULL;
+}
+
+void startPrefetcher(AppState *state, int numTracks, int memoryLimitMb)
+{
+        if (prefetcherRunning || numTracks <= 0 || memoryLimitMb <= 0)
+                return;
+
+        prefetchState = state;
+        maxTracks = (numTracks < PREFETCH_MAX_TRACKS) ? numTracks : PREFETCH_MAX_TRACKS;
+        memoryLimit = (size_t)memoryLimitMb * 1024 * 1024;
+        prefetcherRunning = true;
+
+        if (pthread_create(&prefetchThread, NULL, prefetchThreadFunction, NULL) != 0)
+        {
+                perror("Failed to create prefetch thread");
+                prefetcherRunning = false;
+        }
+}
+
+void stopPrefetcher(void)
+{
+        if (!prefetcherRunning)
+                return;
+
+        pthread_mutex_lock(&prefetchMutex);
+        prefetcherRunning = false;
+        numWanted = 0;
+        pthread_cond_signal(&prefetchWake);
+        pthread_mutex_unlock(&prefetchMutex);
+
+        pthread_join(prefetchThread, NULL);
+
+        // Nothing is loading anymore, so everything is unloaded
+        pthread_mutex_lock(&prefetchMutex);
+        unloadUnwanted();
+        pthread_mutex_unlock(&prefetchMutex);
+}
+
+// This song and the ones after it in the playlist are loaded, the ones that came before are unloaded
+void prefetchFrom(Node *song)
+{
+        if (!prefetcherRunning)
+                return;
+
+        pthread_mutex_lock(&prefetchMutex);
+
+        numWanted = 0;
+
+        for (Node *node = song; node != NULL && numWanted < maxTracks + 1; node = getListNext(node))
+        {
+                if (node->song.filePath == NULL || node->song.filePath[0] == '\0')
+                        continue;
+
+                c_strcpy(wanted[numWanted], node->song.filePath, sizeof(wanted[numWanted]));
+                taken[numWanted] = false;
+                numWanted++;
+        }
+
+        pthread_cond_signal(&prefetchWake);
+        pthread_mutex_unlock(&prefetchMutex);
+}
+
+// Called with prefetchMutex held
+static void setTaken(const char *filePath, bool isTaken)
+{
+        for (int i = 0; i < numWanted; i++)
+        {
+                if (strcmp(wanted[i], filePath) == 0)
+                        taken[i] = isTaken;
+        }
+}
+
+// The prefetched song data, waiting for it if it is being loaded, or else it is loaded now. The caller owns it.
+// Returns NULL without taking anything if isCancelled says so before the song is taken or loaded.
+SongData *loadPrefetchedSongData(char *filePath, AppState *state, bool (*isCancelled)(void *data), void *data)
+{
+        SongData *songData = NULL;
+        bool found = false;
+
+        pthread_mutex_lock(&prefetchMutex);
+
+        PrefetchSlot *slot = findSlot(filePath);
+
+        while (slot != NULL && slot->loading)
+        {
+                pthread_cond_wait(&prefetchLoaded, &prefetchMutex);
+                slot = findSlot(filePath);
+        }
+
+        // It stays where it is for when it is wanted again
+        if (isCancelled != NULL && isCancelled(data))
+        {
+                pthread_mutex_unlock(&prefetchMutex);
+                return NULL;
+        }
+
+        // It doesn't have to be loaded again once it is taken
+        setTaken(filePath, true);
+
+        if (slot != NULL)
+        {
+                songData = slot->songData;
+                found = true;
+                freeSlot(slot);
+                pthread_cond_signal(&prefetchWake);
+        }
+
+        pthread_mutex_unlock(&prefetchMutex);
+
+        if (!found)
+                songData = loadSongData(filePath, state);
+
+        return songData;
+}
+
+// Song data from loadPrefetchedSongData that ended up not being used. It goes back in a slot if the song is still
+// coming up and there is room, or else it is unloaded.
+void returnPrefetchedSongData(char *filePath, SongData *songData, AppState *state)
+{
+        if (songData == NULL)
+                return;
+
+        size_t bytes = getSongDataBytes(songData);
+
+        pthread_mutex_lock(&prefetchMutex);
+
+        if (prefetcherRunning && isWanted(filePath) && findSlot(filePath) == NULL && memoryUsed + bytes <= memoryLimit)
+        {
+                for (int i = 0; i < PREFETCH_SLOTS; i++)
+                {
+                        if (slots[i].used)
+                                continue;
+
+                        c_strcpy(slots[i].filePath, filePath, sizeof(slots[i].filePath));
+                        slots[i].songData = songData;
+                        slots[i].bytes = bytes;
+                        slots[i].loading = false;
+                        slots[i].used = true;
+                        memoryUsed += bytes;
+
+                        setTaken(filePath, false);
+                        pthread_cond_broadcast(&prefetchLoaded);
+
+                        pthread_mutex_unlock(&prefetchMutex);
+                        return;
+                }
+        }
+
+        pthread_mutex_unlock(&prefetchMutex);
+
+        unloadSongData(&songData, state);
+}
@@ -0,0 +1,26 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "appstate.h"
+#include "playlist.h"
+#include "songloader.h"
+
+void startPrefetcher(AppState *state, int numTracks, int memoryLimitMb);
+
+void stopPrefetcher(void);
+
+void prefetchFrom(Node *song);
+
+SongData *loadPrefetchedSongData(char *filePath, AppState *state, bool (*isCancelled)(void *data), void *data);
+
+void returnPrefetchedSongData(char *filePath, SongData *songData, AppState *state);
+
+#endif
@@ -0,0 +1,392 @@
+#include "replaygain.h"
+
+/*
+
+replaygain.c
+
+ Applies the ReplayGain of the playing track to decoded audio, with a soft limiter so that turning
+ a track up doesn't make it clip.
+
+*/
+
+#define GAIN_RAMP_MS 20            // From one track's gain to the next
+#define LIMITER_THRESHOLD 0.989f   // About -0.1 dBFS
+#define LIMITER_LOOKAHEAD 64       // Frames the limiter starts turning down before a peak
+#define LIMITER_RELEASE_MS 100
+#define GAIN_BLOCK_FRAMES 1024
+
+// Four samples at a time. The compiler turns these into SSE2 or NEON instructions where it can.
+typedef float Float4 __attribute__((vector_size(16)));
+typedef ma_int32 Int4 __attribute__((vector_size(16)));
+typedef ma_int16 Short4 __attribute__((vector_size(8)));
+typedef double Double2 __attribute__((vector_size(16)));
+typedef ma_int32 Int2 __attribute__((vector_size(8)));
+
+typedef struct
+{
+        float gain; // For the next frame
+        float targetGain;
+        float rampStep;       // Per frame
+        ma_uint32 rampFrames; // Left until the target gain is reached
+        float limit;          // What the limiter turns the gain down by, 1 when it isn't limiting
+        float releaseCoef;
+        ma_uint32 sampleRate;
+        bool started;
+} GainStage;
+
+// Only used by the decoder thread
+static GainStage gainStage = {1.0f, 1.0f, 0.0f, 0, 1.0f, 0.0f, 0, false};
+static float frameGains[GAIN_BLOCK_FRAMES];
+static float frameLimits[GAIN_BLOCK_FRAMES];
+
+double dbToLinear(double db)
+{
+        return pow(10.0, db / 20.0);
+}
+
+double getReplayGainDb(const SongData *songData)
+{
+        if (songData == NULL || songData->metadata == NULL)
+                return 0.0;
+
+        if (songData->metadata->replaygainTrack > -50.0)
+                return songData->metadata->replaygainTrack;
+
+        if (songData->metadata->replaygainAlbum > -50.0)
+                return songData->metadata->replaygainAlbum;
+
+        return 0.0;
+}
+
+// Playback starts over, so the next gain is used from the first frame on
+void resetReplayGain(ma_uint32 sampleRate)
+{
+        gainStage.gain = 1.0f;
+        gainStage.targetGain = 1.0f;
+        gainStage.rampStep = 0.0f;
+        gainStage.rampFrames = 0;
+        gainStage.limit = 1.0f;
+        gainStage.sampleRate = sampleRate;
+        gainStage.releaseCoef = (sampleRate > 0) ? 1.0f - expf(-1000.0f / (LIMITER_RELEASE_MS * (float)sampleRate)) : 1.0f;
+        gainStage.started = false;
+}
+
+// A change of gain, at a change of track, is a short ramp instead of a step
+void setReplayGain(double gainDb)
+{
+        float target = (float)dbToLinear(gainDb);
+
+        if (!gainStage.started)
+        {
+                gainStage.gain = target;
+                gainStage.targetGain = target;
+                gainStage.rampFrames = 0;
+                gainStage.started = true;
+                return;
+        }
+
+        if (target == gainStage.targetGain)
+                return;
+
+        ma_uint32 rampFrames = gainStage.sampleRate * GAIN_RAMP_MS / 1000;
+
+        if (rampFrames == 0)
+                rampFrames = 1;
+
+        gainStage.targetGain = target;
+        gainStage.rampFrames = rampFrames;
+        gainStage.rampStep = (target - gainStage.gain) / rampFrames;
+}
+
+static inline Float4 splat(float value)
+{
+        return (Float4){value, value, value, value};
+}
+
+static inline Float4 absOf(Float4 v)
+{
+        return (Float4)((Int4)v & 0x7fffffff);
+}
+
+static inline Float4 maxOf(Float4 a, Float4 b)
+{
+        Int4 greater = a > b;
+
+        return (Float4)((greater & (Int4)a) | (~greater & (Int4)b));
+}
+
+static inline float largestOf(Float4 v)
+{
+        float largest = v[0];
+
+        for (int i = 1; i < 4; i++)
+        {
+                if (v[i] > largest)
+                        largest = v[i];
+        }
+
+        return largest;
+}
+
+// The largest sample, with full scale at 1
+static float findPeak(const void *pSamples, size_t count, ma_format format)
+{
+        Float4 peak = splat(0.0f);
+        float tailPeak = 0.0f;
+        float scale = 1.0f;
+        size_t i = 0;
+
+        switch (format)
+        {
+        case ma_format_f32:
+        {
+                const float *samples = pSamples;
+
+                for (; i + 4 <= count; i += 4)
+                {
+                        Float4 v;
+                        memcpy(&v, samples + i, sizeof(v));
+                        peak = maxOf(absOf(v), peak);
+                }
+
+                for (; i < count; i++)
+                        tailPeak = fmaxf(tailPeak, fabsf(samples[i]));
+                break;
+        }
+        case ma_format_s16:
+        {
+                const ma_int16 *samples = pSamples;
+
+                for (; i + 4 <= count; i += 4)
+                {
+                        Short4 v;
+                        memcpy(&v, samples + i, sizeof(v));
+                        peak = maxOf(absOf(__builtin_convertvector(v, Float4)), peak);
+                }
+
+                for (; i < count; i++)
+                        tailPeak = fmaxf(tailPeak, fabsf((float)samples[i]));
+
+                scale = 1.0f / 32768.0f;
+                break;
+        }
+        case ma_format_s32:
+        {
+                const ma_int32 *samples = pSamples;
+
+                for (; i + 4 <= count; i += 4)
+                {
+                        Int4 v;
+                        memcpy(&v, samples + i, sizeof(v));
+                        peak = maxOf(absOf(__builtin_convertvector(v, Float4)), peak);
+                }
+
+                for (; i < count; i++)
+                        tailPeak = fmaxf(tailPeak, fabsf((float)samples[i]));
+
+                scale = 1.0f / 2147483648.0f;
+                break;
+        }
+        default:
+                break;
+        }
+
+        return fmaxf(largestOf(peak), tailPeak) * scale;
+}
+
+// The caller makes sure the samples can't go over full scale
+static void scaleSamples(void *pSamples, size_t count, ma_format format, float gain)
+{
+        size_t i = 0;
+
+        switch (format)
+        {
+        case ma_format_f32:
+        {
+                float *samples = pSamples;
+                Float4 g = splat(gain);
+
+                for (; i + 8 <= count; i += 8)
+                {
+                        Float4 a, b;
+                        memcpy(&a, samples + i, sizeof(a));
+                        memcpy(&b, samples + i + 4, sizeof(b));
+                        a *= g;
+                        b *= g;
+                        memcpy(samples + i, &a, sizeof(a));
+                        memcpy(samples + i + 4, &b, sizeof(b));
+                }
+
+                for (; i < count; i++)
+                        samples[i] *= gain;
+                break;
+        }
+        case ma_format_s16:
+        {
+                ma_int16 *samples = pSamples;
+                Float4 g = splat(gain);
+                Float4 rounding = splat(12582912.0f); // Adding and taking away 1.5 * 2^23 rounds to the nearest integer
+
+                for (; i + 4 <= count; i += 4)
+                {
+                        Short4 v;
+                        memcpy(&v, samples + i, sizeof(v));
+                        Float4 scaled = __builtin_convertvector(v, Float4) * g;
+                        scaled = (scaled + rounding) - rounding;
+                        v = __builtin_convertvector(__builtin_convertvector(scaled, Int4), Short4);
+                        memcpy(samples + i, &v, sizeof(v));
+                }
+
+                for (; i < count; i++)
+                        samples[i] = (ma_int16)lrintf(samples[i] * gain);
+                break;
+        }
+        case ma_format_s32:
+        {
+                // In doubles, floats don't have the precision for 32-bit samples
+                ma_int32 *samples = pSamples;
+                Double2 g = {gain, gain};
+                Double2 rounding = {6755399441055744.0, 6755399441055744.0}; // 1.5 * 2^52
+
+                for (; i + 2 <= count; i += 2)
+                {
+                        Int2 v;
+                        memcpy(&v, samples + i, sizeof(v));
+                        Double2 scaled = __builtin_convertvector(v, Double2) * g;
+                        scaled = (scaled + rounding) - rounding;
+                        v = __builtin_convertvector(scaled, Int2);
+                        memcpy(samples + i, &v, sizeof(v));
+                }
+
+                for (; i < count; i++)
+                        samples[i] = (ma_int32)lrint(samples[i] * (double)gain);
+                break;
+        }
+        default:
+                break;
+        }
+}
+
+static inline float sampleLevel(const void *pSamples, size_t i, ma_format format)
+{
+        switch (format)
+        {
+        case ma_format_s16:
+                return fabsf(((const ma_int16 *)pSamples)[i] / 32768.0f);
+        case ma_format_s32:
+                return fabsf(((const ma_int32 *)pSamples)[i] / 2147483648.0f);
+        default:
+                return fabsf(((const float *)pSamples)[i]);
+        }
+}
+
+static void scaleFrame(void *pSamples, size_t first, ma_uint32 channels, ma_format format, float factor)
+{
+        for (size_t i = first; i < first + channels; i++)
+        {
+                switch (format)
+                {
+                case ma_format_s16:
+                {
+                        long sample = lrintf(((ma_int16 *)pSamples)[i] * factor);
+                        ((ma_int16 *)pSamples)[i] = (ma_int16)(sample > 32767 ? 32767 : (sample < -32768 ? -32768 : sample));
+                        break;
+                }
+                case ma_format_s32:
+                {
+                        long long sample = llrint(((ma_int32 *)pSamples)[i] * (double)factor);
+                        ((ma_int32 *)pSamples)[i] = (ma_int32)(sample > 2147483647LL ? 2147483647LL : (sample < -2147483648LL ? -2147483648LL : sample));
+                        break;
+                }
+                default:
+                {
+                        float sample = ((float *)pSamples)[i] * factor;
+                        ((float *)pSamples)[i] = fmaxf(-1.0f, fminf(1.0f, sample));
+                        break;
+                }
+                }
+        }
+}
+
+// Frame by frame, while the gain ramps or the limiter is turning it down
+static void limitFrames(void *pFrames, size_t frameCount, ma_format format, ma_uint32 channels)
+{
+        // The gain of each frame and how much the limiter has to take off it to stay under the threshold
+        for (size_t i = 0; i < frameCount; i++)
+        {
+                float gain = gainStage.gain;
+                float peak = 0.0f;
+
+                if (gainStage.rampFrames > 0)
+                {
+                        gainStage.rampFrames--;
+                        gainStage.gain = (gainStage.rampFrames == 0) ? gainStage.targetGain : gainStage.gain + gainStage.rampStep;
+                }
+
+                for (ma_uint32 ch = 0; ch < channels; ch++)
+                        peak = fmaxf(peak, sampleLevel(pFrames, i * channels + ch, format));
+
+                peak *= gain;
+
+                frameGains[i] = gain;
+                frameLimits[i] = (peak > LIMITER_THRESHOLD) ? LIMITER_THRESHOLD / peak : 1.0f;
+        }
+
+        // Looking ahead, it starts turning down before a peak. A peak at the start of a block is limited at once.
+        float next = 1.0f;
+        for (size_t i = frameCount; i-- > 0;)
+        {
+                next = fminf(frameLimits[i], next + 1.0f / LIMITER_LOOKAHEAD);
+                frameLimits[i] = next;
+        }
+
+        for (size_t i = 0; i < frameCount; i++)
+        {
+                float limit = gainStage.limit + (1.0f - gainStage.limit) * gainStage.releaseCoef;
+
+                gainStage.limit = fminf(limit, frameLimits[i]);
+
+                scaleFrame(pFrames, i * channels, channels, format, frameGains[i] * gainStage.limit);
+        }
+
+        if (gainStage.limit > 0.9999f)
+                gainStage.limit = 1.0f;
+}
+
+// Decoder thread only, on frames of one track
+void applyReplayGain(void *pFrames, ma_uint64 frameCount, ma_format format, ma_uint32 channels)
+{
+        if (pFrames == NULL || frameCount == 0 || channels == 0)
+                return;
+
+        if (format != ma_format_f32 && format != ma_format_s16 && format != ma_format_s32)
+                return;
+
+        if (gainStage.rampFrames == 0 && gainStage.limit == 1.0f)
+        {
+                size_t count = frameCount * channels;
+                float gain = gainStage.gain;
+
+                if (gain == 1.0f)
+                        return;
+
+                // Turning down can't clip, and turning up only can if it goes over the threshold
+                if (gain < 1.0f || findPeak(pFrames, count, format) * gain <= LIMITER_THRESHOLD)
+                {
+                        scaleSamples(pFrames, count, format, gain);
+                        return;
+                }
+        }
+
+        ma_uint32 bytesPerFrame = ma_get_bytes_per_frame(format, channels);
+
+        for (ma_uint64 done = 0; done < frameCount; done += GAIN_BLOCK_FRAMES)
+        {
+                ma_uint64 blockFrames = frameCount - done;
+
+                if (blockFrames > GAIN_BLOCK_FRAMES)
+                        blockFrames = GAIN_BLOCK_FRAMES;
+
+                limitFrames((unsigned char *)pFrames + done * bytesPerFrame, blockFrames, format, channels);
+        }
+}
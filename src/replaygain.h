@@ -0,0 +1,22 @@
+#ifndef REPLAYGAIN_H
+#define REPLAYGAIN_H
+
+#include <miniaudio.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "soundcommon.h"
+
+double dbToLinear(double db);
+
+double getReplayGainDb(const SongData *songData);
+
+void resetReplayGain(ma_uint32 sampleRate);
+
+void setReplayGain(double gainDb);
+
+void applyReplayGain(void *pFrames, ma_uint64 frameCount, ma_format format, ma_uint32 channels);
+
+#endif
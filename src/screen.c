@@ -0,0 +1,988 @@
+#include "screen.h"
+#include "term.h"
+
+/*
+
+screen.c
+
+ Everything the player prints to the terminal goes through here. What is printed between two flushes
+ is a frame. The frame is run through a small terminal emulator into a grid of cells, and only the
+ cells that differ from what the terminal already shows are written, with one write per frame.
+ Frames the emulator can't follow, like ones with images drawn in a pixel protocol, are written the
+ way they were printed.
+
+*/
+
+#define SCREEN_MAX_TEXT 8      // A character and its combining marks, in UTF-8
+#define SCREEN_MAX_PARAMS 16   // Parameters of one escape sequence
+#define SCREEN_MAX_SKIP_CELLS 4 // Unchanged cells that are cheaper to print again than to jump over
+
+#define COLOR_DEFAULT 0
+#define COLOR_INDEXED (1u << 24)
+#define COLOR_RGB (2u << 24)
+
+#define ATTR_BOLD 1
+#define ATTR_DIM 2
+#define ATTR_ITALIC 4
+#define ATTR_UNDERLINE 8
+#define ATTR_BLINK 16
+#define ATTR_REVERSE 32
+#define ATTR_STRIKE 64
+
+typedef struct
+{
+        uint32_t fg; // COLOR_DEFAULT, or COLOR_INDEXED or COLOR_RGB with the color in the low bits
+        uint32_t bg;
+        uint8_t attrs;
+} ScreenStyle;
+
+typedef struct
+{
+        char text[SCREEN_MAX_TEXT]; // Empty for the right half of a wide character
+        uint8_t width;
+        ScreenStyle style;
+} ScreenCell;
+
+typedef struct
+{
+        char *data;
+        size_t length;
+        size_t capacity;
+} ScreenBuffer;
+
+static ScreenBuffer frame;  // What was printed since the last flush
+static ScreenBuffer output; // What is written to the terminal
+static ScreenBuffer modes;  // Mode changes, like hiding the cursor, in the order they were printed
+
+static ScreenCell *front = NULL; // What the terminal shows
+static ScreenCell *back = NULL;  // What was drawn
+static int screenWidth = 0;
+static int screenHeight = 0;
+
+// The emulated terminal
+static int cursorRow = 0;
+static int cursorCol = 0;
+static bool wrapPending = false;
+static int savedRow = 0;
+static int savedCol = 0;
+static bool savedKnown = false;
+static bool cursorSavedInFrame = false;
+static ScreenStyle pen = {0};
+static bool cellsKnown = false; // The cells are what the terminal shows
+static bool cursorKnown = false;
+
+// The real terminal, after what was written last
+static int outRow = -1;
+static int outCol = -1;
+static ScreenStyle outPen = {0};
+
+static ScreenStats screenStats = {0};
+static pthread_mutex_t screenMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool reserve(ScreenBuffer *buffer, size_t length)
+{
+        if (buffer->length + length + 1 <= buffer->capacity)
+                return true;
+
+        size_t capacity = (buffer->capacity > 0) ? buffer->capacity : 16384;
+
+        while (capacity < buffer->length + length + 1)
+                capacity *= 2;
+
+        char *data = realloc(buffer->data, capacity);
+        if (data == NULL)
+                return false;
+
+        buffer->data = data;
+        buffer->capacity = capacity;
+
+        return true;
+}
+
+static void append(ScreenBuffer *buffer, const char *data, size_t length)
+{
+        if (!reserve(buffer, length))
+                return;
+
+        memcpy(buffer->data + buffer->length, data, length);
+        buffer->length += length;
+        buffer->data[buffer->length] = '\0';
+}
+
+static void appendf(ScreenBuffer *buffer, const char *format, ...)
+{
+        char text[64];
+        va_list args;
+
+        va_start(args, format);
+        int length = vsnprintf(text, sizeof(text), format, args);
+        va_end(args);
+
+        if (length > 0)
+                append(buffer, text, ((size_t)length < sizeof(text)) ? (size_t)length : sizeof(text) - 1);
+}
+
+void screenPrintf(const char *format, ...)
+{
+        va_list args;
+        va_list argsCopy;
+
+        pthread_mutex_lock(&screenMutex);
+
+        va_start(args, format);
+        va_copy(argsCopy, args);
+
+        int length = vsnprintf(NULL, 0, format, args);
+
+        if (length > 0 && reserve(&frame, (size_t)length))
+        {
+                vsnprintf(frame.data + frame.length, (size_t)length + 1, format, argsCopy);
+                frame.length += (size_t)length;
+        }
+
+        va_end(argsCopy);
+        va_end(args);
+
+        pthread_mutex_unlock(&screenMutex);
+}
+
+// For output that is ready as it is, like a rendered image
+void screenWrite(const char *data, size_t length)
+{
+        pthread_mutex_lock(&screenMutex);
+
+        append(&frame, data, length);
+
+        pthread_mutex_unlock(&screenMutex);
+}
+
+static ScreenCell *cellAt(ScreenCell *cells, int row, int col)
+{
+        return &cells[row * screenWidth + col];
+}
+
+static ScreenCell blankCell(void)
+{
+        // Erased cells keep the background color, like on most terminals
+        ScreenCell cell = {{' ', '\0'}, 1, {COLOR_DEFAULT, pen.bg, 0}};
+
+        return cell;
+}
+
+static bool sameStyle(ScreenStyle a, ScreenStyle b)
+{
+        return a.fg == b.fg && a.bg == b.bg && a.attrs == b.attrs;
+}
+
+static bool sameCell(const ScreenCell *a, const ScreenCell *b)
+{
+        return a->width == b->width && sameStyle(a->style, b->style) && strcmp(a->text, b->text) == 0;
+}
+
+static void eraseCells(int row, int fromCol, int toCol)
+{
+        ScreenCell blank = blankCell();
+
+        for (int col = fromCol; col <= toCol && col < screenWidth; col++)
+                *cellAt(back, row, col) = blank;
+}
+
+static void eraseRows(int fromRow, int toRow)
+{
+        for (int row = fromRow; row <= toRow && row < screenHeight; row++)
+                eraseCells(row, 0, screenWidth - 1);
+}
+
+static void resizeScreen(int width, int height)
+{
+        free(front);
+        free(back);
+
+        screenWidth = width;
+        screenHeight = height;
+
+        front = calloc((size_t)width * height, sizeof(ScreenCell));
+        back = calloc((size_t)width * height, sizeof(ScreenCell));
+
+        if (front == NULL || back == NULL)
+        {
+                free(front);
+                free(back);
+                front = back = NULL;
+                screenWidth = screenHeight = 0;
+        }
+        else
+        {
+                eraseRows(0, height - 1);
+        }
+
+        // The terminal reflowed its contents, so what it shows isn't known anymore
+        cellsKnown = false;
+        cursorKnown = false;
+        savedKnown = false;
+}
+
+static void moveCursor(int row, int col)
+{
+        cursorRow = (row < 0) ? 0 : (row >= screenHeight ? screenHeight - 1 : row);
+        cursorCol = (col < 0) ? 0 : (col >= screenWidth ? screenWidth - 1 : col);
+        wrapPending = false;
+}
+
+static void lineFeed(void)
+{
+        // The tty turns a line feed into a carriage return and a line feed
+        cursorCol = 0;
+        wrapPending = false;
+
+        if (cursorRow < screenHeight - 1)
+        {
+                cursorRow++;
+                return;
+        }
+
+        memmove(back, back + screenWidth, (size_t)(screenHeight - 1) * screenWidth * sizeof(ScreenCell));
+        eraseCells(screenHeight - 1, 0, screenWidth - 1);
+}
+
+static int getCharWidth(gunichar c)
+{
+        if (g_unichar_iszerowidth(c) || g_unichar_ismark(c))
+                return 0;
+
+        return g_unichar_iswide(c) ? 2 : 1;
+}
+
+static void putChar(const char *text, int length, int width)
+{
+        if (!cursorKnown)
+        {
+                cellsKnown = false;
+                return;
+        }
+
+        if (width == 0)
+        {
+                // Combining marks go with the character before them
+                int col = wrapPending ? cursorCol : cursorCol - 1;
+                if (col < 0)
+                        return;
+
+                ScreenCell *cell = cellAt(back, cursorRow, col);
+                if (cell->width == 0 && col > 0)
+                        cell = cellAt(back, cursorRow, col - 1);
+
+                size_t used = strlen(cell->text);
+                if (used + length < SCREEN_MAX_TEXT)
+                {
+                        memcpy(cell->text + used, text, length);
+                        cell->text[used + length] = '\0';
+                }
+                return;
+        }
+
+        if (width > screenWidth)
+                return;
+
+        if (wrapPending || cursorCol + width > screenWidth)
+                lineFeed();
+
+        ScreenCell *cell = cellAt(back, cursorRow, cursorCol);
+
+        // Whatever was partly overwritten of a wide character is erased
+        if (cell->width == 0 && cursorCol > 0)
+                eraseCells(cursorRow, cursorCol - 1, cursorCol - 1);
+        if (cursorCol + width < screenWidth && cellAt(back, cursorRow, cursorCol + width)->width == 0)
+                eraseCells(cursorRow, cursorCol + width, cursorCol + width);
+
+        memcpy(cell->text, text, length);
+        cell->text[length] = '\0';
+        cell->width = (uint8_t)width;
+        cell->style = pen;
+
+        if (width == 2)
+        {
+                ScreenCell *right = cellAt(back, cursorRow, cursorCol + 1);
+                right->text[0] = '\0';
+                right->width = 0;
+                right->style = pen;
+        }
+
+        cursorCol += width;
+
+        if (cursorCol >= screenWidth)
+        {
+                cursorCol = screenWidth - 1;
+                wrapPending = true;
+        }
+}
+
+static int parseColor(const int *params, int count, int *i, uint32_t *color)
+{
+        if (*i + 1 < count && params[*i + 1] == 5 && *i + 2 < count)
+        {
+                *color = COLOR_INDEXED | (params[*i + 2] & 0xFF);
+                *i += 2;
+                return 0;
+        }
+
+        if (*i + 1 < count && params[*i + 1] == 2 && *i + 4 < count)
+        {
+                *color = COLOR_RGB | ((params[*i + 2] & 0xFF) << 16) | ((params[*i + 3] & 0xFF) << 8) | (params[*i + 4] & 0xFF);
+                *i += 4;
+                return 0;
+        }
+
+        return -1;
+}
+
+static void setGraphicsRendition(const int *params, int count)
+{
+        if (count == 0)
+        {
+                pen = (ScreenStyle){0};
+                return;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+                int p = params[i];
+
+                if (p == 0)
+                        pen = (ScreenStyle){0};
+                else if (p == 1)
+                        pen.attrs |= ATTR_BOLD;
+                else if (p == 2)
+                        pen.attrs |= ATTR_DIM;
+                else if (p == 3)
+                        pen.attrs |= ATTR_ITALIC;
+                else if (p == 4)
+                        pen.attrs |= ATTR_UNDERLINE;
+                else if (p == 5)
+                        pen.attrs |= ATTR_BLINK;
+                else if (p == 7)
+                        pen.attrs |= ATTR_REVERSE;
+                else if (p == 9)
+                        pen.attrs |= ATTR_STRIKE;
+                else if (p == 22)
+                        pen.attrs &= ~(ATTR_BOLD | ATTR_DIM);
+                else if (p == 23)
+                        pen.attrs &= ~ATTR_ITALIC;
+                else if (p == 24)
+                        pen.attrs &= ~ATTR_UNDERLINE;
+                else if (p == 25)
+                        pen.attrs &= ~ATTR_BLINK;
+                else if (p == 27)
+                        pen.attrs &= ~ATTR_REVERSE;
+                else if (p == 29)
+                        pen.attrs &= ~ATTR_STRIKE;
+                else if (p >= 30 && p <= 37)
+                        pen.fg = COLOR_INDEXED | (p - 30);
+                else if (p == 38)
+                {
+                        if (parseColor(params, count, &i, &pen.fg) != 0)
+                                return;
+                }
+                else if (p == 39)
+                        pen.fg = COLOR_DEFAULT;
+                else if (p >= 40 && p <= 47)
+                        pen.bg = COLOR_INDEXED | (p - 40);
+                else if (p == 48)
+                {
+                        if (parseColor(params, count, &i, &pen.bg) != 0)
+                                return;
+                }
+                else if (p == 49)
+                        pen.bg = COLOR_DEFAULT;
+                else if (p >= 90 && p <= 97)
+                        pen.fg = COLOR_INDEXED | (p - 90 + 8);
+                else if (p >= 100 && p <= 107)
+                        pen.bg = COLOR_INDEXED | (p - 100 + 8);
+        }
+}
+
+// Returns false for what the emulator can't follow
+static bool controlSequence(const char *start, size_t length, char prefix, const int *params, int count, char final)
+{
+        int n = (count > 0 && params[0] > 0) ? params[0] : 1;
+
+        if (prefix == '?')
+        {
+                for (int i = 0; i < count; i++)
+                {
+                        // The alternate screen has its own contents
+                        if (params[i] == 1049 || params[i] == 1047 || params[i] == 47)
+                        {
+                                if (final == 'h')
+                                {
+                                        eraseRows(0, screenHeight - 1);
+                                }
+                                else
+                                {
+                                        cellsKnown = false;
+                                        cursorKnown = false;
+                                }
+                                return false;
+                        }
+                }
+
+                if (final != 'h' && final != 'l')
+                        return false;
+
+                append(&modes, start, length);
+                return true;
+        }
+
+        if (prefix != '\0')
+                return false;
+
+        if (!cursorKnown && final != 'H' && final != 'f' && final != 'm' && final != 's' && final != 'u' && final != 'J')
+        {
+                if (final == 'K' || final == 'X')
+                        cellsKnown = false;
+                return true;
+        }
+
+        switch (final)
+        {
+        case 'A':
+                moveCursor(cursorRow - n, cursorCol);
+                break;
+        case 'B':
+                moveCursor(cursorRow + n, cursorCol);
+                break;
+        case 'C':
+                moveCursor(cursorRow, cursorCol + n);
+                break;
+        case 'D':
+                moveCursor(cursorRow, cursorCol - n);
+                break;
+        case 'E':
+                moveCursor(cursorRow + n, 0);
+                break;
+        case 'F':
+                moveCursor(cursorRow - n, 0);
+                break;
+        case 'G':
+                moveCursor(cursorRow, n - 1);
+                break;
+        case 'd':
+                moveCursor(n - 1, cursorCol);
+                break;
+        case 'H':
+        case 'f':
+                moveCursor(n - 1, (count > 1 && params[1] > 0) ? params[1] - 1 : 0);
+                cursorKnown = true;
+                break;
+        case 'J':
+        {
+                int mode = (count > 0) ? params[0] : 0;
+
+                if (mode == 2)
+                {
+                        eraseRows(0, screenHeight - 1);
+                        cellsKnown = true;
+                }
+                else if (mode == 3)
+                {
+                        // Only the scrollback
+                }
+                else if (!cursorKnown)
+                {
+                        cellsKnown = false;
+                }
+                else if (mode == 0)
+                {
+                        eraseCells(cursorRow, cursorCol, screenWidth - 1);
+                        eraseRows(cursorRow + 1, screenHeight - 1);
+                }
+                else if (mode == 1)
+                {
+                        eraseRows(0, cursorRow - 1);
+                        eraseCells(cursorRow, 0, cursorCol);
+                }
+                break;
+        }
+        case 'K':
+        {
+                int mode = (count > 0) ? params[0] : 0;
+
+                if (mode == 0)
+                        eraseCells(cursorRow, cursorCol, screenWidth - 1);
+                else if (mode == 1)
+                        eraseCells(cursorRow, 0, cursorCol);
+                else if (mode == 2)
+                        eraseCells(cursorRow, 0, screenWidth - 1);
+                break;
+        }
+        case 'X':
+                eraseCells(cursorRow, cursorCol, cursorCol + n - 1);
+                break;
+        case 'm':
+                setGraphicsRendition(params, count);
+                break;
+        case 's':
+                savedRow = cursorRow;
+                savedCol = cursorCol;
+                savedKnown = cursorKnown;
+                cursorSavedInFrame = true;
+                break;
+        case 'u':
+                cursorKnown = savedKnown;
+                moveCursor(savedRow, savedCol);
+                break;
+        default:
+                // Like inserting or deleting lines, which this player doesn't print
+                cellsKnown = false;
+                return false;
+        }
+
+        return true;
+}
+
+// Skips a string like a pixel image or a window title, ended by ST or BEL
+static size_t skipString(const char *data, size_t length, size_t i)
+{
+        while (i < length)
+        {
+                if (data[i] == '\a')
+                        return i + 1;
+
+                if (data[i] == '\033' && i + 1 < length && data[i + 1] == '\\')
+                        return i + 2;
+
+                i++;
+        }
+
+        return length;
+}
+
+// Runs the frame through the emulator. Returns false if it can't be diffed.
+static bool interpretFrame(void)
+{
+        const char *data = frame.data;
+        size_t length = frame.length;
+        bool tracked = true;
+
+        for (size_t i = 0; i < length;)
+        {
+                unsigned char c = (unsigned char)data[i];
+
+                if (c == '\033')
+                {
+                        if (i + 1 >= length)
+                                break;
+
+                        char kind = data[i + 1];
+
+                        if (kind == '[')
+                        {
+                                size_t start = i;
+                                int params[SCREEN_MAX_PARAMS] = {0};
+                                int count = 0;
+                                char prefix = '\0';
+                                bool intermediate = false;
+
+                                i += 2;
+
+                                if (i < length && (data[i] == '?' || data[i] == '>' || data[i] == '=' || data[i] == '<'))
+                                        prefix = data[i++];
+
+                                bool inParam = false;
+
+                                while (i < length && (unsigned char)data[i] >= 0x20 && (unsigned char)data[i] <= 0x3F)
+                                {
+                                        if (data[i] >= '0' && data[i] <= '9')
+                                        {
+                                                if (count < SCREEN_MAX_PARAMS)
+                                                {
+                                                        if (!inParam)
+                                                                count++;
+                                                        params[count - 1] = params[count - 1] * 10 + (data[i] - '0');
+                                                }
+                                                inParam = true;
+                                        }
+                                        else if (data[i] == ';' || data[i] == ':')
+                                        {
+                                                if (!inParam && count < SCREEN_MAX_PARAMS)
+                                                        count++; // An empty parameter
+                                                inParam = false;
+                                        }
+                                        else
+                                        {
+                                                intermediate = true;
+                                        }
+                                        i++;
+                                }
+
+                                if (i >= length)
+                                        break;
+
+                                char final = data[i++];
+
+                                if (intermediate || !controlSequence(data + start, i - start, prefix, params, count, final))
+                                        tracked = false;
+                        }
+                        else if (kind == ']' || kind == 'P' || kind == '_' || kind == '^' || kind == 'X')
+                        {
+                                // Images in the sixel, kitty or iTerm protocols, and anything else sent as a string.
+                                // Where they leave the cursor depends on the terminal.
+                                i = skipString(data, length, i + 2);
+                                cellsKnown = false;
+                                cursorKnown = false;
+                                tracked = false;
+                        }
+                        else if (kind == 'c')
+                        {
+                                pen = (ScreenStyle){0};
+                                eraseRows(0, screenHeight - 1);
+                                moveCursor(0, 0);
+                                cellsKnown = true;
+                                cursorKnown = true;
+                                tracked = false;
+                                i += 2;
+                        }
+                        else if (kind == '7')
+                        {
+                                savedRow = cursorRow;
+                                savedCol = cursorCol;
+                                savedKnown = cursorKnown;
+                                tracked = false;
+                                i += 2;
+                        }
+                        else if (kind == '8')
+                        {
+                                cursorKnown = savedKnown;
+                                moveCursor(savedRow, savedCol);
+                                tracked = false;
+                                i += 2;
+                        }
+                        else
+                        {
+                                tracked = false;
+                                i += 2;
+                        }
+                }
+                else if (c == '\r')
+                {
+                        cursorCol = 0;
+                        wrapPending = false;
+                        i++;
+                }
+                else if (c == '\n')
+                {
+                        if (cursorKnown)
+                                lineFeed();
+                        i++;
+                }
+                else if (c == '\b')
+                {
+                        if (cursorCol > 0)
+                                cursorCol--;
+                        wrapPending = false;
+                        i++;
+                }
+                else if (c == '\t')
+                {
+                        moveCursor(cursorRow, (cursorCol / 8 + 1) * 8);
+                        i++;
+                }
+                else if (c == '\a')
+                {
+                        append(&modes, "\a", 1);
+                        i++;
+                }
+                else if (c < 0x20 || c == 0x7F)
+                {
+                        i++;
+                }
+                else
+                {
+                        const char *end = g_utf8_find_next_char(data + i, data + length);
+                        int charLength = (end != NULL) ? (int)(end - (data + i)) : (int)(length - i);
+                        gunichar uc = g_utf8_get_char_validated(data + i, charLength);
+
+                        if (charLength <= 0 || charLength >= SCREEN_MAX_TEXT || uc == (gunichar)-1 || uc == (gunichar)-2)
+                        {
+                                // Not valid UTF-8, printed as a replacement character
+                                putChar("\xEF\xBF\xBD", 3, 1);
+                                i++;
+                                continue;
+                        }
+
+                        putChar(data + i, charLength, getCharWidth(uc));
+                        i += charLength;
+                }
+        }
+
+        return tracked;
+}
+
+static void appendColor(ScreenBuffer *buffer, uint32_t color, bool background)
+{
+        if (color == COLOR_DEFAULT)
+                appendf(buffer, ";%d", background ? 49 : 39);
+        else if ((color & COLOR_RGB) == COLOR_RGB)
+                appendf(buffer, ";%d;2;%u;%u;%u", background ? 48 : 38, (color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF);
+        else if ((color & 0xFF) < 8)
+                appendf(buffer, ";%u", (background ? 40 : 30) + (color & 0xFF));
+        else if ((color & 0xFF) < 16)
+                appendf(buffer, ";%u", (background ? 100 : 90) + (color & 0xFF) - 8);
+        else
+                appendf(buffer, ";%d;5;%u", background ? 48 : 38, color & 0xFF);
+}
+
+// Changes the pen with one sequence that holds only what differs
+static void setPen(ScreenStyle style)
+{
+        static const int codes[] = {1, 2, 3, 4, 5, 7, 9};
+
+        if (sameStyle(style, outPen))
+                return;
+
+        ScreenBuffer sgr = {0};
+        ScreenStyle from = outPen;
+
+        // Attributes are only taken away one by one if that doesn't mean starting over anyway
+        if ((from.attrs & ~style.attrs) != 0)
+        {
+                append(&sgr, ";0", 2);
+                from = (ScreenStyle){0};
+        }
+
+        for (int i = 0; i < 7; i++)
+        {
+                if ((style.attrs & (1 << i)) && !(from.attrs & (1 << i)))
+                        appendf(&sgr, ";%d", codes[i]);
+        }
+
+        if (style.fg != from.fg)
+                appendColor(&sgr, style.fg, false);
+
+        if (style.bg != from.bg)
+                appendColor(&sgr, style.bg, true);
+
+        if (sgr.length > 0)
+        {
+                append(&output, "\033[", 2);
+                append(&output, sgr.data + 1, sgr.length - 1); // Without the first separator
+                append(&output, "m", 1);
+        }
+
+        free(sgr.data);
+
+        outPen = style;
+}
+
+static bool canReprint(int row, int fromCol, int toCol)
+{
+        for (int col = fromCol; col < toCol; col++)
+        {
+                ScreenCell *cell = cellAt(back, row, col);
+
+                if (cell->width != 1 || !sameStyle(cell->style, outPen))
+                        return false;
+        }
+
+        return true;
+}
+
+static void moveOutput(int row, int col)
+{
+        if (row == outRow && col == outCol)
+                return;
+
+        if (row == outRow && col > outCol && outCol >= 0 && outCol < screenWidth)
+        {
+                if (col - outCol <= SCREEN_MAX_SKIP_CELLS && canReprint(row, outCol, col))
+                {
+                        for (int i = outCol; i < col; i++)
+                                append(&output, cellAt(back, row, i)->text, strlen(cellAt(back, row, i)->text));
+                }
+                else
+                {
+                        appendf(&output, "\033[%dC", col - outCol);
+                }
+        }
+        else if (row == outRow + 1 && col == 0 && outRow >= 0)
+        {
+                append(&output, "\r\n", 2);
+        }
+        else
+        {
+                appendf(&output, "\033[%d;%dH", row + 1, col + 1);
+        }
+
+        outRow = row;
+        outCol = col;
+}
+
+static void advanceOutput(int width)
+{
+        outCol += width;
+
+        // At the end of the line the terminal waits to wrap, so only an absolute move is safe
+        if (outCol >= screenWidth)
+                outCol = screenWidth;
+}
+
+static void writeChanges(void)
+{
+        for (int row = 0; row < screenHeight; row++)
+        {
+                for (int col = 0; col < screenWidth; col++)
+                {
+                        ScreenCell *cell = cellAt(back, row, col);
+
+                        if (cell->width == 0 || sameCell(cell, cellAt(front, row, col)))
+                                continue;
+
+                        moveOutput(row, col);
+                        setPen(cell->style);
+                        append(&output, cell->text, strlen(cell->text));
+                        advanceOutput(cell->width);
+                }
+        }
+
+        // The terminal is left the way the emulator is, so that the next frame can be written as it is if it has to
+        if (cursorSavedInFrame && savedKnown)
+        {
+                moveOutput(savedRow, savedCol);
+                append(&output, "\033[s", 3);
+        }
+
+        if (wrapPending)
+        {
+                ScreenCell *cell = cellAt(back, cursorRow, screenWidth - 1);
+
+                moveOutput(cursorRow, screenWidth - 1);
+                setPen(cell->style);
+                append(&output, (cell->width == 1) ? cell->text : " ", (cell->width == 1) ? strlen(cell->text) : 1);
+                advanceOutput(1);
+        }
+        else
+        {
+                moveOutput(cursorRow, cursorCol);
+        }
+
+        setPen(pen);
+
+        append(&output, modes.data, modes.length);
+}
+
+static void writeOutput(void)
+{
+        size_t written = 0;
+
+        fflush(stdout);
+
+        while (written < output.length)
+        {
+                ssize_t n = write(STDOUT_FILENO, output.data + written, output.length - written);
+
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0)
+                        break;
+
+                written += (size_t)n;
+        }
+
+        if (output.length > 0)
+        {
+                screenStats.frames++;
+                screenStats.bytesWritten += written;
+                screenStats.lastFrameBytes = written;
+        }
+}
+
+// Writes what was printed since the last flush
+void screenFlush(void)
+{
+        pthread_mutex_lock(&screenMutex);
+
+        if (frame.length == 0)
+        {
+                pthread_mutex_unlock(&screenMutex);
+                return;
+        }
+
+        int width, height;
+        getTermSize(&width, &height);
+
+        if (width != screenWidth || height != screenHeight)
+                resizeScreen(width, height);
+
+        output.length = 0;
+        modes.length = 0;
+        cursorSavedInFrame = false;
+
+        bool synced = (front != NULL && cellsKnown && cursorKnown);
+        bool tracked = (front != NULL && interpretFrame());
+
+        if (synced && tracked && cellsKnown && cursorKnown)
+        {
+                writeChanges();
+        }
+        else
+        {
+                // Written the way it was printed, in one go, on terminals that support synchronized output
+                append(&output, "\033[?2026h", 8);
+                append(&output, frame.data, frame.length);
+                append(&output, "\033[?2026l", 8);
+
+                outRow = cursorKnown ? cursorRow : -1;
+                outCol = cursorKnown ? (wrapPending ? screenWidth : cursorCol) : -1;
+                outPen = pen;
+
+                screenStats.fullFrames++;
+        }
+
+        if (front != NULL && cellsKnown && cursorKnown)
+                memcpy(front, back, (size_t)screenWidth * screenHeight * sizeof(ScreenCell));
+
+        writeOutput();
+
+        frame.length = 0;
+
+        pthread_mutex_unlock(&screenMutex);
+}
+
+// For when something was printed without going through here, so the next frame is written whole
+void screenInvalidate(void)
+{
+        pthread_mutex_lock(&screenMutex);
+
+        cellsKnown = false;
+        cursorKnown = false;
+
+        pthread_mutex_unlock(&screenMutex);
+}
+
+void getScreenStats(ScreenStats *stats)
+{
+        pthread_mutex_lock(&screenMutex);
+
+        *stats = screenStats;
+
+        pthread_mutex_unlock(&screenMutex);
+}
+
+void freeScreen(void)
+{
+        pthread_mutex_lock(&screenMutex);
+
+        free(frame.data);
+        free(output.data);
+        free(modes.data);
+        free(front);
+        free(back);
+
+        frame = output = modes = (ScreenBuffer){0};
+        front = back = NULL;
+        screenWidth = screenHeight = 0;
+        cellsKnown = false;
+        cursorKnown = false;
+
+        pthread_mutex_unlock(&screenMutex);
+}
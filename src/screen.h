@@ -0,0 +1,38 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include <errno.h>
+#include <glib.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef SCREENSTATS_STRUCT
+#define SCREENSTATS_STRUCT
+typedef struct
+{
+        uint64_t frames;         // Flushes that wrote something
+        uint64_t fullFrames;     // Frames written the way they were printed, because they couldn't be diffed
+        uint64_t bytesWritten;
+        uint64_t lastFrameBytes;
+} ScreenStats;
+#endif
+
+void screenPrintf(const char *format, ...);
+
+void screenWrite(const char *data, size_t length);
+
+void screenFlush(void);
+
+void screenInvalidate(void);
+
+void getScreenStats(ScreenStats *stats);
+
+void freeScreen(void);
+
+#endif
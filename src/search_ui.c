@@ -9,6 +9,7 @@ search_ui.c
 */
 
 #define MAX_SEARCH_LEN 32
+#define SEARCH_STACK_SIZE 16
 
 int numSearchLetters = 0;
 int numSearchBytes = 0;
@@ -27,6 +28,18 @@ size_t resultsCapacity = 0;
 int minSearchLetters = 1;
 FileSystemEntry *currentSearchEntry = NULL;
 
+SearchIndex *searchIndex = NULL;
+
+// The searches for the current search text and the texts it was typed from, so that backspace doesn't search again
+typedef struct
+{
+        char text[MAX_SEARCH_LEN * 4 + 1];
+        SearchQuery *query;
+} SearchStackEntry;
+
+SearchStackEntry searchStack[SEARCH_STACK_SIZE];
+int searchStackSize = 0;
+
 char searchText[MAX_SEARCH_LEN * 4 + 1]; // Unicode can be 4 characters
 
 FileSystemEntry *getCurrentSearchEntry(void)
@@ -74,17 +87,79 @@ void freeSearchResults(void)
         resultsCount = 0;
 }
 
+static void popSearchStack(void)
+{
+        searchStackSize--;
+        freeSearchQuery(searchStack[searchStackSize].query);
+        searchStack[searchStackSize].query = NULL;
+}
+
+static void clearSearchStack(void)
+{
+        while (searchStackSize > 0)
+                popSearchStack();
+}
+
+static SearchQuery *getSearchQuery(int threshold)
+{
+        // Drop the searches for text that has since been erased
+        while (searchStackSize > 0 && strncmp(searchText, searchStack[searchStackSize - 1].text, strlen(searchStack[searchStackSize - 1].text)) != 0)
+                popSearchStack();
+
+        if (searchStackSize > 0 && strcmp(searchText, searchStack[searchStackSize - 1].text) == 0)
+                return searchStack[searchStackSize - 1].query;
+
+        // The text was typed on from the top search, so its results only need narrowing down
+        SearchQuery *previous = searchStackSize > 0 ? searchStack[searchStackSize - 1].query : NULL;
+        SearchQuery *query = runSearchQuery(searchIndex, searchText, threshold, previous);
+        if (query == NULL)
+                return NULL;
+
+        if (searchStackSize == SEARCH_STACK_SIZE)
+        {
+                freeSearchQuery(searchStack[0].query);
+                memmove(searchStack, searchStack + 1, (SEARCH_STACK_SIZE - 1) * sizeof(SearchStackEntry));
+                searchStackSize--;
+        }
+
+        c_strcpy(searchStack[searchStackSize].text, searchText, sizeof(searchStack[searchStackSize].text));
+        searchStack[searchStackSize].query = query;
+        searchStackSize++;
+
+        return query;
+}
+
 void fuzzySearch(FileSystemEntry *root, int threshold)
 {
         freeSearchResults();
 
         if (numSearchLetters > minSearchLetters)
         {
-                fuzzySearchRecursive(root, searchText, threshold, collectResult);
+                // The index is built on the first search, and again after the library has changed.
+                // The library watcher changes the tree under switchMutex, so it doesn't change while it is read.
+                pthread_mutex_lock(&switchMutex);
+
+                if (!searchIndexIsCurrent(searchIndex, root))
+                {
+                        clearSearchStack();
+                        freeSearchIndex(searchIndex);
+                        searchIndex = createSearchIndex(root);
+                }
+
+                pthread_mutex_unlock(&switchMutex);
+
+                forEachSearchMatch(searchIndex, getSearchQuery(threshold), collectResult);
         }
         refresh = true;
 }
 
+void freeLibrarySearchIndex(void)
+{
+        clearSearchStack();
+        freeSearchIndex(searchIndex);
+        searchIndex = NULL;
+}
+
 int compareResults(const void *a, const void *b)
 {
         SearchResult *resultA = (SearchResult *)a;
@@ -105,12 +180,12 @@ int displaySearchBox(int indent, UISettings *ui)
                 setColor(ui);
 
         printBlankSpaces(indent);
-        printf(" [Search]: ");
+        screenPrintf(" [Search]: ");
         setDefaultTextColor();
         // Save cursor position
-        printf("%s", searchText);
-        printf("\033[s");
-        printf("█\n");
+        screenPrintf("%s", searchText);
+        screenPrintf("\033[s");
+        screenPrintf("█\n");
 
         return 0;
 }
@@ -131,15 +206,15 @@ int addToSearchText(const char *str)
         }
 
         // Restore cursor position
-        printf("\033[u");
+        screenPrintf("\033[u");
 
         // Print the string
-        printf("%s", str);
+        screenPrintf("%s", str);
 
         // Save cursor position
-        printf("\033[s");
+        screenPrintf("\033[s");
 
-        printf("█\n");
+        screenPrintf("█\n");
 
         // Add the string to the search text buffer
         for (size_t i = 0; i < len; i++)
@@ -180,33 +255,33 @@ int removeFromSearchText(void)
                 return 0;
 
         // Restore cursor position
-        printf("\033[u");
+        screenPrintf("\033[u");
 
         // Move cursor back one step
-        printf("\033[D");
+        screenPrintf("\033[D");
 
         // Overwrite the character with spaces
         for (int i = 0; i < lastCharBytes; i++)
         {
-                printf(" ");
+                screenPrintf(" ");
         }
 
         // Move cursor back again to the original position
         for (int i = 0; i < lastCharBytes; i++)
         {
-                printf("\033[D");
+                screenPrintf("\033[D");
         }
 
         // Save cursor position
-        printf("\033[s");
+        screenPrintf("\033[s");
 
         // Print a block character to represent the cursor
-        printf("█");
+        screenPrintf("█");
 
         // Clear the end of the line
-        printf("\033[K");
+        screenPrintf("\033[K");
 
-        fflush(stdout);
+        screenFlush();
 
         // Remove the character from the buffer
         numSearchBytes -= lastCharBytes;
@@ -247,7 +322,7 @@ int displaySearchResults(int maxListSize, int indent, int *chosenRow, int startS
         if (*chosenRow < 0)
                 startSearchIter = *chosenRow = 0;
 
-        printf("\n");
+        screenPrintf("\n");
         printedRows++;
 
         // Print the sorted results
@@ -273,11 +348,11 @@ int displaySearchResults(int maxListSize, int indent, int *chosenRow, int startS
                                         setTextColor(ui->enqueuedColor);
                                 else
                                         setColor(ui);
-                                printf("\x1b[7m * ");
+                                screenPrintf("\x1b[7m * ");
                         }
                         else
                         {
-                                printf("  \x1b[7m ");
+                                screenPrintf("  \x1b[7m ");
                         }
                 }
                 else
@@ -288,10 +363,10 @@ int displaySearchResults(int maxListSize, int indent, int *chosenRow, int startS
                                         setTextColor(ui->enqueuedColor);
                                 else
                                         setColor(ui);
-                                printf(" * ");
+                                screenPrintf(" * ");
                         }
                         else
-                                printf("   ");
+                                screenPrintf("   ");
                 }
 
 
@@ -311,13 +386,13 @@ int displaySearchResults(int maxListSize, int indent, int *chosenRow, int startS
                         else
                                 snprintf(name, maxNameWidth + 1, "%s", results[i].entry->name);
                 }
-                printf("%s\n", name);
+                screenPrintf("%s\n", name);
                 printedRows++;
         }
 
         while (printedRows < maxListSize)
         {
-                printf("\n");
+                screenPrintf("\n");
                 printedRows++;
         }
 
@@ -2,6 +2,7 @@
 #include <math.h>
 #include "soundcommon.h"
 #include "directorytree.h"
+#include "searchindex.h"
 #include "term.h"
 #include "common_ui.h"
 #include "common.h"
@@ -18,4 +19,6 @@ void fuzzySearch(FileSystemEntry *root, int threshold);
 
 void freeSearchResults(void);
 
+void freeLibrarySearchIndex(void);
+
 FileSystemEntry *getCurrentSearchEntry(void);
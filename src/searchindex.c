@@ -0,0 +1,750 @@
+#include "searchindex.h"
+
+/*
+
+searchindex.c
+
+ Index of the library names, for searching the library as you type.
+
+*/
+
+#define TRIGRAM_BUCKETS (1 << 16)
+#define MAX_INDEXED_LENGTH 255 // Longer names share the last length bucket
+#define MAX_QUERY_TRIGRAMS 64  // Enough to narrow down the candidates, the rest of a long term is checked by strstr
+#define MAX_PATTERN_LENGTH 64  // Terms up to this many characters fit in one word for the bit-parallel edit distance
+
+typedef struct
+{
+        FileSystemEntry *entry;
+        uint32_t nameOffset; // Of the casefolded name in the names buffer
+        uint32_t length;     // In characters
+} IndexedName;
+
+typedef struct
+{
+        uint32_t index;
+        int distance;
+} SearchMatch;
+
+// A search term prepared for measuring the edit distance of names to it
+typedef struct
+{
+        int length;                 // In characters
+        uint64_t asciiMasks[128];   // For each character, the positions in the term where it is
+        gunichar otherChars[MAX_PATTERN_LENGTH];
+        uint64_t otherMasks[MAX_PATTERN_LENGTH];
+        int numOther;
+        gunichar *chars; // The decoded term, when it is too long for the masks
+} EditDistancePattern;
+
+struct SearchQuery
+{
+        char *term; // Casefolded
+        int threshold;
+        unsigned int version;       // Of the tree the index was built from
+        uint32_t *substringMatches; // The names that contain the term, in ascending order
+        uint32_t numSubstringMatches;
+        SearchMatch *matches; // Every match, in tree order
+        uint32_t numMatches;
+};
+
+struct SearchIndex
+{
+        const FileSystemEntry *root;
+        unsigned int version;
+        IndexedName *names; // In the order the tree is walked, which is the order results are reported in
+        uint32_t numNames;
+        uint32_t namesCapacity;
+        char *buffer; // The casefolded names, null-terminated, one after another
+        size_t bufferSize;
+        size_t bufferCapacity;
+        uint32_t *trigramStart;   // Where each bucket starts in trigramEntries, TRIGRAM_BUCKETS + 1 of them
+        uint32_t *trigramEntries; // Per bucket, the names with a trigram in that bucket, in ascending order
+        uint32_t *lengthStart;    // Where each length starts in byLength, MAX_INDEXED_LENGTH + 2 of them
+        uint32_t *byLength;       // The names ordered by length, then by index
+};
+
+static uint32_t trigramBucket(const unsigned char *str)
+{
+        uint32_t trigram = ((uint32_t)str[0] << 16) | ((uint32_t)str[1] << 8) | str[2];
+
+        return (trigram * 2654435761u) >> 16;
+}
+
+static bool addName(SearchIndex *index, FileSystemEntry *entry)
+{
+        char *folded = g_utf8_casefold(entry->name, -1);
+        if (folded == NULL)
+                return false;
+
+        size_t size = strlen(folded) + 1;
+
+        if (index->numNames == index->namesCapacity)
+        {
+                uint32_t capacity = index->namesCapacity == 0 ? 1024 : index->namesCapacity * 2;
+                IndexedName *names = realloc(index->names, capacity * sizeof(IndexedName));
+                if (names == NULL)
+                {
+                        g_free(folded);
+                        return false;
+                }
+                index->names = names;
+                index->namesCapacity = capacity;
+        }
+
+        if (index->bufferSize + size > index->bufferCapacity)
+        {
+                size_t capacity = index->bufferCapacity == 0 ? 64 * 1024 : index->bufferCapacity * 2;
+                while (capacity < index->bufferSize + size)
+                        capacity *= 2;
+
+                // Names are found by 32-bit offsets
+                char *buffer = capacity <= UINT32_MAX ? realloc(index->buffer, capacity) : NULL;
+                if (buffer == NULL)
+                {
+                        g_free(folded);
+                        return false;
+                }
+                index->buffer = buffer;
+                index->bufferCapacity = capacity;
+        }
+
+        IndexedName *name = &index->names[index->numNames++];
+        name->entry = entry;
+        name->nameOffset = (uint32_t)index->bufferSize;
+        name->length = (uint32_t)g_utf8_strlen(folded, -1);
+
+        memcpy(index->buffer + index->bufferSize, folded, size);
+        index->bufferSize += size;
+
+        g_free(folded);
+
+        return true;
+}
+
+// Adds the names in the same order as the tree is searched recursively: each entry, then its children, then its siblings
+static bool addNames(SearchIndex *index, FileSystemEntry *node, bool withSiblings)
+{
+        for (; node != NULL; node = withSiblings ? node->next : NULL)
+        {
+                if (!addName(index, node) || !addNames(index, node->children, true))
+                        return false;
+        }
+
+        return true;
+}
+
+static bool buildTrigramIndex(SearchIndex *index)
+{
+        uint32_t *lastName = calloc(TRIGRAM_BUCKETS, sizeof(uint32_t));
+        index->trigramStart = calloc(TRIGRAM_BUCKETS + 1, sizeof(uint32_t));
+        if (lastName == NULL || index->trigramStart == NULL)
+        {
+                free(lastName);
+                return false;
+        }
+
+        // Count the names in each bucket, each name once even if it has several trigrams in the same bucket
+        size_t numEntries = 0;
+        for (uint32_t i = 0; i < index->numNames; i++)
+        {
+                const unsigned char *name = (const unsigned char *)index->buffer + index->names[i].nameOffset;
+
+                for (; name[0] != '\0' && name[1] != '\0' && name[2] != '\0'; name++)
+                {
+                        uint32_t bucket = trigramBucket(name);
+                        if (lastName[bucket] == i + 1)
+                                continue;
+
+                        lastName[bucket] = i + 1;
+                        index->trigramStart[bucket + 1]++;
+                        numEntries++;
+                }
+        }
+
+        for (uint32_t bucket = 0; bucket < TRIGRAM_BUCKETS; bucket++)
+        {
+                index->trigramStart[bucket + 1] += index->trigramStart[bucket];
+        }
+
+        index->trigramEntries = malloc((numEntries > 0 ? numEntries : 1) * sizeof(uint32_t));
+        if (index->trigramEntries == NULL)
+        {
+                free(lastName);
+                return false;
+        }
+
+        // Then fill them in, going through the names in order keeps every bucket sorted
+        uint32_t *fill = lastName;
+        memcpy(fill, index->trigramStart, TRIGRAM_BUCKETS * sizeof(uint32_t));
+
+        for (uint32_t i = 0; i < index->numNames; i++)
+        {
+                const unsigned char *name = (const unsigned char *)index->buffer + index->names[i].nameOffset;
+
+                for (; name[0] != '\0' && name[1] != '\0' && name[2] != '\0'; name++)
+                {
+                        uint32_t bucket = trigramBucket(name);
+                        uint32_t start = index->trigramStart[bucket];
+
+                        if (fill[bucket] > start && index->trigramEntries[fill[bucket] - 1] == i)
+                                continue;
+
+                        index->trigramEntries[fill[bucket]++] = i;
+                }
+        }
+
+        free(lastName);
+
+        return true;
+}
+
+static bool buildLengthIndex(SearchIndex *index)
+{
+        index->lengthStart = calloc(MAX_INDEXED_LENGTH + 2, sizeof(uint32_t));
+        index->byLength = malloc((index->numNames > 0 ? index->numNames : 1) * sizeof(uint32_t));
+        uint32_t *fill = malloc((MAX_INDEXED_LENGTH + 1) * sizeof(uint32_t));
+        if (index->lengthStart == NULL || index->byLength == NULL || fill == NULL)
+        {
+                free(fill);
+                return false;
+        }
+
+        for (uint32_t i = 0; i < index->numNames; i++)
+        {
+                uint32_t length = MIN(index->names[i].length, MAX_INDEXED_LENGTH);
+                index->lengthStart[length + 1]++;
+        }
+
+        for (int length = 0; length <= MAX_INDEXED_LENGTH; length++)
+        {
+                index->lengthStart[length + 1] += index->lengthStart[length];
+        }
+
+        memcpy(fill, index->lengthStart, (MAX_INDEXED_LENGTH + 1) * sizeof(uint32_t));
+
+        for (uint32_t i = 0; i < index->numNames; i++)
+        {
+                uint32_t length = MIN(index->names[i].length, MAX_INDEXED_LENGTH);
+                index->byLength[fill[length]++] = i;
+        }
+
+        free(fill);
+
+        return true;
+}
+
+// Reads the tree, so the caller holds switchMutex to keep it from being changed meanwhile
+SearchIndex *createSearchIndex(FileSystemEntry *root)
+{
+        if (root == NULL)
+                return NULL;
+
+        SearchIndex *index = calloc(1, sizeof(SearchIndex));
+        if (index == NULL)
+                return NULL;
+
+        index->root = root;
+        index->version = getTreeVersion(root);
+
+        // Only the tree below root, not the siblings of root
+        if (!addNames(index, root, false) || !buildTrigramIndex(index) || !buildLengthIndex(index))
+        {
+                fprintf(stderr, "Failed to build the search index.\n");
+                freeSearchIndex(index);
+                return NULL;
+        }
+
+        return index;
+}
+
+void freeSearchIndex(SearchIndex *index)
+{
+        if (index == NULL)
+                return;
+
+        free(index->names);
+        free(index->buffer);
+        free(index->trigramStart);
+        free(index->trigramEntries);
+        free(index->lengthStart);
+        free(index->byLength);
+        free(index);
+}
+
+bool searchIndexIsCurrent(const SearchIndex *index, const FileSystemEntry *root)
+{
+        return index != NULL && index->root == root && index->version == getTreeVersion(root);
+}
+
+static bool prepareEditDistancePattern(EditDistancePattern *pattern, const char *term)
+{
+        memset(pattern, 0, sizeof(EditDistancePattern));
+
+        pattern->length = g_utf8_strlen(term, -1);
+
+        if (pattern->length > MAX_PATTERN_LENGTH)
+        {
+                pattern->chars = malloc(pattern->length * sizeof(gunichar));
+                if (pattern->chars == NULL)
+                        return false;
+
+                const char *p = term;
+                for (int i = 0; i < pattern->length; i++, p = g_utf8_next_char(p))
+                        pattern->chars[i] = g_utf8_get_char(p);
+
+                return true;
+        }
+
+        const char *p = term;
+        for (int i = 0; i < pattern->length; i++, p = g_utf8_next_char(p))
+        {
+                gunichar c = g_utf8_get_char(p);
+                uint64_t bit = (uint64_t)1 << i;
+
+                if (c < 128)
+                {
+                        pattern->asciiMasks[c] |= bit;
+                        continue;
+                }
+
+                int j = 0;
+                while (j < pattern->numOther && pattern->otherChars[j] != c)
+                        j++;
+
+                if (j == pattern->numOther)
+                {
+                        pattern->otherChars[j] = c;
+                        pattern->numOther++;
+                }
+                pattern->otherMasks[j] |= bit;
+        }
+
+        return true;
+}
+
+static void freeEditDistancePattern(EditDistancePattern *pattern)
+{
+        free(pattern->chars);
+        pattern->chars = NULL;
+}
+
+// Plain dynamic programming for terms too long for one word, a row at a time, giving up when a whole row is over the limit
+static int boundedEditDistanceLong(const EditDistancePattern *pattern, const char *text, int maxDistance)
+{
+        int m = pattern->length;
+        int *prevRow = malloc((m + 1) * sizeof(int));
+        int *currRow = malloc((m + 1) * sizeof(int));
+        int distance = maxDistance + 1;
+
+        if (prevRow == NULL || currRow == NULL)
+        {
+                free(prevRow);
+                free(currRow);
+                return distance;
+        }
+
+        for (int j = 0; j <= m; j++)
+                prevRow[j] = j;
+
+        int i = 0;
+        for (const char *p = text; *p != '\0'; p = g_utf8_next_char(p))
+        {
+                gunichar c = g_utf8_get_char(p);
+                int rowMin = ++i;
+
+                currRow[0] = i;
+
+                for (int j = 1; j <= m; j++)
+                {
+                        int cost = pattern->chars[j - 1] == c ? 0 : 1;
+
+                        currRow[j] = MIN(prevRow[j] + 1, MIN(currRow[j - 1] + 1, prevRow[j - 1] + cost));
+                        rowMin = MIN(rowMin, currRow[j]);
+                }
+
+                if (rowMin > maxDistance)
+                        goto done;
+
+                int *temp = prevRow;
+                prevRow = currRow;
+                currRow = temp;
+        }
+
+        distance = prevRow[m];
+
+done:
+        free(prevRow);
+        free(currRow);
+
+        return distance <= maxDistance ? distance : maxDistance + 1;
+}
+
+// Levenshtein distance between the term and a name of textLength characters, or maxDistance + 1 if it is more than that.
+// Uses the bit-parallel algorithm of Myers, as formulated by Hyyrö for the edit distance: a column of the distance matrix
+// is kept as bit vectors of its vertical differences, and updated for each character of the name with a few word operations.
+static int boundedEditDistance(const EditDistancePattern *pattern, const char *text, int textLength, int maxDistance)
+{
+        int m = pattern->length;
+
+        if (abs(textLength - m) > maxDistance)
+                return maxDistance + 1;
+
+        if (m == 0)
+                return textLength;
+
+        if (pattern->chars != NULL)
+                return boundedEditDistanceLong(pattern, text, maxDistance);
+
+        uint64_t highBit = (uint64_t)1 << (m - 1);
+        uint64_t pv = ~(uint64_t)0;
+        uint64_t mv = 0;
+        int score = m;
+        int remaining = textLength;
+
+        for (const unsigned char *p = (const unsigned char *)text; *p != '\0';)
+        {
+                uint64_t eq = 0;
+
+                if (*p < 128)
+                {
+                        eq = pattern->asciiMasks[*p];
+                        p++;
+                }
+                else
+                {
+                        gunichar c = g_utf8_get_char((const char *)p);
+                        for (int j = 0; j < pattern->numOther; j++)
+                        {
+                                if (pattern->otherChars[j] == c)
+                                {
+                                        eq = pattern->otherMasks[j];
+                                        break;
+                                }
+                        }
+                        p = (const unsigned char *)g_utf8_next_char((const char *)p);
+                }
+
+                uint64_t xv = eq | mv;
+                uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+                uint64_t ph = mv | ~(xh | pv);
+                uint64_t mh = pv & xh;
+
+                if (ph & highBit)
+                        score++;
+                else if (mh & highBit)
+                        score--;
+
+                ph = (ph << 1) | 1;
+                mh <<= 1;
+                pv = mh | ~(xv | ph);
+                mv = ph & xv;
+
+                // Each character left can lower the distance by one at most
+                if (score - --remaining > maxDistance)
+                        return maxDistance + 1;
+        }
+
+        return score <= maxDistance ? score : maxDistance + 1;
+}
+
+static bool containsSorted(const uint32_t *list, uint32_t count, uint32_t value)
+{
+        uint32_t low = 0, high = count;
+
+        while (low < high)
+        {
+                uint32_t mid = low + (high - low) / 2;
+
+                if (list[mid] < value)
+                        low = mid + 1;
+                else
+                        high = mid;
+        }
+
+        return low < count && list[low] == value;
+}
+
+static bool addIndex(uint32_t **list, uint32_t *count, uint32_t *capacity, uint32_t value)
+{
+        if (*count == *capacity)
+        {
+                uint32_t newCapacity = *capacity == 0 ? 64 : *capacity * 2;
+                uint32_t *tmp = realloc(*list, newCapacity * sizeof(uint32_t));
+                if (tmp == NULL)
+                        return false;
+                *list = tmp;
+                *capacity = newCapacity;
+        }
+
+        (*list)[(*count)++] = value;
+
+        return true;
+}
+
+static int compareIndexes(const void *a, const void *b)
+{
+        uint32_t indexA = *(const uint32_t *)a;
+        uint32_t indexB = *(const uint32_t *)b;
+
+        return (indexA > indexB) - (indexA < indexB);
+}
+
+static int compareMatches(const void *a, const void *b)
+{
+        return compareIndexes(&((const SearchMatch *)a)->index, &((const SearchMatch *)b)->index);
+}
+
+static const uint32_t *getTrigramList(const SearchIndex *index, const char *str, uint32_t *count)
+{
+        uint32_t bucket = trigramBucket((const unsigned char *)str);
+
+        *count = index->trigramStart[bucket + 1] - index->trigramStart[bucket];
+
+        return index->trigramEntries + index->trigramStart[bucket];
+}
+
+// Finds the names that contain the term, in ascending order. A term that extends the previous one can only be
+// found among the names that contained the previous one.
+static void findSubstringMatches(const SearchIndex *index, SearchQuery *query, const SearchQuery *previous)
+{
+        const char *term = query->term;
+        size_t termSize = strlen(term);
+        uint32_t capacity = 0;
+
+        if (previous != NULL)
+        {
+                for (uint32_t c = 0; c < previous->numSubstringMatches; c++)
+                {
+                        uint32_t i = previous->substringMatches[c];
+
+                        if (strstr(index->buffer + index->names[i].nameOffset, term) != NULL &&
+                            !addIndex(&query->substringMatches, &query->numSubstringMatches, &capacity, i))
+                                return;
+                }
+                return;
+        }
+
+        if (termSize < 3)
+        {
+                for (uint32_t i = 0; i < index->numNames; i++)
+                {
+                        if (strstr(index->buffer + index->names[i].nameOffset, term) != NULL &&
+                            !addIndex(&query->substringMatches, &query->numSubstringMatches, &capacity, i))
+                                return;
+                }
+                return;
+        }
+
+        // A name that contains the term contains all of its trigrams, so start from the rarest one
+        const uint32_t *lists[MAX_QUERY_TRIGRAMS];
+        uint32_t counts[MAX_QUERY_TRIGRAMS];
+        int numLists = 0;
+        int rarest = 0;
+
+        for (size_t i = 0; i + 2 < termSize && numLists < MAX_QUERY_TRIGRAMS; i++)
+        {
+                lists[numLists] = getTrigramList(index, term + i, &counts[numLists]);
+
+                if (counts[numLists] < counts[rarest])
+                        rarest = numLists;
+
+                numLists++;
+        }
+
+        for (uint32_t c = 0; c < counts[rarest]; c++)
+        {
+                uint32_t i = lists[rarest][c];
+                bool inAll = true;
+
+                for (int l = 0; l < numLists && inAll; l++)
+                {
+                        if (l != rarest)
+                                inAll = containsSorted(lists[l], counts[l], i);
+                }
+
+                // Buckets are shared by several trigrams, so the name itself decides
+                if (inAll && strstr(index->buffer + index->names[i].nameOffset, term) != NULL &&
+                    !addIndex(&query->substringMatches, &query->numSubstringMatches, &capacity, i))
+                        return;
+        }
+}
+
+// Finds the names that could be within the edit distance of the term, in no particular order
+static uint32_t *findFuzzyCandidates(const SearchIndex *index, const char *term, int termLength, int threshold, uint32_t *count)
+{
+        uint32_t *candidates = NULL;
+        uint32_t capacity = 0;
+        int minLength = MAX(termLength - threshold, 0);
+        int maxLength = MIN(termLength + threshold, MAX_INDEXED_LENGTH);
+        int numParts = threshold + 1;
+
+        *count = 0;
+
+        if (termLength < 3 * numParts)
+        {
+                // A name within the distance is at most that many characters longer or shorter than the term
+                for (int length = minLength; length <= maxLength; length++)
+                {
+                        for (uint32_t j = index->lengthStart[length]; j < index->lengthStart[length + 1]; j++)
+                        {
+                                if (!addIndex(&candidates, count, &capacity, index->byLength[j]))
+                                        return candidates;
+                        }
+                }
+                return candidates;
+        }
+
+        // Split into one part more than the number of edits allowed, at least one part is then left unchanged
+        // in a name within the distance. Every part is three characters or more, so its first trigram is indexed.
+        const char *part = term;
+        int partStart = 0;
+
+        for (int p = 0; p < numParts; p++)
+        {
+                uint32_t listCount;
+                const uint32_t *list = getTrigramList(index, part, &listCount);
+
+                for (uint32_t j = 0; j < listCount; j++)
+                {
+                        uint32_t length = index->names[list[j]].length;
+
+                        if ((int)length >= minLength && (int)length <= maxLength &&
+                            !addIndex(&candidates, count, &capacity, list[j]))
+                                return candidates;
+                }
+
+                int nextStart = (p + 1) * termLength / numParts;
+                for (; partStart < nextStart; partStart++)
+                        part = g_utf8_next_char(part);
+        }
+
+        // A name can be in several lists
+        if (*count > 1)
+        {
+                qsort(candidates, *count, sizeof(uint32_t), compareIndexes);
+
+                uint32_t unique = 1;
+                for (uint32_t j = 1; j < *count; j++)
+                {
+                        if (candidates[j] != candidates[unique - 1])
+                                candidates[unique++] = candidates[j];
+                }
+                *count = unique;
+        }
+
+        return candidates;
+}
+
+SearchQuery *runSearchQuery(const SearchIndex *index, const char *searchTerm, int threshold, const SearchQuery *previous)
+{
+        if (index == NULL || searchTerm == NULL)
+                return NULL;
+
+        SearchQuery *query = calloc(1, sizeof(SearchQuery));
+        if (query == NULL)
+                return NULL;
+
+        query->term = g_utf8_casefold(searchTerm, -1);
+        query->threshold = threshold;
+        query->version = index->version;
+
+        if (query->term == NULL)
+        {
+                freeSearchQuery(query);
+                return NULL;
+        }
+
+        // The previous query can be refined if this term starts with its term
+        if (previous != NULL &&
+            (previous->version != index->version || previous->threshold != threshold ||
+             strncmp(query->term, previous->term, strlen(previous->term)) != 0))
+                previous = NULL;
+
+        findSubstringMatches(index, query, previous);
+
+        EditDistancePattern pattern;
+        if (!prepareEditDistancePattern(&pattern, query->term))
+        {
+                freeSearchQuery(query);
+                return NULL;
+        }
+
+        uint32_t numCandidates = 0;
+        uint32_t *candidates = findFuzzyCandidates(index, query->term, pattern.length, threshold, &numCandidates);
+        SearchMatch *fuzzyMatches = numCandidates > 0 ? malloc(numCandidates * sizeof(SearchMatch)) : NULL;
+        uint32_t numFuzzyMatches = 0;
+
+        for (uint32_t c = 0; c < numCandidates && fuzzyMatches != NULL; c++)
+        {
+                uint32_t i = candidates[c];
+
+                if (containsSorted(query->substringMatches, query->numSubstringMatches, i))
+                        continue;
+
+                int distance = boundedEditDistance(&pattern, index->buffer + index->names[i].nameOffset, index->names[i].length, threshold);
+
+                if (distance <= threshold)
+                {
+                        fuzzyMatches[numFuzzyMatches].index = i;
+                        fuzzyMatches[numFuzzyMatches].distance = distance;
+                        numFuzzyMatches++;
+                }
+        }
+
+        free(candidates);
+        freeEditDistancePattern(&pattern);
+
+        if (numFuzzyMatches > 1)
+                qsort(fuzzyMatches, numFuzzyMatches, sizeof(SearchMatch), compareMatches);
+
+        // Both lists are in tree order, merge them like a walk of the tree would report them
+        uint32_t numMatches = query->numSubstringMatches + numFuzzyMatches;
+        query->matches = numMatches > 0 ? malloc(numMatches * sizeof(SearchMatch)) : NULL;
+
+        if (query->matches != NULL)
+        {
+                uint32_t s = 0, f = 0;
+
+                while (s < query->numSubstringMatches || f < numFuzzyMatches)
+                {
+                        SearchMatch *match = &query->matches[query->numMatches++];
+
+                        if (f == numFuzzyMatches || (s < query->numSubstringMatches && query->substringMatches[s] < fuzzyMatches[f].index))
+                        {
+                                match->index = query->substringMatches[s++];
+                                match->distance = 0;
+                        }
+                        else
+                        {
+                                *match = fuzzyMatches[f++];
+                        }
+                }
+        }
+
+        free(fuzzyMatches);
+
+        return query;
+}
+
+void forEachSearchMatch(const SearchIndex *index, const SearchQuery *query, void (*callback)(FileSystemEntry *, int))
+{
+        if (index == NULL || query == NULL || query->version != index->version)
+                return;
+
+        for (uint32_t i = 0; i < query->numMatches; i++)
+        {
+                callback(index->names[query->matches[i].index].entry, query->matches[i].distance);
+        }
+}
+
+void freeSearchQuery(SearchQuery *query)
+{
+        if (query == NULL)
+                return;
+
+        g_free(query->term);
+        free(query->substringMatches);
+        free(query->matches);
+        free(query);
+}
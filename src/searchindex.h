@@ -0,0 +1,28 @@
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "directorytree.h"
+
+typedef struct SearchIndex SearchIndex;
+
+typedef struct SearchQuery SearchQuery;
+
+SearchIndex *createSearchIndex(FileSystemEntry *root);
+
+void freeSearchIndex(SearchIndex *index);
+
+bool searchIndexIsCurrent(const SearchIndex *index, const FileSystemEntry *root);
+
+SearchQuery *runSearchQuery(const SearchIndex *index, const char *searchTerm, int threshold, const SearchQuery *previous);
+
+void forEachSearchMatch(const SearchIndex *index, const SearchQuery *query, void (*callback)(FileSystemEntry *, int));
+
+void freeSearchQuery(SearchQuery *query);
+
+#endif
@@ -193,12 +193,12 @@ int displayRadioSearchBox(int indent, UISettings *ui)
                 setColor(ui);
 
         printBlankSpaces(indent);
-        printf(" [Radio Search]: ");
+        screenPrintf(" [Radio Search]: ");
         setDefaultTextColor();
         // Save cursor position
-        printf("%s", radioSearchText);
-        printf("\033[s");
-        printf("█\n");
+        screenPrintf("%s", radioSearchText);
+        screenPrintf("\033[s");
+        screenPrintf("█\n");
 
         return 0;
 }
@@ -219,15 +219,15 @@ int addToRadioSearchText(const char *str)
         }
 
         // Restore cursor position
-        printf("\033[u");
+        screenPrintf("\033[u");
 
         // Print the string
-        printf("%s", str);
+        screenPrintf("%s", str);
 
         // Save cursor position
-        printf("\033[s");
+        screenPrintf("\033[s");
 
-        printf("█\n");
+        screenPrintf("█\n");
 
         // Add the string to the search text buffer
         for (size_t i = 0; i < len; i++)
@@ -273,33 +273,33 @@ int removeFromRadioSearchText(void)
                 return 0;
 
         // Restore cursor position
-        printf("\033[u");
+        screenPrintf("\033[u");
 
         // Move cursor back one step
-        printf("\033[D");
+        screenPrintf("\033[D");
 
         // Overwrite the character with spaces
         for (int i = 0; i < lastCharBytes; i++)
         {
-                printf(" ");
+                screenPrintf(" ");
         }
 
         // Move cursor back again to the original position
         for (int i = 0; i < lastCharBytes; i++)
         {
-                printf("\033[D");
+                screenPrintf("\033[D");
         }
 
         // Save cursor position
-        printf("\033[s");
+        screenPrintf("\033[s");
 
         // Print a block character to represent the cursor
-        printf("█");
+        screenPrintf("█");
 
         // Clear the end of the line
-        printf("\033[K");
+        screenPrintf("\033[K");
 
-        fflush(stdout);
+        screenFlush();
 
         // Remove the character from the buffer
         numRadioSearchBytes -= lastCharBytes;
@@ -344,7 +344,7 @@ int displayRadioSearchResults(RadioSearchResult *radioSearchResults, size_t radi
         if (*chosenRow < 0)
                 startSearchIter = *chosenRow = 0;
 
-        printf("\n");
+        screenPrintf("\n");
         printedRows++;
 
         bool isFavorite = false;
@@ -378,16 +378,16 @@ int displayRadioSearchResults(RadioSearchResult *radioSearchResults, size_t radi
                         {
                                 setTextColor(ui->enqueuedColor);
 
-                                printf("\x1b[7m * ");
+                                screenPrintf("\x1b[7m * ");
                         }
                         else if (isFavorite)
                         {
                                 setTextColor(ui->enqueuedColor);
-                                printf("  \x1b[7m ");
+                                screenPrintf("  \x1b[7m ");
                         }
                         else
                         {
-                                printf("  \x1b[7m ");
+                                screenPrintf("  \x1b[7m ");
                         }
                 }
                 else
@@ -397,15 +397,15 @@ int displayRadioSearchResults(RadioSearchResult *radioSearchResults, size_t radi
 
                         {
                                 setTextColor(ui->enqueuedColor);
-                                printf(" * ");
+                                screenPrintf(" * ");
                         }
                         else if (isFavorite)
                         {
                                 setTextColor(ui->enqueuedColor);
-                                printf("   ");
+                                screenPrintf("   ");
                         }
                         else
-                                printf("   ");
+                                screenPrintf("   ");
                 }
 
                 name[0] = '\0';
@@ -418,13 +418,13 @@ int displayRadioSearchResults(RadioSearchResult *radioSearchResults, size_t radi
                                                                                                                                                : "",
                          radioSearchResults[i].country);
 
-                printf("%s\n", name);
+                screenPrintf("%s\n", name);
                 printedRows++;
         }
 
         while (printedRows < maxListSize)
         {
-                printf("\n");
+                screenPrintf("\n");
                 printedRows++;
         }
 
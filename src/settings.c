@@ -49,8 +49,14 @@ AppSettings constructAppSettings(KeyValuePair *pairs, int count)
         c_strcpy(settings.hideLogo, "0", sizeof(settings.hideLogo));
         c_strcpy(settings.hideHelp, "0", sizeof(settings.hideHelp));
         c_strcpy(settings.cacheLibrary, "-1", sizeof(settings.cacheLibrary));
+        c_strcpy(settings.libraryScanThreads, "0", sizeof(settings.libraryScanThreads));
+        c_strcpy(settings.watchLibrary, "0", sizeof(settings.watchLibrary));
+        c_strcpy(settings.outputSampleRate, "0", sizeof(settings.outputSampleRate));
+        c_strcpy(settings.prefetchTracks, "2", sizeof(settings.prefetchTracks));
+        c_strcpy(settings.prefetchMemoryLimit, "64", sizeof(settings.prefetchMemoryLimit));
         c_strcpy(settings.visualizerHeight, "5", sizeof(settings.visualizerHeight));
         c_strcpy(settings.visualizerColorType, "0", sizeof(settings.visualizerColorType));
+        c_strcpy(settings.visualizerMeasureFft, "0", sizeof(settings.visualizerMeasureFft));
         c_strcpy(settings.titleDelay, "9", sizeof(settings.titleDelay));
         c_strcpy(settings.nextView, "\t", sizeof(settings.nextView));
         c_strcpy(settings.prevView, "[Z", sizeof(settings.prevView));
@@ -168,6 +174,22 @@ AppSettings constructAppSettings(KeyValuePair *pairs, int count)
                 {
                         snprintf(settings.visualizerColorType, sizeof(settings.visualizerColorType), "%s", pair->value);
                 }
+                else if (strcmp(lowercaseKey, "visualizermeasurefft") == 0)
+                {
+                        snprintf(settings.visualizerMeasureFft, sizeof(settings.visualizerMeasureFft), "%s", pair->value);
+                }
+                else if (strcmp(lowercaseKey, "outputsamplerate") == 0)
+                {
+                        snprintf(settings.outputSampleRate, sizeof(settings.outputSampleRate), "%s", pair->value);
+                }
+                else if (strcmp(lowercaseKey, "prefetchtracks") == 0)
+                {
+                        snprintf(settings.prefetchTracks, sizeof(settings.prefetchTracks), "%s", pair->value);
+                }
+                else if (strcmp(lowercaseKey, "prefetchmemorylimit") == 0)
+                {
+                        snprintf(settings.prefetchMemoryLimit, sizeof(settings.prefetchMemoryLimit), "%s", pair->value);
+                }
                 else if (strcmp(lowercaseKey, "titledelay") == 0)
                 {
                         snprintf(settings.titleDelay, sizeof(settings.titleDelay), "%s", pair->value);
@@ -312,6 +334,14 @@ AppSettings constructAppSettings(KeyValuePair *pairs, int count)
                 {
                         snprintf(settings.cacheLibrary, sizeof(settings.cacheLibrary), "%s", pair->value);
                 }
+                else if (strcmp(lowercaseKey, "libraryscanthreads") == 0)
+                {
+                        snprintf(settings.libraryScanThreads, sizeof(settings.libraryScanThreads), "%s", pair->value);
+                }
+                else if (strcmp(lowercaseKey, "watchlibrary") == 0)
+                {
+                        snprintf(settings.watchLibrary, sizeof(settings.watchLibrary), "%s", pair->value);
+                }
                 else if (strcmp(lowercaseKey, "quitonstop") == 0)
                 {
                         snprintf(settings.quitAfterStopping, sizeof(settings.quitAfterStopping), "%s", pair->value);
@@ -631,9 +661,11 @@ void getConfig(AppSettings *settings, UISettings *ui)
         ui->coverEnabled = (settings->coverEnabled[0] == '1');
         ui->coverAnsi = (settings->coverAnsi[0] == '1');
         ui->visualizerEnabled = (settings->visualizerEnabled[0] == '1');
+        ui->visualizerMeasureFft = (settings->visualizerMeasureFft[0] == '1');
         ui->useConfigColors = (settings->useConfigColors[0] == '1');
         ui->quitAfterStopping = (settings->quitAfterStopping[0] == '1');
         ui->hideGlimmeringText = (settings->hideGlimmeringText[0] == '1');
+        ui->watchLibrary = (settings->watchLibrary[0] == '1');
         ui->mouseEnabled = (settings->mouseEnabled[0] == '1');
         ui->hideLogo = (settings->hideLogo[0] == '1');
         ui->hideHelp = (settings->hideHelp[0] == '1');
@@ -701,6 +733,18 @@ void getConfig(AppSettings *settings, UISettings *ui)
         if (temp >= 0)
                 ui->titleDelay = temp;
 
+        temp = getNumber(settings->outputSampleRate);
+        if (temp == 0 || (temp >= 8000 && temp <= 384000))
+                ui->outputSampleRate = temp;
+
+        temp = getNumber(settings->prefetchTracks);
+        if (temp >= 0 && temp <= 8)
+                ui->prefetchTracks = temp;
+
+        temp = getNumber(settings->prefetchMemoryLimit);
+        if (temp > 0)
+                ui->prefetchMemoryLimit = temp;
+
         temp = getNumber(settings->lastVolume);
         if (temp >= 0)
                 setVolume(temp);
@@ -709,6 +753,10 @@ void getConfig(AppSettings *settings, UISettings *ui)
         if (temp >= 0)
                 ui->cacheLibrary = temp;
 
+        temp = getNumber(settings->libraryScanThreads);
+        if (temp >= 0)
+                ui->libraryScanThreads = temp;
+
         getMusicLibraryPath(settings->path);
         free(configdir);
 }
@@ -755,10 +803,22 @@ void setConfig(AppSettings *settings, UISettings *ui)
                 snprintf(settings->visualizerHeight, sizeof(settings->visualizerHeight), "%d", ui->visualizerHeight);
         if (settings->visualizerColorType[0] == '\0')
                 snprintf(settings->visualizerColorType, sizeof(settings->visualizerColorType), "%d", ui->visualizerColorType);
+        if (settings->visualizerMeasureFft[0] == '\0')
+                ui->visualizerMeasureFft ? c_strcpy(settings->visualizerMeasureFft, "1", sizeof(settings->visualizerMeasureFft)) : c_strcpy(settings->visualizerMeasureFft, "0", sizeof(settings->visualizerMeasureFft));
         if (settings->titleDelay[0] == '\0')
                 snprintf(settings->titleDelay, sizeof(settings->titleDelay), "%d", ui->titleDelay);
         if (settings->cacheLibrary[0] == '\0')
                 snprintf(settings->cacheLibrary, sizeof(settings->cacheLibrary), "%d", ui->cacheLibrary);
+        if (settings->libraryScanThreads[0] == '\0')
+                snprintf(settings->libraryScanThreads, sizeof(settings->libraryScanThreads), "%d", ui->libraryScanThreads);
+        if (settings->watchLibrary[0] == '\0')
+                ui->watchLibrary ? c_strcpy(settings->watchLibrary, "1", sizeof(settings->watchLibrary)) : c_strcpy(settings->watchLibrary, "0", sizeof(settings->watchLibrary));
+        if (settings->outputSampleRate[0] == '\0')
+                snprintf(settings->outputSampleRate, sizeof(settings->outputSampleRate), "%d", ui->outputSampleRate);
+        if (settings->prefetchTracks[0] == '\0')
+                snprintf(settings->prefetchTracks, sizeof(settings->prefetchTracks), "%d", ui->prefetchTracks);
+        if (settings->prefetchMemoryLimit[0] == '\0')
+                snprintf(settings->prefetchMemoryLimit, sizeof(settings->prefetchMemoryLimit), "%d", ui->prefetchMemoryLimit);
 
         int currentVolume = getCurrentVolume();
         currentVolume = (currentVolume <= 0) ? 10 : currentVolume;
@@ -798,6 +858,8 @@ void setConfig(AppSettings *settings, UISettings *ui)
         fprintf(file, "visualizerHeight=%s\n", settings->visualizerHeight);
         fprintf(file, "# How colors are laid out in the spectrum visualizer. 0=default, 1=brightness depending on bar height, 2=reversed.\n");
         fprintf(file, "visualizerColorType=%s\n", settings->visualizerColorType);
+        fprintf(file, "# Find the fastest way to run the visualizer's FFT on this machine (1 = On, 0 = Off). Slower to start the first time.\n");
+        fprintf(file, "visualizerMeasureFft=%s\n", settings->visualizerMeasureFft);
         fprintf(file, "useConfigColors=%s\n", settings->useConfigColors);
         fprintf(file, "allowNotifications=%s\n", settings->allowNotifications);
         fprintf(file, "hideLogo=%s\n", settings->hideLogo);
@@ -807,6 +869,24 @@ void setConfig(AppSettings *settings, UISettings *ui)
         fprintf(file, "\n# Cache: Set to 1 to use cache of the music library directory tree for faster startup times.\n");
         fprintf(file, "cacheLibrary=%s\n", settings->cacheLibrary);
 
+        fprintf(file, "\n# Number of threads used for reading the music library directories, 0 picks one per processor core (max 8).\n");
+        fprintf(file, "# Higher values can speed up reading a library on a network drive.\n");
+        fprintf(file, "libraryScanThreads=%s\n", settings->libraryScanThreads);
+
+        fprintf(file, "\n# Watch the music folder and update the library when something is added or removed (1 = On, 0 = Off).\n");
+        fprintf(file, "# Folders with more than 8192 subfolders are checked for changes once a minute instead.\n");
+        fprintf(file, "watchLibrary=%s\n", settings->watchLibrary);
+
+        fprintf(file, "\n# Keep the audio device open at this sample rate, for instance 48000, and convert every track to it.\n");
+        fprintf(file, "# Avoids reopening the device when the format changes between tracks. 0 opens it at the rate of each track.\n");
+        fprintf(file, "outputSampleRate=%s\n", settings->outputSampleRate);
+
+        fprintf(file, "\n# Number of upcoming songs in the playlist to load ahead of time, up to 8, 0 to not load ahead.\n");
+        fprintf(file, "# Their tags and covers are read and the start of each file is read from disk before they play.\n");
+        fprintf(file, "prefetchTracks=%s\n", settings->prefetchTracks);
+        fprintf(file, "# How much memory in MB the songs loaded ahead of time can use.\n");
+        fprintf(file, "prefetchMemoryLimit=%s\n", settings->prefetchMemoryLimit);
+
         fprintf(file, "\n# Delay when drawing title in track view, set to 0 to have no delay.\n");
         fprintf(file, "titleDelay=%s\n", settings->titleDelay);
 
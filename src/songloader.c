@@ -12,7 +12,7 @@ songloader.c
 #define MAXPATHLEN 4096
 #endif
 
-static guint track_counter = 0;
+static _Atomic guint track_counter = 0; // Songs are loaded ahead of time on another thread too
 
 char *findLargestImageFile(const char *directoryPath, char *largestImageFile, off_t *largestFileSize)
 {
@@ -71,8 +71,7 @@ char *findLargestImageFile(const char *directoryPath, char *largestImageFile, of
 // Generate a new track ID
 gchar *generateTrackId(void)
 {
-        gchar *trackId = g_strdup_printf("/org/kew/tracklist/track%d", track_counter);
-        track_counter++;
+        gchar *trackId = g_strdup_printf("/org/kew/tracklist/track%d", atomic_fetch_add(&track_counter, 1));
         return trackId;
 }
 
@@ -85,13 +84,14 @@ void loadMetaData(SongData *songdata, AppState *state)
 {
         char path[MAXPATHLEN];
 
+        (void)state;
+
         songdata->metadata = malloc(sizeof(TagSettings));
         songdata->metadata->replaygainTrack = 0.0;
         songdata->metadata->replaygainAlbum = 0.0;
 
-        generateTempFilePath(songdata->coverArtPath, "cover", ".jpg");
-
-        int res = extractTags(songdata->filePath, songdata->metadata, &(songdata->duration), songdata->coverArtPath);
+        // The embedded picture stays in memory, it is only written to a file if something asks for its path
+        int res = extractTags(songdata->filePath, songdata->metadata, &(songdata->duration), &(songdata->coverData), &(songdata->coverDataSize));
 
         if (res == -2)
         {
@@ -113,13 +113,13 @@ void loadMetaData(SongData *songdata, AppState *state)
                 }
                 else
                         c_strcpy(songdata->coverArtPath, "", sizeof(songdata->coverArtPath));
+
+                songdata->cover = getBitmap(songdata->coverArtPath, &(songdata->coverWidth), &(songdata->coverHeight));
         }
         else
         {
-                addToCache(state->tempCache, songdata->coverArtPath);
+                songdata->cover = getBitmapFromMemory(songdata->coverData, songdata->coverDataSize, &(songdata->coverWidth), &(songdata->coverHeight));
         }
-
-        songdata->cover = getBitmap(songdata->coverArtPath, &(songdata->coverWidth), &(songdata->coverHeight));
 }
 
 SongData *loadSongData(char *filePath, AppState *state)
@@ -130,15 +130,25 @@ SongData *loadSongData(char *filePath, AppState *state)
         songdata->hasErrors = false;
         c_strcpy(songdata->filePath, "", sizeof(songdata->filePath));
         c_strcpy(songdata->coverArtPath, "", sizeof(songdata->coverArtPath));
+        songdata->coverData = NULL;
+        songdata->coverDataSize = 0;
+        songdata->coverArtIsTemp = false;
         songdata->red = defaultColor;
         songdata->green = defaultColor;
         songdata->blue = defaultColor;
         songdata->metadata = NULL;
         songdata->cover = NULL;
+        songdata->coverRender.output = NULL;
         songdata->duration = 0.0;
         c_strcpy(songdata->filePath, filePath, sizeof(songdata->filePath));
         loadMetaData(songdata, state);
         loadColor(songdata);
+
+        // Rendered here, on the loader's thread, so that showing the cover only copies it
+        int coverHeight = getLastCoverHeight();
+        if (songdata->cover != NULL && state->uiSettings.uiEnabled && state->uiSettings.coverEnabled && coverHeight > 0)
+                getCoverRender(&(songdata->coverRender), songdata->cover, songdata->coverWidth, songdata->coverHeight, coverHeight, state->uiSettings.coverAnsi);
+
         return songdata;
 }
 
@@ -149,21 +159,27 @@ void unloadSongData(SongData **songdata, AppState *state)
 
         SongData *data = *songdata;
 
+        (void)state;
+
         if (data->cover != NULL)
         {
                 stbi_image_free(data->cover);
                 data->cover = NULL;
         }
 
-        if (existsInCache(state->tempCache, data->coverArtPath) && isInTempDir(data->coverArtPath))
+        freeCoverRender(&(data->coverRender));
+
+        if (data->coverArtIsTemp && isInTempDir(data->coverArtPath))
         {
                 deleteFile(data->coverArtPath);
         }
 
+        free(data->coverData);
         free(data->metadata);
         free(data->trackId);
 
         data->cover = NULL;
+        data->coverData = NULL;
         data->metadata = NULL;
 
         data->trackId = NULL;
@@ -171,3 +187,38 @@ void unloadSongData(SongData **songdata, AppState *state)
         free(*songdata);
         *songdata = NULL;
 }
+
+// The path of the cover, for MPRIS and notifications. An embedded picture is written to a temporary file the first time.
+const char *getCoverArtPath(SongData *songdata)
+{
+        if (songdata == NULL)
+                return "";
+
+        if (songdata->coverArtPath[0] != '\0' || songdata->coverData == NULL)
+                return songdata->coverArtPath;
+
+        char path[MAXPATHLEN];
+        generateTempFilePath(path, "cover", ".jpg");
+
+        FILE *file = fopen(path, "wb");
+        if (file == NULL)
+                return songdata->coverArtPath;
+
+        size_t written = fwrite(songdata->coverData, 1, songdata->coverDataSize, file);
+
+        if (fclose(file) != 0 || written != songdata->coverDataSize)
+        {
+                deleteFile(path);
+                return songdata->coverArtPath;
+        }
+
+        c_strcpy(songdata->coverArtPath, path, sizeof(songdata->coverArtPath));
+        songdata->coverArtIsTemp = true;
+
+        // It is in the file now
+        free(songdata->coverData);
+        songdata->coverData = NULL;
+        songdata->coverDataSize = 0;
+
+        return songdata->coverArtPath;
+}
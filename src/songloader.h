@@ -4,7 +4,6 @@
 #include <unistd.h>
 #include "appstate.h"
 #include "tagLibWrapper.h"
-#include "cache.h"
 #include "imgfunc.h"
 #include "file.h"
 #include "sound.h"
@@ -40,6 +39,8 @@ typedef struct
                 char date[METADATA_MAX_LENGTH];
                 double replaygainTrack;
                 double replaygainAlbum;
+                unsigned int gaplessSkip;          // Decoded frames before the music starts, like the encoder delay
+                unsigned long long gaplessLength;  // Frames of music after that, without the encoder's padding. 0 when not known
         } TagSettings;
 
 #endif
@@ -52,6 +53,9 @@ typedef struct
         gchar *trackId;
         char filePath[MAXPATHLEN];
         char coverArtPath[MAXPATHLEN];
+        unsigned char *coverData;  // The embedded picture the way it is stored, until it is written out to coverArtPath
+        size_t coverDataSize;
+        bool coverArtIsTemp;       // coverArtPath is a temporary file of ours
         unsigned char red;
         unsigned char green;
         unsigned char blue;
@@ -61,6 +65,7 @@ typedef struct
         int coverHeight;
         double duration;
         bool hasErrors;
+        CoverRender coverRender; // The cover, ready to print
 } SongData;
 
 #endif
@@ -68,3 +73,5 @@ typedef struct
 SongData *loadSongData(char *filePath, AppState *state);
 
 void unloadSongData(SongData **songdata, AppState *state);
+
+const char *getCoverArtPath(SongData *songdata);
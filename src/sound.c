@@ -4,6 +4,7 @@
 
 #include <miniaudio.h>
 #include "sound.h"
+#include "audiotap.h"
 
 /*
 
@@ -34,6 +35,7 @@ ma_result initFirstDatasource(AudioData *pAudioData, UserData *pUserData)
 
         pAudioData->pUserData = pUserData;
         pAudioData->currentPCMFrame = 0;
+        pAudioData->trackFrame = 0;
         pAudioData->restart = false;
 
         if (hasBuiltinDecoder(filePath))
@@ -99,42 +101,95 @@ ma_result initFirstDatasource(AudioData *pAudioData, UserData *pUserData)
         return MA_SUCCESS;
 }
 
-int createDevice(UserData *userData, ma_device *device, ma_context *context, ma_data_source_vtable *vtable, ma_device_data_proc callback)
+// Plays what the first decoder outputs. With a fixed output format the device is opened once at that
+// format, and when the next track needs new decoders only what they are converted from changes.
+static int startPlaybackDevice(enum AudioImplementation implementation, ma_device_config *deviceConfig, ma_context *context, ma_device *device)
 {
         ma_result result;
+        ma_format format = deviceConfig->playback.format;
+        ma_uint32 channels = deviceConfig->playback.channels;
+        ma_uint32 sampleRate = deviceConfig->sampleRate;
 
-        ma_data_source_uninit(&audioData);
-        result = initFirstDatasource(&audioData, userData);
-        if (result != MA_SUCCESS)
-                return -1;
+        if (isOutputFormatFixed())
+        {
+                if (ma_device_get_state(device) != ma_device_state_uninitialized)
+                {
+                        discardDecodedAudio();
 
-        audioData.base.vtable = vtable;
+                        if (setDecodeAheadInput(implementation, format, channels, sampleRate) < 0)
+                        {
+                                setErrorMessage("Failed to convert to the output format.");
+                                return -1;
+                        }
 
-        ma_device_config deviceConfig = ma_device_config_init(ma_device_type_playback);
-        deviceConfig.playback.format = audioData.format;
-        deviceConfig.playback.channels = audioData.channels;
-        deviceConfig.sampleRate = audioData.sampleRate;
-        deviceConfig.dataCallback = callback;
-        deviceConfig.pUserData = &audioData;
+                        if (!ma_device_is_started(device) && ma_device_start(device) != MA_SUCCESS)
+                        {
+                                setErrorMessage("Failed to start miniaudio device.");
+                                return -1;
+                        }
+
+                        appState.uiState.doNotifyMPRISPlaying = true;
+
+                        return 0;
+                }
+
+                deviceConfig->playback.format = FIXED_OUTPUT_FORMAT;
+                deviceConfig->playback.channels = FIXED_OUTPUT_CHANNELS;
+                deviceConfig->sampleRate = appState.uiSettings.outputSampleRate;
+        }
 
-        result = ma_device_init(context, &deviceConfig, device);
+        if (resetDecodeAhead(implementation, deviceConfig->playback.format, deviceConfig->playback.channels, deviceConfig->sampleRate) < 0 ||
+            setDecodeAheadInput(implementation, format, channels, sampleRate) < 0)
+        {
+                setErrorMessage("Failed to allocate audio buffer.");
+                return -1;
+        }
+
+        result = ma_device_init(context, deviceConfig, device);
         if (result != MA_SUCCESS)
+        {
+                setErrorMessage("Failed to initialize miniaudio device.");
                 return -1;
+        }
 
         setVolume(getCurrentVolume());
 
         result = ma_device_start(device);
         if (result != MA_SUCCESS)
+        {
+                setErrorMessage("Failed to start miniaudio device.");
                 return -1;
+        }
 
         appState.uiState.doNotifyMPRISPlaying = true;
 
         return 0;
 }
 
+int createDevice(UserData *userData, ma_device *device, ma_context *context, ma_data_source_vtable *vtable, ma_device_data_proc callback)
+{
+        ma_result result;
+
+        ma_data_source_uninit(&audioData);
+        result = initFirstDatasource(&audioData, userData);
+        if (result != MA_SUCCESS)
+                return -1;
+
+        audioData.base.vtable = vtable;
+
+        ma_device_config deviceConfig = ma_device_config_init(ma_device_type_playback);
+        deviceConfig.playback.format = audioData.format;
+        deviceConfig.playback.channels = audioData.channels;
+        deviceConfig.sampleRate = audioData.sampleRate;
+        deviceConfig.dataCallback = callback;
+        deviceConfig.pUserData = &audioData;
+
+        return startPlaybackDevice(BUILTIN, &deviceConfig, context, device);
+}
+
 int builtin_createAudioDevice(UserData *userData, ma_device *device, ma_context *context, ma_data_source_vtable *vtable)
 {
-        return createDevice(userData, device, context, vtable, builtin_on_audio_frames);
+        return createDevice(userData, device, context, vtable, decodeahead_on_audio_frames);
 }
 
 int vorbis_createAudioDevice(UserData *userData, ma_device *device, ma_context *context)
@@ -153,28 +208,10 @@ int vorbis_createAudioDevice(UserData *userData, ma_device *device, ma_context *
         deviceConfig.playback.format = vorbis->format;
         deviceConfig.playback.channels = audioData.channels;
         deviceConfig.sampleRate = audioData.sampleRate;
-        deviceConfig.dataCallback = vorbis_on_audio_frames;
+        deviceConfig.dataCallback = decodeahead_on_audio_frames;
         deviceConfig.pUserData = vorbis;
 
-        result = ma_device_init(context, &deviceConfig, device);
-        if (result != MA_SUCCESS)
-        {
-                setErrorMessage("Failed to initialize miniaudio device.");
-                return -1;
-        }
-
-        setVolume(getCurrentVolume());
-
-        result = ma_device_start(device);
-        if (result != MA_SUCCESS)
-        {
-                setErrorMessage("Failed to start miniaudio device.");
-                return -1;
-        }
-
-        appState.uiState.doNotifyMPRISPlaying = true;
-
-        return 0;
+        return startPlaybackDevice(VORBIS, &deviceConfig, context, device);
 }
 
 #ifdef USE_FAAD
@@ -194,29 +231,10 @@ int m4a_createAudioDevice(UserData *userData, ma_device *device, ma_context *con
         deviceConfig.playback.format = decoder->format;
         deviceConfig.playback.channels = audioData.channels;
         deviceConfig.sampleRate = audioData.sampleRate;
-        deviceConfig.dataCallback = m4a_on_audio_frames;
+        deviceConfig.dataCallback = decodeahead_on_audio_frames;
         deviceConfig.pUserData = decoder;
 
-        result = ma_device_init(context, &deviceConfig, device);
-        if (result != MA_SUCCESS)
-        {
-                setErrorMessage("Failed to initialize miniaudio device.");
-                return -1;
-        }
-
-        setVolume(getCurrentVolume());
-
-        result = ma_device_start(device);
-
-        if (result != MA_SUCCESS)
-        {
-                setErrorMessage("Failed to start miniaudio device.");
-                return -1;
-        }
-
-        appState.uiState.doNotifyMPRISPlaying = true;
-
-        return 0;
+        return startPlaybackDevice(M4A, &deviceConfig, context, device);
 }
 #endif
 
@@ -237,28 +255,10 @@ int opus_createAudioDevice(UserData *userData, ma_device *device, ma_context *co
         deviceConfig.playback.format = opus->format;
         deviceConfig.playback.channels = audioData.channels;
         deviceConfig.sampleRate = audioData.sampleRate;
-        deviceConfig.dataCallback = opus_on_audio_frames;
+        deviceConfig.dataCallback = decodeahead_on_audio_frames;
         deviceConfig.pUserData = opus;
 
-        result = ma_device_init(context, &deviceConfig, device);
-        if (result != MA_SUCCESS)
-        {
-                setErrorMessage("Failed to initialize miniaudio device.");
-                return -1;
-        }
-
-        setVolume(getCurrentVolume());
-
-        result = ma_device_start(device);
-        if (result != MA_SUCCESS)
-        {
-                setErrorMessage("Failed to start miniaudio device.");
-                return -1;
-        }
-
-        appState.uiState.doNotifyMPRISPlaying = true;
-
-        return 0;
+        return startPlaybackDevice(OPUS, &deviceConfig, context, device);
 }
 
 bool validFilePath(char *filePath)
@@ -272,6 +272,55 @@ bool validFilePath(char *filePath)
         return true;
 }
 
+// Called on the decoder thread with dataSourceMutex held, once the last frames of a track are decoded. Decoding
+// carries on into the next track when its decoder is ready or can be opened here, and the device can play what
+// it outputs. Otherwise the main thread opens it once playback reaches the end, like before.
+bool startNextTrack(void)
+{
+        enum AudioImplementation implementation = getCurrentImplementationType();
+        SongData *songData = getLoadedSongData(&userData);
+
+        if (isRepeatEnabled() || implementation == NONE || audioData.endOfListReached)
+                return false;
+
+        if (isNextTrackPrepared())
+                return true;
+
+        // Raw aac has no length to tell where it ends
+        if (songData == NULL || songData->hasErrors || !validFilePath(songData->filePath) || pathEndsWith(songData->filePath, "aac"))
+                return false;
+
+        if (hasBuiltinDecoder(songData->filePath))
+                implementation = BUILTIN;
+        else if (pathEndsWith(songData->filePath, "opus"))
+                implementation = OPUS;
+        else if (pathEndsWith(songData->filePath, "ogg"))
+                implementation = VORBIS;
+#ifdef USE_FAAD
+        else if (pathEndsWith(songData->filePath, "m4a"))
+                implementation = M4A;
+#endif
+        else
+                return false;
+
+        resetAllDecoders();
+        setCurrentImplementationType(implementation);
+
+        if (implementation == BUILTIN)
+                audioData.base.vtable = &builtin_file_data_source_vtable;
+
+        if (initFirstDatasource(&audioData, &userData) != MA_SUCCESS ||
+            (!isOutputFormatFixed() && !isDecodeAheadFormat(audioData.format, audioData.channels, audioData.sampleRate)) ||
+            setDecodeAheadInput(implementation, audioData.format, audioData.channels, audioData.sampleRate) < 0)
+        {
+                // No decoders is a change of format to the main thread, which opens the track again
+                resetAllDecoders();
+                return false;
+        }
+
+        return true;
+}
+
 bool tryAgain = false;
 
 int switchAudioImplementation(void)
@@ -344,10 +393,12 @@ int switchAudioImplementation(void)
 
                         setCurrentImplementationType(BUILTIN);
 
-                        cleanupPlaybackDevice();
+                        // The device keeps playing what is buffered while the decoders change
+                        if (!isOutputFormatFixed())
+                                cleanupPlaybackDevice();
 
                         resetAllDecoders();
-                        resetAudioBuffer();
+                        clearAudioTap();
 
                         audioData.sampleRate = sampleRate;
 
@@ -398,10 +449,11 @@ int switchAudioImplementation(void)
 
                         setCurrentImplementationType(OPUS);
 
-                        cleanupPlaybackDevice();
+                        if (!isOutputFormatFixed())
+                                cleanupPlaybackDevice();
 
                         resetAllDecoders();
-                        resetAudioBuffer();
+                        clearAudioTap();
 
                         audioData.sampleRate = sampleRate;
 
@@ -452,10 +504,11 @@ int switchAudioImplementation(void)
 
                         setCurrentImplementationType(VORBIS);
 
-                        cleanupPlaybackDevice();
+                        if (!isOutputFormatFixed())
+                                cleanupPlaybackDevice();
 
                         resetAllDecoders();
-                        resetAudioBuffer();
+                        clearAudioTap();
 
                         audioData.sampleRate = sampleRate;
 
@@ -510,10 +563,11 @@ int switchAudioImplementation(void)
 
                         setCurrentImplementationType(M4A);
 
-                        cleanupPlaybackDevice();
+                        if (!isOutputFormatFixed())
+                                cleanupPlaybackDevice();
 
                         resetAllDecoders();
-                        resetAudioBuffer();
+                        clearAudioTap();
 
                         audioData.sampleRate = sampleRate;
 
@@ -18,6 +18,7 @@
 #include "soundcommon.h"
 #include "soundradio.h"
 #include "common.h"
+#include "decodeahead.h"
 
 #ifndef USERDATA_STRUCT
 #define USERDATA_STRUCT
@@ -45,6 +46,7 @@ typedef struct
         bool switchFiles;
         int currentFileIndex;
         ma_uint64 totalFrames;
+        ma_uint64 trackFrame; // Frames the current decoder has output, the skipped ones too
         bool endOfListReached;
         bool restart;
 } AudioData;
@@ -58,6 +60,8 @@ int createAudioDevice();
 
 int switchAudioImplementation(void);
 
+bool startNextTrack(void);
+
 void cleanupAudioContext(void);
 
 #endif
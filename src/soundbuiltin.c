@@ -99,70 +99,30 @@ ma_data_source_vtable builtin_file_data_source_vtable = {
     0 // Flags
 };
 
-double dbToLinear(double db)
+// Runs on the decoder thread with dataSourceMutex held
+void builtin_read_pcm_frames(AudioData *audioData, void *pFramesOut, ma_uint64 frameCount, ma_uint64 *pFramesRead)
 {
-        return pow(10.0, db / 20.0);
-}
-
-void builtin_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_uint64 frameCount, ma_uint64 *pFramesRead)
-{
-        AudioData *audioData = (AudioData *)pDataSource;
         ma_uint64 framesRead = 0;
 
-        // Convert ReplayGain dB values to linear gain factors
-        double gainDb = 0.0; // Default to 0 dB (no gain)
-        bool gainAvailable = false;
-
-        if ((!audioData->pUserData->songdataADeleted && audioData->pUserData->currentSongData == audioData->pUserData->songdataA) ||
-            (!audioData->pUserData->songdataBDeleted && audioData->pUserData->currentSongData == audioData->pUserData->songdataB))
-        {
-                if (audioData->pUserData->currentSongData->metadata->replaygainTrack > -50.0)
-                {
-                        gainDb = audioData->pUserData->currentSongData->metadata->replaygainTrack;
-                        gainAvailable = true;
-                }
-                else if (audioData->pUserData->currentSongData->metadata->replaygainAlbum > -50.0)
-                {
-                        gainDb = audioData->pUserData->currentSongData->metadata->replaygainAlbum;
-                        gainAvailable = true;
-                }
-        }
-
-        double totalGainFactor = 1.0;
-        if (gainAvailable)
-        {
-                totalGainFactor = dbToLinear(gainDb);
-        }
+        ma_uint32 bytesPerFrame = ma_get_bytes_per_frame(audioData->format, audioData->channels);
 
         while (framesRead < frameCount)
         {
                 ma_uint64 remainingFrames = frameCount - framesRead;
 
-                if (pthread_mutex_trylock(&dataSourceMutex) != 0)
-                {
-                        return;
-                }
-
-                if (isImplSwitchReached() || audioData == NULL)
-                {
-                        pthread_mutex_unlock(&dataSourceMutex);
-                        return;
-                }
+                if (isImplSwitchReached())
+                        break;
 
                 if (audioData->switchFiles)
                 {
                         executeSwitch(audioData);
-                        pthread_mutex_unlock(&dataSourceMutex);
                         break;
                 }
 
                 ma_decoder *decoder = getCurrentBuiltinDecoder();
 
                 if ((getCurrentImplementationType() != BUILTIN && !isSkipToNext()))
-                {
-                        pthread_mutex_unlock(&dataSourceMutex);
-                        return;
-                }
+                        break;
 
                 if (audioData->totalFrames == 0)
                         ma_data_source_get_length_in_pcm_frames(decoder, &(audioData->totalFrames));
@@ -180,142 +140,51 @@ void builtin_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_u
 
                         ma_result seekResult = ma_decoder_seek_to_pcm_frame(decoder, targetFrame);
 
+                        setSeekRequested(false);
+
                         if (seekResult != MA_SUCCESS)
-                        {
-                                setSeekRequested(false);
-                                pthread_mutex_unlock(&dataSourceMutex);
-                                return;
-                        }
+                                break;
 
-                        setSeekRequested(false);
+                        setTrackPosition(audioData, targetFrame);
+
+                        // What was decoded before the seek shouldn't be played
+                        discardDecodedAudio();
+                        framesRead = 0;
+                        remainingFrames = frameCount;
                 }
 
                 ma_uint64 framesToRead = 0;
-                ma_decoder *firstDecoder = getFirstDecoder();
-                ma_uint64 cursor = 0;
-                ma_result result;
 
-                if (firstDecoder == NULL)
-                {
-                        pthread_mutex_unlock(&dataSourceMutex);
-                        return;
-                }
+                if (decoder == NULL)
+                        break;
 
-                if (isEOFReached())
+                // Don't play what is buffered of a song that is skipped
+                if (isSkipToNext())
                 {
-                        pthread_mutex_unlock(&dataSourceMutex);
-                        return;
+                        discardDecodedAudio();
+                        framesRead = 0;
+                        activateSwitch(audioData);
+                        continue;
                 }
 
-                result = ma_data_source_read_pcm_frames(firstDecoder, (ma_int32 *)pFramesOut + framesRead * audioData->channels, remainingFrames, &framesToRead);
-                ma_data_source_get_cursor_in_pcm_frames(decoder, &cursor);
+                ma_result result = readTrackFrames(audioData, decoder, (unsigned char *)pFramesOut + framesRead * bytesPerFrame, remainingFrames, &framesToRead);
 
-                float *frames = (float *)pFramesOut + framesRead * audioData->channels;
+                framesRead += framesToRead;
 
-                // Apply replay gain
-                if (totalGainFactor != 1.0)
+                // The track's last frames are kept, the next track is read from after the switch.
+                // Only one track end is waited for at a time.
+                if (framesToRead < remainingFrames || result != MA_SUCCESS)
                 {
-                        switch (audioData->format)
-                        {
-                        case ma_format_f32:
-                                for (ma_uint64 i = 0; i < framesToRead; ++i)
-                                {
-                                        for (int ch = 0; ch < (int)audioData->channels; ++ch)
-                                        {
-                                                ma_uint64 frameIndex = i * audioData->channels + ch;
-                                                float originalSample = frames[frameIndex];
-                                                double sample = (double)originalSample;
-
-                                                sample *= totalGainFactor;
-                                                frames[frameIndex] = (float)sample;
-                                        }
-                                }
-                                break;
-
-                        case ma_format_s16:
-                                for (ma_uint64 i = 0; i < framesToRead; ++i)
-                                {
-                                        for (int ch = 0; ch < (int)audioData->channels; ++ch)
-                                        {
-                                                ma_uint64 frameIndex = i * audioData->channels + ch;
-                                                ma_int16 originalSample = frames[frameIndex];
-                                                double sample = (double)originalSample;
-
-                                                sample *= totalGainFactor;
-
-                                                if (sample > 32767.0)
-                                                        sample = 32767.0;
-                                                else if (sample < -32768.0)
-                                                        sample = -32768.0;
-
-                                                frames[frameIndex] = (ma_int16)sample;
-                                        }
-                                }
-                                break;
-
-                        case ma_format_s32:
-                                for (ma_uint64 i = 0; i < framesToRead; ++i)
-                                {
-                                        for (int ch = 0; ch < (int)audioData->channels; ++ch)
-                                        {
-                                                ma_uint64 frameIndex = i * audioData->channels + ch;
-                                                ma_int32 originalSample = frames[frameIndex];
-                                                double sample = (double)originalSample;
-
-                                                sample *= totalGainFactor;
-
-                                                // Clamp
-                                                if (sample > 2147483647.0)
-                                                        sample = 2147483647.0;
-                                                else if (sample < -2147483648.0)
-                                                        sample = -2147483648.0;
-
-                                                frames[frameIndex] = (ma_int32)sample;
-                                        }
-                                }
+                        if (isEndOfTrackPending())
                                 break;
 
-                        default:
-                                break;
-                        }
-                }
-
-                if (((audioData->totalFrames != 0 && cursor != 0 && cursor >= audioData->totalFrames) || framesToRead == 0 || isSkipToNext() || result != MA_SUCCESS) && !isEOFReached())
-                {
                         activateSwitch(audioData);
-                        pthread_mutex_unlock(&dataSourceMutex);
                         continue;
                 }
-
-                framesRead += framesToRead;
-                setBufferSize(framesToRead);
-
-                pthread_mutex_unlock(&dataSourceMutex);
         }
 
-        ma_int32 *audioBuffer = getAudioBuffer();
-        if (audioBuffer == NULL)
-        {
-                audioBuffer = malloc(sizeof(ma_int32) * MAX_BUFFER_SIZE);
-                if (audioBuffer == NULL)
-                {
-                        return;
-                }
-        }
-
-        memcpy(audioBuffer, pFramesOut, sizeof(ma_int32) * framesRead);
-        setAudioBuffer(audioBuffer);
-
         if (pFramesRead != NULL)
         {
                 *pFramesRead = framesRead;
         }
 }
-
-void builtin_on_audio_frames(ma_device *pDevice, void *pFramesOut, const void *pFramesIn, ma_uint32 frameCount)
-{
-        AudioData *pDataSource = (AudioData *)pDevice->pUserData;
-        ma_uint64 framesRead = 0;
-        builtin_read_pcm_frames(&(pDataSource->base), pFramesOut, frameCount, &framesRead);
-        (void)pFramesIn;
-}
@@ -1,4 +1,5 @@
 #include "soundcommon.h"
+#include "decodeahead.h"
 #include "playerops.h"
 
 /*
@@ -34,9 +35,8 @@ _Atomic bool readingFrames = false;
 pthread_mutex_t dataSourceMutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t switchMutex = PTHREAD_MUTEX_INITIALIZER;
 ma_device device = {0};
-ma_int32 *audioBuffer = NULL;
 AudioData audioData;
-int bufSize;
+_Atomic int bufSize = 0; // Frames the audio callback is asked for, what the visualizer analyses
 ma_event switchAudioImpl;
 enum AudioImplementation currentImplementation = NONE;
 
@@ -65,6 +65,10 @@ int m4aDecoderIndex = -1;
 int opusDecoderIndex = -1;
 int vorbisDecoderIndex = -1;
 
+// Opened for the next track while the current one plays, so that it can follow without a gap
+static void *preparedDecoder = NULL;
+static bool nextTrackPrepared = false;
+
 void uninitMaDecoder(void *decoder)
 {
         ma_decoder_uninit((ma_decoder *)decoder);
@@ -128,6 +132,9 @@ void resetDecoders(void **decoderArray, void **firstDecoder, int arraySize, int
 
 void resetAllDecoders()
 {
+        preparedDecoder = NULL;
+        nextTrackPrepared = false;
+
         resetDecoders((void **)decoders, (void **)&firstDecoder, MAX_DECODERS, &decoderIndex, uninitMaDecoder);
         resetDecoders((void **)vorbisDecoders, (void **)&firstVorbisDecoder, MAX_DECODERS, &vorbisDecoderIndex, uninitVorbisDecoder);
         resetDecoders((void **)opusDecoders, (void **)&firstOpusDecoder, MAX_DECODERS, &opusDecoderIndex, uninitOpusDecoder);
@@ -260,6 +267,8 @@ int prepareNextM4aDecoder(SongData *songData)
 
         char *filepath = songData->filePath;
 
+        preparedDecoder = NULL;
+
         if (m4aDecoderIndex == -1)
         {
                 currentDecoder = getFirstM4aDecoder();
@@ -325,10 +334,8 @@ int prepareNextM4aDecoder(SongData *songData)
         }
 
         if (currentDecoder != NULL && decoder != NULL && decoder->fileType != k_rawAAC)
-        {
-                if (!isEOFReached())
-                        ma_data_source_set_next(currentDecoder, decoder);
-        }
+                preparedDecoder = decoder;
+
         return 0;
 }
 
@@ -401,6 +408,13 @@ void getCurrentFormatAndSampleRate(ma_format *format, ma_uint32 *sampleRate)
         }
 
         *sampleRate = audioData.sampleRate;
+
+        // The visualizer gets what is played, after conversion
+        if (!isRadioPlaying() && isOutputFormatFixed())
+        {
+                *format = FIXED_OUTPUT_FORMAT;
+                *sampleRate = appState.uiSettings.outputSampleRate;
+        }
 }
 
 void getFileInfo(const char *filename, ma_uint32 *sampleRate, ma_uint32 *channels, ma_format *format)
@@ -484,6 +498,8 @@ int prepareNextVorbisDecoder(char *filepath)
 {
         ma_libvorbis *currentDecoder;
 
+        preparedDecoder = NULL;
+
         if (vorbisDecoderIndex == -1)
         {
                 currentDecoder = getFirstVorbisDecoder();
@@ -538,10 +554,7 @@ int prepareNextVorbisDecoder(char *filepath)
         setNextDecoder((void **)vorbisDecoders, (void**)&decoder, (void**)&firstVorbisDecoder, &vorbisDecoderIndex, (uninit_func)uninitVorbisDecoder);
 
         if (currentDecoder != NULL && decoder != NULL)
-        {
-                if (!isEOFReached())
-                        ma_data_source_set_next(currentDecoder, decoder);
-        }
+                preparedDecoder = decoder;
 
         return 0;
 }
@@ -550,6 +563,8 @@ int prepareNextDecoder(char *filepath)
 {
         ma_decoder *currentDecoder;
 
+        preparedDecoder = NULL;
+
         if (decoderIndex == -1)
         {
                 currentDecoder = getFirstDecoder();
@@ -586,10 +601,8 @@ int prepareNextDecoder(char *filepath)
         setNextDecoder((void **)decoders, (void**)&decoder, (void**)&firstDecoder, &decoderIndex, (uninit_func)uninitMaDecoder);
 
         if (currentDecoder != NULL && decoder != NULL)
-        {
-                if (!isEOFReached())
-                        ma_data_source_set_next(currentDecoder, decoder);
-        }
+                preparedDecoder = decoder;
+
         return 0;
 }
 
@@ -597,6 +610,8 @@ int prepareNextOpusDecoder(char *filepath)
 {
         ma_libopus *currentDecoder;
 
+        preparedDecoder = NULL;
+
         if (opusDecoderIndex == -1)
         {
                 currentDecoder = getFirstOpusDecoder();
@@ -650,10 +665,8 @@ int prepareNextOpusDecoder(char *filepath)
         setNextDecoder((void **)opusDecoders, (void**)&decoder, (void**)&firstOpusDecoder, &opusDecoderIndex, (uninit_func)uninitOpusDecoder);
 
         if (currentDecoder != NULL && decoder != NULL)
-        {
-                if (!isEOFReached())
-                        ma_data_source_set_next(currentDecoder, decoder);
-        }
+                preparedDecoder = decoder;
+
         return 0;
 }
 
@@ -667,42 +680,6 @@ void setBufferSize(int value)
         bufSize = value;
 }
 
-void initAudioBuffer(void)
-{
-        if (audioBuffer == NULL)
-        {
-                audioBuffer = malloc(sizeof(ma_int32) * MAX_BUFFER_SIZE);
-                if (audioBuffer == NULL)
-                {
-                        // Memory allocation failed
-                        return;
-                }
-        }
-}
-
-ma_int32 *getAudioBuffer(void)
-{
-        return audioBuffer;
-}
-
-void setAudioBuffer(ma_int32 *buf)
-{
-        audioBuffer = buf;
-}
-
-void resetAudioBuffer(void)
-{
-        memset(audioBuffer, 0, sizeof(float) * MAX_BUFFER_SIZE);
-}
-
-void freeAudioBuffer(void)
-{
-        if (audioBuffer != NULL)
-        {
-                free(audioBuffer);
-                audioBuffer = NULL;
-        }
-}
 
 bool isRepeatEnabled(void)
 {
@@ -820,6 +797,7 @@ void seekPercentage(float percent)
 {
         seekPercent = percent;
         seekRequested = true;
+        wakeDecodeAhead();
 }
 
 void resumePlayback(void)
@@ -839,6 +817,8 @@ void resumePlayback(void)
 
         stopped = false;
 
+        wakeDecodeAhead();
+
         if (appState.currentView != TRACK_VIEW)
         {
                 refresh = true;
@@ -875,6 +855,11 @@ void pausePlayback(void)
         }
 }
 
+bool isOutputFormatFixed(void)
+{
+        return appState.uiSettings.outputSampleRate > 0;
+}
+
 void cleanupPlaybackDevice(void)
 {
         ma_device_stop(&device);
@@ -895,7 +880,6 @@ void clearCurrentTrack(void)
         }
 
         resetAllDecoders();
-        ma_data_source_set_next(currentDecoder, NULL);
 }
 
 void togglePausePlayback(void)
@@ -978,6 +962,25 @@ gint64 getLengthInMicroSec(double duration)
         return floor(llround(duration * G_USEC_PER_SEC));
 }
 
+static void *getCurrentDecoder(enum AudioImplementation implementation)
+{
+        switch (implementation)
+        {
+        case BUILTIN:
+                return getCurrentBuiltinDecoder();
+        case OPUS:
+                return getCurrentOpusDecoder();
+        case VORBIS:
+                return getCurrentVorbisDecoder();
+#ifdef USE_FAAD
+        case M4A:
+                return getCurrentM4aDecoder();
+#endif
+        default:
+                return NULL;
+        }
+}
+
 void executeSwitch(AudioData *pAudioData)
 {
         pAudioData->switchFiles = false;
@@ -986,13 +989,93 @@ void executeSwitch(AudioData *pAudioData)
         switchDecoder(&m4aDecoderIndex);
         switchDecoder(&vorbisDecoderIndex);
 
+        nextTrackPrepared = (preparedDecoder != NULL && getCurrentDecoder(getCurrentImplementationType()) == preparedDecoder);
+        preparedDecoder = NULL;
+
         pAudioData->pUserData->currentSongData = (pAudioData->currentFileIndex == 0) ? pAudioData->pUserData->songdataA : pAudioData->pUserData->songdataB;
         pAudioData->totalFrames = 0;
+        pAudioData->trackFrame = 0;
         pAudioData->currentPCMFrame = 0;
 
         setSeekElapsed(0.0);
 
-        setEOFReached();
+        // The main thread is told when playback has caught up with the decoder
+        markEndOfTrack();
+}
+
+// The current song data, unless the loader thread has deleted it to load another song in its place
+SongData *getLoadedSongData(UserData *pUserData)
+{
+        if (pUserData == NULL)
+                return NULL;
+
+        if ((!pUserData->songdataADeleted && pUserData->currentSongData == pUserData->songdataA) ||
+            (!pUserData->songdataBDeleted && pUserData->currentSongData == pUserData->songdataB))
+                return pUserData->currentSongData;
+
+        return NULL;
+}
+
+// True when the decoder executeSwitch() moved on to was opened for the track that follows
+bool isNextTrackPrepared(void)
+{
+        return nextTrackPrepared;
+}
+
+void setTrackPosition(AudioData *pAudioData, ma_uint64 frameIndex)
+{
+        pAudioData->trackFrame = frameIndex;
+}
+
+// Reads from the current track's decoder only. The encoder delay and padding are left out when the tags say how long
+// they are, so that tracks meant to be played without a gap between them don't get one of silence.
+ma_result readTrackFrames(AudioData *pAudioData, ma_data_source *decoder, void *pFramesOut, ma_uint64 frameCount, ma_uint64 *pFramesRead)
+{
+        SongData *songData = getLoadedSongData(pAudioData->pUserData);
+        ma_uint64 skip = 0;
+        ma_uint64 end = 0;
+
+        *pFramesRead = 0;
+
+        if (songData != NULL && songData->metadata != NULL)
+        {
+                skip = songData->metadata->gaplessSkip;
+
+                if (songData->metadata->gaplessLength > 0)
+                        end = skip + songData->metadata->gaplessLength;
+        }
+
+        // The delay is decoded into pFramesOut and written over
+        while (pAudioData->trackFrame < skip)
+        {
+                ma_uint64 framesToSkip = skip - pAudioData->trackFrame;
+                ma_uint64 framesSkipped = 0;
+
+                if (framesToSkip > frameCount)
+                        framesToSkip = frameCount;
+
+                ma_result result = ma_data_source_read_pcm_frames(decoder, pFramesOut, framesToSkip, &framesSkipped);
+
+                pAudioData->trackFrame += framesSkipped;
+
+                if (result != MA_SUCCESS)
+                        return result;
+        }
+
+        if (end > 0)
+        {
+                if (pAudioData->trackFrame >= end)
+                        return MA_AT_END;
+
+                if (frameCount > end - pAudioData->trackFrame)
+                        frameCount = end - pAudioData->trackFrame;
+        }
+
+        ma_result result = ma_data_source_read_pcm_frames(decoder, pFramesOut, frameCount, pFramesRead);
+
+        pAudioData->trackFrame += *pFramesRead;
+
+        return result;
 }
 
 int getCurrentVolume(void)
@@ -1140,38 +1223,27 @@ int adjustVolumePercent(int volumeChange)
         return 0;
 }
 
-ma_uint64 lastCursor = 0;
-
 #ifdef USE_FAAD
-void m4a_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_uint64 frameCount, ma_uint64 *pFramesRead)
+// Runs on the decoder thread with dataSourceMutex held
+void m4a_read_pcm_frames(AudioData *pAudioData, void *pFramesOut, ma_uint64 frameCount, ma_uint64 *pFramesRead)
 {
-        m4a_decoder *m4a = (m4a_decoder *)pDataSource;
-        AudioData *pAudioData = (AudioData *)m4a->pReadSeekTellUserData;
         ma_uint64 framesRead = 0;
+        ma_uint32 bytesPerFrame = ma_get_bytes_per_frame(pAudioData->format, pAudioData->channels);
 
         while (framesRead < frameCount)
         {
                 if (isImplSwitchReached())
-                        return;
-
-                if (pthread_mutex_trylock(&dataSourceMutex) != 0)
-                {
-                        return;
-                }
+                        break;
 
                 // Check if a file switch is required
                 if (pAudioData->switchFiles)
                 {
                         executeSwitch(pAudioData);
-                        pthread_mutex_unlock(&dataSourceMutex);
                         break; // Exit the loop after the file switch
                 }
 
                 if (getCurrentImplementationType() != M4A && !isSkipToNext())
-                {
-                        pthread_mutex_unlock(&dataSourceMutex);
-                        return;
-                }
+                        break;
 
                 m4a_decoder *decoder = getCurrentM4aDecoder();
 
@@ -1181,125 +1253,99 @@ void m4a_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_uint6
                 // Check if seeking is requested
                 if (isSeekRequested())
                 {
-                        if (decoder->fileType != k_rawAAC)
-                        {
-                                ma_uint64 totalFrames = pAudioData->totalFrames;
-                                ma_uint64 seekPercent = getSeekPercentage();
+                        ma_uint64 totalFrames = pAudioData->totalFrames;
+                        ma_uint64 seekPercent = getSeekPercentage();
 
-                                if (seekPercent >= 100.0)
-                                        seekPercent = 100.0;
+                        if (seekPercent >= 100.0)
+                                seekPercent = 100.0;
 
-                                ma_uint64 targetFrame = (ma_uint64)((totalFrames - 1) * seekPercent / 100.0);
+                        ma_uint64 targetFrame = (ma_uint64)((totalFrames - 1) * seekPercent / 100.0);
 
-                                if (targetFrame >= totalFrames)
-                                        targetFrame = totalFrames - 1;
+                        if (targetFrame >= totalFrames)
+                                targetFrame = totalFrames - 1;
 
-                                // Set the read pointer for the decoder
-                                ma_result seekResult = m4a_decoder_seek_to_pcm_frame(decoder, targetFrame);
-                                if (seekResult != MA_SUCCESS)
-                                {
-                                        // Handle seek error
-                                        setSeekRequested(false);
-                                        pthread_mutex_unlock(&dataSourceMutex);
-                                        return;
-                                }
+                        // Set the read pointer for the decoder
+                        ma_result seekResult = m4a_decoder_seek_to_pcm_frame(decoder, targetFrame);
+                        if (seekResult != MA_SUCCESS)
+                        {
+                                // Handle seek error
+                                setSeekRequested(false);
+                                break;
                         }
 
+                        // m4a seeks by packet. faad2 outputs 1024 frames for each but the first.
+                        // Raw aac seeks by pcm frame.
+                        if (decoder->fileType == k_rawAAC)
+                                setTrackPosition(pAudioData, targetFrame);
+                        else if (decoder->fileType != k_ALAC)
+                                setTrackPosition(pAudioData, targetFrame > 0 ? (targetFrame - 1) * 1024 : 0);
+
+                        // What was decoded before the seek shouldn't be played
+                        discardDecodedAudio();
+                        framesRead = 0;
+
                         setSeekRequested(false); // Reset seek flag
                 }
 
                 // Read from the current decoder
                 ma_uint64 framesToRead = 0;
-                ma_result result;
                 ma_uint64 remainingFrames = frameCount - framesRead;
-                m4a_decoder *firstDecoder = getFirstM4aDecoder();
-                ma_uint64 cursor = 0;
-
-                if (firstDecoder == NULL)
-                {
-                        pthread_mutex_unlock(&dataSourceMutex);
-                        return;
-                }
-
-                result = ma_data_source_read_pcm_frames(firstDecoder, (ma_int32 *)pFramesOut + framesRead * pAudioData->channels, remainingFrames, &framesToRead);
 
-                ma_data_source_get_cursor_in_pcm_frames(decoder, &cursor);
+                if (decoder == NULL)
+                        break;
 
-                if (((cursor != 0 && cursor == lastCursor) || framesToRead == 0 || isSkipToNext() || result != MA_SUCCESS) && !isEOFReached())
+                // Don't play what is buffered of a song that is skipped
+                if (isSkipToNext())
                 {
+                        discardDecodedAudio();
+                        framesRead = 0;
                         activateSwitch(pAudioData);
-                        pthread_mutex_unlock(&dataSourceMutex);
                         continue;
                 }
 
-                lastCursor = cursor;
+                ma_result result = readTrackFrames(pAudioData, decoder, (unsigned char *)pFramesOut + framesRead * bytesPerFrame, remainingFrames, &framesToRead);
 
                 framesRead += framesToRead;
-                setBufferSize(framesToRead);
-
-                pthread_mutex_unlock(&dataSourceMutex);
-        }
 
-        ma_int32 *audioBuffer = getAudioBuffer();
-        if (audioBuffer == NULL)
-        {
-                audioBuffer = malloc(sizeof(ma_int32) * MAX_BUFFER_SIZE);
-                if (audioBuffer == NULL)
+                // The track's last frames are kept, the next track is read from after the switch.
+                // Only one track end is waited for at a time.
+                if (framesToRead < remainingFrames || result != MA_SUCCESS)
                 {
-                        // Memory allocation failed
-                        return;
+                        if (isEndOfTrackPending())
+                                break;
+
+                        activateSwitch(pAudioData);
+                        continue;
                 }
         }
 
-        // No format conversion needed, just copy the audio samples
-        memcpy(audioBuffer, pFramesOut, sizeof(ma_int32) * framesRead);
-        setAudioBuffer(audioBuffer);
-
         if (pFramesRead != NULL)
         {
                 *pFramesRead = framesRead;
         }
 }
-
-void m4a_on_audio_frames(ma_device *pDevice, void *pFramesOut, const void *pFramesIn, ma_uint32 frameCount)
-{
-        AudioData *pDataSource = (AudioData *)pDevice->pUserData;
-        ma_uint64 framesRead = 0;
-        m4a_read_pcm_frames(&(pDataSource->base), pFramesOut, frameCount, &framesRead);
-        (void)pFramesIn;
-}
 #endif
 
-void opus_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_uint64 frameCount, ma_uint64 *pFramesRead)
+// Runs on the decoder thread with dataSourceMutex held
+void opus_read_pcm_frames(AudioData *pAudioData, void *pFramesOut, ma_uint64 frameCount, ma_uint64 *pFramesRead)
 {
-        ma_libopus *opus = (ma_libopus *)pDataSource;
-        AudioData *pAudioData = (AudioData *)opus->pReadSeekTellUserData;
-
         ma_uint64 framesRead = 0;
+        ma_uint32 bytesPerFrame = ma_get_bytes_per_frame(pAudioData->format, pAudioData->channels);
 
         while (framesRead < frameCount)
         {
                 if (isImplSwitchReached())
-                        return;
-
-                if (pthread_mutex_trylock(&dataSourceMutex) != 0)
-                {
-                        return;
-                }
+                        break;
 
                 // Check if a file switch is required
                 if (pAudioData->switchFiles)
                 {
                         executeSwitch(pAudioData);
-                        pthread_mutex_unlock(&dataSourceMutex);
                         break; // Exit the loop after the file switch
                 }
 
                 if (getCurrentImplementationType() != OPUS && !isSkipToNext())
-                {
-                        pthread_mutex_unlock(&dataSourceMutex);
-                        return;
-                }
+                        break;
 
                 ma_libopus *decoder = getCurrentOpusDecoder();
 
@@ -1325,100 +1371,71 @@ void opus_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_uint
                         {
                                 // Handle seek error
                                 setSeekRequested(false);
-                                pthread_mutex_unlock(&dataSourceMutex);
-                                return;
+                                break;
                         }
 
+                        setTrackPosition(pAudioData, targetFrame);
+
+                        // What was decoded before the seek shouldn't be played
+                        discardDecodedAudio();
+                        framesRead = 0;
+
                         setSeekRequested(false); // Reset seek flag
                 }
 
                 // Read from the current decoder
                 ma_uint64 framesToRead = 0;
-                ma_result result;
                 ma_uint64 remainingFrames = frameCount - framesRead;
-                ma_libopus *firstDecoder = getFirstOpusDecoder();
-                ma_uint64 cursor = 0;
-
-                if (firstDecoder == NULL)
-                {
-                        pthread_mutex_unlock(&dataSourceMutex);
-                        return;
-                }
-
-                if (isEOFReached())
-                {
-                        pthread_mutex_unlock(&dataSourceMutex);
-                        return;
-                }
 
-                result = ma_data_source_read_pcm_frames(firstDecoder, (ma_int32 *)pFramesOut + framesRead * pAudioData->channels, remainingFrames, &framesToRead);
-
-                ma_data_source_get_cursor_in_pcm_frames(decoder, &cursor);
+                if (decoder == NULL)
+                        break;
 
-                if (((cursor != 0 && cursor >= pAudioData->totalFrames) || framesToRead == 0 || isSkipToNext() || result != MA_SUCCESS) && !isEOFReached())
+                // Don't play what is buffered of a song that is skipped
+                if (isSkipToNext())
                 {
+                        discardDecodedAudio();
+                        framesRead = 0;
                         activateSwitch(pAudioData);
-                        pthread_mutex_unlock(&dataSourceMutex);
                         continue;
                 }
 
-                framesRead += framesToRead;
-                setBufferSize(framesToRead);
+                ma_result result = readTrackFrames(pAudioData, decoder, (unsigned char *)pFramesOut + framesRead * bytesPerFrame, remainingFrames, &framesToRead);
 
-                pthread_mutex_unlock(&dataSourceMutex);
-        }
+                framesRead += framesToRead;
 
-        ma_int32 *audioBuffer = getAudioBuffer();
-        if (audioBuffer == NULL)
-        {
-                audioBuffer = malloc(sizeof(ma_int32) * MAX_BUFFER_SIZE);
-                if (audioBuffer == NULL)
+                // The track's last frames are kept, the next track is read from after the switch.
+                // Only one track end is waited for at a time.
+                if (framesToRead < remainingFrames || result != MA_SUCCESS)
                 {
-                        // Memory allocation failed
-                        return;
+                        if (isEndOfTrackPending())
+                                break;
+
+                        activateSwitch(pAudioData);
+                        continue;
                 }
         }
 
-        // No format conversion needed, just copy the audio samples
-        memcpy(audioBuffer, pFramesOut, sizeof(ma_int32) * framesRead);
-        setAudioBuffer(audioBuffer);
-
         if (pFramesRead != NULL)
         {
                 *pFramesRead = framesRead;
         }
 }
 
-void opus_on_audio_frames(ma_device *pDevice, void *pFramesOut, const void *pFramesIn, ma_uint32 frameCount)
-{
-        AudioData *pDataSource = (AudioData *)pDevice->pUserData;
-        ma_uint64 framesRead = 0;
-        opus_read_pcm_frames(&(pDataSource->base), pFramesOut, frameCount, &framesRead);
-        (void)pFramesIn;
-}
-
-void vorbis_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_uint64 frameCount, ma_uint64 *pFramesRead)
+// Runs on the decoder thread with dataSourceMutex held
+void vorbis_read_pcm_frames(AudioData *pAudioData, void *pFramesOut, ma_uint64 frameCount, ma_uint64 *pFramesRead)
 {
-        ma_libvorbis *vorbis = (ma_libvorbis *)pDataSource;
-        AudioData *pAudioData = (AudioData *)vorbis->pReadSeekTellUserData;
-
         ma_uint64 framesRead = 0;
+        ma_uint32 bytesPerFrame = ma_get_bytes_per_frame(pAudioData->format, pAudioData->channels);
 
         while (framesRead < frameCount)
         {
                 if (isImplSwitchReached())
-                        return;
-
-                if (pthread_mutex_trylock(&dataSourceMutex) != 0)
-                {
-                        return;
-                }
+                        break;
 
                 // Check if a file switch is required
                 if (pAudioData->switchFiles)
                 {
                         executeSwitch(pAudioData);
-                        pthread_mutex_unlock(&dataSourceMutex);
                         break;
                 }
 
@@ -1428,10 +1445,7 @@ void vorbis_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_ui
                         ma_data_source_get_length_in_pcm_frames(decoder, &(pAudioData->totalFrames));
 
                 if ((getCurrentImplementationType() != VORBIS && !isSkipToNext()) || (decoder == NULL))
-                {
-                        pthread_mutex_unlock(&dataSourceMutex);
-                        return;
-                }
+                        break;
 
                 // Check if seeking is requested
                 if (isSeekRequested())
@@ -1452,75 +1466,52 @@ void vorbis_read_pcm_frames(ma_data_source *pDataSource, void *pFramesOut, ma_ui
                         {
                                 // Handle seek error
                                 setSeekRequested(false);
-                                pthread_mutex_unlock(&dataSourceMutex);
-                                return;
+                                break;
                         }
 
+                        setTrackPosition(pAudioData, targetFrame);
+
+                        // What was decoded before the seek shouldn't be played
+                        discardDecodedAudio();
+                        framesRead = 0;
+
                         setSeekRequested(false); // Reset seek flag
                 }
 
                 // Read from the current decoder
                 ma_uint64 framesToRead = 0;
-                ma_result result;
-                ma_uint64 framesRequested = frameCount - framesRead;
-                ma_libvorbis *firstDecoder = getFirstVorbisDecoder();
-                ma_uint64 cursor = 0;
-
-                if (firstDecoder == NULL)
-                {
-                        pthread_mutex_unlock(&dataSourceMutex);
-                        return;
-                }
-
-                if (isEOFReached())
-                {
-                        pthread_mutex_unlock(&dataSourceMutex);
-                        return;
-                }
-
-                result = ma_data_source_read_pcm_frames(firstDecoder, (ma_int32 *)pFramesOut + framesRead * pAudioData->channels, framesRequested, &framesToRead);
+                ma_uint64 remainingFrames = frameCount - framesRead;
 
-                ma_data_source_get_cursor_in_pcm_frames(decoder, &cursor);
+                if (decoder == NULL)
+                        break;
 
-                if (((cursor != 0 && cursor >= pAudioData->totalFrames) || isSkipToNext() || result != MA_SUCCESS) &&
-                    !isEOFReached())
+                // Don't play what is buffered of a song that is skipped
+                if (isSkipToNext())
                 {
+                        discardDecodedAudio();
+                        framesRead = 0;
                         activateSwitch(pAudioData);
-                        pthread_mutex_unlock(&dataSourceMutex);
                         continue;
                 }
 
-                framesRead += framesToRead;
-                setBufferSize(framesToRead);
+                ma_result result = readTrackFrames(pAudioData, decoder, (unsigned char *)pFramesOut + framesRead * bytesPerFrame, remainingFrames, &framesToRead);
 
-                pthread_mutex_unlock(&dataSourceMutex);
-        }
+                framesRead += framesToRead;
 
-        ma_int32 *audioBuffer = getAudioBuffer();
-        if (audioBuffer == NULL)
-        {
-                audioBuffer = malloc(sizeof(ma_int32) * MAX_BUFFER_SIZE);
-                if (audioBuffer == NULL)
+                // The track's last frames are kept, the next track is read from after the switch.
+                // Only one track end is waited for at a time.
+                if (framesToRead < remainingFrames || result != MA_SUCCESS)
                 {
-                        // Memory allocation failed
-                        return;
+                        if (isEndOfTrackPending())
+                                break;
+
+                        activateSwitch(pAudioData);
+                        continue;
                 }
         }
 
-        // No format conversion needed, just copy the audio samples
-        memcpy(audioBuffer, pFramesOut, sizeof(ma_int32) * framesRead);
-        setAudioBuffer(audioBuffer);
-
         if (pFramesRead != NULL)
         {
                 *pFramesRead = framesRead;
         }
 }
-
-void vorbis_on_audio_frames(ma_device *pDevice, void *pFramesOut, const void *pFramesIn, ma_uint32 frameCount)
-{
-        AudioData *pDataSource = (AudioData *)pDevice->pUserData;
-        ma_uint64 framesRead = 0;
-        vorbis_read_pcm_frames(&(pDataSource->base), pFramesOut, frameCount, &framesRead);
-        (void)pFramesIn;
-}
@@ -33,6 +33,10 @@
 #define MAX_DECODERS 2
 #endif
 
+// What the device is opened with when outputSampleRate is set
+#define FIXED_OUTPUT_FORMAT ma_format_f32
+#define FIXED_OUTPUT_CHANNELS 2
+
 #ifndef TAGSETTINGS_STRUCT
 #define TAGSETTINGS_STRUCT
 
@@ -47,10 +51,26 @@
                 char date[METADATA_MAX_LENGTH];
                 double replaygainTrack;
                 double replaygainAlbum;
+                unsigned int gaplessSkip;          // Decoded frames before the music starts, like the encoder delay
+                unsigned long long gaplessLength;  // Frames of music after that, without the encoder's padding. 0 when not known
         } TagSettings;
 
 #endif
 
+#ifndef COVERRENDER_STRUCT
+#define COVERRENDER_STRUCT
+typedef struct
+{
+        GString *output;
+        int termWidth;
+        int termHeight;
+        int termWidthPixels;
+        int termHeightPixels;
+        int baseHeight;
+        bool ascii;
+} CoverRender;
+#endif
+
 #ifndef SONGDATA_STRUCT
 #define SONGDATA_STRUCT
 typedef struct
@@ -58,6 +78,9 @@ typedef struct
         gchar *trackId;
         char filePath[MAXPATHLEN];
         char coverArtPath[MAXPATHLEN];
+        unsigned char *coverData;
+        size_t coverDataSize;
+        bool coverArtIsTemp;
         unsigned char red;
         unsigned char green;
         unsigned char blue;
@@ -67,6 +90,7 @@ typedef struct
         int coverHeight;
         double duration;
         bool hasErrors;
+        CoverRender coverRender;
 } SongData;
 #endif
 
@@ -97,6 +121,7 @@ typedef struct
         bool switchFiles;
         int currentFileIndex;
         ma_uint64 totalFrames;
+        ma_uint64 trackFrame; // Frames the current decoder has output, the skipped ones too
         bool endOfListReached;
         bool restart;
 } AudioData;
@@ -188,16 +213,6 @@ ma_libvorbis *getFirstVorbisDecoder(void);
 
 void getFileInfo(const char* filename, ma_uint32* sampleRate, ma_uint32* channels, ma_format* format);
 
-void initAudioBuffer(void);
-
-ma_int32 *getAudioBuffer(void);
-
-void setAudioBuffer(ma_int32 *buf);
-
-void resetAudioBuffer(void);
-
-void freeAudioBuffer(void);
-
 bool isRepeatEnabled(void);
 
 void setRepeatEnabled(bool value);
@@ -248,6 +263,8 @@ void pausePlayback(void);
 
 void cleanupPlaybackDevice(void);
 
+bool isOutputFormatFixed(void);
+
 void togglePausePlayback(void);
 
 bool isPaused(void);
@@ -266,6 +283,14 @@ void activateSwitch(AudioData *pPCMDataSource);
 
 void executeSwitch(AudioData *pPCMDataSource);
 
+SongData *getLoadedSongData(UserData *pUserData);
+
+bool isNextTrackPrepared(void);
+
+ma_result readTrackFrames(AudioData *pAudioData, ma_data_source *decoder, void *pFramesOut, ma_uint64 frameCount, ma_uint64 *pFramesRead);
+
+void setTrackPosition(AudioData *pAudioData, ma_uint64 frameIndex);
+
 gint64 getLengthInMicroSec(double duration);
 
 int getCurrentVolume(void);
@@ -274,11 +299,13 @@ void setVolume(int volume);
 
 int adjustVolumePercent(int volumeChange);
 
-void m4a_on_audio_frames(ma_device *pDevice, void *pFramesOut, const void *pFramesIn, ma_uint32 frameCount);
+#ifdef USE_FAAD
+void m4a_read_pcm_frames(AudioData *pAudioData, void *pFramesOut, ma_uint64 frameCount, ma_uint64 *pFramesRead);
+#endif
 
-void opus_on_audio_frames(ma_device *pDevice, void *pFramesOut, const void *pFramesIn, ma_uint32 frameCount);
+void opus_read_pcm_frames(AudioData *pAudioData, void *pFramesOut, ma_uint64 frameCount, ma_uint64 *pFramesRead);
 
-void vorbis_on_audio_frames(ma_device *pDevice, void *pFramesOut, const void *pFramesIn, ma_uint32 frameCount);
+void vorbis_read_pcm_frames(AudioData *pAudioData, void *pFramesOut, ma_uint64 frameCount, ma_uint64 *pFramesRead);
 
 void logTime(const char *message);
 
@@ -1,5 +1,6 @@
 #include "miniaudio.h"
 #include "soundradio.h"
+#include "audiotap.h"
 
 /*
 
@@ -567,6 +568,7 @@ void *searchThreadFunction(void *arg)
                                 if (count % 10 == 0)
                                 {
                                         refresh = true;
+                                        wakeMainLoop();
                                         c_sleep(100);
                                 }
                         }
@@ -575,6 +577,9 @@ void *searchThreadFunction(void *arg)
                         res.memory = NULL;
                         res.size = 0;
 
+                        refresh = true;
+                        wakeMainLoop();
+
                         free(encodedTerm);
                         if (curl)
                                 curl_easy_cleanup(curl);
@@ -723,6 +728,7 @@ static ma_result decoder_read_callback(ma_decoder *decoder, void *pBufferOut, si
                                         *bytesRead = total_read;
 
                                         buf->stale = true;
+                                        wakeMainLoop();
 
                                         return MA_ERROR;
                                 }
@@ -774,20 +780,9 @@ static void audio_data_callback(ma_device *device, void *output, const void *inp
                 memset((char *)output + framesRead * device->playback.channels * sizeof(float), 0, (frameCount - framesRead) * device->playback.channels * sizeof(float));
         }
 
-        setBufferSize(framesRead);
-
-        ma_int32 *audioBuffer = getAudioBuffer();
-        if (audioBuffer == NULL)
-        {
-                audioBuffer = malloc(sizeof(ma_int32) * MAX_BUFFER_SIZE);
-                if (audioBuffer == NULL)
-                {
-                        return;
-                }
-        }
-
-        memcpy(audioBuffer, output, sizeof(ma_int32) * framesRead);
-        setAudioBuffer(audioBuffer);
+        publishAudioTap(output, framesRead, device->playback.format, device->playback.channels);
+        // The device period, which doesn't change when a callback comes up short, so the visualizer keeps its size
+        setBufferSize(frameCount < MAX_BUFFER_SIZE ? (int)frameCount : MAX_BUFFER_SIZE);
 }
 
 RadioSearchResult *copyRadioSearchResult(const RadioSearchResult *original)
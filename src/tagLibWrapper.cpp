@@ -4,10 +4,10 @@
 #include <cctype>
 #include <cstring>
 #include <cstdio>
+#include <cstdlib>
 #include <vector>
 #include <string>
 #include <cstring>
-#include <fstream>
 #include <iostream>
 
 #include <taglib/attachedpictureframe.h>
@@ -147,7 +147,24 @@ extern "C"
                 imageData.assign(&ptr[offset], &ptr[offset + dataLength]);
         }
 
-        int extractCoverArtFromOgg(const std::string &audioFilePath, const std::string &outputFileName)
+        // Hands the picture over to the caller in a buffer of its own, which it frees
+        bool storeCoverData(const unsigned char *data, size_t size, unsigned char **coverData, size_t *coverDataSize)
+        {
+                if (data == nullptr || size == 0)
+                        return false;
+
+                unsigned char *buffer = static_cast<unsigned char *>(malloc(size));
+                if (buffer == nullptr)
+                        return false;
+
+                memcpy(buffer, data, size);
+                *coverData = buffer;
+                *coverDataSize = size;
+
+                return true;
+        }
+
+        bool extractCoverArtFromOgg(const std::string &audioFilePath, unsigned char **coverData, size_t *coverDataSize)
         {
                 TagLib::File *file = nullptr;
                 TagLib::Tag *tag = nullptr;
@@ -188,17 +205,9 @@ extern "C"
                         std::vector<unsigned char> imageData;
                         parseFlacPictureBlock(decodedData, mimeType, imageData);
 
-                        std::ofstream outFile(outputFileName, std::ios::binary);
-                        if (!outFile)
-                        {
-                                std::cerr << "Error: Could not write to output file." << std::endl;
-                                delete file;
-                                return false; // Could not write to output file
-                        }
-                        outFile.write(reinterpret_cast<const char *>(imageData.data()), imageData.size());
-                        outFile.close();
+                        bool stored = storeCoverData(imageData.data(), imageData.size(), coverData, coverDataSize);
                         delete file;
-                        return 0; // Success
+                        return stored;
                 }
 
                 // Check COVERART and COVERARTMIME
@@ -209,17 +218,9 @@ extern "C"
                         std::string base64Data = coverArtList.front().to8Bit(true);
                         std::vector<unsigned char> imageData = decodeBase64(base64Data);
 
-                        std::ofstream outFile(outputFileName, std::ios::binary);
-                        if (!outFile)
-                        {
-                                std::cerr << "Error: Could not write to output file." << std::endl;
-                                delete file;
-                                return false; // Could not write to output file
-                        }
-                        outFile.write(reinterpret_cast<const char *>(imageData.data()), imageData.size());
-                        outFile.close();
+                        bool stored = storeCoverData(imageData.data(), imageData.size(), coverData, coverDataSize);
                         delete file;
-                        return true; // Success
+                        return stored;
                 }
 
                 std::cerr << "No cover art found in the file." << std::endl;
@@ -227,7 +228,7 @@ extern "C"
                 return false; // No cover art found
         }
 
-        bool extractCoverArtFromOggVideo(const std::string &audioFilePath, const std::string &outputFileName)
+        bool extractCoverArtFromOggVideo(const std::string &audioFilePath, unsigned char **coverData, size_t *coverDataSize)
         {
                 FILE *oggFile = fopen(audioFilePath.c_str(), "rb");
                 if (!oggFile)
@@ -315,23 +316,8 @@ extern "C"
                 {
                         if (isImageStream[entry.first] && !entry.second.empty())
                         {
-                                // Save the image data to a file using outputFileName
-                                std::ofstream outFile(outputFileName, std::ios::binary);
-                                if (!outFile)
-                                {
-                                        std::cerr << "Error: Could not write to output file." << std::endl;
-                                        // Clean up stream states
-                                        for (auto &streamEntry : streams)
-                                        {
-                                                ogg_stream_clear(&(streamEntry.second));
-                                        }
-                                        return false; // Could not write to output file
-                                }
-                                outFile.write(reinterpret_cast<const char *>(entry.second.data()), entry.second.size());
-                                outFile.close();
-
-                                coverArtFound = true;
-                                break; // Stop after finding and writing the first cover art
+                                coverArtFound = storeCoverData(entry.second.data(), entry.second.size(), coverData, coverDataSize);
+                                break; // Stop after the first cover art
                         }
                 }
 
@@ -341,7 +327,7 @@ extern "C"
                         ogg_stream_clear(&(streamEntry.second));
                 }
 
-                // Return whether the cover art was successfully found and written
+                // Return whether the cover art was found
                 if (!coverArtFound)
                 {
                         std::cerr << "No cover art found in the file." << std::endl;
@@ -351,7 +337,7 @@ extern "C"
                 return true; // Success
         }
 
-        bool extractCoverArtFromMp3(const std::string &inputFile, const std::string &coverFilePath)
+        bool extractCoverArtFromMp3(const std::string &inputFile, unsigned char **coverData, size_t *coverDataSize)
         {
                 TagLib::MPEG::File file(inputFile.c_str());
                 if (!file.isValid())
@@ -374,29 +360,10 @@ extern "C"
                                         const TagLib::ID3v2::AttachedPictureFrame *picFrame = dynamic_cast<TagLib::ID3v2::AttachedPictureFrame *>(*it);
                                         if (picFrame)
                                         {
-                                                // Access picture data and MIME type
+                                                // Access picture data
                                                 TagLib::ByteVector pictureData = picFrame->picture();
-                                                TagLib::String mimeType = picFrame->mimeType();
 
-                                                // Construct the output file path
-                                                std::string outputFilePath = coverFilePath;
-
-                                                // Write the image data to a file
-                                                FILE *outFile = fopen(outputFilePath.c_str(), "wb");
-                                                if (outFile)
-                                                {
-                                                        fwrite(pictureData.data(), 1, pictureData.size(), outFile);
-                                                        fclose(outFile);
-
-                                                        return true;
-                                                }
-                                                else
-                                                {
-                                                        return false; // Failed to open output file
-                                                }
-
-                                                // Break if only the first image is needed
-                                                break;
+                                                return storeCoverData(reinterpret_cast<const unsigned char *>(pictureData.data()), pictureData.size(), coverData, coverDataSize);
                                         }
                                 }
                         }
@@ -410,10 +377,10 @@ extern "C"
                         return false; // No ID3v2 tag found
                 }
 
-                return true; // Success
+                return false; // None of the frames was a picture
         }
 
-        bool extractCoverArtFromFlac(const std::string &inputFile, const std::string &coverFilePath)
+        bool extractCoverArtFromFlac(const std::string &inputFile, unsigned char **coverData, size_t *coverDataSize)
         {
                 TagLib::FLAC::File file(inputFile.c_str());
 
@@ -422,24 +389,14 @@ extern "C"
                         const TagLib::FLAC::Picture *picture = file.pictureList().front();
                         if (picture)
                         {
-                                FILE *coverFile = fopen(coverFilePath.c_str(), "wb");
-                                if (coverFile)
-                                {
-                                        fwrite(picture->data().data(), 1, picture->data().size(), coverFile);
-                                        fclose(coverFile);
-                                        return true;
-                                }
-                                else
-                                {
-                                        return false;
-                                }
+                                return storeCoverData(reinterpret_cast<const unsigned char *>(picture->data().data()), picture->data().size(), coverData, coverDataSize);
                         }
                 }
 
                 return false;
         }
 
-        bool extractCoverArtFromWav(const std::string &inputFile, const std::string &coverFilePath)
+        bool extractCoverArtFromWav(const std::string &inputFile, unsigned char **coverData, size_t *coverDataSize)
         {
                 TagLib::RIFF::WAV::File file(inputFile.c_str());
                 if (!file.isValid())
@@ -462,29 +419,10 @@ extern "C"
                                         const TagLib::ID3v2::AttachedPictureFrame *picFrame = dynamic_cast<TagLib::ID3v2::AttachedPictureFrame *>(*it);
                                         if (picFrame)
                                         {
-                                                // Access picture data and MIME type
+                                                // Access picture data
                                                 TagLib::ByteVector pictureData = picFrame->picture();
-                                                TagLib::String mimeType = picFrame->mimeType();
-
-                                                // Construct the output file path
-                                                std::string outputFilePath = coverFilePath;
-
-                                                // Write the image data to a file
-                                                FILE *outFile = fopen(outputFilePath.c_str(), "wb");
-                                                if (outFile)
-                                                {
-                                                        fwrite(pictureData.data(), 1, pictureData.size(), outFile);
-                                                        fclose(outFile);
-
-                                                        return true;
-                                                }
-                                                else
-                                                {
-                                                        return false; // Failed to open output file
-                                                }
 
-                                                // Break if only the first image is needed
-                                                break;
+                                                return storeCoverData(reinterpret_cast<const unsigned char *>(pictureData.data()), pictureData.size(), coverData, coverDataSize);
                                         }
                                 }
                         }
@@ -498,10 +436,10 @@ extern "C"
                         return false; // No ID3v2 tag found
                 }
 
-                return true; // Success
+                return false; // None of the frames was a picture
         }
 
-        bool extractCoverArtFromOpus(const std::string &audioFilePath, const std::string &outputFileName)
+        bool extractCoverArtFromOpus(const std::string &audioFilePath, unsigned char **coverData, size_t *coverDataSize)
         {
                 int error;
                 OggOpusFile *of = op_open_file(audioFilePath.c_str(), &error);
@@ -609,19 +547,9 @@ extern "C"
                                 // Extract image data
                                 std::vector<unsigned char> imageData(pictureBlock.begin() + offset, pictureBlock.begin() + offset + dataLength);
 
-                                // Save image data to file
-                                std::ofstream outFile(outputFileName, std::ios::binary);
-                                if (!outFile)
-                                {
-                                        std::cerr << "Error: Could not write to output file." << std::endl;
-                                        op_free(of);
-                                        return false;
-                                }
-                                outFile.write(reinterpret_cast<const char *>(imageData.data()), imageData.size());
-                                outFile.close();
-
+                                bool stored = storeCoverData(imageData.data(), imageData.size(), coverData, coverDataSize);
                                 op_free(of);
-                                return true;
+                                return stored;
                         }
                 }
 
@@ -630,7 +558,7 @@ extern "C"
                 return false;
         }
 
-        bool extractCoverArtFromMp4(const std::string &inputFile, const std::string &coverFilePath)
+        bool extractCoverArtFromMp4(const std::string &inputFile, unsigned char **coverData, size_t *coverDataSize)
         {
                 TagLib::MP4::File file(inputFile.c_str());
 
@@ -647,18 +575,7 @@ extern "C"
                         if (!coverArtList.isEmpty())
                         {
                                 const TagLib::MP4::CoverArt &coverArt = coverArtList.front();
-                                FILE *coverFile = fopen(coverFilePath.c_str(), "wb");
-                                if (coverFile)
-                                {
-                                        fwrite(coverArt.data().data(), 1, coverArt.data().size(), coverFile);
-                                        fclose(coverFile);
-                                        return true; // Success
-                                }
-                                else
-                                {
-                                        fprintf(stderr, "Could not open output file '%s'\n", coverFilePath.c_str());
-                                        return false; // Failed to open the output file
-                                }
+                                return storeCoverData(reinterpret_cast<const unsigned char *>(coverArt.data().data()), coverArt.data().size(), coverData, coverDataSize);
                         }
                 }
 
@@ -733,10 +650,104 @@ extern "C"
                 return val;
         }
 
-        int extractTags(const char *input_file, TagSettings *tag_settings, double *duration, const char *coverFilePath)
+        // LAME, and encoders that copy it, put the encoder delay and padding in the Xing/Info frame at the start of an mp3.
+        // The decoder plays that frame as silence, and 529 frames of its own delay come before the music too.
+        void readMp3GaplessInfo(TagLib::MPEG::File &file, TagSettings *tag_settings)
+        {
+                long long offset = file.firstFrameOffset();
+
+                if (offset < 0)
+                        return;
+
+                file.seek(offset);
+                TagLib::ByteVector frame = file.readBlock(2048);
+                const unsigned char *data = reinterpret_cast<const unsigned char *>(frame.data());
+                size_t size = frame.size();
+
+                if (size < 4 || data[0] != 0xFF || (data[1] & 0xE0) != 0xE0)
+                        return;
+
+                int version = (data[1] >> 3) & 0x03; // 3 is MPEG 1, 2 is MPEG 2, 0 is MPEG 2.5
+                int layer = (data[1] >> 1) & 0x03;   // 1 is layer III
+                bool crc = (data[1] & 0x01) == 0;
+                bool mono = ((data[3] >> 6) & 0x03) == 3;
+
+                if (layer != 1 || version == 1)
+                        return;
+
+                size_t sideInfoSize = (version == 3) ? (mono ? 17 : 32) : (mono ? 9 : 17);
+                size_t pos = 4 + (crc ? 2 : 0) + sideInfoSize;
+                unsigned int samplesPerFrame = (version == 3) ? 1152 : 576;
+
+                if (pos + 8 > size || (memcmp(data + pos, "Xing", 4) != 0 && memcmp(data + pos, "Info", 4) != 0))
+                        return;
+
+                unsigned int flags = data[pos + 7];
+                unsigned long long frames = 0;
+
+                pos += 8;
+
+                if ((flags & 0x01) && pos + 4 <= size)
+                {
+                        frames = read_uint32_be(data, pos);
+                        pos += 4;
+                }
+                if (flags & 0x02)
+                        pos += 4;
+                if (flags & 0x04)
+                        pos += 100;
+                if (flags & 0x08)
+                        pos += 4;
+
+                tag_settings->gaplessSkip = samplesPerFrame;
+
+                if (pos + 24 > size || data[pos] == 0)
+                        return;
+
+                unsigned int delay = (data[pos + 21] << 4) | (data[pos + 22] >> 4);
+                unsigned int padding = ((data[pos + 22] & 0x0F) << 8) | data[pos + 23];
+                unsigned int decoderDelay = 529;
+                unsigned int endPadding = padding > decoderDelay ? padding - decoderDelay : 0;
+                unsigned long long skip = delay + decoderDelay;
+
+                tag_settings->gaplessSkip = samplesPerFrame + skip;
+
+                if (frames * samplesPerFrame > skip + endPadding)
+                        tag_settings->gaplessLength = frames * samplesPerFrame - skip - endPadding;
+        }
+
+        // iTunes stores the encoder delay, padding and the length without them as hex numbers in iTunSMPB.
+        // ALAC has neither, its last packet is just shorter.
+        void readMp4GaplessInfo(TagLib::MP4::File &file, TagSettings *tag_settings)
+        {
+                if (file.tag() == NULL || file.audioProperties() == NULL || file.audioProperties()->codec() != TagLib::MP4::Properties::AAC)
+                        return;
+
+                const TagLib::MP4::Item item = file.tag()->item("----:com.apple.iTunes:iTunSMPB");
+
+                if (!item.isValid() || item.toStringList().isEmpty())
+                        return;
+
+                unsigned int reserved = 0;
+                unsigned int delay = 0;
+                unsigned int padding = 0;
+                unsigned long long length = 0;
+
+                if (sscanf(item.toStringList().front().toCString(), " %x %x %x %llx", &reserved, &delay, &padding, &length) != 4)
+                        return;
+
+                // faad2 doesn't output the first frame it decodes, which is part of the delay
+                tag_settings->gaplessSkip = delay >= 1024 ? delay - 1024 : 0;
+                tag_settings->gaplessLength = length;
+        }
+
+        int extractTags(const char *input_file, TagSettings *tag_settings, double *duration, unsigned char **coverData, size_t *coverDataSize)
         {
                 memset(tag_settings, 0, sizeof(TagSettings)); // Initialize tag settings
 
+                *coverData = NULL;
+                *coverDataSize = 0;
+
                 tag_settings->replaygainTrack = 0.0;
                 tag_settings->replaygainAlbum = 0.0;
 
@@ -862,6 +873,15 @@ extern "C"
                                         }
                                 }
                         }
+
+                        readMp3GaplessInfo(mp3File, tag_settings);
+                }
+                else if (std::string(input_file).find(".m4a") != std::string::npos)
+                {
+                        TagLib::MP4::File mp4File(input_file);
+
+                        if (mp4File.isValid())
+                                readMp4GaplessInfo(mp4File, tag_settings);
                 }
                 else if (std::string(input_file).find(".flac") != std::string::npos)
                 {
@@ -900,32 +920,32 @@ extern "C"
 
                 if (extension == "mp3")
                 {
-                        coverArtExtracted = extractCoverArtFromMp3(input_file, coverFilePath);
+                        coverArtExtracted = extractCoverArtFromMp3(input_file, coverData, coverDataSize);
                 }
                 else if (extension == "flac")
                 {
-                        coverArtExtracted = extractCoverArtFromFlac(input_file, coverFilePath);
+                        coverArtExtracted = extractCoverArtFromFlac(input_file, coverData, coverDataSize);
                 }
                 else if (extension == "m4a" || extension == "aac")
                 {
-                        coverArtExtracted = extractCoverArtFromMp4(input_file, coverFilePath);
+                        coverArtExtracted = extractCoverArtFromMp4(input_file, coverData, coverDataSize);
                 }
                 if (extension == "opus")
                 {
-                        coverArtExtracted = extractCoverArtFromOpus(input_file, coverFilePath);
+                        coverArtExtracted = extractCoverArtFromOpus(input_file, coverData, coverDataSize);
                 }
                 else if (extension == "ogg")
                 {
-                        coverArtExtracted = extractCoverArtFromOggVideo(input_file, coverFilePath);
+                        coverArtExtracted = extractCoverArtFromOggVideo(input_file, coverData, coverDataSize);
 
                         if (!coverArtExtracted)
                         {
-                                coverArtExtracted = extractCoverArtFromOgg(input_file, coverFilePath);
+                                coverArtExtracted = extractCoverArtFromOgg(input_file, coverData, coverDataSize);
                         }
                 }
                 else if (extension == "wav")
                 {
-                        coverArtExtracted = extractCoverArtFromWav(input_file, coverFilePath);
+                        coverArtExtracted = extractCoverArtFromWav(input_file, coverData, coverDataSize);
                 }
 
                 if (coverArtExtracted)
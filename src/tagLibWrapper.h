@@ -21,9 +21,11 @@ extern "C"
                 char date[METADATA_MAX_LENGTH];
                 double replaygainTrack;
                 double replaygainAlbum;
+                unsigned int gaplessSkip;          // Decoded frames before the music starts, like the encoder delay
+                unsigned long long gaplessLength;  // Frames of music after that, without the encoder's padding. 0 when not known
         } TagSettings;
 #endif
-        int extractTags(const char *input_file, TagSettings *tag_settings, double *duration, const char *coverFilePath);
+        int extractTags(const char *input_file, TagSettings *tag_settings, double *duration, unsigned char **coverData, size_t *coverDataSize);
 
 #ifdef __cplusplus
 }
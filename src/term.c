@@ -21,12 +21,12 @@ void setTextColor(int color)
         - 6: Cyan
         - 7: White
         */
-        printf("\033[0;3%dm", color);
+        screenPrintf("\033[0;3%dm", color);
 }
 
 void setTextColorRGB(int r, int g, int b)
 {
-        printf("\033[0;38;2;%03u;%03u;%03um", r, g, b);
+        screenPrintf("\033[0;38;2;%03u;%03u;%03um", r, g, b);
 }
 
 void getTermSize(int *width, int *height)
@@ -58,17 +58,17 @@ void restoreTerminalMode()
 
 void saveCursorPosition()
 {
-        printf("\033[s");
+        screenPrintf("\033[s");
 }
 
 void restoreCursorPosition()
 {
-        printf("\033[u");
+        screenPrintf("\033[u");
 }
 
 void setDefaultTextColor()
 {
-        printf("\033[0m");
+        screenPrintf("\033[0m");
 }
 
 int isInputAvailable()
@@ -92,40 +92,40 @@ int isInputAvailable()
 
 void hideCursor()
 {
-        printf("\033[?25l");
-        fflush(stdout);
+        screenPrintf("\033[?25l");
+        screenFlush();
 }
 
 void showCursor()
 {
-        printf("\033[?25h");
-        fflush(stdout);
+        screenPrintf("\033[?25h");
+        screenFlush();
 }
 
 void resetConsole()
 {
         // Print ANSI escape codes to reset terminal, clear screen, and move cursor to top-left
-        printf("\033\143");     // Reset to Initial State (RIS)
-        printf("\033[3J");      // Clear scrollback buffer
-        printf("\033[H\033[J"); // Move cursor to top-left and clear screen
+        screenPrintf("\033\143");     // Reset to Initial State (RIS)
+        screenPrintf("\033[3J");      // Clear scrollback buffer
+        screenPrintf("\033[H\033[J"); // Move cursor to top-left and clear screen
 
-        fflush(stdout);
+        screenFlush();
 }
 
 void clearRestOfScreen()
 {
-        printf("\033[J");
+        screenPrintf("\033[J");
 }
 
 void clearScreen()
 {
-        printf("\033[3J");      // Clear scrollback buffer
-        printf("\033[2J\033[3J\033[H"); // Move cursor to top-left and clear screen and scrollback buffer
+        screenPrintf("\033[3J");      // Clear scrollback buffer
+        screenPrintf("\033[2J\033[3J\033[H"); // Move cursor to top-left and clear screen and scrollback buffer
 }
 
 void enableScrolling()
 {
-        printf("\033[?7h");
+        screenPrintf("\033[?7h");
 }
 
 void disableInputBuffering(void)
@@ -146,13 +146,13 @@ void enableInputBuffering()
 
 void cursorJump(int numRows)
 {
-        printf("\033[%dA", numRows);
-        printf("\033[0m");
+        screenPrintf("\033[%dA", numRows);
+        screenPrintf("\033[0m");
 }
 
 void cursorJumpDown(int numRows)
 {
-        printf("\033[%dB", numRows);
+        screenPrintf("\033[%dB", numRows);
 }
 
 int readInputSequence(char *seq, size_t seqSize)
@@ -223,23 +223,23 @@ int getIndentation(int terminalWidth)
 void enterAlternateScreenBuffer()
 {
         // Enter alternate screen buffer
-        printf("\033[?1049h");
+        screenPrintf("\033[?1049h");
 }
 
 void exitAlternateScreenBuffer()
 {
         // Exit alternate screen buffer
-        printf("\033[?1049l");
+        screenPrintf("\033[?1049l");
 }
 
 void enableTerminalMouseButtons()
 {
         // Enable program to accept mouse input as codes
-        printf("\033[?1002h");
+        screenPrintf("\033[?1002h");
 }
 
 void disableTerminalMouseButtons()
 {
         // Disable program to accept mouse input as codes
-        printf("\033[?1002l");
+        screenPrintf("\033[?1002l");
 }
@@ -17,6 +17,7 @@
 #include <termios.h>
 #include <unistd.h>
 #include "utils.h"
+#include "screen.h"
 
 #ifdef __GNU__
 # define _BSD_SOURCE
@@ -1,3 +1,4 @@
+#include "screen.h"
 #include "utils.h"
 
 /*
@@ -42,6 +43,15 @@ void c_sleep(int milliseconds)
         nanosleep(&ts, NULL);
 }
 
+// Milliseconds since start, which was taken from CLOCK_MONOTONIC
+double getMsSince(const struct timespec *start)
+{
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
 void c_usleep(int microseconds)
 {
         struct timespec ts;
@@ -382,7 +392,7 @@ void printBlankSpaces(int numSpaces)
 {
         if (numSpaces < 1)
                 return;
-        printf("%*s", numSpaces, " ");
+        screenPrintf("%*s", numSpaces, " ");
 }
 
 int naturalCompare(const char *a, const char *b)
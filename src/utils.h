@@ -32,6 +32,8 @@ void c_sleep(int milliseconds);
 
 void c_usleep(int microseconds);
 
+double getMsSince(const struct timespec *start);
+
 void c_strcpy(char *dest, const char *src, size_t dest_size);
 
 char *stringToUpper(const char *str);
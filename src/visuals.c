@@ -1,4 +1,5 @@
 #include "visuals.h"
+#include "audiotap.h"
 
 /*
 
@@ -14,12 +15,22 @@ visuals.c
 
 #define MAX_BARS 64
 
+#define FFTW_WISDOM_FILE "fftw_wisdom"
+
+#define FFT_WINDOW_SIZE 512 // Samples analysed per frame, about one device period
+
 int bufferSize = 8192;
 int prevBufferSize = 0;
 float alpha = 0.2f;
 float lastMax = -1.0f;
 float *fftInput = NULL;
 fftwf_complex *fftOutput = NULL;
+float *fftWindow = NULL;
+
+// Made once for FFT_WINDOW_SIZE, whatever the audio callback is asked for
+static fftwf_plan fftPlan = NULL;
+static bool measureFftPlans = false;
+static bool fftWisdomChanged = false;
 
 int bufferIndex = 0;
 
@@ -170,7 +181,7 @@ void enhancePeaks(int numBars, float *magnitudes, int height)
         }
 }
 
-void applyBlackmanHarris(float *fftInput, int bufferSize)
+void calcBlackmanHarris(float *window, int bufferSize)
 {
         for (int i = 0; i < bufferSize; i++)
         {
@@ -180,10 +191,8 @@ void applyBlackmanHarris(float *fftInput, int bufferSize)
                 float alpha3 = 0.01168f;
 
                 float fraction = (float)i / (float)(bufferSize - 1); // i / (N-1)
-                float window =
+                window[i] =
                     alpha0 - alpha1 * cosf(2.0f * M_PI * fraction) + alpha2 * cosf(4.0f * M_PI * fraction) - alpha3 * cosf(6.0f * M_PI * fraction);
-
-                fftInput[i] *= window;
         }
 }
 
@@ -345,55 +354,22 @@ DecayPeakAndCombine:
         }
 }
 
-void calc(int height, int numBars, ma_int32 *audioBuffer, int bitDepth, float *fftInput, fftwf_complex *fftOutput, float *magnitudes, fftwf_plan plan)
+void calc(int height, int numBars, float *fftInput, fftwf_complex *fftOutput, float *magnitudes, fftwf_plan plan)
 {
-        int bufferSize = getBufferSize();
+        // The size the plan was made for
+        int bufferSize = prevBufferSize;
 
-        if (audioBuffer == NULL)
-        {
-                fprintf(stderr, "Audio buffer is NULL.\n");
+        if (!readAudioTap(fftInput, bufferSize))
                 return;
-        }
 
         for (int i = 0; i < bufferSize; i++)
         {
-                ma_int32 sample = audioBuffer[i];
-                float normalizedSample = 0.0f;
-
-                switch (bitDepth)
-                {
-                case 8:
-                        normalizedSample = ((float)sample - 128.0f) / 127.0f;
-                        break;
-                case 16:
-                        normalizedSample = (float)sample / 32768.0f;
-                        break;
-                case 24:
-                {
-                        int32_t lower24Bits = sample & 0xFFFFFF;
-                        if (lower24Bits & 0x800000)
-                        {
-                                lower24Bits |= 0xFF000000; // Sign extension
-                        }
-                        normalizedSample = (float)lower24Bits / 8388608.0f;
-                        break;
-                }
-                case 32: // Assuming 32-bit integers
-                        normalizedSample = (float)sample / 2147483648.0f;
-                        break;
-                default:
-                        fprintf(stderr, "Unsupported bit depth: %d\n", bitDepth);
-                        return;
-                }
-
-                fftInput[i] = normalizedSample;
+                fftInput[i] *= fftWindow[i];
         }
 
         int halfSize = bufferSize / 2;
         int limit = (numBars < halfSize) ? numBars : halfSize;
 
-        applyBlackmanHarris(fftInput, bufferSize);
-
         fftwf_execute(plan);
 
         clearMagnitudes(numBars, magnitudes);
@@ -441,39 +417,12 @@ char *getUpwardMotionChar(int level)
 
 int calcSpectrum(int height, int numBars, float *fftInput, fftwf_complex *fftOutput, float *magnitudes, fftwf_plan plan)
 {
-
-        ma_int32 *g_audioBuffer = getAudioBuffer();
-
         getCurrentFormatAndSampleRate(&format, &sampleRate);
 
         if (format == ma_format_unknown)
                 return -1;
 
-        int bitDepth = 32;
-
-        switch (format)
-        {
-        case ma_format_u8:
-                bitDepth = 8;
-                break;
-
-        case ma_format_s16:
-                bitDepth = 16;
-                break;
-
-        case ma_format_s24:
-                bitDepth = 24;
-                break;
-
-        case ma_format_f32:
-        case ma_format_s32:
-                bitDepth = 32;
-                break;
-        default:
-                break;
-        }
-
-        calc(height, numBars, g_audioBuffer, bitDepth, fftInput, fftOutput, magnitudes, plan);
+        calc(height, numBars, fftInput, fftOutput, magnitudes, plan);
 
         return 0;
 }
@@ -490,13 +439,13 @@ PixelData increaseLuminosity(PixelData pixel, int amount)
 
 void printSpectrum(int height, int numBars, float *magnitudes, PixelData color, int indentation, bool useConfigColors, int visualizerColorType)
 {
-        printf("\n");
+        screenPrintf("\n");
 
         PixelData tmp;
 
         for (int j = height; j > 0; j--)
         {
-                printf("\r");
+                screenPrintf("\r");
                 printBlankSpaces(indentation);
                 if (color.r != 0 || color.g != 0 || color.b != 0)
                 {
@@ -510,7 +459,7 @@ void printSpectrum(int height, int numBars, float *magnitudes, PixelData color,
                                 {
                                         tmp = increaseLuminosity(color, round((height - j) * height * 8));
                                 }
-                                printf("\033[38;2;%d;%d;%dm", tmp.r, tmp.g, tmp.b);
+                                screenPrintf("\033[38;2;%d;%d;%dm", tmp.r, tmp.g, tmp.b);
                         }
                 }
                 else
@@ -522,9 +471,9 @@ void printSpectrum(int height, int numBars, float *magnitudes, PixelData color,
                 {
                         for (int i = 0; i < numBars; i++)
                         {
-                                printf("  ");
+                                screenPrintf("  ");
                         }
-                        printf("\n ");
+                        screenPrintf("\n ");
                         continue;
                 }
 
@@ -535,34 +484,69 @@ void printSpectrum(int height, int numBars, float *magnitudes, PixelData color,
                                 tmp = (PixelData){color.r / 2, color.g / 2, color.b / 2}; // Make colors half as bright before increasing brightness
                                 tmp = increaseLuminosity(tmp, round(magnitudes[i] * 10 * 4));
 
-                                printf("\033[38;2;%d;%d;%dm", tmp.r, tmp.g, tmp.b);
+                                screenPrintf("\033[38;2;%d;%d;%dm", tmp.r, tmp.g, tmp.b);
                         }
 
                         if (magnitudes[i] >= j)
                         {
-                                printf(" %s", getUpwardMotionChar(10));
+                                screenPrintf(" %s", getUpwardMotionChar(10));
                         }
                         else if (magnitudes[i] + 1 >= j)
                         {
                                 int firstDecimalDigit = (int)(fmod(magnitudes[i] * 10, 10));
-                                printf(" %s", getUpwardMotionChar(firstDecimalDigit));
+                                screenPrintf(" %s", getUpwardMotionChar(firstDecimalDigit));
                         }
                         else
                         {
-                                printf("  ");
+                                screenPrintf("  ");
                         }
                 }
-                printf("\n ");
+                screenPrintf("\n ");
         }
-        printf("\r");
-        fflush(stdout);
+        screenPrintf("\r");
 }
 
-void freeVisuals(void)
+static char *getWisdomFilePath(void)
+{
+        char *configdir = getConfigPath();
+        if (configdir == NULL)
+                return NULL;
+
+        char *filepath = malloc(MAXPATHLEN);
+        if (filepath != NULL)
+                snprintf(filepath, MAXPATHLEN, "%s/%s", configdir, FFTW_WISDOM_FILE);
+
+        free(configdir);
+
+        return filepath;
+}
+
+void initVisuals(bool measurePlans)
+{
+        measureFftPlans = measurePlans;
+
+        if (!measureFftPlans)
+                return;
+
+        // Measuring takes a while, with the wisdom from earlier runs it only has to be done once
+        char *filepath = getWisdomFilePath();
+        if (filepath != NULL)
+        {
+                fftwf_import_wisdom_from_filename(filepath);
+                free(filepath);
+        }
+}
+
+static void freeFftBuffers(void)
 {
+        if (fftPlan != NULL)
+        {
+                fftwf_destroy_plan(fftPlan);
+                fftPlan = NULL;
+        }
         if (fftInput != NULL)
         {
-                free(fftInput);
+                fftwf_free(fftInput);
                 fftInput = NULL;
         }
         if (fftOutput != NULL)
@@ -570,6 +554,58 @@ void freeVisuals(void)
                 fftwf_free(fftOutput);
                 fftOutput = NULL;
         }
+        if (fftWindow != NULL)
+        {
+                free(fftWindow);
+                fftWindow = NULL;
+        }
+        prevBufferSize = 0;
+}
+
+static bool createFftBuffers(int size)
+{
+        fftInput = (float *)fftwf_malloc(sizeof(float) * size);
+        fftOutput = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * (size / 2 + 1));
+        fftWindow = (float *)malloc(sizeof(float) * size);
+
+        if (fftInput == NULL || fftOutput == NULL || fftWindow == NULL)
+        {
+                freeFftBuffers();
+                return false;
+        }
+
+        calcBlackmanHarris(fftWindow, size);
+
+        // Measuring overwrites the buffers, which is fine since the input is filled before every run
+        fftPlan = fftwf_plan_dft_r2c_1d(size, fftInput, fftOutput, measureFftPlans ? FFTW_MEASURE : FFTW_ESTIMATE);
+        if (fftPlan == NULL)
+        {
+                freeFftBuffers();
+                return false;
+        }
+
+        if (measureFftPlans)
+                fftWisdomChanged = true;
+
+        prevBufferSize = size;
+
+        return true;
+}
+
+void freeVisuals(void)
+{
+        freeFftBuffers();
+
+        if (fftWisdomChanged)
+        {
+                char *filepath = getWisdomFilePath();
+                if (filepath != NULL)
+                {
+                        fftwf_export_wisdom_to_filename(filepath);
+                        free(filepath);
+                }
+                fftWisdomChanged = false;
+        }
 }
 
 void drawSpectrumVisualizer(int height, int numBars, PixelData c, int indentation, bool useConfigColors, int visualizerColorType)
@@ -591,58 +627,36 @@ void drawSpectrumVisualizer(int height, int numBars, PixelData c, int indentatio
         if (numBars > MAX_BARS)
                 numBars = MAX_BARS;
 
+        // Nothing played yet
         if (bufferSize <= 0)
         {
                 for (int i = 0; i <= height; i++)
                 {
-                        printf("\n");
+                        screenPrintf("\n");
                 }
                 return;
         }
-        if (bufferSize != prevBufferSize)
-        {
-                lastMax = -1.0f;
 
-                freeVisuals();
-
-                fftInput = (float *)malloc(sizeof(float) * bufferSize);
-                if (fftInput == NULL)
-                {
-                        for (int i = 0; i <= height; i++)
-                        {
-                                printf("\n");
-                        }
-                        return;
-                }
-
-                fftOutput = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * bufferSize);
-                if (fftOutput == NULL)
+        // The window size is fixed, so the plan is only made the first time
+        if (fftPlan == NULL)
+        {
+                if (!createFftBuffers(FFT_WINDOW_SIZE))
                 {
-                        fftwf_free(fftInput);
-                        fftInput = NULL;
                         for (int i = 0; i <= height; i++)
                         {
-                                printf("\n");
+                                screenPrintf("\n");
                         }
                         return;
                 }
-                prevBufferSize = bufferSize;
         }
 
-        fftwf_plan plan = fftwf_plan_dft_r2c_1d(bufferSize,
-                                                fftInput,
-                                                fftOutput,
-                                                FFTW_ESTIMATE);
-
         float magnitudes[numBars];
         for (int i = 0; i < numBars; i++)
         {
                 magnitudes[i] = 0.0f;
         }
 
-        calcSpectrum(height, numBars, fftInput, fftOutput, magnitudes, plan);
+        calcSpectrum(height, numBars, fftInput, fftOutput, magnitudes, fftPlan);
 
         printSpectrum(height, numBars, magnitudes, color, indentation, useConfigColors, visualizerColorType);
-
-        fftwf_destroy_plan(plan);
 }
@@ -4,8 +4,10 @@
 #include <fftw3.h>
 #include <math.h>
 #include <complex.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/param.h>
 #include "sound.h"
 #include "term.h"
 #include "utils.h"
@@ -20,7 +22,7 @@
     } PixelData;
 #endif
 
-void initVisuals(void);
+void initVisuals(bool measurePlans);
 
 void freeVisuals(void);
 
@@ -0,0 +1,67 @@
+#include "wakeup.h"
+
+/*
+
+wakeup.c
+
+ Lets the audio, loader and other threads wake up the main loop when they changed something it
+ should act on, so that it doesn't have to check on a timer. It is safe to call from signal handlers.
+ The descriptor stays open until the process exits, as threads that are still finishing up might
+ write to it.
+
+*/
+
+static int wakeupFds[2] = {-1, -1}; // Read end, write end. The same eventfd on Linux.
+
+int initWakeup(void)
+{
+#ifdef __linux__
+        int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd < 0)
+                return -1;
+
+        wakeupFds[0] = fd;
+        wakeupFds[1] = fd;
+#else
+        if (pipe(wakeupFds) != 0)
+                return -1;
+
+        for (int i = 0; i < 2; i++)
+        {
+                fcntl(wakeupFds[i], F_SETFL, fcntl(wakeupFds[i], F_GETFL) | O_NONBLOCK);
+                fcntl(wakeupFds[i], F_SETFD, FD_CLOEXEC);
+        }
+#endif
+        return 0;
+}
+
+int getWakeupFd(void)
+{
+        return wakeupFds[0];
+}
+
+void wakeMainLoop(void)
+{
+        if (wakeupFds[1] < 0)
+                return;
+
+#ifdef __linux__
+        uint64_t value = 1;
+#else
+        char value = 0;
+#endif
+        // If it can't be written, the main loop has a wakeup waiting already
+        ssize_t n = write(wakeupFds[1], &value, sizeof(value));
+        (void)n;
+}
+
+void clearWakeup(void)
+{
+        uint64_t buffer[8];
+
+        if (wakeupFds[0] < 0)
+                return;
+
+        while (read(wakeupFds[0], buffer, sizeof(buffer)) > 0)
+                ;
+}
@@ -0,0 +1,19 @@
+#ifndef WAKEUP_H
+#define WAKEUP_H
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+int initWakeup(void);
+
+int getWakeupFd(void);
+
+void wakeMainLoop(void);
+
+void clearWakeup(void);
+
+#endif